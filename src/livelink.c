@@ -0,0 +1,228 @@
+/*
+ * Basilisk live link consumer.
+ * A stand-in for the game: maps the region the editor publishes its plan to
+ * (F10 in the editor, see livelink.h) and reports every plan it picks up, so
+ * the live link can be tried without the game.
+ *
+ * livelink [$name [$generations]]
+ *
+ * Stops after $generations plans if given, or when the editor closes the link.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "livelink.h"
+
+#define POLL_INTERVAL_NS 4000000L /* A quarter of a 60 Hz frame. */
+
+static const struct BAS_LiveLinkHeader *header = NULL;
+static size_t mapsize = 0;
+/* The last plan taken, header and values. */
+static struct BAS_LiveLinkHeader copy;
+static int32_t *values = NULL;
+static size_t values_capacity = 0;
+
+static double
+now(void)
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec+time.tv_nsec/1e9;
+}
+static void
+pause_poll(void)
+{
+	const struct timespec interval = {0, POLL_INTERVAL_NS};
+	nanosleep(&interval, NULL);
+}
+
+/* Map the whole region as it is now. Returns 0 on success, 1 on error. */
+static int
+map(int descriptor)
+{
+	struct stat status;
+	void *mapping;
+	if (fstat(descriptor, &status) || (size_t)status.st_size < sizeof(struct BAS_LiveLinkHeader))
+	{
+		return 1;
+	}
+	mapping = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, descriptor, 0);
+	if (mapping == MAP_FAILED)
+	{
+		return 1;
+	}
+	if (header)
+	{
+		munmap((void *)header, mapsize);
+	}
+	header  = mapping;
+	mapsize = status.st_size;
+	return 0;
+}
+
+/*
+ * Copy the current plan under the seqlock, `sequence` is set to the one it was
+ * taken at. Returns 0 when a whole plan was taken, 1 if the writer got in the
+ * way (try again) and -1 on error.
+ */
+static int
+take(int descriptor, uint32_t *sequence)
+{
+	size_t count;
+	int fits;
+	if ((*sequence = LIVELINK_SEQUENCE_READ(header)) & 1)
+	{
+		return 1;
+	}
+	memcpy(&copy, header, sizeof(struct BAS_LiveLinkHeader));
+	if (copy.size > mapsize)
+	{
+		/* It grew, map it again and start over. */
+		return map(descriptor) ? -1 : 1;
+	}
+	count = copy.used;
+	fits  = sizeof(struct BAS_LiveLinkHeader)+count*sizeof(int32_t) <= mapsize
+	     && (size_t)copy.chunk_offset+(size_t)copy.chunk_count*LIVELINK_CHUNK_FIELDS <= count
+	     && (size_t)copy.dirty_offset+(size_t)copy.dirty_count*2 <= count;
+	if (fits && count > values_capacity)
+	{
+		int32_t *resized = realloc(values, count*sizeof(int32_t));
+		if (!resized)
+		{
+			return -1;
+		}
+		values          = resized;
+		values_capacity = count;
+	}
+	if (fits)
+	{
+		memcpy(values, header+1, count*sizeof(int32_t));
+	}
+	LIVELINK_FENCE_ACQUIRE();
+	if (LIVELINK_SEQUENCE_READ(header) != *sequence)
+	{
+		return 1;
+	}
+	/* Counts which do not fit were not torn, the region is broken. */
+	return fits ? 0 : -1;
+}
+
+static void
+report(int retries, double seconds)
+{
+	register uint32_t i, j;
+	long sum = 0;
+	const int32_t *chunks = values+copy.chunk_offset;
+	const int32_t *dirty  = values+copy.dirty_offset;
+	/* Touch every wall, chunk by chunk, as a game would when building its collision. */
+	for (i = 0; i < copy.chunk_count; i++)
+	{
+		const int32_t *chunk = chunks+(size_t)i*LIVELINK_CHUNK_FIELDS;
+		const int32_t *lines = values+(uint32_t)chunk[2];
+		if ((size_t)(uint32_t)chunk[2]+(size_t)(uint32_t)chunk[3]*LIVELINK_LINE_FIELDS > copy.used)
+		{
+			continue;
+		}
+		for (j = 0; j < (uint32_t)chunk[3]*LIVELINK_LINE_FIELDS; j++)
+		{
+			sum += lines[j];
+		}
+	}
+	printf(
+		"Generation %u: %u walls (sum %ld), %u things in %u chunks, ",
+		copy.generation, copy.line_count, sum, copy.thing_count, copy.chunk_count
+	);
+	if (copy.flags & LIVELINK_FLAG_FULL)
+	{
+		printf("everything changed");
+	}
+	else
+	{
+		printf("%u chunks changed", copy.dirty_count);
+		for (i = 0; i < copy.dirty_count && i < 8; i++)
+		{
+			printf(i ? ", (%d %d)" : " (%d %d)", dirty[i*2], dirty[i*2+1]);
+		}
+		if (copy.dirty_count > 8)
+		{
+			printf(", ...");
+		}
+	}
+	printf("; copied in %.3f ms, %d retries.\n", seconds*1000.0, retries);
+	fflush(stdout);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int descriptor, retries, status, waited = 0;
+	uint32_t sequence = 0, reported = 0;
+	long taken = 0;
+	const long generations = argc > 2 ? atol(argv[2]) : 0;
+	const char *name = argc > 1 ? argv[1] : LIVELINK_DEFAULT_NAME;
+	while ((descriptor = shm_open(name, O_RDONLY, 0)) < 0)
+	{
+		if (!waited++)
+		{
+			printf("Waiting for the editor to open %s (F10)...\n", name);
+			fflush(stdout);
+		}
+		pause_poll();
+	}
+	while (map(descriptor) || memcmp(header->magic, LIVELINK_MAGIC, 8))
+	{
+		pause_poll();
+	}
+	if (header->version != LIVELINK_VERSION)
+	{
+		fprintf(stderr, "Live link version %u, expected %u.\n", header->version, LIVELINK_VERSION);
+		return 1;
+	}
+	printf("Mapped %s, %lu bytes.\n", name, (unsigned long)mapsize);
+	fflush(stdout);
+	for (;;)
+	{
+		double start;
+		if (LIVELINK_SEQUENCE_READ(header) == sequence)
+		{
+			pause_poll();
+			continue;
+		}
+		start = now();
+		for (retries = 0; (status = take(descriptor, &sequence)) == 1; retries++)
+		{
+			sched_yield();
+		}
+		if (status < 0)
+		{
+			fprintf(stderr, "Failed to read the live link.\n");
+			return 1;
+		}
+		if (copy.flags & LIVELINK_FLAG_CLOSED)
+		{
+			printf("The editor closed the live link.\n");
+			break;
+		}
+		/* Opening the link again changes the sequence, but not the plan. */
+		if (copy.generation != reported)
+		{
+			reported = copy.generation;
+			report(retries, now()-start);
+			if (++taken == generations)
+			{
+				break;
+			}
+		}
+	}
+	munmap((void *)header, mapsize);
+	close(descriptor);
+	free(values);
+	return 0;
+}
@@ -0,0 +1,63 @@
+/*
+ * Basilisk live link.
+ * Layout of the POSIX shared memory region the editor publishes its plan to,
+ * shared by the editor (see BAS_LiveLink in main.c) and its consumers.
+ *
+ * The region starts with a struct BAS_LiveLinkHeader, followed by $used
+ * int32_t values. Offsets are counted in values from the end of the header.
+ * The plan is kept by chunks of $chunk_size cells. At $chunk_offset lie the
+ * $chunk_count chunks which hold anything, sorted by y and then x, each as
+ * x y offset line_count thing_count. At its offset, every chunk has its walls
+ * (x0 y0 x1 y1, node-space) followed by its things (x y type facing flags.low
+ * flags.high, thing-space). A wall belongs to the chunk of its room.
+ * At $dirty_offset lie the $dirty_count chunks (x y) whose walls or things
+ * changed since the previous generation. Only those are written again. The
+ * other chunks stay where they are, so values no chunk refers to may lie in
+ * between.
+ *
+ * The region is guarded by a seqlock: the writer makes `sequence` odd, writes
+ * and makes it even again. A reader copies what it needs between two reads of
+ * `sequence` and keeps the copy only if both were the same even value. The
+ * region only grows, a reader whose mapping is smaller than `size` maps it
+ * again.
+ */
+#ifndef BAS_LIVELINK_H
+#define BAS_LIVELINK_H
+#include <stdint.h>
+
+#define LIVELINK_MAGIC        "BASLINK"
+#define LIVELINK_VERSION      2
+#define LIVELINK_DEFAULT_NAME "/basilisk-livelink"
+#define LIVELINK_LINE_FIELDS  4
+#define LIVELINK_THING_FIELDS 6
+#define LIVELINK_CHUNK_FIELDS 5
+#define LIVELINK_FLAG_FULL    1 /* Anything may have changed, the dirty list is empty. */
+#define LIVELINK_FLAG_CLOSED  2 /* The editor let go of the region, nothing more will come. */
+
+struct BAS_LiveLinkHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t size;       /* Of the whole region, in bytes. */
+	uint32_t sequence;   /* Odd while a generation is being written. */
+	uint32_t generation; /* Counts the plans published so far. */
+	uint32_t flags;
+	int32_t cell_scale;
+	int32_t thing_scale;
+	int32_t chunk_size;
+	uint32_t line_count;   /* Of the whole plan. */
+	uint32_t thing_count;
+	uint32_t chunk_count;
+	uint32_t chunk_offset;
+	uint32_t dirty_count;
+	uint32_t dirty_offset;
+	uint32_t used;         /* Values after the header, everything lies below. */
+	uint32_t reserved;
+};
+
+#define LIVELINK_SEQUENCE_READ(header)         __atomic_load_n(&(header)->sequence, __ATOMIC_ACQUIRE)
+#define LIVELINK_SEQUENCE_WRITE(header, value) __atomic_store_n(&(header)->sequence, (value), __ATOMIC_RELEASE)
+#define LIVELINK_FENCE_ACQUIRE()               __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define LIVELINK_FENCE_RELEASE()               __atomic_thread_fence(__ATOMIC_RELEASE)
+
+#endif
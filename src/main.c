@@ -5,10 +5,33 @@
  *
  * Timestamp - 02.09.2019.
  */
+#if defined(__unix__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#define BAS_HAVE_MMAP
+#define BAS_HAVE_DIRENT
+#define BAS_HAVE_SHM
+#endif
+#ifdef __linux__
+#define BAS_HAVE_INOTIFY
+#endif
 #include <stdio.h>
+#include <limits.h>
+#ifdef BAS_HAVE_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#ifdef BAS_HAVE_DIRENT
+#include <dirent.h>
+#endif
+#ifdef BAS_HAVE_INOTIFY
+#include <sys/inotify.h>
+#endif
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
 #include <SDL2/SDL_ttf.h>
+#include "livelink.h"
 
 /* Simple preprocessor defines for boilerplate code */
 #define BAS_UseColour(r, g, b) SDL_SetRenderDrawColor(renderer, r, g, b, 0xff)
@@ -39,26 +62,61 @@ static const int CROSSHAIR_COLOUR[3]   = {200, 200, 200};
 static const SDL_Color TEXT_BACKGROUND = {0, 0, 0, 255};
 static const SDL_Color TEXT_COLOUR     = {255, 255, 255, 255};
 static const char* const FONT_PATH     = "data/default.ttf";
+static const char* const HELP_IMAGE    = "data/bas.tga";
+enum FONT_INDEX
+{
+	FONT_DEFAULT = 0, /* Status line and panels. */
+	FONT_TEXTINPUT,   /* Text input and the help screen. */
+	FONT_COUNT
+};
+static const int FONT_SIZES[FONT_COUNT] = {12, 24};
+static const SDL_SystemCursor CURSOR_SYSTEM[CURSOR_COUNT] = {
+	SDL_SYSTEM_CURSOR_ARROW, SDL_SYSTEM_CURSOR_CROSSHAIR, SDL_SYSTEM_CURSOR_HAND, SDL_SYSTEM_CURSOR_NO
+};
+/* Made on first use, see BAS_Font and BAS_Cursor. The help image is loaded with the help screen. */
 static SDL_Cursor* cursorheap[CURSOR_COUNT];
-static TTF_Font* font_default;
-static TTF_Font* font_textinput;
+static TTF_Font* fontheap[FONT_COUNT];
+static int fontheap_tried[FONT_COUNT];
 static SDL_Texture *basilisk_texture = NULL;
 
 /*
  * Editor data
+ * Rooms and lines live in arrays which grow on demand (see BAS_Reserve).
  */
-#define MAX_ROOM_COUNT  1024
-#define MAX_LINE_COUNT  1024
-#define MAX_THING_COUNT 1024
+#define BAS_MAX_BATCH_CELLS (1 << 22) /* Upper limit of cells a single batch edit may touch. */
 struct BAS_Room
 {
 	int cellposition[2]; /* (x, y) position of the room (cell-space). */
 };
+/*
+ * A wall, packed. Walls are the sides of rooms without a neighbour, so they
+ * are one cell long and axis aligned: only the start node and the side of the
+ * room are kept, the end node and the normal follow from the side (see
+ * BAS_Line_Nodes and BAS_Line_Normal). The start node is split into a chunk of
+ * 2^LINE_CHUNK_BITS nodes and the position within it, which holds any node in
+ * [-2^30, 2^30).
+ */
+#define LINE_CHUNK_BITS 16
+#define LINE_CHUNK_MASK 0x7FFF /* Of a chunk coordinate. */
 struct BAS_Line
 {
-	int cellnodeposition[2][2];
-	int normal[2][2]; /* Two vertices representing normal vector */
+	Uint32 chunk;    /* The side (2 bits), the chunk's x and y (15 bits each, two's complement). */
+	Uint16 local[2]; /* Start node within the chunk. */
 };
+/*
+ * Rooms are kept where plan-space (CELL_SCALE units per cell) still fits an
+ * int with a margin for the sums drawing and exporting do on it, which is well
+ * inside what the packed walls hold: every cell coordinate is in
+ * [-ROOM_LIMIT, ROOM_LIMIT-1). Whatever adds rooms checks it first, things are
+ * kept to the same cells.
+ */
+#define ROOM_LIMIT (1 << 24) /* At most INT_MAX/CELL_SCALE/2, a multiple of the plan file chunk size. */
+static inline int
+BAS_Room_Inside(Sint64 cx, Sint64 cy)
+{
+	return cx >= -ROOM_LIMIT && cx < ROOM_LIMIT-1 && cy >= -ROOM_LIMIT && cy < ROOM_LIMIT-1;
+}
+/* A single thing, as handed out by BAS_Thing_Get. */
 struct BAS_Thing
 {
 	uint64_t flags;
@@ -66,1117 +124,10536 @@ struct BAS_Thing
 	int type;
 	int facing;
 };
-static struct BAS_Room  rooms[MAX_ROOM_COUNT];
-static struct BAS_Line  lines[MAX_LINE_COUNT];
-static struct BAS_Thing things[MAX_THING_COUNT];
-static int room_count  = 0;
-static int line_count  = 0;
-static int thing_count = 0;
-
 /*
- * Required for windowing system
+ * Things are stored as a structure of arrays, one array per field, so that
+ * queries over many things only stream through the fields they test.
  */
-static SDL_Window* window;
-static SDL_Renderer* renderer;
-static const int WINDOW_WIDTH  = CELL_SCALE*32+1;
-static const int WINDOW_HEIGHT = CELL_SCALE*22+1;
+struct BAS_ThingStore
+{
+	int *thingposition[2];
+	int *type;
+	int *facing;
+	uint64_t *flags;
+};
 
 /*
- * Event system additions
+ * A prefab is a piece of plan which can be stamped any number of times. Its
+ * rooms (cell-space) and things (thing-space) are kept once, in the plan's
+ * prefab_rooms and prefab_things, relative to the top left corner of its
+ * size[0] x size[1] cell footprint. An instance places a prefab with the top
+ * left corner of its (turned) footprint at cellposition, turned by `rotation`
+ * quarter turns clockwise.
  */
-static const int DELAY_PER_FRAME_DEFAULT = 30;
-static const int DELAY_PER_FRAME_ABSENT  = 70;
-static const int DELAY_PER_FRAME_MOTION  = 15;
-static Uint32 delayperframe;
+struct BAS_Prefab
+{
+	int size[2];
+	int rooms, room_count;   /* Range of prefab_rooms. */
+	int things, thing_count; /* Range of prefab_things. */
+};
+struct BAS_Instance
+{
+	int prefab;
+	int cellposition[2];
+	int rotation;
+	int expanded; /* Its rooms and things are in the plan, see BAS_Instance_ExpandPending. */
+};
 
 /*
- * Printing of messages
+ * Rooms are looked up by their cell position through an open addressing hash
+ * table with linear probing. Empty slots have their room set to BAS_NO_SUCH_ROOM.
  */
-#define WRITE_I(s) BAS_PrintInfo(s)
-#define WRITE_W(s) BAS_PrintWarning(s)
-#define WRITE_E(s) BAS_PrintError(s)
-static inline void
-BAS_PrintInfo(const char* s)
+struct BAS_RoomSlot
 {
-	printf("[i] %s\n", s);
-}
-static inline void
-BAS_PrintWarning(const char* s)
-{
-	printf("[W] %s\n", s);
-}
-static inline void
-BAS_PrintError(const char* s)
+	int cellposition[2];
+	int room;
+};
+/*
+ * Everything a plan is made of. The code works on the plan `plan` points at,
+ * which is the editor's plan unless the thread has switched to another one
+ * (see BAS_Batch), so plans on different threads share no state.
+ * Set up with BAS_Plan_Init and let go of with BAS_Plan_Free.
+ */
+struct BAS_Plan
 {
-	printf("[X] %s\n", s);
-}
+	struct BAS_Room *rooms;
+	struct BAS_Line *lines;
+	struct BAS_ThingStore things;
+	int room_count;
+	int line_count;
+	int thing_count;
+	int room_capacity;
+	int line_capacity;
+	int thing_capacity;
+	struct BAS_RoomSlot *roomindex;
+	int roomindex_capacity; /* Always a power of two. */
+	/*
+	 * Edits which come in bursts (painting with the mouse) only mark the lines as
+	 * outdated. The main loop recalculates them once per event batch, before drawing.
+	 */
+	int lines_outdated;
+	Uint32 lines_version;     /* Counts the edits to the rooms, see BAS_Lines_Update. */
+	int floor_outdated;       /* The floor rectangles follow the rooms, see BAS_RecalculateFloor. */
+	int (*roomneighbours)[4]; /* Neighbouring rooms of every room, by side. Valid after BAS_RecalculateLines. */
+	int roomneighbours_capacity;
+	struct BAS_FloorRect *floorrects;
+	int floorrect_count;
+	int floorrect_capacity;
+	/*
+	 * Instances remember their prefab, but their rooms and things are added to
+	 * the plan when the walls are next recalculated and from then on take as
+	 * much memory as pasted ones. Saves and exports write them as references
+	 * for as long as those rooms and things are left untouched.
+	 */
+	struct BAS_Prefab *prefabs;
+	int prefab_count;
+	int prefab_capacity;
+	int (*prefab_rooms)[2];
+	int prefab_room_count;
+	int prefab_room_capacity;
+	struct BAS_Thing *prefab_things;
+	int prefab_thing_count;
+	int prefab_thing_capacity;
+	struct BAS_Instance *instances;
+	int instance_count;
+	int instance_capacity;
+	int instances_pending;      /* Some instance is not expanded yet. */
+	/* Index of the plan file as it was last saved or loaded. */
+	struct BAS_PlanChunkEntry *planfile_index;
+	int planfile_chunkcount;
+	int planfile_indexcapacity; /* Entries reserved in the file. */
+	Uint64 planfile_indexoffset;
+	Uint64 planfile_end;        /* End of the last slot in the file. */
+	Uint64 planfile_prefaboffset; /* Slot of the prefab table, unused if its capacity is 0. */
+	Uint32 planfile_prefabsize;
+	Uint32 planfile_prefabcapacity;
+	Uint32 planfile_prefabcrc;
+	char planfile_path[96];
+	Uint32 planfile_revision;   /* Changes whenever the plan or the index is replaced, see BAS_HotReload. */
+	/* The mapped plan file while the plan is open paged, see BAS_Paging. */
+	const Uint8 *paging_map;
+	size_t paging_mapsize;
+	size_t paging_cap;
+	Uint32 paging_frame;
+	long paging_stuck;          /* Plan size at which the last eviction freed nothing. */
+};
+#ifdef _MSC_VER
+#define BAS_THREAD_LOCAL __declspec(thread)
+#else
+#define BAS_THREAD_LOCAL __thread
+#endif
+static struct BAS_Plan plan_editor;
+static BAS_THREAD_LOCAL struct BAS_Plan *plan = &plan_editor;
 
 /*
- * Each tool has its own way of execution.
- * Changing tool changes the function called each frame.
+ * Required for windowing system
  */
-#define TOOL_SPECIAL_VOID       0 /* Nothing. */
-#define TOOL_SPECIAL_RESETSTATE 1 /* Same tool ran again. */
-#define TOOL_SPECIAL_STOP       2 /* Tool changed, ran on the previous tool. */
-#define TOOL_SPECIAL_BEGIN      3 /* Tool changed, ran on the new tool. */
-typedef void (*executionjump)(SDL_Event, int, int, int);
-typedef void (*drawexectionjump)(int, int);
+static SDL_Window* window;
+static SDL_Renderer* renderer;
+static const int WINDOW_WIDTH  = CELL_SCALE*32+1;
+static const int WINDOW_HEIGHT = CELL_SCALE*22+1;
 
-/* Snap the given coordinate to the closest cell's node or the closest cell. */
-inline static void
-BAS_SnapToClosestNode(int* x, int* y)
+/*
+ * View over the plan.
+ * Plan-space is where rooms and things live (CELL_SCALE units per cell) and
+ * screen-space is the window. The mouse wheel zooms by powers of two around
+ * the cursor, dragging with the middle mouse button pans the view.
+ */
+#define VIEW_ZOOMLEVEL_MIN -5
+#define VIEW_ZOOMLEVEL_MAX 1
+static int view_offset[2] = {0, 0}; /* Plan-space position of the window's top left corner. */
+static int view_zoomlevel = 0;
+static float view_zoom    = 1.0f;
+static inline void
+BAS_View_ToScreen(int px, int py, int *sx, int *sy)
 {
-	*x = (int)((float)(*x)/CELL_SCALE+0.5)*CELL_SCALE;
-	*y = (int)((float)(*y)/CELL_SCALE+0.5)*CELL_SCALE;
+	*sx = (int)floorf((px-view_offset[0])*view_zoom);
+	*sy = (int)floorf((py-view_offset[1])*view_zoom);
 }
-inline static void
-BAS_SnapToClosestNode_Custom(int* x, int* y, const int scale)
+static inline void
+BAS_View_ToPlan(int sx, int sy, int *px, int *py)
 {
-	*x = (int)((float)(*x)/scale+0.5)*scale;
-	*y = (int)((float)(*y)/scale+0.5)*scale;
+	*px = view_offset[0]+(int)floorf(sx/view_zoom);
+	*py = view_offset[1]+(int)floorf(sy/view_zoom);
 }
-inline static void
-BAS_SnapToClosestCell(int* x, int* y)
+/* Length in screen-space of the given plan-space length, never less than a pixel. */
+static inline int
+BAS_View_Scale(int length)
 {
-	*x -= CELL_SCALE/2;
-	*y -= CELL_SCALE/2;
-	BAS_SnapToClosestNode(x, y);
+	const int scaled = length*view_zoom;
+	return scaled > 0 ? scaled : 1;
 }
-inline static void
-BAS_SnapToClosestCell_Custom(int* x, int* y, const int scale)
+static void
+BAS_View_Zoom(int steps, int sx, int sy)
 {
-	*x -= scale/2;
-	*y -= scale/2;
-	BAS_SnapToClosestNode_Custom(x, y, scale);
+	int px, py;
+	BAS_View_ToPlan(sx, sy, &px, &py);
+	view_zoomlevel += steps;
+	if (view_zoomlevel < VIEW_ZOOMLEVEL_MIN) { view_zoomlevel = VIEW_ZOOMLEVEL_MIN; }
+	if (view_zoomlevel > VIEW_ZOOMLEVEL_MAX) { view_zoomlevel = VIEW_ZOOMLEVEL_MAX; }
+	view_zoom = ldexpf(1.0f, view_zoomlevel);
+	/* Keep the point under the cursor in place. */
+	view_offset[0] = px-(int)floorf(sx/view_zoom);
+	view_offset[1] = py-(int)floorf(sy/view_zoom);
 }
-
-/* Calculate the closest cell's position to the given coordinates. */
-static void
-BAS_ClosestCellPosition(int fx, int fy, int *cx, int *cy)
+static inline void
+BAS_View_Pan(int dx, int dy)
 {
-	*cx = fx;
-	*cy = fy;
-	BAS_SnapToClosestCell(cx, cy);
-	*cx /= CELL_SCALE;
-	*cy /= CELL_SCALE;
+	view_offset[0] -= (int)(dx/view_zoom);
+	view_offset[1] -= (int)(dy/view_zoom);
 }
 
 /*
- * Given two vertices, calculate the normal of the line the two vertices create.
+ * Event system additions
  */
-static void
-BAS_CalculateLineNormalVertices(struct BAS_Line *line)
-{
-	int x0 = line->cellnodeposition[0][0]*CELL_SCALE;
-	int y0 = line->cellnodeposition[0][1]*CELL_SCALE;
-	int x1 = line->cellnodeposition[1][0]*CELL_SCALE;
-	int y1 = line->cellnodeposition[1][1]*CELL_SCALE;
-	int length;
-	length = (int) sqrt(pow(x0-x1, 2)+pow(y0-y1, 2));
-	line->normal[0][0] = (x0+x1)/2;
-	line->normal[0][1] = (y0+y1)/2;
-	line->normal[1][0] = NORMAL_LENGTH*(x0-x1)/length;
-	line->normal[1][1] = NORMAL_LENGTH*(y0-y1)/length;
-}
-
+static const int DELAY_PER_FRAME_DEFAULT = 30;
+static const int DELAY_PER_FRAME_ABSENT  = 70;
+static const int DELAY_PER_FRAME_MOTION  = 15;
+static Uint32 delayperframe;
 /*
- * Create a texture from the given string.
- * The texture should be freed one it's of no use.
+ * The mouse and the modifier keys are read through these, so that a replayed
+ * trace (see BAS_Trace_Poll) sees them as they were when it was recorded.
  */
-static SDL_Texture*
-BAS_CreateTextTexture(TTF_Font* font, const char* text)
+static int trace_replaying = 0;
+static int trace_mouse[2]  = {0, 0};
+static Uint16 trace_mod    = 0;
+static inline void
+BAS_GetMouseState(int *x, int *y)
 {
-	SDL_Texture* texture;
-	SDL_Surface* temporarysuface;
-	temporarysuface = TTF_RenderUTF8_Shaded(font, text, TEXT_COLOUR, TEXT_BACKGROUND);
-	texture         = SDL_CreateTextureFromSurface(renderer, temporarysuface);
-	SDL_FreeSurface(temporarysuface);
-	return texture;
+	if (trace_replaying)
+	{
+		*x = trace_mouse[0];
+		*y = trace_mouse[1];
+		return;
+	}
+	SDL_GetMouseState(x, y);
 }
-static SDL_Texture*
-BAS_CreateTextTextureBlended(TTF_Font* font, const char* text)
+static inline SDL_Keymod
+BAS_GetModState(void)
 {
-	SDL_Texture* texture;
-	SDL_Surface* temporarysuface;
-	temporarysuface = TTF_RenderUTF8_Blended(font, text, TEXT_COLOUR);
-	texture         = SDL_CreateTextureFromSurface(renderer, temporarysuface);
-	SDL_FreeSurface(temporarysuface);
-	return texture;
+	return trace_replaying ? (SDL_Keymod)trace_mod : SDL_GetModState();
 }
 
 /*
- * If the given cell coordinates do not correspond to a room, create a new room (returns 0).
- * Otherwise, returns 1.
+ * Printing of messages
+ * Messages are copied into a ring of fixed size records which a flusher thread
+ * writes out, so printing never waits on stdout (a slow pipe or terminal).
+ * Any thread may print: a record is claimed by moving log_head on and handed
+ * over by setting its sequence, a bounded queue after D. Vyukov. When the ring
+ * is full the message is dropped and counted instead of waiting.
+ * Without the flusher (before BAS_Log_Start, after BAS_Log_Stop) messages are
+ * printed directly.
  */
-static int
-BAS_Room_Create(int cx, int cy)
+#define WRITE_I(s) BAS_Log(LOG_INFO, s)
+#define WRITE_W(s) BAS_Log(LOG_WARNING, s)
+#define WRITE_E(s) BAS_Log(LOG_ERROR, s)
+#define LOG_INFO          0
+#define LOG_WARNING       1
+#define LOG_ERROR         2
+#define LOG_RING_SIZE     1024 /* Records, a power of two. */
+#define LOG_RECORD_LENGTH 200  /* Longer messages are cut. */
+static const char LOG_LEVELS[3] = {'i', 'W', 'X'};
+struct BAS_LogRecord
 {
-	register int i;
-	for (i = 0; i < room_count; i++)
-	{
-		if (rooms[i].cellposition[0] == cx && rooms[i].cellposition[1] == cy)
-		{
-			return 1;
-		}
-	}
-	rooms[room_count].cellposition[0] = cx;
-	rooms[room_count].cellposition[1] = cy;
-	room_count++;
-	return 0;
+	SDL_atomic_t sequence; /* The position it can be claimed at, that plus one once written. */
+	int level;
+	Uint64 time;
+	char text[LOG_RECORD_LENGTH];
+};
+static struct BAS_LogRecord log_ring[LOG_RING_SIZE];
+static SDL_atomic_t log_head;
+static SDL_atomic_t log_tail;
+static SDL_atomic_t log_running;
+static SDL_atomic_t log_dropped;
+static SDL_Thread *log_thread = NULL;
+static SDL_sem *log_wake      = NULL;
+static Uint64 log_start       = 0;
+static int print_quiet        = 0; /* Leave out the informational messages. */
+
+static void
+BAS_Log_Print(int level, Uint64 time, const char *s)
+{
+	printf("[%c] %8.3f %s\n", LOG_LEVELS[level], (double)(time-log_start)/SDL_GetPerformanceFrequency(), s);
 }
 
-static int
-BAS_FindRoom(int cx, int cy)
+static void
+BAS_Log(int level, const char *s)
 {
-	register int i;
-	for (i = 0; i < room_count; i++)
+	struct BAS_LogRecord *record;
+	unsigned int position;
+	size_t length;
+	const Uint64 now = SDL_GetPerformanceCounter();
+	if (level == LOG_INFO && print_quiet)
+	{
+		return;
+	}
+	if (!log_thread)
+	{
+		BAS_Log_Print(level, now, s);
+		return;
+	}
+	position = (unsigned int)SDL_AtomicGet(&log_head);
+	for (;;)
 	{
-		if (rooms[i].cellposition[0] == cx && rooms[i].cellposition[1] == cy)
+		const int difference = (int)((unsigned int)SDL_AtomicGet(&log_ring[position & (LOG_RING_SIZE-1)].sequence)-position);
+		if (difference == 0 && SDL_AtomicCAS(&log_head, (int)position, (int)(position+1)))
 		{
-			return i;
+			break;
+		}
+		if (difference < 0)
+		{
+			/* The flusher is a whole ring behind. */
+			SDL_AtomicAdd(&log_dropped, 1);
+			return;
 		}
+		position = (unsigned int)SDL_AtomicGet(&log_head);
 	}
-	return BAS_NO_SUCH_ROOM;
+	record = &log_ring[position & (LOG_RING_SIZE-1)];
+	length = strlen(s) < LOG_RECORD_LENGTH ? strlen(s) : LOG_RECORD_LENGTH-1;
+	memcpy(record->text, s, length);
+	record->text[length] = '\0';
+	record->level = level;
+	record->time  = now;
+	SDL_AtomicSet(&record->sequence, (int)(position+1));
+	SDL_SemPost(log_wake);
 }
 
 static int
-BAS_FindThing(int cx, int cy)
+BAS_Log_Flusher(void *unused)
 {
-	register int i;
-	for (i = 0; i < thing_count; i++)
+	int reported = 0;
+	(void)unused;
+	for (;;)
 	{
-		if (things[i].thingposition[0] == cx && things[i].thingposition[1] == cy)
+		/* Read before draining, so whatever was printed before BAS_Log_Stop still comes out. */
+		const int running = SDL_AtomicGet(&log_running);
+		unsigned int tail = (unsigned int)SDL_AtomicGet(&log_tail);
+		int written = 0, dropped;
+		for (;;)
 		{
-			return i;
+			struct BAS_LogRecord *record = &log_ring[tail & (LOG_RING_SIZE-1)];
+			if ((unsigned int)SDL_AtomicGet(&record->sequence) != tail+1)
+			{
+				break;
+			}
+			BAS_Log_Print(record->level, record->time, record->text);
+			SDL_AtomicSet(&record->sequence, (int)(tail+LOG_RING_SIZE));
+			SDL_AtomicSet(&log_tail, (int)++tail);
+			written = 1;
+		}
+		if ((dropped = SDL_AtomicGet(&log_dropped)) != reported)
+		{
+			char message[64];
+			snprintf(message, sizeof(message), "%d messages were dropped, printing could not keep up.", dropped-reported);
+			BAS_Log_Print(LOG_WARNING, SDL_GetPerformanceCounter(), message);
+			reported = dropped;
+			written  = 1;
 		}
+		if (written)
+		{
+			fflush(stdout);
+		}
+		if (!running)
+		{
+			return 0;
+		}
+		SDL_SemWaitTimeout(log_wake, 100);
 	}
-	return BAS_NO_SUCH_THING;
 }
 
-static inline void
-BAS_Line_Create(int x0, int y0, int x1, int y1)
+/* Wait for the flusher to write everything printed so far, before writing to stdout directly. */
+static void
+BAS_Log_Flush(void)
 {
-	lines[line_count].cellnodeposition[0][0] = x0;
-	lines[line_count].cellnodeposition[0][1] = y0;
-	lines[line_count].cellnodeposition[1][0] = x1;
-	lines[line_count].cellnodeposition[1][1] = y1;
-	BAS_CalculateLineNormalVertices(&lines[line_count]);
-	line_count++;
+	while (log_thread && SDL_AtomicGet(&log_tail) != SDL_AtomicGet(&log_head))
+	{
+		SDL_Delay(1);
+	}
 }
 
-static int walkedrooms[MAX_ROOM_COUNT];
 static void
-walkrooms(int room_index)
+BAS_Log_Stop(void)
 {
-	const int room_cx = rooms[room_index].cellposition[0];
-	const int room_cy = rooms[room_index].cellposition[1];
-	int neighbour_north, neighbour_south, neighbour_west, neighbour_east;
-
-	if (walkedrooms[room_index])
+	if (!log_thread)
 	{
 		return;
 	}
-	walkedrooms[room_index] = 1;
-
-	/* Test north/south/west/east side */
-	neighbour_north = BAS_FindRoom(room_cx, room_cy-1);
-	neighbour_south = BAS_FindRoom(room_cx, room_cy+1);
-	neighbour_west  = BAS_FindRoom(room_cx-1, room_cy);
-	neighbour_east  = BAS_FindRoom(room_cx+1, room_cy);
+	SDL_AtomicSet(&log_running, 0);
+	SDL_SemPost(log_wake);
+	SDL_WaitThread(log_thread, NULL);
+	SDL_DestroySemaphore(log_wake);
+	log_thread = NULL;
+	log_wake   = NULL;
+}
 
-	if (neighbour_north == BAS_NO_SUCH_ROOM)
+/* Start the flusher, it is stopped at exit. On failure messages keep being printed directly. */
+static void
+BAS_Log_Start(void)
+{
+	register int i;
+	log_start = SDL_GetPerformanceCounter();
+	for (i = 0; i < LOG_RING_SIZE; i++)
 	{
-		BAS_Line_Create(room_cx+1, room_cy, room_cx, room_cy);
+		SDL_AtomicSet(&log_ring[i].sequence, i);
 	}
-	else
+	SDL_AtomicSet(&log_head, 0);
+	SDL_AtomicSet(&log_tail, 0);
+	SDL_AtomicSet(&log_dropped, 0);
+	SDL_AtomicSet(&log_running, 1);
+	if (!(log_wake = SDL_CreateSemaphore(0)))
 	{
-		walkrooms(neighbour_north);
+		return;
 	}
-	if (neighbour_south == BAS_NO_SUCH_ROOM)
+	if (!(log_thread = SDL_CreateThread(BAS_Log_Flusher, "log", NULL)))
 	{
-		BAS_Line_Create(room_cx, room_cy+1, room_cx+1, room_cy+1);
+		SDL_DestroySemaphore(log_wake);
+		log_wake = NULL;
+		return;
 	}
-	else
+	atexit(BAS_Log_Stop);
+}
+
+/*
+ * ----------------
+ * Memory.
+ * What the editor holds, by category: the bytes held now and at most, and the
+ * blocks alive and made so far. Blocks are made with BAS_Alloc (BAS_Calloc,
+ * BAS_Realloc) and let go of with BAS_Free, never with free(), as they start
+ * with a header which remembers their size and category. Textures are counted
+ * at their size in pixels, SDL does not tell what it really holds for them.
+ * Most short lived buffers (of an export, a save) are plainly malloc()ed and
+ * left out.
+ * A category may be given a budget, see BAS_Memory_Budgets. Going over it is
+ * warned about once, and again only after having gone back under.
+ * ----------------
+ */
+#define MEMORY_PLAN       0 /* Rooms, things, prefabs, instances and their indices. */
+#define MEMORY_LINES      1 /* Walls, room neighbours and floor rectangles. */
+#define MEMORY_TEXT       2 /* Text textures. */
+#define MEMORY_RENDER     3 /* Level of detail blocks and lists, visible things, the minimap. */
+#define MEMORY_WORK       4 /* Selections, spans, traces, the live link's dirty list, batch jobs. */
+#define MEMORY_CATEGORIES 5
+#define MEMORY_BUDGETS_ENV "BASILISK_BUDGETS"
+static const char *const MEMORY_NAMES[MEMORY_CATEGORIES] = {"plan", "lines", "text", "render", "work"};
+struct BAS_MemoryCategory
+{
+	size_t current, peak;
+	size_t budget; /* In bytes, none when 0. */
+	long live, made;
+	int over;      /* Warned about being over the budget. */
+};
+union BAS_MemoryHeader
+{
+	struct
 	{
-		walkrooms(neighbour_south);
-	}
-	if (neighbour_west == BAS_NO_SUCH_ROOM)
+		size_t size;
+		int category;
+	} block;
+	/* Keep what follows aligned for any type. */
+	long double alignment;
+	void *pointer;
+};
+static struct BAS_MemoryCategory memory_categories[MEMORY_CATEGORIES];
+static SDL_SpinLock memory_lock;
+static SDL_atomic_t memory_generation; /* Moves on with every change, for the overlay. */
+
+/* Print the given size in B, kB, MB or GB. */
+static void
+BAS_Memory_Format(char *buffer, size_t length, size_t bytes)
+{
+	if (bytes < 1024)
 	{
-		BAS_Line_Create(room_cx, room_cy, room_cx, room_cy+1);
+		snprintf(buffer, length, "%lu B", (unsigned long)bytes);
 	}
-	else
+	else if (bytes < (size_t)1 << 20)
 	{
-		walkrooms(neighbour_west);
+		snprintf(buffer, length, "%.1f kB", bytes/1024.0);
 	}
-	if (neighbour_east == BAS_NO_SUCH_ROOM)
+	else if (bytes < (size_t)1 << 30)
 	{
-		BAS_Line_Create(room_cx+1, room_cy+1, room_cx+1, room_cy);
+		snprintf(buffer, length, "%.1f MB", bytes/1048576.0);
 	}
 	else
 	{
-		walkrooms(neighbour_east);
+		snprintf(buffer, length, "%.2f GB", bytes/1073741824.0);
 	}
 }
 
+/* Count `bytes` more (or fewer) and a block made (1), let go of (-1) or resized (0). */
 static void
-BAS_RecalculateLines(void)
+BAS_Memory_Count(int category, ptrdiff_t bytes, int blocks)
 {
-	line_count = 0;
-	if (room_count <= 0)
+	struct BAS_MemoryCategory *counts = &memory_categories[category];
+	size_t current, budget = 0;
+	SDL_AtomicLock(&memory_lock);
+	counts->current += bytes;
+	counts->live    += blocks;
+	counts->made    += blocks > 0;
+	if (counts->current > counts->peak)
 	{
-		WRITE_I("room_count < 0, not calculating lines.");
-		return;
+		counts->peak = counts->current;
+	}
+	if (counts->budget && counts->over != (counts->current > counts->budget))
+	{
+		counts->over = !counts->over;
+		budget = counts->over ? counts->budget : 0;
+	}
+	current = counts->current;
+	SDL_AtomicUnlock(&memory_lock);
+	SDL_AtomicAdd(&memory_generation, 1);
+	if (budget)
+	{
+		char message[96], held[16], allowed[16];
+		BAS_Memory_Format(held, sizeof(held), current);
+		BAS_Memory_Format(allowed, sizeof(allowed), budget);
+		snprintf(message, sizeof(message), "Over the memory budget: %s holds %s of %s.", MEMORY_NAMES[category], held, allowed);
+		WRITE_W(message);
 	}
-	/*
-	 * Set all walked rooms to zero. Afterwards, recursively walk through all the
-	 * rooms.
-	 */
-	memset(walkedrooms, 0, sizeof(walkedrooms));
-	walkrooms(0);
 }
 
-/*
- * Use a new message for the status line.
- */
-#define BAS_STATUSMESSAGE_LENGTH 128
-#define BAS_STATUSMESSAGE_TYPE_INFO 0
-#define BAS_STATUSMESSAGE_TYPE_WARNING 1
-#define BAS_STATUSMESSAGE_TYPE_ERROR 2
-static const SDL_Color TEXTCOLOUR_INFO    = {255, 255, 255, 255};
-static const SDL_Color TEXTCOLOUR_WARNING = {255, 255, 0, 255};
-static const SDL_Color TEXTCOLOUR_ERROR   = {255, 128, 0, 255};
-static SDL_Surface *statuslinesurface     = NULL;
-static SDL_Texture *statuslinetexture[2]  = {NULL, NULL};
-static void
-BAS_PushStatus(int type, const char status0[BAS_STATUSMESSAGE_LENGTH], const char status1[BAS_STATUSMESSAGE_LENGTH])
+static void *
+BAS_Alloc(int category, size_t size)
 {
-	SDL_Color textcolour = TEXTCOLOUR_INFO;
-	switch(type)
+	union BAS_MemoryHeader *header = malloc(sizeof(union BAS_MemoryHeader)+size);
+	if (!header)
 	{
-		case BAS_STATUSMESSAGE_TYPE_WARNING: textcolour = TEXTCOLOUR_WARNING; break;
-		case BAS_STATUSMESSAGE_TYPE_ERROR:   textcolour = TEXTCOLOUR_ERROR;   break;
+		return NULL;
 	}
-	strncpy(statusline[0], status0, (BAS_STATUSMESSAGE_LENGTH-1)*sizeof(char));
-	strncpy(statusline[1], status1, (BAS_STATUSMESSAGE_LENGTH-1)*sizeof(char));
-	SDL_FreeSurface(statuslinesurface);
-	SDL_DestroyTexture(statuslinetexture[0]);
-	SDL_DestroyTexture(statuslinetexture[1]);
-	statuslinesurface    = TTF_RenderText_Shaded(font_default, statusline[0], textcolour, TEXT_BACKGROUND);
-	statuslinetexture[0] = SDL_CreateTextureFromSurface(renderer, statuslinesurface);
-	SDL_FreeSurface(statuslinesurface);
-	statuslinesurface    = TTF_RenderText_Shaded(font_default, statusline[1], textcolour, TEXT_BACKGROUND);
-	statuslinetexture[1] = SDL_CreateTextureFromSurface(renderer, statuslinesurface);
+	header->block.size     = size;
+	header->block.category = category;
+	BAS_Memory_Count(category, (ptrdiff_t)size, 1);
+	return header+1;
 }
-static inline void
-BAS_PushStatusAndWriteInfo(const char *message)
+static void *
+BAS_Calloc(int category, size_t count, size_t size)
 {
-	WRITE_I(message);
-	BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_INFO, "[info]", message);
+	union BAS_MemoryHeader *header;
+	if (size && count > ((size_t)-1-sizeof(union BAS_MemoryHeader))/size)
+	{
+		return NULL;
+	}
+	if (!(header = calloc(1, sizeof(union BAS_MemoryHeader)+count*size)))
+	{
+		return NULL;
+	}
+	header->block.size     = count*size;
+	header->block.category = category;
+	BAS_Memory_Count(category, (ptrdiff_t)(count*size), 1);
+	return header+1;
 }
-static inline void
-BAS_PushStatusAndWriteWarning(const char *message)
+/* A block keeps the category it was made in. On error the block is left untouched. */
+static void *
+BAS_Realloc(int category, void *block, size_t size)
 {
-	WRITE_W(message);
-	BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_WARNING, "[warning]", message);
+	union BAS_MemoryHeader *header, *resized;
+	size_t previous;
+	if (!block)
+	{
+		return BAS_Alloc(category, size);
+	}
+	header   = (union BAS_MemoryHeader *)block-1;
+	previous = header->block.size;
+	if (!(resized = realloc(header, sizeof(union BAS_MemoryHeader)+size)))
+	{
+		return NULL;
+	}
+	resized->block.size = size;
+	BAS_Memory_Count(resized->block.category, (ptrdiff_t)size-(ptrdiff_t)previous, 0);
+	return resized+1;
 }
-static inline void
-BAS_PushStatusAndWriteError(const char *message)
+static void
+BAS_Free(void *block)
 {
-	WRITE_E(message);
-	BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_ERROR, "[error]", message);
+	union BAS_MemoryHeader *header;
+	if (!block)
+	{
+		return;
+	}
+	header = (union BAS_MemoryHeader *)block-1;
+	BAS_Memory_Count(header->block.category, -(ptrdiff_t)header->block.size, -1);
+	free(header);
 }
 
-/* What says on the tin. */
+/* Count the given texture in (1) or out (-1) of a category. */
 static void
-BAS_DrawGrid(void)
+BAS_Memory_CountTexture(int category, SDL_Texture *texture, int blocks)
 {
-	register int i;
-	BAS_UseColour(32, 32, 32);
-	for (i = 0; i < WINDOW_WIDTH; i += CELL_SCALE)
-	{
-		SDL_RenderDrawLine(renderer, i, 0, i, WINDOW_HEIGHT);
-	}
-	for (i = 0; i < WINDOW_HEIGHT; i += CELL_SCALE)
+	Uint32 format = SDL_PIXELFORMAT_ARGB8888;
+	int width = 0, height = 0;
+	if (!texture)
 	{
-		SDL_RenderDrawLine(renderer, 0, i, WINDOW_WIDTH, i);
+		return;
 	}
+	SDL_QueryTexture(texture, &format, NULL, &width, &height);
+	BAS_Memory_Count(category, (ptrdiff_t)blocks*width*height*SDL_BYTESPERPIXEL(format), blocks);
 }
 
-static void
-BAS_DrawCrosshair(void)
-{
-	int mx, my;
-	BAS_UseColour(CROSSHAIR_COLOUR[0], CROSSHAIR_COLOUR[1], CROSSHAIR_COLOUR[2]);
-	SDL_GetMouseState(&mx, &my);
-	SDL_RenderDrawLine(renderer, mx, 0, mx, WINDOW_HEIGHT);
-	SDL_RenderDrawLine(renderer, 0, my, WINDOW_WIDTH, my);
-	BAS_UseColour(255, 255, 0);
+/*
+ * Set budgets from a list like "plan=64M,text=2M" (sizes in bytes, or with a
+ * k, M or G suffix, 0 for none). Returns 0 on success, 1 on error.
+ */
+static int
+BAS_Memory_Budgets(const char *budgets)
+{
+	const char *entry = budgets;
+	while (*entry)
+	{
+		int category;
+		char *end;
+		double size;
+		const size_t length = strcspn(entry, "=");
+		for (category = 0; category < MEMORY_CATEGORIES; category++)
+		{
+			if (strlen(MEMORY_NAMES[category]) == length && !strncmp(entry, MEMORY_NAMES[category], length))
+			{
+				break;
+			}
+		}
+		if (category == MEMORY_CATEGORIES || entry[length] != '=')
+		{
+			WRITE_E("Unknown memory category in the budgets!");
+			return 1;
+		}
+		size = strtod(entry+length+1, &end);
+		switch (*end)
+		{
+			case 'k': case 'K': size *= 1024.0;       end++; break;
+			case 'm': case 'M': size *= 1048576.0;    end++; break;
+			case 'g': case 'G': size *= 1073741824.0; end++; break;
+		}
+		if (end == entry+length+1 || size < 0.0 || (*end && *end != ','))
+		{
+			WRITE_E("Malformed memory budget!");
+			return 1;
+		}
+		SDL_AtomicLock(&memory_lock);
+		memory_categories[category].budget = (size_t)size;
+		memory_categories[category].over   = 0;
+		SDL_AtomicUnlock(&memory_lock);
+		entry = *end ? end+1 : end;
+	}
+	return 0;
 }
 
+/* A consistent copy of every category. */
 static void
-BAS_DrawCrosshair_Small(int mx, int my)
+BAS_Memory_Get(struct BAS_MemoryCategory categories[MEMORY_CATEGORIES])
 {
-	SDL_Rect rectangle;
-	const int length = 96;
-	BAS_UseColour(CROSSHAIR_COLOUR[0], CROSSHAIR_COLOUR[1], CROSSHAIR_COLOUR[2]);
-	rectangle.x = mx-THING_SCALE/2;
-	rectangle.y = my-THING_SCALE/2;
-	rectangle.w = rectangle.h = THING_SCALE;
-	SDL_RenderDrawLine(renderer, mx, my-length, mx, my-THING_SCALE/2);
-	SDL_RenderDrawLine(renderer, mx, my+THING_SCALE/2, mx, my+length);
-	SDL_RenderDrawLine(renderer, mx-length, my, mx-THING_SCALE/2, my);
-	SDL_RenderDrawLine(renderer, mx+THING_SCALE/2, my, mx+length, my);
-	SDL_RenderDrawRect(renderer, &rectangle);
+	SDL_AtomicLock(&memory_lock);
+	memcpy(categories, memory_categories, sizeof(memory_categories));
+	SDL_AtomicUnlock(&memory_lock);
 }
 
+/* Describe the given category in a line, as the report and the overlay show it. */
 static void
-BAS_DrawRooms(void)
+BAS_Memory_Describe(char *buffer, size_t length, int category, const struct BAS_MemoryCategory *counts)
 {
-	register int i;
-	BAS_UseColourAlpha(0, 255, 0, 60);
-	for (i = 0; i < room_count; i++)
+	char current[16], peak[16], budget[16] = "none";
+	BAS_Memory_Format(current, sizeof(current), counts->current);
+	BAS_Memory_Format(peak, sizeof(peak), counts->peak);
+	if (counts->budget)
 	{
-		const int plan_x = rooms[i].cellposition[0]*CELL_SCALE;
-		const int plan_y = rooms[i].cellposition[1]*CELL_SCALE;
-		SDL_Rect rectangle;
-		rectangle.x = plan_x;
-		rectangle.y = plan_y;
-		rectangle.w = CELL_SCALE;
-		rectangle.h = CELL_SCALE;
-		SDL_RenderFillRect(renderer, &rectangle);
+		BAS_Memory_Format(budget, sizeof(budget), counts->budget);
 	}
+	snprintf(
+		buffer, length, "%-6s %10s now, %10s peak, %6ld alive, %8ld made, budget %s%s",
+		MEMORY_NAMES[category], current, peak, counts->live, counts->made, budget,
+		counts->budget && counts->current > counts->budget ? " (over)" : ""
+	);
 }
 
-static void
-BAS_DrawLines(void)
+/*
+ * Report what is still held, once everything should have been let go of.
+ * Returns the number of blocks leaked.
+ */
+static long
+BAS_Memory_CheckLeaks(void)
 {
 	register int i;
-	for (i = 0; i < line_count; i++)
-	{
-		const int x0 = lines[i].cellnodeposition[0][0]*CELL_SCALE;
-		const int y0 = lines[i].cellnodeposition[0][1]*CELL_SCALE;
-		const int x1 = lines[i].cellnodeposition[1][0]*CELL_SCALE;
-		const int y1 = lines[i].cellnodeposition[1][1]*CELL_SCALE;
-		const int normal_middle[2] = {lines[i].normal[0][0], lines[i].normal[0][1]};
-		const int normal_delta[2]  = {lines[i].normal[1][0], lines[i].normal[1][1]};
-		BAS_UseColour(128, 128, 128);
-		SDL_RenderDrawLine(renderer, x0, y0, x1, y1);
-		BAS_UseColour(NORMAL_COLOUR[0], NORMAL_COLOUR[1], NORMAL_COLOUR[2]);
-		SDL_RenderDrawLine(renderer,
-			normal_middle[0], normal_middle[1],
-			normal_middle[0]-normal_delta[1], normal_middle[1]+normal_delta[0]
-		);
+	long leaked = 0;
+	struct BAS_MemoryCategory categories[MEMORY_CATEGORIES];
+	BAS_Memory_Get(categories);
+	for (i = 0; i < MEMORY_CATEGORIES; i++)
+	{
+		if (categories[i].live)
+		{
+			char message[96], held[16];
+			BAS_Memory_Format(held, sizeof(held), categories[i].current);
+			snprintf(message, sizeof(message), "Leaked %ld blocks (%s) of %s.", categories[i].live, held, MEMORY_NAMES[i]);
+			WRITE_W(message);
+			leaked += categories[i].live;
+		}
 	}
+	return leaked;
 }
 
-static void
-BAS_DrawThings(void)
+/*
+ * Spans
+ * Timed spans of work which nest (a frame and its stages, the tool handling an
+ * event, the walls being recalculated, an export and its sections, worker
+ * threads), to see where a stall comes from. While recording, every thread
+ * appends the begin and end of its spans to a buffer of its own, without
+ * locking. A thread takes a buffer on its first span and hands it back when it
+ * ends, to the next thread of the same name, so worker threads share lanes.
+ * BAS_Span_Stop writes the buffers out in the Chrome trace event format, which
+ * chrome://tracing and Perfetto open. A full buffer drops what follows.
+ * BAS_Span_Start only moves the epoch on, every owner empties its buffer on
+ * its first span of the new epoch, so no thread writes to a buffer it does not
+ * own and the buffers of an older epoch are left out.
+ */
+#define SPAN_EVENTS       (1 << 16) /* Per buffer, begins and ends. */
+#define SPAN_BUFFERS      64
+#define SPAN_DEFAULT_FILE "./spans.json"
+struct BAS_SpanEvent
+{
+	const char *name; /* A string literal, written out as it is. */
+	Uint64 time;
+	char phase;       /* 'B' or 'E'. */
+};
+struct BAS_SpanBuffer
+{
+	struct BAS_SpanEvent events[SPAN_EVENTS];
+	SDL_atomic_t count;   /* Events written, the owner appends after them. */
+	SDL_atomic_t dropped;
+	SDL_atomic_t epoch;   /* Of the recording the events belong to, set by the owner. */
+	const char *name;
+	int taken;            /* Some thread appends to it, guarded by span_lock. */
+};
+static struct BAS_SpanBuffer *span_buffers[SPAN_BUFFERS];
+static int span_buffer_count = 0;
+static SDL_SpinLock span_lock;
+static SDL_atomic_t span_recording;
+static SDL_atomic_t span_epoch;
+static int span_toggle = 0; /* F11 was pressed, recording starts or stops at the next frame boundary. */
+static const char *span_file = NULL; /* Where the spans recorded from the start go, see --spans. */
+static BAS_THREAD_LOCAL struct BAS_SpanBuffer *span_buffer = NULL;
+static BAS_THREAD_LOCAL const char *span_thread = NULL;
+
+/* A free buffer of the calling thread's name, or a new one. Returns NULL if there is none left. */
+static struct BAS_SpanBuffer *
+BAS_Span_Take(void)
 {
 	register int i;
-	SDL_Rect rectangle;
-	for (i = 0; i < thing_count; i++)
+	struct BAS_SpanBuffer *buffer = NULL;
+	const char *name = span_thread ? span_thread : "thread";
+	SDL_AtomicLock(&span_lock);
+	for (i = 0; i < span_buffer_count && !buffer; i++)
 	{
-		/* Outer shade */
-		rectangle.x = things[i].thingposition[0];
-		rectangle.y = things[i].thingposition[1];
-		rectangle.w = THING_SCALE;
-		rectangle.h = THING_SCALE;
-		BAS_UseColour(0, 0, 144);
-		SDL_RenderFillRect(renderer, &rectangle);
-		/* Inner shade */
-		rectangle.x += 1;
-		rectangle.y += 1;
-		rectangle.w -= 2;
-		rectangle.h -= 2;
-		BAS_UseColour(0, 255, 0);
-		SDL_RenderFillRect(renderer, &rectangle);
+		if (!span_buffers[i]->taken && !strcmp(span_buffers[i]->name, name))
+		{
+			buffer = span_buffers[i];
+		}
 	}
+	if (!buffer && span_buffer_count < SPAN_BUFFERS && (buffer = BAS_Calloc(MEMORY_WORK, 1, sizeof(struct BAS_SpanBuffer))))
+	{
+		buffer->name = name;
+		span_buffers[span_buffer_count++] = buffer;
+	}
+	if (buffer)
+	{
+		buffer->taken = 1;
+	}
+	SDL_AtomicUnlock(&span_lock);
+	return buffer;
 }
 
 static void
-BAS_DrawStatusline(void)
-{
-	SDL_Rect rectangle;
-	rectangle.x = 0;
-	rectangle.y = WINDOW_HEIGHT-32;
-	SDL_QueryTexture(statuslinetexture[0], NULL, NULL, &rectangle.w, &rectangle.h);
-	SDL_RenderCopy(renderer, statuslinetexture[0], NULL, &rectangle);
-	rectangle.y = WINDOW_HEIGHT-16;
-	SDL_QueryTexture(statuslinetexture[1], NULL, NULL, &rectangle.w, &rectangle.h);
-	SDL_RenderCopy(renderer, statuslinetexture[1], NULL, &rectangle);
-}
-
-/*
- * ----------------
- * Help tool.
- * ----------------
- */
-static SDL_Texture* helpme_textureauthor = NULL;
-static SDL_Texture* helpme_textblock[8]  = {NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL};
-static inline void
-helpme_resetstate(void)
-{
-	SDL_SetCursor(cursorheap[CURSOR_ARROW]);
-}
-static void
-helpme_createtextures(void)
+BAS_Span(const char *name, char phase)
 {
-	/*
-	 * If helpme_textureauthor is not a valid texture, we can safely assume other
-	 * textures are also invalid.
-	 */
-	if (!helpme_textureauthor)
+	struct BAS_SpanEvent *event;
+	int count, epoch;
+	if (!SDL_AtomicGet(&span_recording) || (!span_buffer && !(span_buffer = BAS_Span_Take())))
+	{
+		return;
+	}
+	if (SDL_AtomicGet(&span_buffer->epoch) != (epoch = SDL_AtomicGet(&span_epoch)))
+	{
+		SDL_AtomicSet(&span_buffer->count, 0);
+		SDL_AtomicSet(&span_buffer->dropped, 0);
+		SDL_AtomicSet(&span_buffer->epoch, epoch);
+	}
+	if ((count = SDL_AtomicGet(&span_buffer->count)) == SPAN_EVENTS)
 	{
-		helpme_textureauthor = BAS_CreateTextTexture(font_default, "author ★ Aleksandar Urošević, 2019.");
-		helpme_textblock[0] = BAS_CreateTextTextureBlended(font_textinput, "Basilisk 0");
-		helpme_textblock[1] = BAS_CreateTextTextureBlended(font_textinput, "----------------");
-		helpme_textblock[2] = BAS_CreateTextTextureBlended(font_textinput, "F1 - help screen;");
-		helpme_textblock[3] = BAS_CreateTextTextureBlended(font_textinput, "F2 - room placing tool;");
-		helpme_textblock[4] = BAS_CreateTextTextureBlended(font_textinput, "F3 - thing editing tool;");
-		helpme_textblock[5] = BAS_CreateTextTextureBlended(font_textinput, "F5 - export world plan.");
-		helpme_textblock[6] = BAS_CreateTextTextureBlended(font_textinput, "");
-		helpme_textblock[7] = BAS_CreateTextTextureBlended(font_textinput, "Have a nice day.");
+		SDL_AtomicAdd(&span_buffer->dropped, 1);
+		return;
 	}
+	event = &span_buffer->events[count];
+	event->name  = name;
+	event->time  = SDL_GetPerformanceCounter();
+	event->phase = phase;
+	SDL_AtomicSet(&span_buffer->count, count+1);
 }
+#define BAS_Span_Begin(name) BAS_Span(name, 'B')
+#define BAS_Span_End(name)   BAS_Span(name, 'E')
+
+/* Name the lane of the calling thread, before its first span. The name must be a string literal. */
 static void
-helpme_destroytextures(void)
+BAS_Span_Thread(const char *name)
 {
-	SDL_DestroyTexture(helpme_textblock[0]);
-	SDL_DestroyTexture(helpme_textblock[1]);
-	SDL_DestroyTexture(helpme_textblock[2]);
-	SDL_DestroyTexture(helpme_textblock[3]);
-	SDL_DestroyTexture(helpme_textblock[4]);
-	SDL_DestroyTexture(helpme_textblock[5]);
-	SDL_DestroyTexture(helpme_textblock[6]);
-	SDL_DestroyTexture(helpme_textblock[7]);
-	SDL_DestroyTexture(helpme_textureauthor);
-	helpme_textureauthor = NULL;
+	span_thread = name;
 }
+/* Hand the buffer of the calling thread back, before the thread ends. */
 static void
-BAS_Tool_HelpMe(SDL_Event e, int mx, int my, int special)
+BAS_Span_ThreadEnd(void)
 {
-	switch(special)
+	if (!span_buffer)
 	{
-	case TOOL_SPECIAL_RESETSTATE:
-		helpme_resetstate();
-		return;
-	case TOOL_SPECIAL_BEGIN:
-		helpme_createtextures();
-		return;
-	case TOOL_SPECIAL_STOP:
-		helpme_destroytextures();
 		return;
 	}
+	SDL_AtomicLock(&span_lock);
+	span_buffer->taken = 0;
+	SDL_AtomicUnlock(&span_lock);
+	span_buffer = NULL;
 }
+
+/* Start recording, the spans recorded before are dropped (by their owners, see BAS_Span). */
 static void
-BAS_Tool_HelpMe_Draw(int mx, int my)
+BAS_Span_Start(void)
 {
-	int i;
-	const int screen_w = 800;
-	const int screen_h = 500;
-	SDL_Rect rectangle;
-	rectangle.w = screen_w;
-	rectangle.h = screen_h;
-	rectangle.x = WINDOW_WIDTH/2-screen_w/2;
-	rectangle.y = WINDOW_HEIGHT/2-screen_h/2;
-	/* Title image */
-	SDL_RenderCopy(renderer, basilisk_texture, NULL, &rectangle);
-	/* Outline */
-	BAS_UseColour(255, 255, 255);
-	SDL_RenderDrawRect(renderer, &rectangle);
-	/* Text on the title image */
-	rectangle.x += 1;
-	rectangle.y += 1;
-	for (i = 0; i < 8; i++)
-	{
-		SDL_QueryTexture(helpme_textblock[i], NULL, NULL, &rectangle.w, &rectangle.h);
-		SDL_RenderCopy(renderer, helpme_textblock[i], NULL, &rectangle);
-		rectangle.y += 24;
-	}
-	/* Black strip */
-	rectangle.x = 1+WINDOW_WIDTH/2-screen_w/2;
-	rectangle.y = WINDOW_HEIGHT/2+(screen_h*3.0)/7.0;
-	rectangle.h = 12;
-	rectangle.w = screen_w-2;
-	BAS_UseColour(0, 0, 0);
-	SDL_RenderFillRect(renderer, &rectangle);
-	/* Author text */
-	rectangle.x += rectangle.w;
-	SDL_QueryTexture(helpme_textureauthor, NULL, NULL, &rectangle.w, &rectangle.h);
-	rectangle.x -= rectangle.w+12;
-	SDL_RenderCopy(renderer, helpme_textureauthor, NULL, &rectangle);
+	SDL_AtomicAdd(&span_epoch, 1);
+	SDL_AtomicSet(&span_recording, 1);
 }
 
 /*
- * ----------------
- * Tool for placing rooms.
- * ----------------
+ * Stop recording and write the spans to the given path as a trace event JSON
+ * file, every buffer a thread of its own. An end without its begin (a worker
+ * which was busy when recording started) is left out. Returns 0 on success, 1
+ * on error.
  */
-static inline void
-drawroom_resetstate(void)
-{
-	SDL_SetCursor(cursorheap[CURSOR_ARROW]);
-}
-static void
-BAS_Tool_DrawRoom(SDL_Event e, int mx, int my, int special)
+static int
+BAS_Span_Stop(const char *path)
 {
-	switch(special)
-	{
-	case TOOL_SPECIAL_RESETSTATE:
-		drawroom_resetstate();
-	case TOOL_SPECIAL_STOP:
-		return;
-	}
-	if ((e.type == SDL_KEYDOWN         && e.key.keysym.sym == SDLK_SPACE)
-	 || (e.type == SDL_MOUSEBUTTONDOWN && e.button.button  == SDL_BUTTON_LEFT))
+	register int i, j;
+	struct BAS_SpanBuffer *buffers[SPAN_BUFFERS];
+	int buffer_count, written = 0, dropped = 0;
+	const int epoch = SDL_AtomicGet(&span_epoch);
+	char message[160];
+	FILE *file;
+	const double microseconds = 1e6/SDL_GetPerformanceFrequency();
+	SDL_AtomicSet(&span_recording, 0);
+	/* Buffers are never let go of, only the list may grow meanwhile. */
+	SDL_AtomicLock(&span_lock);
+	buffer_count = span_buffer_count;
+	memcpy(buffers, span_buffers, buffer_count*sizeof(struct BAS_SpanBuffer *));
+	SDL_AtomicUnlock(&span_lock);
+	if (!(file = fopen(path, "w")))
 	{
-		int cx, cy;
-		BAS_ClosestCellPosition(mx, my, &cx, &cy);
-		if (BAS_Room_Create(cx, cy))
-		{
-			BAS_PushStatusAndWriteWarning("Selected room already exists.");
-		}
-		else
-		{
-			BAS_RecalculateLines();
-		}
+		WRITE_E("Failed to open file for writing!");
+		return 1;
 	}
-	else if ((e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_DELETE)
-	 || (e.type == SDL_MOUSEBUTTONDOWN && e.button.button == SDL_BUTTON_RIGHT))
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	for (i = 0; i < buffer_count; i++)
 	{
-		register int i;
-		int cx, cy;
-		BAS_ClosestCellPosition(mx, my, &cx, &cy);
-		if ((i = BAS_FindRoom(cx, cy)) != BAS_NO_SUCH_ROOM)
+		const struct BAS_SpanBuffer *buffer = buffers[i];
+		const int count = SDL_AtomicGet(&buffers[i]->epoch) == epoch ? SDL_AtomicGet(&buffers[i]->count) : 0;
+		int depth = 0;
+		fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", i ? ",\n" : "", i+1, buffer->name);
+		for (j = 0; j < count; j++)
 		{
-			register int j;
-			for (j = i; j < room_count; j++)
+			if (buffer->events[j].phase == 'E' && !depth)
 			{
-				rooms[j] = rooms[j+1];
+				continue;
 			}
-			room_count--;
-			BAS_RecalculateLines();
+			depth += buffer->events[j].phase == 'B' ? 1 : -1;
+			written++;
+			fprintf(
+				file, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":1,\"tid\":%d,\"ts\":%.3f}",
+				buffer->events[j].name, buffer->events[j].phase, i+1, (buffer->events[j].time-log_start)*microseconds
+			);
 		}
-		else
+		if (count)
 		{
-			BAS_PushStatusAndWriteWarning("No room under the cursor to delete!");
+			dropped += SDL_AtomicGet(&buffers[i]->dropped);
 		}
 	}
+	fprintf(file, "\n]}\n");
+	if (fclose(file))
+	{
+		WRITE_E("Failed to write the spans!");
+		return 1;
+	}
+	snprintf(message, sizeof(message), "Wrote %d span events of %d threads to %s, %d dropped.", written, buffer_count, path, dropped);
+	WRITE_I(message);
+	return 0;
 }
-/* While the room tool is used, draw the room in the cell that's under the mouse */
+
 static void
-BAS_Tool_DrawRoom_Draw(int mx, int my)
+BAS_Span_Free(void)
 {
-	SDL_Rect rectangle;
-	const int activeroomalpha = 255*fabsf(sinf(SDL_GetTicks()/300.0f));
-	BAS_DrawCrosshair();
-	BAS_SnapToClosestCell(&mx, &my);
-	rectangle.x = mx;
-	rectangle.y = my;
-	rectangle.w = CELL_SCALE;
-	rectangle.h = CELL_SCALE;
-	BAS_UseColourAlpha(255, 0, 0, activeroomalpha);
-	SDL_RenderFillRect(renderer, &rectangle);
+	register int i;
+	for (i = 0; i < span_buffer_count; i++)
+	{
+		BAS_Free(span_buffers[i]);
+	}
+	span_buffer_count = 0;
+	span_buffer       = NULL;
 }
 
 /*
- * Export the current plan state to a file.
- * Returns 0 on success, 1 on error.
- * The file format is very simple, here is how it looks (words with $ are variables):
- *
- * Basilisk $version
- * $CELL_SCALE $THING_SCALE
- * l $line_count
- * l.x0 l.y0 l.x1 l.y1
- * (...) repeated $line_count times
- * t $thing_count
- * t[0].x t[0].y t[0].*
- * (...) repeated $thing_count times
+ * The fonts are opened (and SDL_ttf initialised) the first time they are
+ * asked for, a font which fails to open is not tried again.
  */
-static int
-BAS_ExportPlan(const char path[96])
+static TTF_Font *
+BAS_Font(int font)
 {
-	size_t i;
-	FILE *output;
-	WRITE_I("Writing to file...");
-	output = fopen(path, "w");
-	if (!output)
+	char message[64];
+	Uint64 start;
+	if (fontheap[font] || fontheap_tried[font])
 	{
-		WRITE_E("Failed to open file for writing!");
-		return 1;
+		return fontheap[font];
 	}
-	fprintf(output, "Basilisk 0\n");
-	fprintf(output, "%d %d\n", CELL_SCALE, THING_SCALE);
-	fprintf(output, "l %d\n", line_count);
-	for (i = 0; i < line_count; i++)
+	fontheap_tried[font] = 1;
+	start = SDL_GetPerformanceCounter();
+	if ((!TTF_WasInit() && TTF_Init()) || !(fontheap[font] = TTF_OpenFont(FONT_PATH, FONT_SIZES[font])))
 	{
-		struct BAS_Line line = lines[i];
-		fprintf(
-			output,
-			"%d %d %d %d\n",
-			line.cellnodeposition[0][0],
-			line.cellnodeposition[0][1],
-			line.cellnodeposition[1][0],
-			line.cellnodeposition[1][1]
-		);
+		WRITE_E(SDL_GetError());
+		return NULL;
 	}
-	fprintf(output, "t %d\n", thing_count);
-	for (i = 0; i < thing_count; i++)
+	snprintf(
+		message, sizeof(message), "Opened the %d point font in %.1f ms.",
+		FONT_SIZES[font], (SDL_GetPerformanceCounter()-start)*1000.0/SDL_GetPerformanceFrequency()
+	);
+	WRITE_I(message);
+	return fontheap[font];
+}
+static SDL_Cursor *
+BAS_Cursor(int cursor)
+{
+	if (!cursorheap[cursor])
 	{
-		struct BAS_Thing thing = things[i];
-		fprintf(
-			output,
-			"%d %d\n",
-			thing.thingposition[0],
-			thing.thingposition[1]
-		);
+		cursorheap[cursor] = SDL_CreateSystemCursor(CURSOR_SYSTEM[cursor]);
 	}
-	fclose(output);
-	return 0;
+	return cursorheap[cursor];
 }
 
 /*
- * ----------------
- * Thing placing tool
- * ----------------
+ * Each tool has its own way of execution.
+ * Changing tool changes the function called each frame.
  */
-static int panel_width = 225;
-static int thing_seeinfo = 0;
-static int thing_selected = BAS_NO_SUCH_THING;
-static int thingtool_updatecursor = 1;
-static SDL_Texture* thing_infos[32] = {NULL};
-static inline void
-thingtool_resetstate(void)
-{
-	thing_seeinfo  = 0;
-	thing_selected = BAS_NO_SUCH_THING;
-}
-static void
-thingtool_updateinfopanel(const int thingindex)
+#define TOOL_SPECIAL_VOID       0 /* Nothing. */
+#define TOOL_SPECIAL_RESETSTATE 1 /* Same tool ran again. */
+#define TOOL_SPECIAL_STOP       2 /* Tool changed, ran on the previous tool. */
+#define TOOL_SPECIAL_BEGIN      3 /* Tool changed, ran on the new tool. */
+typedef void (*executionjump)(SDL_Event, int, int, int);
+typedef void (*drawexectionjump)(int, int);
+
+/* Snap the given coordinate to the closest cell's node or the closest cell. */
+inline static void
+BAS_SnapToClosestNode(int* x, int* y)
+{
+	*x = (int)floorf((float)(*x)/CELL_SCALE+0.5f)*CELL_SCALE;
+	*y = (int)floorf((float)(*y)/CELL_SCALE+0.5f)*CELL_SCALE;
+}
+inline static void
+BAS_SnapToClosestNode_Custom(int* x, int* y, const int scale)
+{
+	*x = (int)floorf((float)(*x)/scale+0.5f)*scale;
+	*y = (int)floorf((float)(*y)/scale+0.5f)*scale;
+}
+inline static void
+BAS_SnapToClosestCell(int* x, int* y)
+{
+	*x -= CELL_SCALE/2;
+	*y -= CELL_SCALE/2;
+	BAS_SnapToClosestNode(x, y);
+}
+inline static void
+BAS_SnapToClosestCell_Custom(int* x, int* y, const int scale)
+{
+	*x -= scale/2;
+	*y -= scale/2;
+	BAS_SnapToClosestNode_Custom(x, y, scale);
+}
+
+/* Calculate the closest cell's position to the given coordinates. */
+static void
+BAS_ClosestCellPosition(int fx, int fy, int *cx, int *cy)
+{
+	*cx = fx;
+	*cy = fy;
+	BAS_SnapToClosestCell(cx, cy);
+	*cx /= CELL_SCALE;
+	*cy /= CELL_SCALE;
+}
+
+/*
+ * Create a texture from the given string.
+ * The texture should be freed one it's of no use, with BAS_DestroyTextTexture.
+ */
+static SDL_Texture*
+BAS_CreateTextTexture(TTF_Font* font, const char* text)
+{
+	SDL_Texture* texture;
+	SDL_Surface* temporarysuface;
+	temporarysuface = TTF_RenderUTF8_Shaded(font, text, TEXT_COLOUR, TEXT_BACKGROUND);
+	texture         = SDL_CreateTextureFromSurface(renderer, temporarysuface);
+	SDL_FreeSurface(temporarysuface);
+	BAS_Memory_CountTexture(MEMORY_TEXT, texture, 1);
+	return texture;
+}
+static SDL_Texture*
+BAS_CreateTextTextureBlended(TTF_Font* font, const char* text)
+{
+	SDL_Texture* texture;
+	SDL_Surface* temporarysuface;
+	temporarysuface = TTF_RenderUTF8_Blended(font, text, TEXT_COLOUR);
+	texture         = SDL_CreateTextureFromSurface(renderer, temporarysuface);
+	SDL_FreeSurface(temporarysuface);
+	BAS_Memory_CountTexture(MEMORY_TEXT, texture, 1);
+	return texture;
+}
+static SDL_Texture*
+BAS_CreateTextTextureWrapped(TTF_Font* font, const char* text, int width)
+{
+	SDL_Texture* texture;
+	SDL_Surface* temporarysuface;
+	temporarysuface = TTF_RenderUTF8_Blended_Wrapped(font, text, TEXT_COLOUR, width);
+	texture         = SDL_CreateTextureFromSurface(renderer, temporarysuface);
+	SDL_FreeSurface(temporarysuface);
+	BAS_Memory_CountTexture(MEMORY_TEXT, texture, 1);
+	return texture;
+}
+static void
+BAS_DestroyTextTexture(SDL_Texture* texture)
+{
+	if (texture)
+	{
+		BAS_Memory_CountTexture(MEMORY_TEXT, texture, -1);
+		SDL_DestroyTexture(texture);
+	}
+}
+
+/*
+ * Resize the given array to hold `capacity` elements, counted in the given
+ * memory category. On error the array is left untouched.
+ * Returns 0 on success, 1 on error.
+ */
+static int
+BAS_Resize(int category, void **array, int capacity, size_t elementsize)
+{
+	void *resized = BAS_Realloc(category, *array, capacity*elementsize);
+	if (!resized)
+	{
+		WRITE_E("Out of memory!");
+		return 1;
+	}
+	*array = resized;
+	return 0;
+}
+
+/*
+ * Make sure the given array can hold at least `count` elements, growing it
+ * geometrically. Returns 0 on success, 1 on error.
+ */
+static int
+BAS_Reserve(int category, void **array, int *capacity, int count, size_t elementsize)
+{
+	int newcapacity;
+	if (count <= *capacity)
+	{
+		return 0;
+	}
+	newcapacity = *capacity ? *capacity : 64;
+	while (newcapacity < count)
+	{
+		newcapacity *= 2;
+	}
+	if (BAS_Resize(category, array, newcapacity, elementsize))
+	{
+		return 1;
+	}
+	*capacity = newcapacity;
+	return 0;
+}
+
+/* What says on the tin. */
+static int
+BAS_FloorDiv(int a, int b)
+{
+	return a >= 0 ? a/b : -((-a+b-1)/b);
+}
+
+static inline unsigned int
+BAS_CellHash(int cx, int cy)
+{
+	unsigned int h = (unsigned int)cx*0x9E3779B1u ^ (unsigned int)cy*0x85EBCA77u;
+	h ^= h >> 15;
+	h *= 0x2C1B3C6Du;
+	h ^= h >> 12;
+	return h;
+}
+
+/* Returns the index slot holding the given cell, or -1. */
+static inline int
+BAS_RoomIndex_FindSlot(int cx, int cy)
+{
+	const unsigned int mask = plan->roomindex_capacity-1;
+	unsigned int slot;
+	if (!plan->roomindex_capacity)
+	{
+		return -1;
+	}
+	slot = BAS_CellHash(cx, cy) & mask;
+	while (plan->roomindex[slot].room != BAS_NO_SUCH_ROOM)
+	{
+		if (plan->roomindex[slot].cellposition[0] == cx && plan->roomindex[slot].cellposition[1] == cy)
+		{
+			return slot;
+		}
+		slot = (slot+1) & mask;
+	}
+	return -1;
+}
+
+/* Insert the given room into the index. The room must not already be indexed. */
+static inline void
+BAS_RoomIndex_Insert(int room)
+{
+	const unsigned int mask = plan->roomindex_capacity-1;
+	const int cx = plan->rooms[room].cellposition[0];
+	const int cy = plan->rooms[room].cellposition[1];
+	unsigned int slot = BAS_CellHash(cx, cy) & mask;
+	while (plan->roomindex[slot].room != BAS_NO_SUCH_ROOM)
+	{
+		slot = (slot+1) & mask;
+	}
+	plan->roomindex[slot].cellposition[0] = cx;
+	plan->roomindex[slot].cellposition[1] = cy;
+	plan->roomindex[slot].room            = room;
+}
+
+/* Empty the given slot, shifting back the entries of its probe sequence. */
+static void
+BAS_RoomIndex_RemoveSlot(unsigned int slot)
+{
+	const unsigned int mask = plan->roomindex_capacity-1;
+	unsigned int next = slot;
+	for (;;)
+	{
+		unsigned int home;
+		next = (next+1) & mask;
+		if (plan->roomindex[next].room == BAS_NO_SUCH_ROOM)
+		{
+			break;
+		}
+		home = BAS_CellHash(plan->roomindex[next].cellposition[0], plan->roomindex[next].cellposition[1]) & mask;
+		if (((next-home) & mask) >= ((next-slot) & mask))
+		{
+			plan->roomindex[slot] = plan->roomindex[next];
+			slot = next;
+		}
+	}
+	plan->roomindex[slot].room = BAS_NO_SUCH_ROOM;
+}
+
+static int
+BAS_RoomIndex_Rebuild(int capacity)
+{
+	register int i;
+	struct BAS_RoomSlot *newindex = BAS_Alloc(MEMORY_PLAN, capacity*sizeof(struct BAS_RoomSlot));
+	if (!newindex)
+	{
+		WRITE_E("Out of memory!");
+		return 1;
+	}
+	for (i = 0; i < capacity; i++)
+	{
+		newindex[i].room = BAS_NO_SUCH_ROOM;
+	}
+	BAS_Free(plan->roomindex);
+	plan->roomindex          = newindex;
+	plan->roomindex_capacity = capacity;
+	for (i = 0; i < plan->room_count; i++)
+	{
+		BAS_RoomIndex_Insert(i);
+	}
+	return 0;
+}
+
+/*
+ * Make room for `count` more rooms, both in the room array and in the index
+ * (which is kept at most half full). Returns 0 on success, 1 on error.
+ */
+static int
+BAS_Room_Reserve(int count)
+{
+	const int needed = plan->room_count+count;
+	int capacity;
+	if (BAS_Reserve(MEMORY_PLAN, (void **)&plan->rooms, &plan->room_capacity, needed, sizeof(struct BAS_Room)))
+	{
+		return 1;
+	}
+	if (needed*2 <= plan->roomindex_capacity)
+	{
+		return 0;
+	}
+	capacity = plan->roomindex_capacity ? plan->roomindex_capacity : 128;
+	while (capacity < needed*2)
+	{
+		capacity *= 2;
+	}
+	return BAS_RoomIndex_Rebuild(capacity);
+}
+
+/*
+ * Minimap pixels.
+ * The minimap (see BAS_DrawMinimap) keeps one pixel per minimap_scale x
+ * minimap_scale cells of a MINIMAP_CELLS x MINIMAP_CELLS pixel window onto the
+ * editor's plan, with the number of rooms under every pixel. Creating or
+ * deleting a room counts it here; a pixel which turns on or off grows the dirty
+ * rectangle, which is the only part of the texture sent over on the next
+ * frame. A room outside the window asks for a rebuild, which moves the window
+ * over the whole plan, at more cells per pixel if it no longer fits.
+ */
+#define MINIMAP_CELLS      1024 /* Pixels across the window. */
+#define MINIMAP_ROOM_PIXEL 0xFF00C000u
+#define MINIMAP_VOID_PIXEL 0xC0000014u
+static Uint32 *minimap_pixels;
+static Uint32 *minimap_counts;    /* Rooms under every pixel. */
+static int minimap_scale = 1;     /* Cells per pixel, each way. A power of two. */
+static int minimap_origin[2];     /* Pixel of the plan at the window's top left pixel, in cells/minimap_scale. */
+static int minimap_bounds[4];     /* Rooms seen so far, in window pixels: left, top, right, bottom. */
+static int minimap_dirty[4];      /* Likewise, pixels to send over. Empty while left > right. */
+static int minimap_rebuild = 1;
+/* Count a room created (delta 1) or deleted (delta -1) at the given cell. */
+static inline void
+BAS_Minimap_Mark(int cx, int cy, int delta)
+{
+	int x, y;
+	Uint32 *count;
+	if (plan != &plan_editor || !minimap_pixels || minimap_rebuild)
+	{
+		return;
+	}
+	x = BAS_FloorDiv(cx, minimap_scale)-minimap_origin[0];
+	y = BAS_FloorDiv(cy, minimap_scale)-minimap_origin[1];
+	if (x < 0 || y < 0 || x >= MINIMAP_CELLS || y >= MINIMAP_CELLS)
+	{
+		minimap_rebuild = 1;
+		return;
+	}
+	count = &minimap_counts[y*MINIMAP_CELLS+x];
+	*count += delta;
+	if (*count > 1 || (*count == 1 && delta < 0))
+	{
+		return;
+	}
+	minimap_pixels[y*MINIMAP_CELLS+x] = *count ? MINIMAP_ROOM_PIXEL : MINIMAP_VOID_PIXEL;
+	if (x < minimap_dirty[0]) { minimap_dirty[0] = x; }
+	if (y < minimap_dirty[1]) { minimap_dirty[1] = y; }
+	if (x > minimap_dirty[2]) { minimap_dirty[2] = x; }
+	if (y > minimap_dirty[3]) { minimap_dirty[3] = y; }
+	if (*count)
+	{
+		if (x < minimap_bounds[0]) { minimap_bounds[0] = x; }
+		if (y < minimap_bounds[1]) { minimap_bounds[1] = y; }
+		if (x > minimap_bounds[2]) { minimap_bounds[2] = x; }
+		if (y > minimap_bounds[3]) { minimap_bounds[3] = y; }
+	}
+}
+
+/*
+ * Level of detail blocks.
+ * Far enough out, walls and things are drawn as one quad per LOD_BLOCK x
+ * LOD_BLOCK cells (see BAS_DrawLod). The counts behind the quads are kept per
+ * block in a hash table of the editor's plan: editing a room only marks the
+ * blocks whose walls it may change, and those are counted again when they are
+ * next drawn. Things are counted as they come and go.
+ */
+#define LOD_BLOCK 8 /* In cells. */
+struct BAS_LodBlock
+{
+	int blockposition[2];
+	int walls;
+	int things;
+	int used;
+	int dirty;
+};
+static struct BAS_LodBlock *lod_blocks;
+static int lod_block_count    = 0;
+static int lod_block_capacity = 0;
+static int lod_rebuild        = 1; /* Count every block from scratch, see BAS_Lod_Rebuild. */
+
+/* Double the block table. Returns 0 on success, 1 on error. */
+static int
+BAS_Lod_Grow(void)
+{
+	register int i;
+	unsigned int mask, slot;
+	struct BAS_LodBlock *old = lod_blocks;
+	const int oldcapacity    = lod_block_capacity;
+	const int capacity       = lod_block_capacity ? lod_block_capacity*2 : 256;
+	if (!(lod_blocks = BAS_Calloc(MEMORY_RENDER, capacity, sizeof(struct BAS_LodBlock))))
+	{
+		WRITE_E("Out of memory!");
+		lod_blocks = old;
+		return 1;
+	}
+	lod_block_capacity = capacity;
+	mask = capacity-1;
+	for (i = 0; i < oldcapacity; i++)
+	{
+		if (old[i].used)
+		{
+			slot = BAS_CellHash(old[i].blockposition[0], old[i].blockposition[1]) & mask;
+			while (lod_blocks[slot].used)
+			{
+				slot = (slot+1) & mask;
+			}
+			lod_blocks[slot] = old[i];
+		}
+	}
+	BAS_Free(old);
+	return 0;
+}
+/* Find the given block, adding it if it is not there yet. Returns NULL if there is no memory left. */
+static struct BAS_LodBlock *
+BAS_Lod_Block(int bx, int by)
+{
+	unsigned int mask, slot;
+	if (lod_block_capacity)
+	{
+		mask = lod_block_capacity-1;
+		slot = BAS_CellHash(bx, by) & mask;
+		while (lod_blocks[slot].used)
+		{
+			if (lod_blocks[slot].blockposition[0] == bx && lod_blocks[slot].blockposition[1] == by)
+			{
+				return &lod_blocks[slot];
+			}
+			slot = (slot+1) & mask;
+		}
+	}
+	/* Only a new block may need a larger table. */
+	if ((lod_block_count+1)*2 > lod_block_capacity && BAS_Lod_Grow())
+	{
+		return NULL;
+	}
+	mask = lod_block_capacity-1;
+	slot = BAS_CellHash(bx, by) & mask;
+	while (lod_blocks[slot].used)
+	{
+		slot = (slot+1) & mask;
+	}
+	lod_blocks[slot].blockposition[0] = bx;
+	lod_blocks[slot].blockposition[1] = by;
+	lod_blocks[slot].walls  = 0;
+	lod_blocks[slot].things = 0;
+	lod_blocks[slot].used   = 1;
+	lod_blocks[slot].dirty  = 1;
+	lod_block_count++;
+	return &lod_blocks[slot];
+}
+
+/* A room appeared or went away, which changes the walls of its own block and maybe of the blocks next to it. */
+static inline void
+BAS_Lod_MarkRoom(int cx, int cy)
+{
+	register int side;
+	struct BAS_LodBlock *block;
+	if (plan != &plan_editor || lod_rebuild)
+	{
+		return;
+	}
+	for (side = 0; side < 5; side++)
+	{
+		static const int AROUND[5][2] = {{0, 0}, {0, -1}, {0, 1}, {-1, 0}, {1, 0}};
+		const int bx = BAS_FloorDiv(cx+AROUND[side][0], LOD_BLOCK);
+		const int by = BAS_FloorDiv(cy+AROUND[side][1], LOD_BLOCK);
+		if (side > 0 && bx == BAS_FloorDiv(cx, LOD_BLOCK) && by == BAS_FloorDiv(cy, LOD_BLOCK))
+		{
+			continue;
+		}
+		if (!(block = BAS_Lod_Block(bx, by)))
+		{
+			lod_rebuild = 1;
+			return;
+		}
+		block->dirty = 1;
+	}
+}
+
+/* A thing at the given position (thing-space) appeared (count 1) or went away (-1). */
+static inline void
+BAS_Lod_CountThing(int x, int y, int count)
+{
+	struct BAS_LodBlock *block;
+	if (plan != &plan_editor || lod_rebuild)
+	{
+		return;
+	}
+	if (!(block = BAS_Lod_Block(BAS_FloorDiv(x, CELL_SCALE*LOD_BLOCK), BAS_FloorDiv(y, CELL_SCALE*LOD_BLOCK))))
+	{
+		lod_rebuild = 1;
+		return;
+	}
+	block->things += count;
+}
+
+/*
+ * Live link chunks.
+ * While the live link is open (see BAS_LiveLink), the chunks whose rooms or
+ * things change are listed here until the next publish. A mark of the chunk
+ * marked last is dropped, so batch edits only list a chunk every so often, the
+ * duplicates left are sorted out when publishing.
+ */
+#define LIVELINK_CHUNK_SIZE 64 /* In cells, the same as the chunks of plan files. */
+static int livelink_active = 0;
+static int livelink_full   = 1; /* Everything changed, no list is kept. */
+static int (*livelink_dirty)[2];
+static int livelink_dirty_count;
+static int livelink_dirty_capacity;
+static inline void
+BAS_LiveLink_MarkChunk(int chunkx, int chunky)
+{
+	const int last = livelink_dirty_count-1;
+	if (!livelink_active || livelink_full || plan != &plan_editor
+	 || (last >= 0 && livelink_dirty[last][0] == chunkx && livelink_dirty[last][1] == chunky))
+	{
+		return;
+	}
+	if (BAS_Reserve(MEMORY_WORK, (void **)&livelink_dirty, &livelink_dirty_capacity, livelink_dirty_count+1, sizeof(int[2])))
+	{
+		livelink_full = 1;
+		return;
+	}
+	livelink_dirty[livelink_dirty_count][0] = chunkx;
+	livelink_dirty[livelink_dirty_count][1] = chunky;
+	livelink_dirty_count++;
+}
+/* A room on the edge of a chunk takes a wall from or gives one to the room across, in the neighbouring chunk. */
+static inline void
+BAS_LiveLink_MarkRoom(int cx, int cy)
+{
+	const int chunkx = BAS_FloorDiv(cx, LIVELINK_CHUNK_SIZE);
+	const int chunky = BAS_FloorDiv(cy, LIVELINK_CHUNK_SIZE);
+	const int x = cx-chunkx*LIVELINK_CHUNK_SIZE;
+	const int y = cy-chunky*LIVELINK_CHUNK_SIZE;
+	if (!livelink_active)
+	{
+		return;
+	}
+	BAS_LiveLink_MarkChunk(chunkx, chunky);
+	if (x == 0)                     { BAS_LiveLink_MarkChunk(chunkx-1, chunky); }
+	if (x == LIVELINK_CHUNK_SIZE-1) { BAS_LiveLink_MarkChunk(chunkx+1, chunky); }
+	if (y == 0)                     { BAS_LiveLink_MarkChunk(chunkx, chunky-1); }
+	if (y == LIVELINK_CHUNK_SIZE-1) { BAS_LiveLink_MarkChunk(chunkx, chunky+1); }
+}
+static inline void
+BAS_LiveLink_MarkThing(int thing)
+{
+	if (livelink_active)
+	{
+		BAS_LiveLink_MarkChunk(
+			BAS_FloorDiv(plan->things.thingposition[0][thing], CELL_SCALE*LIVELINK_CHUNK_SIZE),
+			BAS_FloorDiv(plan->things.thingposition[1][thing], CELL_SCALE*LIVELINK_CHUNK_SIZE)
+		);
+	}
+}
+
+/* Append a room without looking for duplicates. Space must be reserved beforehand. */
+static inline void
+BAS_Room_Append(int cx, int cy)
+{
+	plan->rooms[plan->room_count].cellposition[0] = cx;
+	plan->rooms[plan->room_count].cellposition[1] = cy;
+	BAS_RoomIndex_Insert(plan->room_count);
+	plan->room_count++;
+	BAS_Minimap_Mark(cx, cy, 1);
+	BAS_Lod_MarkRoom(cx, cy);
+	BAS_LiveLink_MarkRoom(cx, cy);
+}
+
+static int
+BAS_FindRoom(int cx, int cy)
+{
+	const int slot = BAS_RoomIndex_FindSlot(cx, cy);
+	return slot < 0 ? BAS_NO_SUCH_ROOM : plan->roomindex[slot].room;
+}
+
+/*
+ * If the given cell coordinates do not correspond to a room, create a new room (returns 0).
+ * Otherwise, returns 1. Returns -1 if the cell is out of range or there is no memory left for the room.
+ */
+static int
+BAS_Room_Create(int cx, int cy)
+{
+	if (!BAS_Room_Inside(cx, cy))
+	{
+		return -1;
+	}
+	if (BAS_FindRoom(cx, cy) != BAS_NO_SUCH_ROOM)
+	{
+		return 1;
+	}
+	if (BAS_Room_Reserve(1))
+	{
+		return -1;
+	}
+	BAS_Room_Append(cx, cy);
+	return 0;
+}
+
+/*
+ * Delete the room at the given cell coordinates (returns 0).
+ * Returns 1 if there is no such room. The last room takes the deleted one's place.
+ */
+static int
+BAS_Room_Delete(int cx, int cy)
+{
+	int room, slot;
+	const int last = plan->room_count-1;
+	if ((slot = BAS_RoomIndex_FindSlot(cx, cy)) < 0)
+	{
+		return 1;
+	}
+	room = plan->roomindex[slot].room;
+	BAS_RoomIndex_RemoveSlot(slot);
+	if (room != last)
+	{
+		plan->rooms[room] = plan->rooms[last];
+		slot = BAS_RoomIndex_FindSlot(plan->rooms[room].cellposition[0], plan->rooms[room].cellposition[1]);
+		plan->roomindex[slot].room = room;
+	}
+	plan->room_count--;
+	BAS_Minimap_Mark(cx, cy, -1);
+	BAS_Lod_MarkRoom(cx, cy);
+	BAS_LiveLink_MarkRoom(cx, cy);
+	return 0;
+}
+
+/*
+ * Batch edits.
+ * These insert or remove many rooms in one go without touching the walls, the
+ * caller recalculates the lines once when the whole batch is done.
+ * Each returns the number of rooms created or deleted, or -1 on error.
+ */
+static int
+BAS_Room_FillRectangle(int cx0, int cy0, int cx1, int cy1)
+{
+	register int x, y;
+	int created = 0;
+	const int left   = cx0 < cx1 ? cx0 : cx1;
+	const int right  = cx0 < cx1 ? cx1 : cx0;
+	const int top    = cy0 < cy1 ? cy0 : cy1;
+	const int bottom = cy0 < cy1 ? cy1 : cy0;
+	const long area  = (long)(right-left+1)*(bottom-top+1);
+	if (!BAS_Room_Inside(left, top) || !BAS_Room_Inside(right, bottom) || area > BAS_MAX_BATCH_CELLS || BAS_Room_Reserve(area))
+	{
+		return -1;
+	}
+	for (y = top; y <= bottom; y++)
+	{
+		for (x = left; x <= right; x++)
+		{
+			if (BAS_RoomIndex_FindSlot(x, y) < 0)
+			{
+				BAS_Room_Append(x, y);
+				created++;
+			}
+		}
+	}
+	return created;
+}
+
+static int
+BAS_Room_EraseRectangle(int cx0, int cy0, int cx1, int cy1)
+{
+	register int i;
+	int deleted = 0;
+	const int left   = cx0 < cx1 ? cx0 : cx1;
+	const int right  = cx0 < cx1 ? cx1 : cx0;
+	const int top    = cy0 < cy1 ? cy0 : cy1;
+	const int bottom = cy0 < cy1 ? cy1 : cy0;
+	const long area  = (long)(right-left+1)*(bottom-top+1);
+	if (area < plan->room_count)
+	{
+		register int x, y;
+		for (y = top; y <= bottom; y++)
+		{
+			for (x = left; x <= right; x++)
+			{
+				deleted += !BAS_Room_Delete(x, y);
+			}
+		}
+		return deleted;
+	}
+	/* The rectangle is bigger than the plan, walk the rooms instead. */
+	for (i = plan->room_count-1; i >= 0; i--)
+	{
+		const int x = plan->rooms[i].cellposition[0];
+		const int y = plan->rooms[i].cellposition[1];
+		if (x >= left && x <= right && y >= top && y <= bottom)
+		{
+			BAS_Room_Delete(x, y);
+			deleted++;
+		}
+	}
+	return deleted;
+}
+
+/*
+ * Fill the empty area around the given cell which is enclosed by rooms.
+ * Returns -1 if the area is not enclosed (it reaches past the plan's bounds).
+ */
+static int
+BAS_Room_FloodFill(int cx, int cy)
+{
+	register int i;
+	int left, right, top, bottom, width, height;
+	int head, tail;
+	unsigned char *visited;
+	int *queue;
+	if (plan->room_count <= 0 || BAS_FindRoom(cx, cy) != BAS_NO_SUCH_ROOM)
+	{
+		return plan->room_count <= 0 ? -1 : 0;
+	}
+	left = right  = plan->rooms[0].cellposition[0];
+	top  = bottom = plan->rooms[0].cellposition[1];
+	for (i = 1; i < plan->room_count; i++)
+	{
+		if (plan->rooms[i].cellposition[0] < left)   { left   = plan->rooms[i].cellposition[0]; }
+		if (plan->rooms[i].cellposition[0] > right)  { right  = plan->rooms[i].cellposition[0]; }
+		if (plan->rooms[i].cellposition[1] < top)    { top    = plan->rooms[i].cellposition[1]; }
+		if (plan->rooms[i].cellposition[1] > bottom) { bottom = plan->rooms[i].cellposition[1]; }
+	}
+	if (cx <= left || cx >= right || cy <= top || cy >= bottom)
+	{
+		return -1;
+	}
+	width  = right-left+1;
+	height = bottom-top+1;
+	if ((long)width*height > BAS_MAX_BATCH_CELLS)
+	{
+		return -1;
+	}
+	visited = calloc(width*height, 1);
+	queue   = malloc(width*height*sizeof(int));
+	if (!visited || !queue)
+	{
+		WRITE_E("Out of memory!");
+		free(visited);
+		free(queue);
+		return -1;
+	}
+	/* Breadth first walk over the empty cells, the queue holds bounding box offsets. */
+	head = tail = 0;
+	queue[tail++] = (cy-top)*width+(cx-left);
+	visited[queue[0]] = 1;
+	while (head < tail)
+	{
+		const int x = queue[head]%width;
+		const int y = queue[head]/width;
+		const int neighbour[4][2] = {{x, y-1}, {x, y+1}, {x-1, y}, {x+1, y}};
+		head++;
+		for (i = 0; i < 4; i++)
+		{
+			const int nx = neighbour[i][0];
+			const int ny = neighbour[i][1];
+			if (nx < 0 || nx >= width || ny < 0 || ny >= height)
+			{
+				/* Leaked out of the bounding box, the area is open. */
+				free(visited);
+				free(queue);
+				return -1;
+			}
+			if (!visited[ny*width+nx])
+			{
+				visited[ny*width+nx] = 1;
+				if (BAS_RoomIndex_FindSlot(left+nx, top+ny) < 0)
+				{
+					queue[tail++] = ny*width+nx;
+				}
+			}
+		}
+	}
+	if (BAS_Room_Reserve(tail))
+	{
+		tail = -1;
+	}
+	else
+	{
+		for (i = 0; i < tail; i++)
+		{
+			BAS_Room_Append(left+queue[i]%width, top+queue[i]/width);
+		}
+	}
+	free(visited);
+	free(queue);
+	return tail;
+}
+
+/*
+ * Paint (or erase) every cell on the line between the two cells, Bresenham style.
+ * The line is kept 4-connected so painted strokes never leave diagonal gaps.
+ * Returns the number of rooms created or deleted, or -1 on error.
+ */
+static int
+BAS_Room_PaintLine(int cx0, int cy0, int cx1, int cy1, int erase)
+{
+	const int dx = abs(cx1-cx0);
+	const int dy = -abs(cy1-cy0);
+	const int sx = cx0 < cx1 ? 1 : -1;
+	const int sy = cy0 < cy1 ? 1 : -1;
+	int error   = dx+dy;
+	int changed = 0;
+	if (!erase && (!BAS_Room_Inside(cx0, cy0) || !BAS_Room_Inside(cx1, cy1) || BAS_Room_Reserve(dx-dy+1)))
+	{
+		return -1;
+	}
+	for (;;)
+	{
+		int doubled;
+		if (erase)
+		{
+			changed += !BAS_Room_Delete(cx0, cy0);
+		}
+		else if (BAS_RoomIndex_FindSlot(cx0, cy0) < 0)
+		{
+			BAS_Room_Append(cx0, cy0);
+			changed++;
+		}
+		if (cx0 == cx1 && cy0 == cy1)
+		{
+			break;
+		}
+		doubled = 2*error;
+		if (doubled-dy > dx-doubled)
+		{
+			error += dy;
+			cx0   += sx;
+		}
+		else
+		{
+			error += dx;
+			cy0   += sy;
+		}
+	}
+	return changed;
+}
+
+/*
+ * Make room for `count` more things. All the field arrays share one capacity.
+ * Returns 0 on success, 1 on error.
+ */
+static int
+BAS_Thing_Reserve(int count)
+{
+	int capacity;
+	if (plan->thing_count+count <= plan->thing_capacity)
+	{
+		return 0;
+	}
+	capacity = plan->thing_capacity ? plan->thing_capacity : 64;
+	while (capacity < plan->thing_count+count)
+	{
+		capacity *= 2;
+	}
+	if (BAS_Resize(MEMORY_PLAN, (void **)&plan->things.thingposition[0], capacity, sizeof(int))
+	 || BAS_Resize(MEMORY_PLAN, (void **)&plan->things.thingposition[1], capacity, sizeof(int))
+	 || BAS_Resize(MEMORY_PLAN, (void **)&plan->things.type,             capacity, sizeof(int))
+	 || BAS_Resize(MEMORY_PLAN, (void **)&plan->things.facing,           capacity, sizeof(int))
+	 || BAS_Resize(MEMORY_PLAN, (void **)&plan->things.flags,            capacity, sizeof(uint64_t)))
+	{
+		return 1;
+	}
+	plan->thing_capacity = capacity;
+	return 0;
+}
+
+/* Create a thing at the given position (thing-space). Returns its index or BAS_NO_SUCH_THING. */
+static int
+BAS_Thing_Create(int x, int y, int facing)
+{
+	if (!BAS_Room_Inside(BAS_FloorDiv(x, CELL_SCALE), BAS_FloorDiv(y, CELL_SCALE)) || BAS_Thing_Reserve(1))
+	{
+		return BAS_NO_SUCH_THING;
+	}
+	plan->things.thingposition[0][plan->thing_count] = x;
+	plan->things.thingposition[1][plan->thing_count] = y;
+	plan->things.type[plan->thing_count]   = 0;
+	plan->things.facing[plan->thing_count] = facing;
+	plan->things.flags[plan->thing_count]  = 0;
+	BAS_Lod_CountThing(x, y, 1);
+	BAS_LiveLink_MarkThing(plan->thing_count);
+	return plan->thing_count++;
+}
+
+/*
+ * Remove every thing marked in `removed` (one element per thing), keeping the
+ * order of the others. Returns the number of things removed.
+ */
+static int
+BAS_Thing_Remove(const unsigned char *removed)
+{
+	register int i, j;
+	int count;
+	for (i = j = 0; i < plan->thing_count; i++)
+	{
+		if (removed[i])
+		{
+			BAS_Lod_CountThing(plan->things.thingposition[0][i], plan->things.thingposition[1][i], -1);
+			BAS_LiveLink_MarkThing(i);
+			continue;
+		}
+		plan->things.thingposition[0][j] = plan->things.thingposition[0][i];
+		plan->things.thingposition[1][j] = plan->things.thingposition[1][i];
+		plan->things.type[j]   = plan->things.type[i];
+		plan->things.facing[j] = plan->things.facing[i];
+		plan->things.flags[j]  = plan->things.flags[i];
+		j++;
+	}
+	count = plan->thing_count-j;
+	plan->thing_count = j;
+	return count;
+}
+
+static struct BAS_Thing
+BAS_Thing_Get(int thing)
+{
+	struct BAS_Thing t;
+	t.flags            = plan->things.flags[thing];
+	t.thingposition[0] = plan->things.thingposition[0][thing];
+	t.thingposition[1] = plan->things.thingposition[1][thing];
+	t.type             = plan->things.type[thing];
+	t.facing           = plan->things.facing[thing];
+	return t;
+}
+
+static int
+BAS_FindThing(int cx, int cy)
+{
+	register int i;
+	const int *x = plan->things.thingposition[0];
+	const int *y = plan->things.thingposition[1];
+	for (i = 0; i < plan->thing_count; i++)
+	{
+		if (x[i] == cx && y[i] == cy)
+		{
+			return i;
+		}
+	}
+	return BAS_NO_SUCH_THING;
+}
+
+/*
+ * Thing filters.
+ * A filter selects the things which have all the flags of `flagmask` set, the
+ * given type and facing (unless BAS_THINGFILTER_ANY) and lie inside the
+ * thing-space rectangle [rectangle[0], rectangle[1]).
+ */
+#define BAS_THINGFILTER_ANY      -1
+#define BAS_THINGFILTER_BLOCK    4096 /* Things tested per kernel pass, sized to stay in L1. */
+struct BAS_ThingFilter
+{
+	uint64_t flagmask;
+	int type;
+	int facing;
+	int rectangle[2][2];
+};
+static void
+BAS_ThingFilter_Reset(struct BAS_ThingFilter *filter)
+{
+	filter->flagmask        = 0;
+	filter->type            = BAS_THINGFILTER_ANY;
+	filter->facing          = BAS_THINGFILTER_ANY;
+	filter->rectangle[0][0] = INT_MIN;
+	filter->rectangle[0][1] = INT_MIN;
+	filter->rectangle[1][0] = INT_MAX;
+	filter->rectangle[1][1] = INT_MAX;
+}
+/*
+ * Test things [first, first+count) against the filter, writing 1 (match) or 0
+ * into `match`. The loop is branch free over plain arrays so the compiler can
+ * vectorise it.
+ */
+static void
+BAS_ThingFilter_Kernel(const struct BAS_ThingFilter *filter, int first, int count, unsigned char *restrict match)
+{
+	register int i;
+	const uint64_t flagmask = filter->flagmask;
+	const int anytype   = filter->type   == BAS_THINGFILTER_ANY;
+	const int anyfacing = filter->facing == BAS_THINGFILTER_ANY;
+	const int type      = filter->type;
+	const int facing    = filter->facing;
+	const int x0 = filter->rectangle[0][0];
+	const int y0 = filter->rectangle[0][1];
+	const int x1 = filter->rectangle[1][0];
+	const int y1 = filter->rectangle[1][1];
+	const int      *restrict px = plan->things.thingposition[0]+first;
+	const int      *restrict py = plan->things.thingposition[1]+first;
+	const int      *restrict pt = plan->things.type+first;
+	const int      *restrict pf = plan->things.facing+first;
+	const uint64_t *restrict pg = plan->things.flags+first;
+	for (i = 0; i < count; i++)
+	{
+		/* Wanted flags which are not set, reduced to 0/1 without a 64-bit compare (SSE2 has none). */
+		const uint64_t missing = (pg[i] & flagmask) ^ flagmask;
+		match[i] = (unsigned char)(((missing | (0-missing)) >> 63) ^ 1)
+		         & (anytype   | (pt[i] == type))
+		         & (anyfacing | (pf[i] == facing))
+		         & (px[i] >= x0) & (px[i] < x1)
+		         & (py[i] >= y0) & (py[i] < y1);
+	}
+}
+/*
+ * Write the indices of all the matching things into `result`, which must have
+ * space for thing_count elements. Returns the number of matches.
+ */
+static int
+BAS_ThingFilter_Run(const struct BAS_ThingFilter *filter, int *result)
+{
+	unsigned char match[BAS_THINGFILTER_BLOCK];
+	register int i;
+	int first, count = 0;
+	for (first = 0; first < plan->thing_count; first += BAS_THINGFILTER_BLOCK)
+	{
+		const int block = plan->thing_count-first < BAS_THINGFILTER_BLOCK ? plan->thing_count-first : BAS_THINGFILTER_BLOCK;
+		BAS_ThingFilter_Kernel(filter, first, block, match);
+		for (i = 0; i < block; i++)
+		{
+			result[count] = first+i;
+			count += match[i];
+		}
+	}
+	return count;
+}
+
+static inline void
+BAS_InvalidateLines(void)
+{
+	plan->lines_outdated = 1;
+	plan->lines_version++;
+	plan->floor_outdated = 1;
+}
+
+/*
+ * Prefabs.
+ * BAS_Prefab_Capture makes a prefab out of a rectangle of the plan, which
+ * becomes its first instance, and BAS_Instance_Stamp places more instances.
+ * Identical captures share one prefab. Stamped instances are only expanded
+ * into rooms and things by BAS_Instance_ExpandPending, which whatever reads
+ * the whole plan (the walls first of all) calls beforehand. The sharing is in
+ * plan files and exports only: in memory an expanded instance is as large as
+ * the rooms and things it stands for.
+ */
+/* Cell of the plan where the prefab's cell (x, y) lands. */
+static inline void
+BAS_Instance_Cell(const struct BAS_Instance *instance, int x, int y, int *cx, int *cy)
+{
+	const struct BAS_Prefab *prefab = &plan->prefabs[instance->prefab];
+	switch (instance->rotation)
+	{
+	case 1:  *cx = prefab->size[1]-1-y; *cy = x;                   break;
+	case 2:  *cx = prefab->size[0]-1-x; *cy = prefab->size[1]-1-y; break;
+	case 3:  *cx = y;                   *cy = prefab->size[0]-1-x; break;
+	default: *cx = x;                   *cy = y;
+	}
+	*cx += instance->cellposition[0];
+	*cy += instance->cellposition[1];
+}
+/* The prefab's thing as it is placed by the instance. Facings 0 to 3 are quarter turns counter clockwise. */
+static inline struct BAS_Thing
+BAS_Instance_Thing(const struct BAS_Instance *instance, const struct BAS_Thing *thing)
+{
+	struct BAS_Thing t = *thing;
+	const struct BAS_Prefab *prefab = &plan->prefabs[instance->prefab];
+	const int width  = prefab->size[0]*CELL_SCALE-THING_SCALE;
+	const int height = prefab->size[1]*CELL_SCALE-THING_SCALE;
+	const int x = thing->thingposition[0], y = thing->thingposition[1];
+	switch (instance->rotation)
+	{
+	case 1:  t.thingposition[0] = height-y; t.thingposition[1] = x;        break;
+	case 2:  t.thingposition[0] = width-x;  t.thingposition[1] = height-y; break;
+	case 3:  t.thingposition[0] = y;        t.thingposition[1] = width-x;  break;
+	}
+	if (t.facing >= 0 && t.facing < 4)
+	{
+		t.facing = (t.facing+4-instance->rotation) & 3;
+	}
+	t.thingposition[0] += instance->cellposition[0]*CELL_SCALE;
+	t.thingposition[1] += instance->cellposition[1]*CELL_SCALE;
+	return t;
+}
+/* Size of the instance's footprint, which is turned along with the prefab. */
+static inline void
+BAS_Instance_Size(const struct BAS_Instance *instance, int *width, int *height)
+{
+	const struct BAS_Prefab *prefab = &plan->prefabs[instance->prefab];
+	*width  = prefab->size[instance->rotation & 1];
+	*height = prefab->size[!(instance->rotation & 1)];
+}
+
+/* Order of prefab things, so that equal prefabs have their things in the same order. */
+static int
+prefabthing_compare(const void *a, const void *b)
+{
+	const struct BAS_Thing *ta = a, *tb = b;
+	if (ta->thingposition[1] != tb->thingposition[1]) { return ta->thingposition[1] < tb->thingposition[1] ? -1 : 1; }
+	if (ta->thingposition[0] != tb->thingposition[0]) { return ta->thingposition[0] < tb->thingposition[0] ? -1 : 1; }
+	if (ta->type   != tb->type)   { return ta->type   < tb->type   ? -1 : 1; }
+	if (ta->facing != tb->facing) { return ta->facing < tb->facing ? -1 : 1; }
+	if (ta->flags  != tb->flags)  { return ta->flags  < tb->flags  ? -1 : 1; }
+	return 0;
+}
+
+static int
+BAS_Instance_Add(int prefab, int cx, int cy, int rotation, int expanded)
+{
+	struct BAS_Instance *instance;
+	const int width  = plan->prefabs[prefab].size[rotation & 1];
+	const int height = plan->prefabs[prefab].size[!(rotation & 1)];
+	if (!BAS_Room_Inside(cx, cy) || !BAS_Room_Inside((Sint64)cx+width-1, (Sint64)cy+height-1))
+	{
+		WRITE_E("Instance is out of range!");
+		return 1;
+	}
+	if (BAS_Reserve(MEMORY_PLAN, (void **)&plan->instances, &plan->instance_capacity, plan->instance_count+1, sizeof(struct BAS_Instance)))
+	{
+		WRITE_E("Out of memory!");
+		return 1;
+	}
+	instance = &plan->instances[plan->instance_count++];
+	instance->prefab          = prefab;
+	instance->cellposition[0] = cx;
+	instance->cellposition[1] = cy;
+	instance->rotation        = rotation & 3;
+	instance->expanded        = expanded;
+	plan->instances_pending  |= !expanded;
+	return 0;
+}
+
+/* Add the rooms and things of the instances which are not expanded yet. Returns 0 on success, 1 on error. */
+static int
+BAS_Instance_ExpandPending(void)
+{
+	register int i, j;
+	if (!plan->instances_pending)
+	{
+		return 0;
+	}
+	for (i = 0; i < plan->instance_count; i++)
+	{
+		struct BAS_Instance *instance = &plan->instances[i];
+		const struct BAS_Prefab *prefab = &plan->prefabs[instance->prefab];
+		if (instance->expanded)
+		{
+			continue;
+		}
+		if (BAS_Room_Reserve(prefab->room_count) || BAS_Thing_Reserve(prefab->thing_count))
+		{
+			WRITE_E("Out of memory!");
+			return 1;
+		}
+		for (j = 0; j < prefab->room_count; j++)
+		{
+			int cx, cy;
+			BAS_Instance_Cell(instance, plan->prefab_rooms[prefab->rooms+j][0], plan->prefab_rooms[prefab->rooms+j][1], &cx, &cy);
+			if (BAS_FindRoom(cx, cy) == BAS_NO_SUCH_ROOM)
+			{
+				BAS_Room_Append(cx, cy);
+			}
+		}
+		for (j = 0; j < prefab->thing_count; j++)
+		{
+			const struct BAS_Thing t = BAS_Instance_Thing(instance, &plan->prefab_things[prefab->things+j]);
+			const int thing = BAS_Thing_Create(t.thingposition[0], t.thingposition[1], t.facing);
+			plan->things.type[thing]  = t.type;
+			plan->things.flags[thing] = t.flags;
+		}
+		instance->expanded = 1;
+	}
+	plan->instances_pending = 0;
+	return 0;
+}
+
+/*
+ * Make a prefab of the rooms and things in the given cell rectangle, trimmed
+ * to what is there. The rectangle becomes an instance of it.
+ * Returns the prefab, or -1 if the rectangle is empty or on error.
+ */
+static int
+BAS_Prefab_Capture(int cx0, int cy0, int cx1, int cy1)
+{
+	register int i, x, y;
+	int *found, found_count, low[2], high[2];
+	struct BAS_Prefab *prefab;
+	struct BAS_ThingFilter inside;
+	const int left   = cx0 < cx1 ? cx0 : cx1;
+	const int right  = cx0 < cx1 ? cx1 : cx0;
+	const int top    = cy0 < cy1 ? cy0 : cy1;
+	const int bottom = cy0 < cy1 ? cy1 : cy0;
+	const int rooms  = plan->prefab_room_count;
+	const int things = plan->prefab_thing_count;
+	if ((long)(right-left+1)*(bottom-top+1) > BAS_MAX_BATCH_CELLS || BAS_Instance_ExpandPending()
+	 || BAS_Reserve(MEMORY_PLAN, (void **)&plan->prefabs, &plan->prefab_capacity, plan->prefab_count+1, sizeof(struct BAS_Prefab))
+	 || !(found = malloc((plan->thing_count+1)*sizeof(int))))
+	{
+		return -1;
+	}
+	BAS_ThingFilter_Reset(&inside);
+	inside.rectangle[0][0] = left*CELL_SCALE;
+	inside.rectangle[0][1] = top*CELL_SCALE;
+	inside.rectangle[1][0] = (right+1)*CELL_SCALE;
+	inside.rectangle[1][1] = (bottom+1)*CELL_SCALE;
+	found_count = BAS_ThingFilter_Run(&inside, found);
+	if (BAS_Reserve(MEMORY_PLAN, (void **)&plan->prefab_things, &plan->prefab_thing_capacity, things+found_count, sizeof(struct BAS_Thing)))
+	{
+		free(found);
+		return -1;
+	}
+	/* Gather the rooms and things in plan coordinates, then make them relative to their bounds. */
+	low[0]  = low[1]  = INT_MAX;
+	high[0] = high[1] = INT_MIN;
+	for (y = top; y <= bottom; y++)
+	{
+		for (x = left; x <= right; x++)
+		{
+			if (BAS_FindRoom(x, y) == BAS_NO_SUCH_ROOM)
+			{
+				continue;
+			}
+			if (BAS_Reserve(MEMORY_PLAN, (void **)&plan->prefab_rooms, &plan->prefab_room_capacity, plan->prefab_room_count+1, sizeof(int[2])))
+			{
+				plan->prefab_room_count = rooms;
+				free(found);
+				return -1;
+			}
+			plan->prefab_rooms[plan->prefab_room_count][0] = x;
+			plan->prefab_rooms[plan->prefab_room_count][1] = y;
+			plan->prefab_room_count++;
+			low[0]  = x < low[0]  ? x : low[0];
+			low[1]  = y < low[1]  ? y : low[1];
+			high[0] = x > high[0] ? x : high[0];
+			high[1] = y > high[1] ? y : high[1];
+		}
+	}
+	for (i = 0; i < found_count; i++)
+	{
+		const struct BAS_Thing thing = BAS_Thing_Get(found[i]);
+		x = BAS_FloorDiv(thing.thingposition[0], CELL_SCALE);
+		y = BAS_FloorDiv(thing.thingposition[1], CELL_SCALE);
+		plan->prefab_things[things+i] = thing;
+		low[0]  = x < low[0]  ? x : low[0];
+		low[1]  = y < low[1]  ? y : low[1];
+		high[0] = x > high[0] ? x : high[0];
+		high[1] = y > high[1] ? y : high[1];
+	}
+	free(found);
+	plan->prefab_thing_count += found_count;
+	if (low[0] > high[0])
+	{
+		return -1;
+	}
+	for (i = rooms; i < plan->prefab_room_count; i++)
+	{
+		plan->prefab_rooms[i][0] -= low[0];
+		plan->prefab_rooms[i][1] -= low[1];
+	}
+	for (i = things; i < plan->prefab_thing_count; i++)
+	{
+		plan->prefab_things[i].thingposition[0] -= low[0]*CELL_SCALE;
+		plan->prefab_things[i].thingposition[1] -= low[1]*CELL_SCALE;
+	}
+	qsort(plan->prefab_things+things, found_count, sizeof(struct BAS_Thing), prefabthing_compare);
+	prefab = &plan->prefabs[plan->prefab_count];
+	prefab->size[0]     = high[0]-low[0]+1;
+	prefab->size[1]     = high[1]-low[1]+1;
+	prefab->rooms       = rooms;
+	prefab->room_count  = plan->prefab_room_count-rooms;
+	prefab->things      = things;
+	prefab->thing_count = found_count;
+	/* The same prefab may have been captured before. */
+	for (i = 0; i < plan->prefab_count; i++)
+	{
+		const struct BAS_Prefab *other = &plan->prefabs[i];
+		if (other->size[0] == prefab->size[0] && other->size[1] == prefab->size[1]
+		 && other->room_count == prefab->room_count && other->thing_count == prefab->thing_count
+		 && !memcmp(plan->prefab_rooms+other->rooms, plan->prefab_rooms+rooms, prefab->room_count*sizeof(int[2])))
+		{
+			for (x = 0; x < prefab->thing_count && !prefabthing_compare(&plan->prefab_things[other->things+x], &plan->prefab_things[things+x]); x++);
+			if (x == prefab->thing_count)
+			{
+				break;
+			}
+		}
+	}
+	if (i < plan->prefab_count)
+	{
+		plan->prefab_room_count  = rooms;
+		plan->prefab_thing_count = things;
+	}
+	else
+	{
+		plan->prefab_count++;
+	}
+	return BAS_Instance_Add(i, low[0], low[1], 0, 1) ? -1 : i;
+}
+
+/* Place an instance of the prefab, it is expanded with the next wall update. Returns 0 on success, 1 on error. */
+static int
+BAS_Instance_Stamp(int prefab, int cx, int cy, int rotation)
+{
+	if (prefab < 0 || prefab >= plan->prefab_count || BAS_Instance_Add(prefab, cx, cy, rotation, 0))
+	{
+		return 1;
+	}
+	BAS_InvalidateLines();
+	return 0;
+}
+
+/*
+ * Sides of a room, the neighbour in that direction and the wall which is
+ * placed there (node-space, relative to the room) when there is no neighbour.
+ */
+#define BAS_SIDE_NORTH 0
+#define BAS_SIDE_SOUTH 1
+#define BAS_SIDE_WEST  2
+#define BAS_SIDE_EAST  3
+static const int SIDE_NEIGHBOUR[4][2] = {{0, -1}, {0, 1}, {-1, 0}, {1, 0}};
+static const int SIDE_WALL[4][4]      = {{1, 0, 0, 0}, {0, 1, 1, 1}, {0, 0, 0, 1}, {1, 1, 1, 0}};
+
+/* Space for the lines must be reserved beforehand. (x, y) is the start node of the wall. */
+static inline void
+BAS_Line_Create(int x, int y, int side)
+{
+	struct BAS_Line *line = &plan->lines[plan->line_count++];
+	line->local[0] = (Uint16)(x & ((1 << LINE_CHUNK_BITS)-1));
+	line->local[1] = (Uint16)(y & ((1 << LINE_CHUNK_BITS)-1));
+	line->chunk    = (Uint32)side
+	               | ((Uint32)((x-line->local[0])/(1 << LINE_CHUNK_BITS)) & LINE_CHUNK_MASK) << 2
+	               | ((Uint32)((y-line->local[1])/(1 << LINE_CHUNK_BITS)) & LINE_CHUNK_MASK) << (2+15);
+}
+static inline int
+BAS_Line_Side(const struct BAS_Line *line)
+{
+	return (int)(line->chunk & 3);
+}
+/* The start and end node of the wall (node-space): x0, y0, x1, y1. */
+static inline void
+BAS_Line_Nodes(const struct BAS_Line *line, int nodes[4])
+{
+	const int side   = BAS_Line_Side(line);
+	const int chunkx = (int)(((line->chunk >> 2) & LINE_CHUNK_MASK) ^ 0x4000)-0x4000;
+	const int chunky = (int)(((line->chunk >> (2+15)) & LINE_CHUNK_MASK) ^ 0x4000)-0x4000;
+	nodes[0] = chunkx*(1 << LINE_CHUNK_BITS)+line->local[0];
+	nodes[1] = chunky*(1 << LINE_CHUNK_BITS)+line->local[1];
+	nodes[2] = nodes[0]+SIDE_WALL[side][2]-SIDE_WALL[side][0];
+	nodes[3] = nodes[1]+SIDE_WALL[side][3]-SIDE_WALL[side][1];
+}
+/* The middle of the wall (plan-space) and its normal, NORMAL_LENGTH long and pointing into the room. */
+static inline void
+BAS_Line_Normal(const struct BAS_Line *line, int middle[2], int normal[2])
+{
+	int nodes[4];
+	const int side = BAS_Line_Side(line);
+	BAS_Line_Nodes(line, nodes);
+	middle[0] = (nodes[0]+nodes[2])*CELL_SCALE/2;
+	middle[1] = (nodes[1]+nodes[3])*CELL_SCALE/2;
+	normal[0] = -NORMAL_LENGTH*SIDE_NEIGHBOUR[side][0];
+	normal[1] = -NORMAL_LENGTH*SIDE_NEIGHBOUR[side][1];
+}
+
+/*
+ * Every side of a room which has no neighbouring room gets a wall, the rooms
+ * which are found are kept in roomneighbours.
+ * Neighbours are looked up through the room index, so this is linear in the
+ * number of rooms. Instances stamped since the last time are expanded first.
+ */
+static int
+BAS_Lines_Build(void)
+{
+	register int i, side;
+	plan->line_count = 0;
+	if (plan->room_count <= 0)
+	{
+		return 0;
+	}
+	if (BAS_Reserve(MEMORY_LINES, (void **)&plan->lines, &plan->line_capacity, plan->room_count*4, sizeof(struct BAS_Line))
+	 || BAS_Reserve(MEMORY_LINES, (void **)&plan->roomneighbours, &plan->roomneighbours_capacity, plan->room_count, sizeof(int[4])))
+	{
+		return 1;
+	}
+	for (i = 0; i < plan->room_count; i++)
+	{
+		const int room_cx = plan->rooms[i].cellposition[0];
+		const int room_cy = plan->rooms[i].cellposition[1];
+		/* Test north/south/west/east side */
+		for (side = 0; side < 4; side++)
+		{
+			const int slot = BAS_RoomIndex_FindSlot(room_cx+SIDE_NEIGHBOUR[side][0], room_cy+SIDE_NEIGHBOUR[side][1]);
+			if (slot < 0)
+			{
+				plan->roomneighbours[i][side] = BAS_NO_SUCH_ROOM;
+				BAS_Line_Create(room_cx+SIDE_WALL[side][0], room_cy+SIDE_WALL[side][1], side);
+			}
+			else
+			{
+				plan->roomneighbours[i][side] = plan->roomindex[slot].room;
+			}
+		}
+	}
+	return 0;
+}
+static void
+BAS_RecalculateLines(void)
+{
+	BAS_Span_Begin("BAS_RecalculateLines");
+	BAS_Instance_ExpandPending();
+	plan->lines_outdated = 0;
+	plan->floor_outdated = 1;
+	if (plan->room_count <= 0)
+	{
+		WRITE_I("room_count < 0, not calculating lines.");
+	}
+	BAS_Lines_Build();
+	BAS_Span_End("BAS_RecalculateLines");
+}
+
+/*
+ * ----------------
+ * Wall worker.
+ * Once the main loop has a plan of LINES_ASYNC_ROOMS rooms or more, its walls
+ * are recalculated on a worker thread: the rooms and the room index are copied
+ * into a plan of the worker's own, which builds its lines and roomneighbours
+ * while the main thread keeps drawing the walls it has. A finished job is only
+ * taken if no room changed since the copy (lines_version), its buffers are
+ * then swapped with the plan's, so the old ones are reused by the next job.
+ * Anything which needs the walls right away (exports, saves, the navigation
+ * graph) still calls BAS_RecalculateLines, a job finishing after that is
+ * dropped.
+ * ----------------
+ */
+#define LINES_ASYNC_ROOMS (1 << 16)
+struct BAS_LinesJob
+{
+	SDL_Thread *thread;
+	SDL_atomic_t done;
+	Uint32 version;         /* Of the rooms the job was given. */
+	int failed;
+	struct BAS_Plan scratch;
+};
+static struct BAS_LinesJob linesjob;
+
+static int
+lines_worker(void *data)
+{
+	struct BAS_LinesJob *job = data;
+	plan = &job->scratch;
+	BAS_Span_Thread("BAS_Lines");
+	BAS_Span_Begin("lines_worker");
+	job->failed = BAS_Lines_Build();
+	BAS_Span_End("lines_worker");
+	BAS_Span_ThreadEnd();
+	SDL_AtomicSet(&job->done, 1);
+	return 0;
+}
+
+/* Copy the rooms into the job and start building their walls. Returns 0 on success, 1 on error. */
+static int
+BAS_Lines_Start(void)
+{
+	struct BAS_LinesJob *job = &linesjob;
+	struct BAS_Plan *scratch = &job->scratch;
+	BAS_Instance_ExpandPending();
+	if (BAS_Reserve(MEMORY_WORK, (void **)&scratch->rooms, &scratch->room_capacity, plan->room_count, sizeof(struct BAS_Room)))
+	{
+		return 1;
+	}
+	if (scratch->roomindex_capacity != plan->roomindex_capacity)
+	{
+		if (BAS_Resize(MEMORY_WORK, (void **)&scratch->roomindex, plan->roomindex_capacity, sizeof(struct BAS_RoomSlot)))
+		{
+			return 1;
+		}
+		scratch->roomindex_capacity = plan->roomindex_capacity;
+	}
+	memcpy(scratch->rooms, plan->rooms, plan->room_count*sizeof(struct BAS_Room));
+	memcpy(scratch->roomindex, plan->roomindex, plan->roomindex_capacity*sizeof(struct BAS_RoomSlot));
+	scratch->room_count = plan->room_count;
+	job->version = plan->lines_version;
+	job->failed  = 0;
+	SDL_AtomicSet(&job->done, 0);
+	if (!(job->thread = SDL_CreateThread(lines_worker, "BAS_Lines", job)))
+	{
+		WRITE_E("Failed to start the wall thread!");
+		return 1;
+	}
+	return 0;
+}
+
+/* Swap the walls of a finished job with the plan's. */
+static void
+BAS_Lines_Take(struct BAS_LinesJob *job)
+{
+	struct BAS_Plan *scratch = &job->scratch;
+	struct BAS_Line *lines   = plan->lines;
+	int (*roomneighbours)[4] = plan->roomneighbours;
+	const int line_count              = plan->line_count;
+	const int line_capacity           = plan->line_capacity;
+	const int roomneighbours_capacity = plan->roomneighbours_capacity;
+	plan->lines                      = scratch->lines;
+	plan->line_count                 = scratch->line_count;
+	plan->line_capacity              = scratch->line_capacity;
+	plan->roomneighbours             = scratch->roomneighbours;
+	plan->roomneighbours_capacity    = scratch->roomneighbours_capacity;
+	scratch->lines                   = lines;
+	scratch->line_count              = line_count;
+	scratch->line_capacity           = line_capacity;
+	scratch->roomneighbours          = roomneighbours;
+	scratch->roomneighbours_capacity = roomneighbours_capacity;
+	plan->lines_outdated = 0;
+	plan->floor_outdated = 1;
+}
+
+/*
+ * Bring the walls of the editor's plan up to date, called once per frame.
+ * Small plans are recalculated right away, large ones on the worker: until
+ * its job is taken the old walls stay, and lines_outdated stays set.
+ */
+static void
+BAS_Lines_Update(void)
+{
+	struct BAS_LinesJob *job = &linesjob;
+	if (job->thread && SDL_AtomicGet(&job->done))
+	{
+		SDL_WaitThread(job->thread, NULL);
+		job->thread = NULL;
+		/* Rooms changed since the copy or the walls were recalculated meanwhile, drop it. */
+		if (!job->failed && plan->lines_outdated && job->version == plan->lines_version)
+		{
+			BAS_Lines_Take(job);
+		}
+	}
+	if (!plan->lines_outdated)
+	{
+		return;
+	}
+	if (plan->room_count < LINES_ASYNC_ROOMS)
+	{
+		BAS_RecalculateLines();
+	}
+	else if (!job->thread && BAS_Lines_Start())
+	{
+		/* No worker, no way around it. */
+		BAS_RecalculateLines();
+	}
+}
+
+static void
+BAS_Lines_Stop(void)
+{
+	if (linesjob.thread)
+	{
+		SDL_WaitThread(linesjob.thread, NULL);
+	}
+	/* The job only ever holds these. */
+	BAS_Free(linesjob.scratch.roomneighbours);
+	BAS_Free(linesjob.scratch.roomindex);
+	BAS_Free(linesjob.scratch.lines);
+	BAS_Free(linesjob.scratch.rooms);
+	memset(&linesjob, 0, sizeof(linesjob));
+}
+
+/*
+ * ----------------
+ * Floor rectangles.
+ * The rooms, merged greedily into rectangles: scanning row by row, every room
+ * which is not covered yet starts a rectangle which is made as wide as the row
+ * allows and then as tall as the rows below allow. The scan goes over the
+ * rooms sorted by row and then column, so it costs as much as there are rooms
+ * however far apart they lie.
+ * Rebuilt on demand after the rooms have changed.
+ * ----------------
+ */
+struct BAS_FloorRect
+{
+	int cellposition[2];
+	int size[2];
+};
+static int
+floor_compare(const void *a, const void *b)
+{
+	const struct BAS_Room *x = a;
+	const struct BAS_Room *y = b;
+	if (x->cellposition[1] != y->cellposition[1])
+	{
+		return x->cellposition[1] < y->cellposition[1] ? -1 : 1;
+	}
+	return (x->cellposition[0] > y->cellposition[0])-(x->cellposition[0] < y->cellposition[0]);
+}
+/* The first of the sorted rooms at or after cell (x, y). */
+static int
+floor_find(const struct BAS_Room *rooms, int count, int x, int y)
+{
+	int low = 0, high = count;
+	while (low < high)
+	{
+		const int middle = low+(high-low)/2;
+		if (rooms[middle].cellposition[1] < y || (rooms[middle].cellposition[1] == y && rooms[middle].cellposition[0] < x))
+		{
+			low = middle+1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+	return low;
+}
+/* Whether the sorted rooms from `first` on are the `w` cells right of (x, y), none of them covered. */
+static inline int
+floor_rowfree(const struct BAS_Room *rooms, const unsigned char *covered, int count, int first, int x, int y, int w)
+{
+	register int i;
+	for (i = 0; i < w; i++)
+	{
+		if (first+i >= count || covered[first+i] || rooms[first+i].cellposition[1] != y || rooms[first+i].cellposition[0] != x+i)
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+/* On failure there is no floor until the rooms change again, rather than a retry every frame. */
+static void
+BAS_RecalculateFloor(void)
+{
+	register int i;
+	struct BAS_Room *rooms;
+	unsigned char *covered;
+	const int count = plan->room_count;
+	plan->floorrect_count = 0;
+	plan->floor_outdated  = 0;
+	if (count <= 0)
+	{
+		return;
+	}
+	rooms   = malloc(count*sizeof(struct BAS_Room));
+	covered = calloc(count, 1);
+	if (!rooms || !covered || BAS_Reserve(MEMORY_LINES, (void **)&plan->floorrects, &plan->floorrect_capacity, count, sizeof(struct BAS_FloorRect)))
+	{
+		WRITE_E("Out of memory!");
+		free(rooms);
+		free(covered);
+		return;
+	}
+	memcpy(rooms, plan->rooms, count*sizeof(struct BAS_Room));
+	qsort(rooms, count, sizeof(struct BAS_Room), floor_compare);
+	for (i = 0; i < count; i++)
+	{
+		const int x = rooms[i].cellposition[0];
+		const int y = rooms[i].cellposition[1];
+		int w = 1, h = 1, below;
+		if (covered[i])
+		{
+			continue;
+		}
+		while (floor_rowfree(rooms, covered, count, i+w, x+w, y, 1))
+		{
+			w++;
+		}
+		memset(covered+i, 1, w);
+		for (;; h++)
+		{
+			below = floor_find(rooms, count, x, y+h);
+			if (!floor_rowfree(rooms, covered, count, below, x, y+h, w))
+			{
+				break;
+			}
+			memset(covered+below, 1, w);
+		}
+		plan->floorrects[plan->floorrect_count].cellposition[0] = x;
+		plan->floorrects[plan->floorrect_count].cellposition[1] = y;
+		plan->floorrects[plan->floorrect_count].size[0]         = w;
+		plan->floorrects[plan->floorrect_count].size[1]         = h;
+		plan->floorrect_count++;
+	}
+	free(rooms);
+	free(covered);
+}
+
+/*
+ * Use a new message for the status line.
+ */
+#define BAS_STATUSMESSAGE_LENGTH 128
+#define BAS_STATUSMESSAGE_TYPE_INFO 0
+#define BAS_STATUSMESSAGE_TYPE_WARNING 1
+#define BAS_STATUSMESSAGE_TYPE_ERROR 2
+static const SDL_Color TEXTCOLOUR_INFO    = {255, 255, 255, 255};
+static const SDL_Color TEXTCOLOUR_WARNING = {255, 255, 0, 255};
+static const SDL_Color TEXTCOLOUR_ERROR   = {255, 128, 0, 255};
+static SDL_Surface *statuslinesurface     = NULL;
+static SDL_Texture *statuslinetexture[2]  = {NULL, NULL};
+static void
+BAS_PushStatus(int type, const char status0[BAS_STATUSMESSAGE_LENGTH], const char status1[BAS_STATUSMESSAGE_LENGTH])
+{
+	SDL_Color textcolour = TEXTCOLOUR_INFO;
+	switch(type)
+	{
+		case BAS_STATUSMESSAGE_TYPE_WARNING: textcolour = TEXTCOLOUR_WARNING; break;
+		case BAS_STATUSMESSAGE_TYPE_ERROR:   textcolour = TEXTCOLOUR_ERROR;   break;
+	}
+	strncpy(statusline[0], status0, (BAS_STATUSMESSAGE_LENGTH-1)*sizeof(char));
+	strncpy(statusline[1], status1, (BAS_STATUSMESSAGE_LENGTH-1)*sizeof(char));
+	SDL_FreeSurface(statuslinesurface);
+	BAS_DestroyTextTexture(statuslinetexture[0]);
+	BAS_DestroyTextTexture(statuslinetexture[1]);
+	statuslinesurface    = TTF_RenderText_Shaded(BAS_Font(FONT_DEFAULT), statusline[0], textcolour, TEXT_BACKGROUND);
+	statuslinetexture[0] = SDL_CreateTextureFromSurface(renderer, statuslinesurface);
+	SDL_FreeSurface(statuslinesurface);
+	statuslinesurface    = TTF_RenderText_Shaded(BAS_Font(FONT_DEFAULT), statusline[1], textcolour, TEXT_BACKGROUND);
+	statuslinetexture[1] = SDL_CreateTextureFromSurface(renderer, statuslinesurface);
+	BAS_Memory_CountTexture(MEMORY_TEXT, statuslinetexture[0], 1);
+	BAS_Memory_CountTexture(MEMORY_TEXT, statuslinetexture[1], 1);
+}
+static inline void
+BAS_PushStatusAndWriteInfo(const char *message)
+{
+	WRITE_I(message);
+	BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_INFO, "[info]", message);
+}
+static inline void
+BAS_PushStatusAndWriteWarning(const char *message)
+{
+	WRITE_W(message);
+	BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_WARNING, "[warning]", message);
+}
+static inline void
+BAS_PushStatusAndWriteError(const char *message)
+{
+	WRITE_E(message);
+	BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_ERROR, "[error]", message);
+}
+
+/* Too dense a grid is not drawn at all. */
+static void
+BAS_DrawGrid(void)
+{
+	register int i;
+	const int step = CELL_SCALE*view_zoom;
+	int first[2];
+	if (step < 4)
+	{
+		return;
+	}
+	BAS_View_ToScreen(BAS_FloorDiv(view_offset[0], CELL_SCALE)*CELL_SCALE, BAS_FloorDiv(view_offset[1], CELL_SCALE)*CELL_SCALE, &first[0], &first[1]);
+	BAS_UseColour(32, 32, 32);
+	for (i = first[0]; i < WINDOW_WIDTH; i += step)
+	{
+		SDL_RenderDrawLine(renderer, i, 0, i, WINDOW_HEIGHT);
+	}
+	for (i = first[1]; i < WINDOW_HEIGHT; i += step)
+	{
+		SDL_RenderDrawLine(renderer, 0, i, WINDOW_WIDTH, i);
+	}
+}
+
+static void
+BAS_DrawCrosshair(void)
+{
+	int mx, my;
+	BAS_UseColour(CROSSHAIR_COLOUR[0], CROSSHAIR_COLOUR[1], CROSSHAIR_COLOUR[2]);
+	BAS_GetMouseState(&mx, &my);
+	SDL_RenderDrawLine(renderer, mx, 0, mx, WINDOW_HEIGHT);
+	SDL_RenderDrawLine(renderer, 0, my, WINDOW_WIDTH, my);
+	BAS_UseColour(255, 255, 0);
+}
+
+static void
+BAS_DrawCrosshair_Small(int mx, int my)
+{
+	SDL_Rect rectangle;
+	const int length = 96;
+	BAS_UseColour(CROSSHAIR_COLOUR[0], CROSSHAIR_COLOUR[1], CROSSHAIR_COLOUR[2]);
+	rectangle.x = mx-THING_SCALE/2;
+	rectangle.y = my-THING_SCALE/2;
+	rectangle.w = rectangle.h = THING_SCALE;
+	SDL_RenderDrawLine(renderer, mx, my-length, mx, my-THING_SCALE/2);
+	SDL_RenderDrawLine(renderer, mx, my+THING_SCALE/2, mx, my+length);
+	SDL_RenderDrawLine(renderer, mx-length, my, mx-THING_SCALE/2, my);
+	SDL_RenderDrawLine(renderer, mx+THING_SCALE/2, my, mx+length, my);
+	SDL_RenderDrawRect(renderer, &rectangle);
+}
+
+/*
+ * ----------------
+ * Level of detail.
+ * Walls and things far apart on the screen are a waste of lines and quads, so
+ * at LOD_ZOOMLEVEL_* and below they are drawn per block instead (see
+ * BAS_Lod_Block): a grey quad as dark as the block has walls, and a green one
+ * inside it as bright as it has things. Wall normals are simply left out. The
+ * work then depends on the size of the window, not on the size of the plan.
+ * ----------------
+ */
+#define LOD_SHADES 4
+static const int LOD_ZOOMLEVEL_NORMALS = -2;
+static const int LOD_ZOOMLEVEL_WALLS   = -4;
+static const int LOD_ZOOMLEVEL_THINGS  = -3;
+static const int LOD_WALL_ALPHA[LOD_SHADES]  = {70, 120, 170, 220};
+static const int LOD_THING_ALPHA[LOD_SHADES] = {90, 140, 190, 255};
+static SDL_Rect *lod_rects[LOD_SHADES];
+static int lod_rectcapacity[LOD_SHADES];
+
+static struct BAS_LodBlock *
+BAS_Lod_Find(int bx, int by)
+{
+	const unsigned int mask = lod_block_capacity-1;
+	unsigned int slot;
+	if (!lod_block_capacity)
+	{
+		return NULL;
+	}
+	slot = BAS_CellHash(bx, by) & mask;
+	while (lod_blocks[slot].used)
+	{
+		if (lod_blocks[slot].blockposition[0] == bx && lod_blocks[slot].blockposition[1] == by)
+		{
+			return &lod_blocks[slot];
+		}
+		slot = (slot+1) & mask;
+	}
+	return NULL;
+}
+
+/* Forget every block and add back the ones with rooms or things. */
+static void
+BAS_Lod_Rebuild(void)
+{
+	register int i;
+	if (lod_blocks)
+	{
+		memset(lod_blocks, 0, lod_block_capacity*sizeof(struct BAS_LodBlock));
+	}
+	lod_block_count = 0;
+	lod_rebuild     = 0;
+	for (i = 0; i < plan->room_count && !lod_rebuild; i++)
+	{
+		BAS_Lod_MarkRoom(plan->rooms[i].cellposition[0], plan->rooms[i].cellposition[1]);
+	}
+	for (i = 0; i < plan->thing_count && !lod_rebuild; i++)
+	{
+		BAS_Lod_CountThing(plan->things.thingposition[0][i], plan->things.thingposition[1][i], 1);
+	}
+}
+
+/* Count the walls of a block the same way BAS_RecalculateLines places them. */
+static void
+BAS_Lod_CountWalls(struct BAS_LodBlock *block)
+{
+	register int x, y, side;
+	const int left = block->blockposition[0]*LOD_BLOCK;
+	const int top  = block->blockposition[1]*LOD_BLOCK;
+	block->walls = 0;
+	block->dirty = 0;
+	for (y = top; y < top+LOD_BLOCK; y++)
+	{
+		for (x = left; x < left+LOD_BLOCK; x++)
+		{
+			if (BAS_FindRoom(x, y) == BAS_NO_SUCH_ROOM)
+			{
+				continue;
+			}
+			for (side = 0; side < 4; side++)
+			{
+				block->walls += BAS_FindRoom(x+SIDE_NEIGHBOUR[side][0], y+SIDE_NEIGHBOUR[side][1]) == BAS_NO_SUCH_ROOM;
+			}
+		}
+	}
+}
+
+/* Draw the walls (things = 0) or the things (things = 1) of the blocks in the window. */
+static void
+BAS_DrawLod(int things)
+{
+	register int bx, by, shade;
+	int first[2], last[2], count[LOD_SHADES] = {0};
+	if (lod_rebuild)
+	{
+		BAS_Lod_Rebuild();
+	}
+	BAS_View_ToPlan(0, 0, &first[0], &first[1]);
+	BAS_View_ToPlan(WINDOW_WIDTH, WINDOW_HEIGHT, &last[0], &last[1]);
+	first[0] = BAS_FloorDiv(first[0], CELL_SCALE*LOD_BLOCK);
+	first[1] = BAS_FloorDiv(first[1], CELL_SCALE*LOD_BLOCK);
+	last[0]  = BAS_FloorDiv(last[0],  CELL_SCALE*LOD_BLOCK);
+	last[1]  = BAS_FloorDiv(last[1],  CELL_SCALE*LOD_BLOCK);
+	for (shade = 0; shade < LOD_SHADES; shade++)
+	{
+		if (BAS_Reserve(MEMORY_RENDER, (void **)&lod_rects[shade], &lod_rectcapacity[shade], (last[0]-first[0]+1)*(last[1]-first[1]+1), sizeof(SDL_Rect)))
+		{
+			WRITE_E("Out of memory!");
+			return;
+		}
+	}
+	for (by = first[1]; by <= last[1]; by++)
+	{
+		for (bx = first[0]; bx <= last[0]; bx++)
+		{
+			SDL_Rect *rectangle;
+			int x1, y1;
+			struct BAS_LodBlock *block = BAS_Lod_Find(bx, by);
+			if (!block)
+			{
+				continue;
+			}
+			if (things)
+			{
+				if (block->things <= 0)
+				{
+					continue;
+				}
+				shade = block->things >= 16 ? 3 : block->things >= 4 ? 2 : block->things >= 2 ? 1 : 0;
+			}
+			else
+			{
+				if (block->dirty)
+				{
+					BAS_Lod_CountWalls(block);
+				}
+				if (block->walls <= 0)
+				{
+					continue;
+				}
+				shade = block->walls*LOD_SHADES/(LOD_BLOCK*4+1);
+				shade = shade < LOD_SHADES ? shade : LOD_SHADES-1;
+			}
+			rectangle = &lod_rects[shade][count[shade]++];
+			BAS_View_ToScreen(bx*LOD_BLOCK*CELL_SCALE, by*LOD_BLOCK*CELL_SCALE, &rectangle->x, &rectangle->y);
+			BAS_View_ToScreen((bx+1)*LOD_BLOCK*CELL_SCALE, (by+1)*LOD_BLOCK*CELL_SCALE, &x1, &y1);
+			rectangle->w = x1-rectangle->x;
+			rectangle->h = y1-rectangle->y;
+			if (things)
+			{
+				rectangle->x += rectangle->w/4;
+				rectangle->y += rectangle->h/4;
+				rectangle->w -= rectangle->w/2;
+				rectangle->h -= rectangle->h/2;
+			}
+		}
+	}
+	for (shade = 0; shade < LOD_SHADES; shade++)
+	{
+		if (things) { BAS_UseColourAlpha(0, 255, 0, LOD_THING_ALPHA[shade]); }
+		else        { BAS_UseColourAlpha(128, 128, 128, LOD_WALL_ALPHA[shade]); }
+		SDL_RenderFillRects(renderer, lod_rects[shade], count[shade]);
+	}
+}
+
+static void
+BAS_DrawRooms(void)
+{
+	register int i;
+	if (plan->floor_outdated)
+	{
+		BAS_RecalculateFloor();
+	}
+	BAS_UseColourAlpha(0, 255, 0, 60);
+	for (i = 0; i < plan->floorrect_count; i++)
+	{
+		SDL_Rect rectangle;
+		int x1, y1;
+		BAS_View_ToScreen(plan->floorrects[i].cellposition[0]*CELL_SCALE, plan->floorrects[i].cellposition[1]*CELL_SCALE, &rectangle.x, &rectangle.y);
+		BAS_View_ToScreen(
+			(plan->floorrects[i].cellposition[0]+plan->floorrects[i].size[0])*CELL_SCALE,
+			(plan->floorrects[i].cellposition[1]+plan->floorrects[i].size[1])*CELL_SCALE,
+			&x1, &y1
+		);
+		rectangle.w = x1-rectangle.x;
+		rectangle.h = y1-rectangle.y;
+		if (rectangle.x >= WINDOW_WIDTH || rectangle.y >= WINDOW_HEIGHT || rectangle.x+rectangle.w < 0 || rectangle.y+rectangle.h < 0)
+		{
+			continue;
+		}
+		SDL_RenderFillRect(renderer, &rectangle);
+	}
+}
+
+static void
+BAS_DrawLines(void)
+{
+	register int i;
+	const int normals = view_zoomlevel > LOD_ZOOMLEVEL_NORMALS;
+	if (view_zoomlevel <= LOD_ZOOMLEVEL_WALLS)
+	{
+		BAS_DrawLod(0);
+		return;
+	}
+	for (i = 0; i < plan->line_count; i++)
+	{
+		int x0, y0, x1, y1;
+		int nodes[4], normal_middle[2], normal[2];
+		BAS_Line_Nodes(&plan->lines[i], nodes);
+		BAS_View_ToScreen(nodes[0]*CELL_SCALE, nodes[1]*CELL_SCALE, &x0, &y0);
+		BAS_View_ToScreen(nodes[2]*CELL_SCALE, nodes[3]*CELL_SCALE, &x1, &y1);
+		if ((x0 < 0 && x1 < 0) || (y0 < 0 && y1 < 0) || (x0 >= WINDOW_WIDTH && x1 >= WINDOW_WIDTH) || (y0 >= WINDOW_HEIGHT && y1 >= WINDOW_HEIGHT))
+		{
+			continue;
+		}
+		BAS_UseColour(128, 128, 128);
+		SDL_RenderDrawLine(renderer, x0, y0, x1, y1);
+		if (!normals)
+		{
+			continue;
+		}
+		BAS_Line_Normal(&plan->lines[i], normal_middle, normal);
+		BAS_View_ToScreen(normal_middle[0], normal_middle[1], &normal_middle[0], &normal_middle[1]);
+		BAS_UseColour(NORMAL_COLOUR[0], NORMAL_COLOUR[1], NORMAL_COLOUR[2]);
+		SDL_RenderDrawLine(renderer,
+			normal_middle[0], normal_middle[1],
+			normal_middle[0]+normal[0], normal_middle[1]+normal[1]
+		);
+	}
+}
+
+/*
+ * Only the things inside the window are drawn, they are picked out with the
+ * thing filter kernel.
+ */
+static int *thing_visible = NULL;
+static int thing_visiblecapacity = 0;
+static void
+BAS_DrawThings(void)
+{
+	register int i;
+	int count;
+	SDL_Rect rectangle;
+	struct BAS_ThingFilter visible;
+	const int size = BAS_View_Scale(THING_SCALE);
+	if (view_zoomlevel <= LOD_ZOOMLEVEL_THINGS)
+	{
+		BAS_DrawLod(1);
+		return;
+	}
+	if (BAS_Reserve(MEMORY_RENDER, (void **)&thing_visible, &thing_visiblecapacity, plan->thing_count, sizeof(int)))
+	{
+		return;
+	}
+	BAS_ThingFilter_Reset(&visible);
+	BAS_View_ToPlan(0, 0, &visible.rectangle[0][0], &visible.rectangle[0][1]);
+	BAS_View_ToPlan(WINDOW_WIDTH, WINDOW_HEIGHT, &visible.rectangle[1][0], &visible.rectangle[1][1]);
+	visible.rectangle[0][0] -= THING_SCALE;
+	visible.rectangle[0][1] -= THING_SCALE;
+	count = BAS_ThingFilter_Run(&visible, thing_visible);
+	for (i = 0; i < count; i++)
+	{
+		const int thing = thing_visible[i];
+		/* Outer shade */
+		BAS_View_ToScreen(plan->things.thingposition[0][thing], plan->things.thingposition[1][thing], &rectangle.x, &rectangle.y);
+		rectangle.w = size;
+		rectangle.h = size;
+		BAS_UseColour(0, 0, 144);
+		SDL_RenderFillRect(renderer, &rectangle);
+		/* Inner shade */
+		if (size > 2)
+		{
+			rectangle.x += 1;
+			rectangle.y += 1;
+			rectangle.w -= 2;
+			rectangle.h -= 2;
+			BAS_UseColour(0, 255, 0);
+			SDL_RenderFillRect(renderer, &rectangle);
+		}
+	}
+}
+
+static void
+BAS_DrawStatusline(void)
+{
+	SDL_Rect rectangle;
+	rectangle.x = 0;
+	rectangle.y = WINDOW_HEIGHT-32;
+	SDL_QueryTexture(statuslinetexture[0], NULL, NULL, &rectangle.w, &rectangle.h);
+	SDL_RenderCopy(renderer, statuslinetexture[0], NULL, &rectangle);
+	rectangle.y = WINDOW_HEIGHT-16;
+	SDL_QueryTexture(statuslinetexture[1], NULL, NULL, &rectangle.w, &rectangle.h);
+	SDL_RenderCopy(renderer, statuslinetexture[1], NULL, &rectangle);
+}
+
+/*
+ * ----------------
+ * Minimap.
+ * A panel in the top right corner showing the whole plan, at one pixel per
+ * cell while it fits MINIMAP_CELLS across and at a block of cells per pixel
+ * beyond (F8 shows and hides it). The pixels live in a streaming texture which
+ * is only written where BAS_Minimap_Mark saw a change, so drawing the panel is
+ * a single texture copy however many cells it covers. Clicking the panel moves
+ * the view over the clicked cell.
+ * ----------------
+ */
+#define MINIMAP_PANEL    160 /* Size of the panel on screen, in pixels. */
+#define MINIMAP_MARGIN   8
+#define MINIMAP_MIN_SPAN 64  /* Fewest pixels of the texture across the panel. */
+static int minimap_visible = 0;
+static SDL_Texture *minimap_texture;
+static SDL_Rect minimap_source;  /* Part of the texture shown in the panel. */
+static SDL_Rect minimap_rect;    /* The panel, in screen-space. */
+
+/* Move the window over the plan (or over the view if there are no rooms), scaled to fit, and redraw every pixel. */
+static void
+BAS_Minimap_Rebuild(void)
+{
+	register int i;
+	int low[2], high[2];
+	for (i = 0; i < MINIMAP_CELLS*MINIMAP_CELLS; i++)
+	{
+		minimap_pixels[i] = MINIMAP_VOID_PIXEL;
+		minimap_counts[i] = 0;
+	}
+	if (plan->room_count > 0)
+	{
+		low[0] = high[0] = plan->rooms[0].cellposition[0];
+		low[1] = high[1] = plan->rooms[0].cellposition[1];
+		for (i = 1; i < plan->room_count; i++)
+		{
+			if (plan->rooms[i].cellposition[0] < low[0])  { low[0]  = plan->rooms[i].cellposition[0]; }
+			if (plan->rooms[i].cellposition[1] < low[1])  { low[1]  = plan->rooms[i].cellposition[1]; }
+			if (plan->rooms[i].cellposition[0] > high[0]) { high[0] = plan->rooms[i].cellposition[0]; }
+			if (plan->rooms[i].cellposition[1] > high[1]) { high[1] = plan->rooms[i].cellposition[1]; }
+		}
+	}
+	else
+	{
+		BAS_View_ToPlan(WINDOW_WIDTH/2, WINDOW_HEIGHT/2, &low[0], &low[1]);
+		high[0] = low[0] = BAS_FloorDiv(low[0], CELL_SCALE);
+		high[1] = low[1] = BAS_FloorDiv(low[1], CELL_SCALE);
+	}
+	/* Fewest cells per pixel which fit the plan into the window. */
+	for (minimap_scale = 1; minimap_scale < (1 << 30); minimap_scale *= 2)
+	{
+		if (BAS_FloorDiv(high[0], minimap_scale)-BAS_FloorDiv(low[0], minimap_scale) < MINIMAP_CELLS
+		 && BAS_FloorDiv(high[1], minimap_scale)-BAS_FloorDiv(low[1], minimap_scale) < MINIMAP_CELLS)
+		{
+			break;
+		}
+	}
+	for (i = 0; i < 2; i++)
+	{
+		low[i]  = BAS_FloorDiv(low[i], minimap_scale);
+		high[i] = BAS_FloorDiv(high[i], minimap_scale);
+	}
+	/* Centre what is there, leaving room to grow on every side. */
+	minimap_origin[0] = low[0]-(MINIMAP_CELLS-(high[0]-low[0]+1))/2;
+	minimap_origin[1] = low[1]-(MINIMAP_CELLS-(high[1]-low[1]+1))/2;
+	minimap_bounds[0] = minimap_bounds[1] = MINIMAP_CELLS;
+	minimap_bounds[2] = minimap_bounds[3] = -1;
+	minimap_rebuild   = 0;
+	for (i = 0; i < plan->room_count; i++)
+	{
+		BAS_Minimap_Mark(plan->rooms[i].cellposition[0], plan->rooms[i].cellposition[1], 1);
+	}
+	minimap_dirty[0] = minimap_dirty[1] = 0;
+	minimap_dirty[2] = minimap_dirty[3] = MINIMAP_CELLS-1;
+}
+
+/* Send the dirty rectangle over to the texture. */
+static int
+BAS_Minimap_Upload(void)
+{
+	register int y;
+	SDL_Rect rectangle;
+	Uint8 *pixels;
+	int pitch;
+	if (minimap_dirty[0] > minimap_dirty[2])
+	{
+		return 0;
+	}
+	rectangle.x = minimap_dirty[0];
+	rectangle.y = minimap_dirty[1];
+	rectangle.w = minimap_dirty[2]-minimap_dirty[0]+1;
+	rectangle.h = minimap_dirty[3]-minimap_dirty[1]+1;
+	if (SDL_LockTexture(minimap_texture, &rectangle, (void **)&pixels, &pitch))
+	{
+		WRITE_E(SDL_GetError());
+		return 1;
+	}
+	for (y = 0; y < rectangle.h; y++)
+	{
+		memcpy(pixels+(size_t)y*pitch, minimap_pixels+(size_t)(rectangle.y+y)*MINIMAP_CELLS+rectangle.x, rectangle.w*sizeof(Uint32));
+	}
+	SDL_UnlockTexture(minimap_texture);
+	minimap_dirty[0] = minimap_dirty[1] = MINIMAP_CELLS;
+	minimap_dirty[2] = minimap_dirty[3] = -1;
+	return 0;
+}
+
+static void
+BAS_DrawMinimap(void)
+{
+	SDL_Rect view;
+	int span, centre[2], x1, y1;
+	if (!minimap_visible)
+	{
+		return;
+	}
+	if (!minimap_texture)
+	{
+		minimap_pixels  = BAS_Alloc(MEMORY_RENDER, (size_t)MINIMAP_CELLS*MINIMAP_CELLS*sizeof(Uint32));
+		minimap_counts  = BAS_Alloc(MEMORY_RENDER, (size_t)MINIMAP_CELLS*MINIMAP_CELLS*sizeof(Uint32));
+		minimap_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, MINIMAP_CELLS, MINIMAP_CELLS);
+		if (!minimap_pixels || !minimap_counts || !minimap_texture)
+		{
+			WRITE_E("Could not create the minimap.");
+			BAS_Free(minimap_pixels);
+			BAS_Free(minimap_counts);
+			if (minimap_texture)
+			{
+				SDL_DestroyTexture(minimap_texture);
+			}
+			minimap_pixels  = NULL;
+			minimap_counts  = NULL;
+			minimap_texture = NULL;
+			minimap_visible = 0;
+			return;
+		}
+		BAS_Memory_CountTexture(MEMORY_RENDER, minimap_texture, 1);
+		SDL_SetTextureBlendMode(minimap_texture, SDL_BLENDMODE_BLEND);
+		minimap_rebuild = 1;
+	}
+	minimap_rect.x = WINDOW_WIDTH-MINIMAP_PANEL-MINIMAP_MARGIN;
+	minimap_rect.y = MINIMAP_MARGIN;
+	minimap_rect.w = minimap_rect.h = MINIMAP_PANEL;
+	/* Without rooms the window follows the view. */
+	BAS_View_ToPlan(WINDOW_WIDTH/2, WINDOW_HEIGHT/2, &centre[0], &centre[1]);
+	centre[0] = BAS_FloorDiv(BAS_FloorDiv(centre[0], CELL_SCALE), minimap_scale)-minimap_origin[0];
+	centre[1] = BAS_FloorDiv(BAS_FloorDiv(centre[1], CELL_SCALE), minimap_scale)-minimap_origin[1];
+	if (!plan->room_count && (centre[0] < 0 || centre[1] < 0 || centre[0] >= MINIMAP_CELLS || centre[1] >= MINIMAP_CELLS))
+	{
+		minimap_rebuild = 1;
+	}
+	if (minimap_rebuild)
+	{
+		BAS_Minimap_Rebuild();
+	}
+	if (BAS_Minimap_Upload())
+	{
+		return;
+	}
+	/* Show a square around the rooms, or around the view when there are none in the window. */
+	if (minimap_bounds[0] <= minimap_bounds[2])
+	{
+		span = minimap_bounds[2]-minimap_bounds[0] > minimap_bounds[3]-minimap_bounds[1] ? minimap_bounds[2]-minimap_bounds[0] : minimap_bounds[3]-minimap_bounds[1];
+		centre[0] = (minimap_bounds[0]+minimap_bounds[2])/2;
+		centre[1] = (minimap_bounds[1]+minimap_bounds[3])/2;
+		span += span/8+2;
+	}
+	else
+	{
+		BAS_View_ToPlan(WINDOW_WIDTH/2, WINDOW_HEIGHT/2, &centre[0], &centre[1]);
+		centre[0] = BAS_FloorDiv(BAS_FloorDiv(centre[0], CELL_SCALE), minimap_scale)-minimap_origin[0];
+		centre[1] = BAS_FloorDiv(BAS_FloorDiv(centre[1], CELL_SCALE), minimap_scale)-minimap_origin[1];
+		span = 0;
+	}
+	if (span < MINIMAP_MIN_SPAN) { span = MINIMAP_MIN_SPAN; }
+	if (span > MINIMAP_CELLS)    { span = MINIMAP_CELLS; }
+	minimap_source.x = centre[0]-span/2;
+	minimap_source.y = centre[1]-span/2;
+	minimap_source.w = minimap_source.h = span;
+	if (minimap_source.x < 0) { minimap_source.x = 0; }
+	if (minimap_source.y < 0) { minimap_source.y = 0; }
+	if (minimap_source.x > MINIMAP_CELLS-span) { minimap_source.x = MINIMAP_CELLS-span; }
+	if (minimap_source.y > MINIMAP_CELLS-span) { minimap_source.y = MINIMAP_CELLS-span; }
+	SDL_RenderCopy(renderer, minimap_texture, &minimap_source, &minimap_rect);
+	/* The part of the plan in the window. */
+	BAS_View_ToPlan(0, 0, &view.x, &view.y);
+	BAS_View_ToPlan(WINDOW_WIDTH, WINDOW_HEIGHT, &x1, &y1);
+	view.x = minimap_rect.x+(int)floorf(((float)view.x/CELL_SCALE/minimap_scale-minimap_origin[0]-minimap_source.x)*MINIMAP_PANEL/span);
+	view.y = minimap_rect.y+(int)floorf(((float)view.y/CELL_SCALE/minimap_scale-minimap_origin[1]-minimap_source.y)*MINIMAP_PANEL/span);
+	x1     = minimap_rect.x+(int)ceilf (((float)x1/CELL_SCALE/minimap_scale-minimap_origin[0]-minimap_source.x)*MINIMAP_PANEL/span);
+	y1     = minimap_rect.y+(int)ceilf (((float)y1/CELL_SCALE/minimap_scale-minimap_origin[1]-minimap_source.y)*MINIMAP_PANEL/span);
+	view.w = x1-view.x;
+	view.h = y1-view.y;
+	BAS_UseColour(80, 80, 80);
+	SDL_RenderDrawRect(renderer, &minimap_rect);
+	if (SDL_IntersectRect(&view, &minimap_rect, &view))
+	{
+		BAS_UseColour(255, 255, 0);
+		SDL_RenderDrawRect(renderer, &view);
+	}
+}
+
+/* If the screen-space point is on the minimap, centre the view on the cell under it and return 1. */
+static int
+BAS_Minimap_Click(int sx, int sy)
+{
+	int cx, cy;
+	if (!minimap_visible || !minimap_texture || sx < minimap_rect.x || sy < minimap_rect.y || sx >= minimap_rect.x+minimap_rect.w || sy >= minimap_rect.y+minimap_rect.h)
+	{
+		return 0;
+	}
+	cx = (minimap_origin[0]+minimap_source.x+(sx-minimap_rect.x)*minimap_source.w/MINIMAP_PANEL)*minimap_scale+minimap_scale/2;
+	cy = (minimap_origin[1]+minimap_source.y+(sy-minimap_rect.y)*minimap_source.h/MINIMAP_PANEL)*minimap_scale+minimap_scale/2;
+	view_offset[0] = cx*CELL_SCALE+CELL_SCALE/2-(int)floorf(WINDOW_WIDTH/2/view_zoom);
+	view_offset[1] = cy*CELL_SCALE+CELL_SCALE/2-(int)floorf(WINDOW_HEIGHT/2/view_zoom);
+	return 1;
+}
+
+/*
+ * ----------------
+ * Memory overlay.
+ * F9 shows what every memory category holds (see Memory) and the biggest
+ * static arrays, in the top left corner. Its lines are made again at most
+ * every MEMORY_OVERLAY_INTERVAL ms, as they count as text themselves.
+ * ----------------
+ */
+#define MEMORY_OVERLAY_INTERVAL 250
+#define MEMORY_OVERLAY_LINES    (MEMORY_CATEGORIES+2)
+#define MEMORY_OVERLAY_LENGTH   128
+static int memory_visible = 0;
+static SDL_Texture *memory_lines[MEMORY_OVERLAY_LINES];
+static int memory_linesgeneration = 0;
+static Uint32 memory_linestime    = 0;
+
+/* The biggest static arrays, held from the start. */
+static size_t
+BAS_Memory_Static(void)
+{
+	return sizeof(log_ring)+sizeof(span_buffers)+sizeof(plan_editor)+sizeof(statusline);
+}
+
+/* Every category, the static arrays and the total, a line each. */
+static void
+BAS_Memory_Lines(char lines[MEMORY_OVERLAY_LINES][MEMORY_OVERLAY_LENGTH])
+{
+	register int i;
+	char held[16], peak[16];
+	struct BAS_MemoryCategory categories[MEMORY_CATEGORIES];
+	size_t total = BAS_Memory_Static(), totalpeak = BAS_Memory_Static();
+	BAS_Memory_Get(categories);
+	for (i = 0; i < MEMORY_CATEGORIES; i++)
+	{
+		BAS_Memory_Describe(lines[i], MEMORY_OVERLAY_LENGTH, i, &categories[i]);
+		total     += categories[i].current;
+		totalpeak += categories[i].peak;
+	}
+	BAS_Memory_Format(held, sizeof(held), BAS_Memory_Static());
+	snprintf(lines[MEMORY_CATEGORIES], MEMORY_OVERLAY_LENGTH, "%-6s %10s", "static", held);
+	BAS_Memory_Format(held, sizeof(held), total);
+	BAS_Memory_Format(peak, sizeof(peak), totalpeak);
+	snprintf(lines[MEMORY_CATEGORIES+1], MEMORY_OVERLAY_LENGTH, "%-6s %10s now, %10s at most (the peaks added up)", "total", held, peak);
+}
+
+/* Print the overlay's lines, for the command line. */
+static void
+BAS_Memory_Report(void)
+{
+	register int i;
+	char lines[MEMORY_OVERLAY_LINES][MEMORY_OVERLAY_LENGTH];
+	BAS_Memory_Lines(lines);
+	for (i = 0; i < MEMORY_OVERLAY_LINES; i++)
+	{
+		WRITE_I(lines[i]);
+	}
+}
+
+static void
+BAS_Memory_DestroyOverlay(void)
+{
+	register int i;
+	for (i = 0; i < MEMORY_OVERLAY_LINES; i++)
+	{
+		BAS_DestroyTextTexture(memory_lines[i]);
+		memory_lines[i] = NULL;
+	}
+}
+
+static void
+BAS_DrawMemory(void)
+{
+	register int i;
+	SDL_Rect rectangle = {MINIMAP_MARGIN, MINIMAP_MARGIN, 0, 0};
+	if (!memory_visible)
+	{
+		return;
+	}
+	if (!memory_lines[0] || (SDL_AtomicGet(&memory_generation) != memory_linesgeneration && SDL_GetTicks()-memory_linestime >= MEMORY_OVERLAY_INTERVAL))
+	{
+		char lines[MEMORY_OVERLAY_LINES][MEMORY_OVERLAY_LENGTH];
+		BAS_Memory_Lines(lines);
+		BAS_Memory_DestroyOverlay();
+		for (i = 0; i < MEMORY_OVERLAY_LINES; i++)
+		{
+			memory_lines[i] = BAS_CreateTextTexture(BAS_Font(FONT_DEFAULT), lines[i]);
+		}
+		/* Taken after making the lines, which would otherwise be made again right away. */
+		memory_linesgeneration = SDL_AtomicGet(&memory_generation);
+		memory_linestime       = SDL_GetTicks();
+	}
+	for (i = 0; i < MEMORY_OVERLAY_LINES; i++)
+	{
+		int w = 0, h = 0;
+		SDL_QueryTexture(memory_lines[i], NULL, NULL, &w, &h);
+		rectangle.w  = w > rectangle.w ? w : rectangle.w;
+		rectangle.h += h;
+	}
+	BAS_UseColourAlpha(0, 0, 0, 200);
+	SDL_RenderFillRect(renderer, &rectangle);
+	for (i = 0; i < MEMORY_OVERLAY_LINES; i++)
+	{
+		SDL_QueryTexture(memory_lines[i], NULL, NULL, &rectangle.w, &rectangle.h);
+		SDL_RenderCopy(renderer, memory_lines[i], NULL, &rectangle);
+		rectangle.y += rectangle.h;
+	}
+}
+
+/*
+ * ----------------
+ * Plan files.
+ * The editable plan (rooms and things) is saved in chunks of
+ * PLANCHUNK_SIZE x PLANCHUNK_SIZE cells, so that saving again after a small
+ * edit only writes the chunks which have changed. A plan file is:
+ *
+ * header: "BASPLAN" 0 $version $PLANCHUNK_SIZE $entry_count $index_capacity $index_offset
+ * chunks: each in a slot of its own
+ * index:  $entry_count entries of chunk.x chunk.y offset size capacity crc kind
+ *
+ * Numbers are little endian, 32 bits except for the 64 bit offsets (and the
+ * index entries are padded to PLANFILE_ENTRY_SIZE bytes). A chunk holds its
+ * rooms and then its things as varints: $room_count, every room as the zigzag
+ * difference of its position in the chunk to the previous room, $thing_count,
+ * every thing as the zigzag difference of its position in the chunk to the
+ * previous thing, its type, facing and both halves of its flags.
+ * Since version 2 the chunk goes on with $instance_count and every instance
+ * whose footprint lies inside the chunk, as its prefab, the zigzag difference
+ * of its position to the previous instance and its rotation. The rooms and
+ * things the instances account for are not written again.
+ * The prefabs are a slot of their own, whose index entry is of kind
+ * PLANFILE_KIND_PREFABS: $prefab_count and every prefab as its width and
+ * height, then its rooms and things like those of a chunk.
+ * Slots carry the CRC32C of their bytes, which tells whether they have to be
+ * written again and is checked when loading. Version 1 files are still read.
+ * Saving never overwrites a slot or index the header refers to: changed
+ * chunks and the new index are appended, and the header is written last, so a
+ * save cut short leaves the previous one readable.
+ * ----------------
+ */
+#define PLANCHUNK_SIZE        64 /* In cells. */
+#define PLANFILE_VERSION      2
+#define PLANFILE_KIND_CHUNK   0
+#define PLANFILE_KIND_PREFABS 1
+#define PLANFILE_HEADER_SIZE  32
+#define PLANFILE_ENTRY_SIZE   32
+#define DEFAULT_PLAN_FILE     "./plans/plan.bas"
+struct BAS_PlanChunkEntry
+{
+	int chunkposition[2];
+	Uint64 offset;
+	Uint32 size;
+	Uint32 capacity; /* Bytes reserved for the chunk at offset. */
+	Uint32 crc;
+	int resident;    /* Whether the chunk is in the room and thing arrays, see BAS_Paging. */
+	Uint32 lastuse;  /* Frame the chunk was last needed on, for paging. */
+};
+
+static Uint32 crc32c_table[256];
+static Uint32
+BAS_CRC32C(const Uint8 *data, size_t length)
+{
+	Uint32 crc = 0xFFFFFFFFu;
+	if (!crc32c_table[1])
+	{
+		register int i, j;
+		for (i = 0; i < 256; i++)
+		{
+			Uint32 c = i;
+			for (j = 0; j < 8; j++)
+			{
+				c = (c >> 1) ^ (0x82F63B78u & (0u-(c & 1)));
+			}
+			crc32c_table[i] = c;
+		}
+	}
+	while (length--)
+	{
+		crc = (crc >> 8) ^ crc32c_table[(crc ^ *data++) & 0xFF];
+	}
+	return crc ^ 0xFFFFFFFFu;
+}
+
+static inline Uint8 *
+BAS_PutVarint(Uint8 *p, Uint32 value)
+{
+	while (value >= 0x80)
+	{
+		*p++ = (Uint8)(value | 0x80);
+		value >>= 7;
+	}
+	*p++ = (Uint8)value;
+	return p;
+}
+static inline Uint8 *
+BAS_PutZigzag(Uint8 *p, Uint32 value)
+{
+	return BAS_PutVarint(p, (value << 1) ^ (0u-(value >> 31)));
+}
+/* Returns 0 on success, 1 if the varint runs past `end` or is too long. */
+static inline int
+BAS_GetVarint(const Uint8 **p, const Uint8 *end, Uint32 *value)
+{
+	int shift;
+	*value = 0;
+	for (shift = 0; shift < 35 && *p < end; shift += 7)
+	{
+		const Uint8 c = *(*p)++;
+		*value |= (Uint32)(c & 0x7F) << shift;
+		if (!(c & 0x80))
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+static inline int
+BAS_GetZigzag(const Uint8 **p, const Uint8 *end, Uint32 *value)
+{
+	if (BAS_GetVarint(p, end, value))
+	{
+		return 1;
+	}
+	*value = (*value >> 1) ^ (0u-(*value & 1));
+	return 0;
+}
+static inline void
+BAS_PutU32(Uint8 *p, Uint32 value)
+{
+	p[0] = (Uint8)value;
+	p[1] = (Uint8)(value >> 8);
+	p[2] = (Uint8)(value >> 16);
+	p[3] = (Uint8)(value >> 24);
+}
+static inline Uint32
+BAS_GetU32(const Uint8 *p)
+{
+	return (Uint32)p[0] | (Uint32)p[1] << 8 | (Uint32)p[2] << 16 | (Uint32)p[3] << 24;
+}
+static inline void
+BAS_PutU64(Uint8 *p, Uint64 value)
+{
+	BAS_PutU32(p, (Uint32)value);
+	BAS_PutU32(p+4, (Uint32)(value >> 32));
+}
+static inline Uint64
+BAS_GetU64(const Uint8 *p)
+{
+	return (Uint64)BAS_GetU32(p) | (Uint64)BAS_GetU32(p+4) << 32;
+}
+
+static inline int
+BAS_PlanChunk_OfCell(int c)
+{
+	return BAS_FloorDiv(c, PLANCHUNK_SIZE);
+}
+static inline int
+BAS_PlanChunk_OfThing(int t)
+{
+	return BAS_FloorDiv(t, PLANCHUNK_SIZE*CELL_SCALE);
+}
+/* Order of chunks in the file and in the index: by row, then by column. */
+static inline int
+planchunk_compare(int ax, int ay, int bx, int by)
+{
+	if (ay != by) { return ay < by ? -1 : 1; }
+	if (ax != bx) { return ax < bx ? -1 : 1; }
+	return 0;
+}
+static int
+planroom_compare(const void *a, const void *b)
+{
+	const struct BAS_Room *ra = &plan->rooms[*(const int *)a];
+	const struct BAS_Room *rb = &plan->rooms[*(const int *)b];
+	const int order = planchunk_compare(
+		BAS_PlanChunk_OfCell(ra->cellposition[0]), BAS_PlanChunk_OfCell(ra->cellposition[1]),
+		BAS_PlanChunk_OfCell(rb->cellposition[0]), BAS_PlanChunk_OfCell(rb->cellposition[1])
+	);
+	return order ? order : planchunk_compare(ra->cellposition[0], ra->cellposition[1], rb->cellposition[0], rb->cellposition[1]);
+}
+/* Things are ordered by every field, so that equal chunks always encode the same. */
+static int
+planthing_compare(const void *a, const void *b)
+{
+	const int ta = *(const int *)a;
+	const int tb = *(const int *)b;
+	const int *x = plan->things.thingposition[0];
+	const int *y = plan->things.thingposition[1];
+	int order = planchunk_compare(
+		BAS_PlanChunk_OfThing(x[ta]), BAS_PlanChunk_OfThing(y[ta]),
+		BAS_PlanChunk_OfThing(x[tb]), BAS_PlanChunk_OfThing(y[tb])
+	);
+	if (order || (order = planchunk_compare(x[ta], y[ta], x[tb], y[tb])))
+	{
+		return order;
+	}
+	if (plan->things.type[ta]   != plan->things.type[tb])   { return plan->things.type[ta]   < plan->things.type[tb]   ? -1 : 1; }
+	if (plan->things.facing[ta] != plan->things.facing[tb]) { return plan->things.facing[ta] < plan->things.facing[tb] ? -1 : 1; }
+	if (plan->things.flags[ta]  != plan->things.flags[tb])  { return plan->things.flags[ta]  < plan->things.flags[tb]  ? -1 : 1; }
+	return 0;
+}
+
+static int
+planentry_compare(const void *a, const void *b)
+{
+	const struct BAS_PlanChunkEntry *ea = a, *eb = b;
+	return planchunk_compare(ea->chunkposition[0], ea->chunkposition[1], eb->chunkposition[0], eb->chunkposition[1]);
+}
+/* Order of a room and a thing by chunk, ties go to the room. */
+static inline int
+planroomthing_compare(int room, int thing)
+{
+	return planchunk_compare(
+		BAS_PlanChunk_OfCell(plan->rooms[room].cellposition[0]), BAS_PlanChunk_OfCell(plan->rooms[room].cellposition[1]),
+		BAS_PlanChunk_OfThing(plan->things.thingposition[0][thing]), BAS_PlanChunk_OfThing(plan->things.thingposition[1][thing])
+	);
+}
+static inline int
+BAS_PlanChunk_OfInstance(const struct BAS_Instance *instance, int axis)
+{
+	return BAS_PlanChunk_OfCell(instance->cellposition[axis]);
+}
+static int
+planinstance_compare(const void *a, const void *b)
+{
+	const struct BAS_Instance *ia = &plan->instances[*(const int *)a];
+	const struct BAS_Instance *ib = &plan->instances[*(const int *)b];
+	int order = planchunk_compare(
+		BAS_PlanChunk_OfInstance(ia, 0), BAS_PlanChunk_OfInstance(ia, 1),
+		BAS_PlanChunk_OfInstance(ib, 0), BAS_PlanChunk_OfInstance(ib, 1)
+	);
+	if (order || (order = planchunk_compare(ia->cellposition[0], ia->cellposition[1], ib->cellposition[0], ib->cellposition[1])))
+	{
+		return order;
+	}
+	if (ia->prefab != ib->prefab) { return ia->prefab < ib->prefab ? -1 : 1; }
+	return ia->rotation < ib->rotation ? -1 : ia->rotation > ib->rotation;
+}
+/* Whether the instance's footprint lies inside the chunk of its top left cell, so that chunk can hold it. */
+static inline int
+BAS_PlanChunk_HoldsInstance(const struct BAS_Instance *instance)
+{
+	int width, height;
+	BAS_Instance_Size(instance, &width, &height);
+	return BAS_PlanChunk_OfCell(instance->cellposition[0]+width-1)  == BAS_PlanChunk_OfInstance(instance, 0)
+	    && BAS_PlanChunk_OfCell(instance->cellposition[1]+height-1) == BAS_PlanChunk_OfInstance(instance, 1);
+}
+/* Rooms and things of a chunk, as ranges of the sorted room and thing lists. */
+struct planchunk_lists
+{
+	int rooms, roomcount;
+	int things, thingcount;
+	int instances, instancecount;
+};
+
+/* Position of the room at the given cell in a list sorted with planroom_compare, or -1. */
+static int
+planroom_find(const int *roomlist, int count, int cx, int cy)
+{
+	int low = 0, high = count-1;
+	const int chunkx = BAS_PlanChunk_OfCell(cx), chunky = BAS_PlanChunk_OfCell(cy);
+	while (low <= high)
+	{
+		const int middle = (low+high)/2;
+		const struct BAS_Room *room = &plan->rooms[roomlist[middle]];
+		int order = planchunk_compare(BAS_PlanChunk_OfCell(room->cellposition[0]), BAS_PlanChunk_OfCell(room->cellposition[1]), chunkx, chunky);
+		if (!order && !(order = planchunk_compare(room->cellposition[0], room->cellposition[1], cx, cy)))
+		{
+			return middle;
+		}
+		if (order < 0) { low  = middle+1; }
+		else           { high = middle-1; }
+	}
+	return -1;
+}
+/* Position of the first thing equal to `key` in a list sorted with planthing_compare, or -1. */
+static int
+planthing_find(const int *thinglist, int count, const struct BAS_Thing *key)
+{
+	int low = 0, high = count;
+	const int chunkx = BAS_PlanChunk_OfThing(key->thingposition[0]), chunky = BAS_PlanChunk_OfThing(key->thingposition[1]);
+	while (low < high)
+	{
+		const int middle = (low+high)/2;
+		const int thing  = thinglist[middle];
+		int order = planchunk_compare(
+			BAS_PlanChunk_OfThing(plan->things.thingposition[0][thing]), BAS_PlanChunk_OfThing(plan->things.thingposition[1][thing]), chunkx, chunky
+		);
+		if (!order) { order = planchunk_compare(plan->things.thingposition[0][thing], plan->things.thingposition[1][thing], key->thingposition[0], key->thingposition[1]); }
+		if (!order && plan->things.type[thing]   != key->type)   { order = plan->things.type[thing]   < key->type   ? -1 : 1; }
+		if (!order && plan->things.facing[thing] != key->facing) { order = plan->things.facing[thing] < key->facing ? -1 : 1; }
+		if (!order && plan->things.flags[thing]  != key->flags)  { order = plan->things.flags[thing]  < key->flags  ? -1 : 1; }
+		if (order < 0) { low  = middle+1; }
+		else           { high = middle; }
+	}
+	if (low < count)
+	{
+		const struct BAS_Thing found = BAS_Thing_Get(thinglist[low]);
+		if (!prefabthing_compare(&found, key))
+		{
+			return low;
+		}
+	}
+	return -1;
+}
+/*
+ * Find out which of the given instances are intact, that is all their rooms and
+ * things are still in the sorted room and thing lists, and mark what the intact
+ * ones account for in `roomomitted` and `thingomitted` (one flag per list
+ * element). Rooms may be shared, but every thing is accounted for only once.
+ * `intact` gets a flag per instance. Returns 0 on success, 1 on error.
+ */
+static int
+BAS_PlanChunk_Cover(const int *instancelist, int instancecount, const int *roomlist, int roomcount, const int *thinglist, int thingcount, unsigned char *roomomitted, unsigned char *thingomitted, unsigned char *intact)
+{
+	register int i, j;
+	int *claimed, claimed_count, maximum = 0;
+	for (i = 0; i < instancecount; i++)
+	{
+		const int count = plan->prefabs[plan->instances[instancelist[i]].prefab].thing_count;
+		maximum = count > maximum ? count : maximum;
+	}
+	if (!(claimed = malloc((maximum+1)*sizeof(int))))
+	{
+		return 1;
+	}
+	for (i = 0; i < instancecount; i++)
+	{
+		const struct BAS_Instance *instance = &plan->instances[instancelist[i]];
+		const struct BAS_Prefab *prefab = &plan->prefabs[instance->prefab];
+		intact[i] = 1;
+		for (j = 0; j < prefab->room_count && intact[i]; j++)
+		{
+			int cx, cy;
+			BAS_Instance_Cell(instance, plan->prefab_rooms[prefab->rooms+j][0], plan->prefab_rooms[prefab->rooms+j][1], &cx, &cy);
+			intact[i] = planroom_find(roomlist, roomcount, cx, cy) >= 0;
+		}
+		/* Things are claimed as they are found and let go again if one is missing. */
+		for (j = claimed_count = 0; j < prefab->thing_count && intact[i]; j++)
+		{
+			const struct BAS_Thing key = BAS_Instance_Thing(instance, &plan->prefab_things[prefab->things+j]);
+			int found = planthing_find(thinglist, thingcount, &key);
+			while (found >= 0 && found < thingcount && thingomitted[found])
+			{
+				const struct BAS_Thing next = BAS_Thing_Get(thinglist[found]);
+				found = prefabthing_compare(&next, &key) ? -1 : found+1;
+			}
+			if (found < 0 || found >= thingcount)
+			{
+				intact[i] = 0;
+				break;
+			}
+			thingomitted[found] = 1;
+			claimed[claimed_count++] = found;
+		}
+		if (!intact[i])
+		{
+			for (j = 0; j < claimed_count; j++)
+			{
+				thingomitted[claimed[j]] = 0;
+			}
+			continue;
+		}
+		for (j = 0; j < prefab->room_count; j++)
+		{
+			int cx, cy;
+			BAS_Instance_Cell(instance, plan->prefab_rooms[prefab->rooms+j][0], plan->prefab_rooms[prefab->rooms+j][1], &cx, &cy);
+			roomomitted[planroom_find(roomlist, roomcount, cx, cy)] = 1;
+		}
+	}
+	free(claimed);
+	return 0;
+}
+/*
+ * Drop from the sorted lists of a chunk the instances which are not intact,
+ * and the rooms and things which the intact ones account for. The counts are
+ * updated. Returns 0 on success, 1 on error.
+ */
+static int
+BAS_PlanChunk_Omit(int *roomlist, int *roomcount, int *thinglist, int *thingcount, int *instancelist, int *instancecount)
+{
+	register int i, j;
+	unsigned char *roomomitted, *thingomitted, *intact;
+	if (!*instancecount)
+	{
+		return 0;
+	}
+	if (!(roomomitted = calloc(*roomcount+*thingcount+*instancecount, 1)))
+	{
+		return 1;
+	}
+	thingomitted = roomomitted+*roomcount;
+	intact       = thingomitted+*thingcount;
+	if (BAS_PlanChunk_Cover(instancelist, *instancecount, roomlist, *roomcount, thinglist, *thingcount, roomomitted, thingomitted, intact))
+	{
+		free(roomomitted);
+		return 1;
+	}
+	for (i = j = 0; i < *roomcount; i++)
+	{
+		if (!roomomitted[i])
+		{
+			roomlist[j++] = roomlist[i];
+		}
+	}
+	*roomcount = j;
+	for (i = j = 0; i < *thingcount; i++)
+	{
+		if (!thingomitted[i])
+		{
+			thinglist[j++] = thinglist[i];
+		}
+	}
+	*thingcount = j;
+	for (i = j = 0; i < *instancecount; i++)
+	{
+		if (intact[i])
+		{
+			instancelist[j++] = instancelist[i];
+		}
+	}
+	*instancecount = j;
+	free(roomomitted);
+	return 0;
+}
+
+/*
+ * Encode the given rooms, things and instances, which all belong to the chunk
+ * at (chunkx, chunky), into `buffer`. The buffer must hold
+ * 15+roomcount*10+thingcount*30+instancecount*20 bytes. Returns the encoded size.
+ */
+static inline int
+BAS_PlanChunk_MaximumSize(int roomcount, int thingcount, int instancecount)
+{
+	return 15+roomcount*10+thingcount*30+instancecount*20;
+}
+static int
+BAS_PlanChunk_Encode(Uint8 *buffer, int chunkx, int chunky, const int *roomlist, int roomcount, const int *thinglist, int thingcount, const int *instancelist, int instancecount)
+{
+	register int i;
+	Uint8 *p = buffer;
+	Uint32 previous[2] = {0, 0};
+	const int origin[2] = {chunkx*PLANCHUNK_SIZE, chunky*PLANCHUNK_SIZE};
+	p = BAS_PutVarint(p, roomcount);
+	for (i = 0; i < roomcount; i++)
+	{
+		const Uint32 x = plan->rooms[roomlist[i]].cellposition[0]-origin[0];
+		const Uint32 y = plan->rooms[roomlist[i]].cellposition[1]-origin[1];
+		p = BAS_PutZigzag(p, x-previous[0]);
+		p = BAS_PutZigzag(p, y-previous[1]);
+		previous[0] = x;
+		previous[1] = y;
+	}
+	previous[0] = previous[1] = 0;
+	p = BAS_PutVarint(p, thingcount);
+	for (i = 0; i < thingcount; i++)
+	{
+		const int thing = thinglist[i];
+		const Uint32 x = plan->things.thingposition[0][thing]-origin[0]*CELL_SCALE;
+		const Uint32 y = plan->things.thingposition[1][thing]-origin[1]*CELL_SCALE;
+		p = BAS_PutZigzag(p, x-previous[0]);
+		p = BAS_PutZigzag(p, y-previous[1]);
+		p = BAS_PutZigzag(p, (Uint32)plan->things.type[thing]);
+		p = BAS_PutZigzag(p, (Uint32)plan->things.facing[thing]);
+		p = BAS_PutVarint(p, (Uint32)plan->things.flags[thing]);
+		p = BAS_PutVarint(p, (Uint32)(plan->things.flags[thing] >> 32));
+		previous[0] = x;
+		previous[1] = y;
+	}
+	previous[0] = previous[1] = 0;
+	p = BAS_PutVarint(p, instancecount);
+	for (i = 0; i < instancecount; i++)
+	{
+		const struct BAS_Instance *instance = &plan->instances[instancelist[i]];
+		const Uint32 x = instance->cellposition[0]-origin[0];
+		const Uint32 y = instance->cellposition[1]-origin[1];
+		p = BAS_PutVarint(p, instance->prefab);
+		p = BAS_PutZigzag(p, x-previous[0]);
+		p = BAS_PutZigzag(p, y-previous[1]);
+		p = BAS_PutVarint(p, instance->rotation);
+		previous[0] = x;
+		previous[1] = y;
+	}
+	return (int)(p-buffer);
+}
+
+/* Add the rooms and things of an encoded chunk to the plan. Returns 0 on success, 1 on error. */
+static int
+BAS_PlanChunk_Decode(const Uint8 *p, const Uint8 *end, int chunkx, int chunky)
+{
+	Uint32 count, i, position[2] = {0, 0};
+	int origin[2];
+	if (!BAS_Room_Inside((Sint64)chunkx*PLANCHUNK_SIZE, (Sint64)chunky*PLANCHUNK_SIZE))
+	{
+		return 1;
+	}
+	origin[0] = chunkx*PLANCHUNK_SIZE;
+	origin[1] = chunky*PLANCHUNK_SIZE;
+	if (BAS_GetVarint(&p, end, &count) || count > PLANCHUNK_SIZE*PLANCHUNK_SIZE || BAS_Room_Reserve(count))
+	{
+		return 1;
+	}
+	for (i = 0; i < count; i++)
+	{
+		Uint32 dx, dy;
+		if (BAS_GetZigzag(&p, end, &dx) || BAS_GetZigzag(&p, end, &dy))
+		{
+			return 1;
+		}
+		position[0] += dx;
+		position[1] += dy;
+		if (position[0] >= PLANCHUNK_SIZE || position[1] >= PLANCHUNK_SIZE)
+		{
+			return 1;
+		}
+		if (!BAS_Room_Inside((Sint64)origin[0]+position[0], (Sint64)origin[1]+position[1]))
+		{
+			return 1;
+		}
+		/* A paged out chunk may have been painted over meanwhile, keep those rooms. */
+		if (BAS_FindRoom(origin[0]+(int)position[0], origin[1]+(int)position[1]) == BAS_NO_SUCH_ROOM)
+		{
+			BAS_Room_Append(origin[0]+(int)position[0], origin[1]+(int)position[1]);
+		}
+	}
+	position[0] = position[1] = 0;
+	if (BAS_GetVarint(&p, end, &count) || count > (Uint32)(end-p) || BAS_Thing_Reserve(count))
+	{
+		return 1;
+	}
+	for (i = 0; i < count; i++)
+	{
+		Uint32 dx, dy, type, facing, flags[2];
+		int thing;
+		if (BAS_GetZigzag(&p, end, &dx) || BAS_GetZigzag(&p, end, &dy)
+		 || BAS_GetZigzag(&p, end, &type) || BAS_GetZigzag(&p, end, &facing)
+		 || BAS_GetVarint(&p, end, &flags[0]) || BAS_GetVarint(&p, end, &flags[1]))
+		{
+			return 1;
+		}
+		position[0] += dx;
+		position[1] += dy;
+		if (position[0] >= (Uint32)(PLANCHUNK_SIZE*CELL_SCALE) || position[1] >= (Uint32)(PLANCHUNK_SIZE*CELL_SCALE)
+		 || (thing = BAS_Thing_Create(origin[0]*CELL_SCALE+(int)position[0], origin[1]*CELL_SCALE+(int)position[1], (int)facing)) == BAS_NO_SUCH_THING)
+		{
+			return 1;
+		}
+		plan->things.type[thing]  = (int)type;
+		plan->things.flags[thing] = (uint64_t)flags[1] << 32 | flags[0];
+	}
+	/* Version 1 chunks end here. */
+	position[0] = position[1] = 0;
+	if (p == end)
+	{
+		return 0;
+	}
+	if (BAS_GetVarint(&p, end, &count) || count > (Uint32)(end-p))
+	{
+		return 1;
+	}
+	for (i = 0; i < count; i++)
+	{
+		Uint32 prefab, dx, dy, rotation;
+		if (BAS_GetVarint(&p, end, &prefab) || BAS_GetZigzag(&p, end, &dx) || BAS_GetZigzag(&p, end, &dy) || BAS_GetVarint(&p, end, &rotation)
+		 || prefab >= (Uint32)plan->prefab_count || rotation > 3)
+		{
+			return 1;
+		}
+		position[0] += dx;
+		position[1] += dy;
+		if (BAS_Instance_Add((int)prefab, origin[0]+(int)position[0], origin[1]+(int)position[1], (int)rotation, 0))
+		{
+			return 1;
+		}
+	}
+	return p != end;
+}
+
+/* Encode every prefab into `buffer`, which must hold BAS_Prefab_TableSize() bytes. Returns the encoded size. */
+static int
+BAS_Prefab_TableSize(void)
+{
+	return 5+plan->prefab_count*25+plan->prefab_room_count*10+plan->prefab_thing_count*30;
+}
+static int
+BAS_Prefab_EncodeTable(Uint8 *buffer)
+{
+	register int i, j;
+	Uint8 *p = buffer;
+	p = BAS_PutVarint(p, plan->prefab_count);
+	for (i = 0; i < plan->prefab_count; i++)
+	{
+		const struct BAS_Prefab *prefab = &plan->prefabs[i];
+		Uint32 previous[2] = {0, 0};
+		p = BAS_PutVarint(p, prefab->size[0]);
+		p = BAS_PutVarint(p, prefab->size[1]);
+		p = BAS_PutVarint(p, prefab->room_count);
+		for (j = prefab->rooms; j < prefab->rooms+prefab->room_count; j++)
+		{
+			p = BAS_PutZigzag(p, (Uint32)plan->prefab_rooms[j][0]-previous[0]);
+			p = BAS_PutZigzag(p, (Uint32)plan->prefab_rooms[j][1]-previous[1]);
+			previous[0] = plan->prefab_rooms[j][0];
+			previous[1] = plan->prefab_rooms[j][1];
+		}
+		previous[0] = previous[1] = 0;
+		p = BAS_PutVarint(p, prefab->thing_count);
+		for (j = prefab->things; j < prefab->things+prefab->thing_count; j++)
+		{
+			const struct BAS_Thing *thing = &plan->prefab_things[j];
+			p = BAS_PutZigzag(p, (Uint32)thing->thingposition[0]-previous[0]);
+			p = BAS_PutZigzag(p, (Uint32)thing->thingposition[1]-previous[1]);
+			p = BAS_PutZigzag(p, (Uint32)thing->type);
+			p = BAS_PutZigzag(p, (Uint32)thing->facing);
+			p = BAS_PutVarint(p, (Uint32)thing->flags);
+			p = BAS_PutVarint(p, (Uint32)(thing->flags >> 32));
+			previous[0] = thing->thingposition[0];
+			previous[1] = thing->thingposition[1];
+		}
+	}
+	return (int)(p-buffer);
+}
+/* Replace the prefabs with the encoded ones. Returns 0 on success, 1 on error. */
+static int
+BAS_Prefab_DecodeTable(const Uint8 *p, const Uint8 *end)
+{
+	Uint32 count, i, j, size[2], roomcount, thingcount;
+	plan->prefab_count       = 0;
+	plan->prefab_room_count  = 0;
+	plan->prefab_thing_count = 0;
+	if (BAS_GetVarint(&p, end, &count) || count > (Uint32)(end-p)
+	 || BAS_Reserve(MEMORY_PLAN, (void **)&plan->prefabs, &plan->prefab_capacity, count, sizeof(struct BAS_Prefab)))
+	{
+		return 1;
+	}
+	for (i = 0; i < count; i++)
+	{
+		struct BAS_Prefab *prefab = &plan->prefabs[i];
+		Uint32 position[2] = {0, 0};
+		if (BAS_GetVarint(&p, end, &size[0]) || BAS_GetVarint(&p, end, &size[1]) || BAS_GetVarint(&p, end, &roomcount)
+		 || !size[0] || !size[1] || size[0] > BAS_MAX_BATCH_CELLS || size[1] > BAS_MAX_BATCH_CELLS
+		 || roomcount > (Uint32)(end-p)
+		 || BAS_Reserve(MEMORY_PLAN, (void **)&plan->prefab_rooms, &plan->prefab_room_capacity, plan->prefab_room_count+roomcount, sizeof(int[2])))
+		{
+			return 1;
+		}
+		prefab->size[0]    = (int)size[0];
+		prefab->size[1]    = (int)size[1];
+		prefab->rooms      = plan->prefab_room_count;
+		prefab->room_count = (int)roomcount;
+		for (j = 0; j < roomcount; j++)
+		{
+			Uint32 dx, dy;
+			if (BAS_GetZigzag(&p, end, &dx) || BAS_GetZigzag(&p, end, &dy))
+			{
+				return 1;
+			}
+			position[0] += dx;
+			position[1] += dy;
+			if (position[0] >= size[0] || position[1] >= size[1])
+			{
+				return 1;
+			}
+			plan->prefab_rooms[plan->prefab_room_count][0] = (int)position[0];
+			plan->prefab_rooms[plan->prefab_room_count][1] = (int)position[1];
+			plan->prefab_room_count++;
+		}
+		position[0] = position[1] = 0;
+		if (BAS_GetVarint(&p, end, &thingcount) || thingcount > (Uint32)(end-p)
+		 || BAS_Reserve(MEMORY_PLAN, (void **)&plan->prefab_things, &plan->prefab_thing_capacity, plan->prefab_thing_count+thingcount, sizeof(struct BAS_Thing)))
+		{
+			return 1;
+		}
+		prefab->things      = plan->prefab_thing_count;
+		prefab->thing_count = (int)thingcount;
+		for (j = 0; j < thingcount; j++)
+		{
+			struct BAS_Thing *thing = &plan->prefab_things[plan->prefab_thing_count];
+			Uint32 dx, dy, type, facing, flags[2];
+			if (BAS_GetZigzag(&p, end, &dx) || BAS_GetZigzag(&p, end, &dy)
+			 || BAS_GetZigzag(&p, end, &type) || BAS_GetZigzag(&p, end, &facing)
+			 || BAS_GetVarint(&p, end, &flags[0]) || BAS_GetVarint(&p, end, &flags[1]))
+			{
+				return 1;
+			}
+			position[0] += dx;
+			position[1] += dy;
+			if (position[0] >= size[0]*CELL_SCALE || position[1] >= size[1]*CELL_SCALE)
+			{
+				return 1;
+			}
+			thing->thingposition[0] = (int)position[0];
+			thing->thingposition[1] = (int)position[1];
+			thing->type   = (int)type;
+			thing->facing = (int)facing;
+			thing->flags  = (uint64_t)flags[1] << 32 | flags[0];
+			plan->prefab_thing_count++;
+		}
+		plan->prefab_count++;
+	}
+	return p != end;
+}
+
+/* Remove every room, thing and prefab. */
+static void
+BAS_Plan_Clear(void)
+{
+	register int i;
+	plan->room_count         = 0;
+	plan->thing_count        = 0;
+	plan->prefab_count       = 0;
+	plan->prefab_room_count  = 0;
+	plan->prefab_thing_count = 0;
+	plan->instance_count     = 0;
+	plan->instances_pending  = 0;
+	plan->planfile_revision++;
+	for (i = 0; i < plan->roomindex_capacity; i++)
+	{
+		plan->roomindex[i].room = BAS_NO_SUCH_ROOM;
+	}
+	BAS_InvalidateLines();
+	if (plan == &plan_editor)
+	{
+		minimap_rebuild = 1;
+		lod_rebuild     = 1;
+		livelink_full   = 1;
+	}
+}
+
+static int
+BAS_PlanFile_WriteHeader(FILE *file)
+{
+	Uint8 header[PLANFILE_HEADER_SIZE];
+	memcpy(header, "BASPLAN", 8);
+	BAS_PutU32(header+8,  PLANFILE_VERSION);
+	BAS_PutU32(header+12, PLANCHUNK_SIZE);
+	BAS_PutU32(header+16, plan->planfile_chunkcount+(plan->planfile_prefabcapacity != 0));
+	BAS_PutU32(header+20, plan->planfile_indexcapacity);
+	BAS_PutU64(header+24, plan->planfile_indexoffset);
+	return fseek(file, 0, SEEK_SET) || fwrite(header, PLANFILE_HEADER_SIZE, 1, file) != 1;
+}
+static int
+BAS_PlanFile_WriteIndex(FILE *file)
+{
+	register int i;
+	int failed;
+	const int entrycount = plan->planfile_chunkcount+(plan->planfile_prefabcapacity != 0);
+	Uint8 *entries = calloc(entrycount ? entrycount : 1, PLANFILE_ENTRY_SIZE);
+	if (!entries)
+	{
+		WRITE_E("Out of memory!");
+		return 1;
+	}
+	for (i = 0; i < plan->planfile_chunkcount; i++)
+	{
+		Uint8 *entry = entries+i*PLANFILE_ENTRY_SIZE;
+		BAS_PutU32(entry,    (Uint32)plan->planfile_index[i].chunkposition[0]);
+		BAS_PutU32(entry+4,  (Uint32)plan->planfile_index[i].chunkposition[1]);
+		BAS_PutU64(entry+8,  plan->planfile_index[i].offset);
+		BAS_PutU32(entry+16, plan->planfile_index[i].size);
+		BAS_PutU32(entry+20, plan->planfile_index[i].capacity);
+		BAS_PutU32(entry+24, plan->planfile_index[i].crc);
+		BAS_PutU32(entry+28, PLANFILE_KIND_CHUNK);
+	}
+	if (plan->planfile_prefabcapacity)
+	{
+		Uint8 *entry = entries+i*PLANFILE_ENTRY_SIZE;
+		BAS_PutU64(entry+8,  plan->planfile_prefaboffset);
+		BAS_PutU32(entry+16, plan->planfile_prefabsize);
+		BAS_PutU32(entry+20, plan->planfile_prefabcapacity);
+		BAS_PutU32(entry+24, plan->planfile_prefabcrc);
+		BAS_PutU32(entry+28, PLANFILE_KIND_PREFABS);
+	}
+	failed = fseek(file, (long)plan->planfile_indexoffset, SEEK_SET)
+	      || (entrycount && fwrite(entries, PLANFILE_ENTRY_SIZE, entrycount, file) != (size_t)entrycount);
+	free(entries);
+	return failed;
+}
+/* Flush the file to the disk, so that the writes before are there before those after. */
+static int
+BAS_PlanFile_Sync(FILE *file)
+{
+	if (fflush(file))
+	{
+		return 1;
+	}
+#ifdef BAS_HAVE_MMAP
+	return fsync(fileno(file)) != 0;
+#else
+	return 0;
+#endif
+}
+/* Returns the entry of the previous save for the given chunk, or NULL. */
+static const struct BAS_PlanChunkEntry *
+BAS_PlanFile_FindChunk(const struct BAS_PlanChunkEntry *index, int count, int chunkx, int chunky)
+{
+	int low = 0, high = count-1;
+	while (low <= high)
+	{
+		const int middle = (low+high)/2;
+		const int order  = planchunk_compare(index[middle].chunkposition[0], index[middle].chunkposition[1], chunkx, chunky);
+		if (!order)
+		{
+			return &index[middle];
+		}
+		if (order < 0) { low  = middle+1; }
+		else           { high = middle-1; }
+	}
+	return NULL;
+}
+
+/*
+ * Read the header and index of a plan file. Returns the index of the chunks
+ * (all not resident), or NULL on error. `chunkcount` is set to the number of
+ * chunks, `prefabs` to the prefab slot (capacity 0 without one) and `end` to
+ * the end of the last slot.
+ */
+static struct BAS_PlanChunkEntry *
+BAS_PlanFile_ReadIndex(FILE *file, Uint8 header[PLANFILE_HEADER_SIZE], int *chunkcount, struct BAS_PlanChunkEntry *prefabs, Uint64 *end)
+{
+	register int i;
+	int entrycount;
+	Uint8 *entries;
+	struct BAS_PlanChunkEntry *index;
+	if (fread(header, PLANFILE_HEADER_SIZE, 1, file) != 1 || memcmp(header, "BASPLAN", 8)
+	 || BAS_GetU32(header+8) < 1 || BAS_GetU32(header+8) > PLANFILE_VERSION || BAS_GetU32(header+12) != PLANCHUNK_SIZE)
+	{
+		WRITE_E("Not a plan file!");
+		return NULL;
+	}
+	entrycount = (int)BAS_GetU32(header+16);
+	entries    = malloc((size_t)(entrycount ? entrycount : 1)*PLANFILE_ENTRY_SIZE);
+	index      = BAS_Alloc(MEMORY_PLAN, (entrycount ? entrycount : 1)*sizeof(struct BAS_PlanChunkEntry));
+	if (!entries || !index)
+	{
+		WRITE_E("Out of memory!");
+		free(entries);
+		BAS_Free(index);
+		return NULL;
+	}
+	if (fseek(file, (long)BAS_GetU64(header+24), SEEK_SET)
+	 || (entrycount && fread(entries, PLANFILE_ENTRY_SIZE, entrycount, file) != (size_t)entrycount))
+	{
+		WRITE_E("Failed to read the index!");
+		free(entries);
+		BAS_Free(index);
+		return NULL;
+	}
+	*end = BAS_GetU64(header+24)+(Uint64)BAS_GetU32(header+20)*PLANFILE_ENTRY_SIZE;
+	*chunkcount = 0;
+	memset(prefabs, 0, sizeof(struct BAS_PlanChunkEntry));
+	for (i = 0; i < entrycount; i++)
+	{
+		const Uint8 *entry = entries+i*PLANFILE_ENTRY_SIZE;
+		/* Version 1 entries are padded with zeroes, so they are all chunks. */
+		struct BAS_PlanChunkEntry *chunk = BAS_GetU32(entry+28) == PLANFILE_KIND_PREFABS ? prefabs : &index[(*chunkcount)++];
+		chunk->chunkposition[0] = (int)BAS_GetU32(entry);
+		chunk->chunkposition[1] = (int)BAS_GetU32(entry+4);
+		chunk->offset           = BAS_GetU64(entry+8);
+		chunk->size             = BAS_GetU32(entry+16);
+		chunk->capacity         = BAS_GetU32(entry+20);
+		chunk->crc              = BAS_GetU32(entry+24);
+		chunk->resident         = 0;
+		chunk->lastuse          = 0;
+		if (chunk->offset+chunk->capacity > *end)
+		{
+			*end = chunk->offset+chunk->capacity;
+		}
+	}
+	free(entries);
+	return index;
+}
+/*
+ * Read the slot of the given entry into `buffer`, which grows as needed, and
+ * check its CRC. Returns 0 on success, 1 on error.
+ */
+static int
+BAS_PlanFile_ReadSlot(FILE *file, const struct BAS_PlanChunkEntry *slot, Uint8 **buffer, Uint32 *capacity)
+{
+	if (slot->size > *capacity)
+	{
+		Uint8 *resized = realloc(*buffer, slot->size);
+		if (!resized)
+		{
+			WRITE_E("Out of memory!");
+			return 1;
+		}
+		*buffer   = resized;
+		*capacity = slot->size;
+	}
+	if (fseek(file, (long)slot->offset, SEEK_SET) || fread(*buffer, 1, slot->size, file) != slot->size)
+	{
+		WRITE_E("Failed to read a chunk!");
+		return 1;
+	}
+	if (BAS_CRC32C(*buffer, slot->size) != slot->crc)
+	{
+		WRITE_E("Chunk checksum mismatch!");
+		return 1;
+	}
+	return 0;
+}
+/* Whether the path fits planfile_path (and a temporary file next to it), reported if it does not. */
+static int
+BAS_PlanFile_PathFits(const char *path)
+{
+	if (strlen(path) < sizeof(plan->planfile_path))
+	{
+		return 1;
+	}
+	WRITE_E("Plan file path is too long!");
+	return 0;
+}
+/* Make the given index and prefab slot the ones of the current plan file, the path must fit (see BAS_PlanFile_PathFits). */
+static void
+BAS_PlanFile_Adopt(const char *path, const Uint8 header[PLANFILE_HEADER_SIZE], struct BAS_PlanChunkEntry *index, int chunkcount, const struct BAS_PlanChunkEntry *prefabs, Uint64 end)
+{
+	BAS_Free(plan->planfile_index);
+	plan->planfile_index          = index;
+	plan->planfile_chunkcount     = chunkcount;
+	plan->planfile_prefaboffset   = prefabs->offset;
+	plan->planfile_prefabsize     = prefabs->size;
+	plan->planfile_prefabcapacity = prefabs->capacity;
+	plan->planfile_prefabcrc      = prefabs->crc;
+	plan->planfile_indexcapacity = (int)BAS_GetU32(header+20);
+	plan->planfile_indexoffset   = BAS_GetU64(header+24);
+	plan->planfile_end           = end;
+	plan->planfile_revision++;
+	strcpy(plan->planfile_path, path);
+}
+
+/*
+ * ----------------
+ * Paging.
+ * Instead of being loaded, a plan file can be opened paged: the file is
+ * mapped into memory and only the chunks around the view are decoded into the
+ * room and thing arrays, on the first frame they are needed. When the plan
+ * data grows past paging_cap, the chunks which have not been needed for the
+ * longest time are dropped again, as long as they still encode to what is in
+ * the file (the checksum tells). Edited chunks stay until they are saved.
+ * Walls, exports and whole-plan tools only see the chunks which are resident.
+ * ----------------
+ */
+#define PAGING_DEFAULT_CAP ((size_t)256 << 20)
+#define PAGING_MARGIN      1 /* Chunks around the view which are paged in as well. */
+
+/* Estimated memory held by rooms (with their index, neighbours and walls) and things. */
+static inline size_t
+BAS_Paging_Bytes(int roomcount, int thingcount)
+{
+	return (size_t)roomcount*(sizeof(struct BAS_Room)+2*sizeof(struct BAS_RoomSlot)+sizeof(int[4])+2*sizeof(struct BAS_Line))
+	     + (size_t)thingcount*(4*sizeof(int)+sizeof(uint64_t));
+}
+static void
+BAS_Paging_Unmap(void)
+{
+	if (!plan->paging_map)
+	{
+		return;
+	}
+#ifdef BAS_HAVE_MMAP
+	munmap((void *)plan->paging_map, plan->paging_mapsize);
+#else
+	free((void *)plan->paging_map);
+#endif
+	plan->paging_map     = NULL;
+	plan->paging_mapsize = 0;
+}
+/* Map planfile_path. Without mmap the file is read instead. Returns 0 on success, 1 on error. */
+static int
+BAS_Paging_Map(void)
+{
+#ifdef BAS_HAVE_MMAP
+	struct stat status;
+	void *map;
+	const int descriptor = open(plan->planfile_path, O_RDONLY);
+	BAS_Paging_Unmap();
+	if (descriptor < 0 || fstat(descriptor, &status) || !status.st_size)
+	{
+		WRITE_E("Failed to map the plan file!");
+		if (descriptor >= 0)
+		{
+			close(descriptor);
+		}
+		return 1;
+	}
+	map = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, descriptor, 0);
+	close(descriptor);
+	if (map == MAP_FAILED)
+	{
+		WRITE_E("Failed to map the plan file!");
+		return 1;
+	}
+	plan->paging_map     = map;
+	plan->paging_mapsize = status.st_size;
+	return 0;
+#else
+	long size;
+	Uint8 *data;
+	FILE *file = fopen(plan->planfile_path, "rb");
+	BAS_Paging_Unmap();
+	if (!file || fseek(file, 0, SEEK_END) || (size = ftell(file)) <= 0 || fseek(file, 0, SEEK_SET)
+	 || !(data = malloc(size)) || fread(data, 1, size, file) != (size_t)size)
+	{
+		WRITE_E("Failed to read the plan file!");
+		if (file)
+		{
+			fclose(file);
+		}
+		return 1;
+	}
+	fclose(file);
+	plan->paging_map     = data;
+	plan->paging_mapsize = size;
+	return 0;
+#endif
+}
+static void
+BAS_Paging_Close(void)
+{
+	BAS_Paging_Unmap();
+	plan->paging_stuck = -1;
+}
+
+static int
+BAS_Paging_PageIn(struct BAS_PlanChunkEntry *chunk)
+{
+	if (chunk->offset+chunk->size > plan->paging_mapsize
+	 || BAS_CRC32C(plan->paging_map+chunk->offset, chunk->size) != chunk->crc
+	 || BAS_PlanChunk_Decode(plan->paging_map+chunk->offset, plan->paging_map+chunk->offset+chunk->size, chunk->chunkposition[0], chunk->chunkposition[1]))
+	{
+		WRITE_E("Failed to page in a chunk!");
+		return 1;
+	}
+	chunk->resident = 1;
+	chunk->lastuse  = plan->paging_frame;
+	BAS_InvalidateLines();
+	return 0;
+}
+
+/* Page in the chunks which overlap the given cell rectangle, and mark them as used. */
+static void
+BAS_Paging_Require(int cx0, int cy0, int cx1, int cy1)
+{
+	register int i;
+	const int left   = BAS_PlanChunk_OfCell(cx0 < cx1 ? cx0 : cx1);
+	const int right  = BAS_PlanChunk_OfCell(cx0 < cx1 ? cx1 : cx0);
+	const int top    = BAS_PlanChunk_OfCell(cy0 < cy1 ? cy0 : cy1);
+	const int bottom = BAS_PlanChunk_OfCell(cy0 < cy1 ? cy1 : cy0);
+	if (!plan->paging_map)
+	{
+		return;
+	}
+	for (i = 0; i < plan->planfile_chunkcount; i++)
+	{
+		struct BAS_PlanChunkEntry *chunk = &plan->planfile_index[i];
+		if (chunk->chunkposition[0] < left || chunk->chunkposition[0] > right
+		 || chunk->chunkposition[1] < top  || chunk->chunkposition[1] > bottom)
+		{
+			continue;
+		}
+		if (!chunk->resident && BAS_Paging_PageIn(chunk))
+		{
+			continue;
+		}
+		chunk->lastuse = plan->paging_frame;
+	}
+}
+
+/* Page in every chunk of the file which has resident rooms or things, so they can be saved together. */
+static int
+BAS_Paging_PageInEdited(void)
+{
+	register int i;
+	for (i = 0; i < plan->room_count; i++)
+	{
+		struct BAS_PlanChunkEntry *chunk = (struct BAS_PlanChunkEntry *)BAS_PlanFile_FindChunk(
+			plan->planfile_index, plan->planfile_chunkcount,
+			BAS_PlanChunk_OfCell(plan->rooms[i].cellposition[0]), BAS_PlanChunk_OfCell(plan->rooms[i].cellposition[1])
+		);
+		if (chunk && !chunk->resident && BAS_Paging_PageIn(chunk))
+		{
+			return 1;
+		}
+	}
+	for (i = 0; i < plan->thing_count; i++)
+	{
+		struct BAS_PlanChunkEntry *chunk = (struct BAS_PlanChunkEntry *)BAS_PlanFile_FindChunk(
+			plan->planfile_index, plan->planfile_chunkcount,
+			BAS_PlanChunk_OfThing(plan->things.thingposition[0][i]), BAS_PlanChunk_OfThing(plan->things.thingposition[1][i])
+		);
+		if (chunk && !chunk->resident && BAS_Paging_PageIn(chunk))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int
+pagingchunk_compare(const void *a, const void *b)
+{
+	const Uint32 ua = plan->planfile_index[*(const int *)a].lastuse;
+	const Uint32 ub = plan->planfile_index[*(const int *)b].lastuse;
+	return ua < ub ? -1 : ua > ub;
+}
+/*
+ * Group the rooms, things or instances (as `of` says) by the rank of their
+ * chunk: on return list[start[r], start[r+1]) holds the ones in the chunk of
+ * rank r. Instances which straddle chunks belong to none.
+ * `start` must hold rank_count+2 elements, `itemrank` one per room (thing, instance).
+ */
+#define PAGING_ROOMS     0
+#define PAGING_THINGS    1
+#define PAGING_INSTANCES 2
+static void
+BAS_Paging_Group(int of, const int *rank, int rank_count, int *start, int *list, int *itemrank)
+{
+	register int i;
+	const int count = of == PAGING_THINGS ? plan->thing_count : of == PAGING_INSTANCES ? plan->instance_count : plan->room_count;
+	memset(start, 0, (rank_count+2)*sizeof(int));
+	for (i = 0; i < count; i++)
+	{
+		const struct BAS_PlanChunkEntry *chunk = NULL;
+		switch (of)
+		{
+		case PAGING_ROOMS:
+			chunk = BAS_PlanFile_FindChunk(plan->planfile_index, plan->planfile_chunkcount, BAS_PlanChunk_OfCell(plan->rooms[i].cellposition[0]), BAS_PlanChunk_OfCell(plan->rooms[i].cellposition[1]));
+			break;
+		case PAGING_THINGS:
+			chunk = BAS_PlanFile_FindChunk(plan->planfile_index, plan->planfile_chunkcount, BAS_PlanChunk_OfThing(plan->things.thingposition[0][i]), BAS_PlanChunk_OfThing(plan->things.thingposition[1][i]));
+			break;
+		case PAGING_INSTANCES:
+			if (BAS_PlanChunk_HoldsInstance(&plan->instances[i]))
+			{
+				chunk = BAS_PlanFile_FindChunk(plan->planfile_index, plan->planfile_chunkcount, BAS_PlanChunk_OfInstance(&plan->instances[i], 0), BAS_PlanChunk_OfInstance(&plan->instances[i], 1));
+			}
+			break;
+		}
+		itemrank[i] = chunk ? rank[chunk-plan->planfile_index] : -1;
+		if (itemrank[i] >= 0)
+		{
+			start[itemrank[i]+2]++;
+		}
+	}
+	for (i = 2; i < rank_count+2; i++)
+	{
+		start[i] += start[i-1];
+	}
+	for (i = 0; i < count; i++)
+	{
+		if (itemrank[i] >= 0)
+		{
+			list[start[itemrank[i]+1]++] = i;
+		}
+	}
+}
+/*
+ * Drop the least recently needed clean chunks until the plan is well under
+ * paging_cap. Returns 1 if any thing was dropped (thing indices have changed), 0 otherwise.
+ */
+static int
+BAS_Paging_Evict(void)
+{
+	register int i, j;
+	int candidate_count = 0, evicted = 0, removed_count = 0, maximum = 0, thingsremoved = 0;
+	int *candidates, *rank, *roomstart, *thingstart, *instancestart, *roomlist, *thinglist, *instancelist, *itemrank, (*removed)[2];
+	int *keptrooms, *keptthings, *keptinstances;
+	unsigned char *removedthings, *removedinstances;
+	Uint8 *buffer = NULL;
+	size_t resident;
+	const size_t target = plan->paging_cap/4*3;
+	char message[128];
+	/* Chunks are compared to the file as they would be saved, with their instances. */
+	if (BAS_Instance_ExpandPending())
+	{
+		return 0;
+	}
+	resident         = BAS_Paging_Bytes(plan->room_count, plan->thing_count);
+	candidates       = malloc((plan->planfile_chunkcount+1)*sizeof(int));
+	rank             = malloc((plan->planfile_chunkcount+1)*sizeof(int));
+	roomstart        = malloc((plan->planfile_chunkcount+2)*sizeof(int));
+	thingstart       = malloc((plan->planfile_chunkcount+2)*sizeof(int));
+	instancestart    = malloc((plan->planfile_chunkcount+2)*sizeof(int));
+	roomlist         = malloc((plan->room_count+1)*sizeof(int));
+	thinglist        = malloc((plan->thing_count+1)*sizeof(int));
+	instancelist     = malloc((plan->instance_count+1)*sizeof(int));
+	keptrooms        = malloc((plan->room_count+1)*sizeof(int));
+	keptthings       = malloc((plan->thing_count+1)*sizeof(int));
+	keptinstances    = malloc((plan->instance_count+1)*sizeof(int));
+	itemrank         = malloc((plan->room_count+plan->thing_count+plan->instance_count+1)*sizeof(int));
+	removed          = malloc((plan->room_count+1)*sizeof(int[2]));
+	removedthings    = calloc(plan->thing_count+1, 1);
+	removedinstances = calloc(plan->instance_count+1, 1);
+	if (!candidates || !rank || !roomstart || !thingstart || !instancestart || !roomlist || !thinglist || !instancelist
+	 || !keptrooms || !keptthings || !keptinstances || !itemrank || !removed || !removedthings || !removedinstances)
+	{
+		WRITE_E("Out of memory!");
+		goto done;
+	}
+	/* Resident chunks which were not needed this frame, least recently needed first. */
+	for (i = 0; i < plan->planfile_chunkcount; i++)
+	{
+		rank[i] = -1;
+		if (plan->planfile_index[i].resident && plan->planfile_index[i].lastuse != plan->paging_frame)
+		{
+			candidates[candidate_count++] = i;
+		}
+	}
+	qsort(candidates, candidate_count, sizeof(int), pagingchunk_compare);
+	for (i = 0; i < candidate_count; i++)
+	{
+		rank[candidates[i]] = i;
+	}
+	BAS_Paging_Group(PAGING_ROOMS, rank, candidate_count, roomstart, roomlist, itemrank);
+	BAS_Paging_Group(PAGING_THINGS, rank, candidate_count, thingstart, thinglist, itemrank);
+	BAS_Paging_Group(PAGING_INSTANCES, rank, candidate_count, instancestart, instancelist, itemrank);
+	for (i = 0; i < candidate_count; i++)
+	{
+		const int size = BAS_PlanChunk_MaximumSize(roomstart[i+1]-roomstart[i], thingstart[i+1]-thingstart[i], instancestart[i+1]-instancestart[i]);
+		maximum = size > maximum ? size : maximum;
+	}
+	if (!(buffer = malloc(maximum ? maximum : 1)))
+	{
+		WRITE_E("Out of memory!");
+		goto done;
+	}
+	/* Drop the chunks which still encode to what is in the file. */
+	for (i = 0; i < candidate_count && resident > target; i++)
+	{
+		struct BAS_PlanChunkEntry *chunk = &plan->planfile_index[candidates[i]];
+		const int roomcount     = roomstart[i+1]-roomstart[i];
+		const int thingcount    = thingstart[i+1]-thingstart[i];
+		const int instancecount = instancestart[i+1]-instancestart[i];
+		int size, keptroomcount = roomcount, keptthingcount = thingcount, keptinstancecount = instancecount;
+		qsort(roomlist+roomstart[i], roomcount, sizeof(int), planroom_compare);
+		qsort(thinglist+thingstart[i], thingcount, sizeof(int), planthing_compare);
+		qsort(instancelist+instancestart[i], instancecount, sizeof(int), planinstance_compare);
+		memcpy(keptrooms, roomlist+roomstart[i], roomcount*sizeof(int));
+		memcpy(keptthings, thinglist+thingstart[i], thingcount*sizeof(int));
+		memcpy(keptinstances, instancelist+instancestart[i], instancecount*sizeof(int));
+		if (BAS_PlanChunk_Omit(keptrooms, &keptroomcount, keptthings, &keptthingcount, keptinstances, &keptinstancecount))
+		{
+			continue;
+		}
+		size = BAS_PlanChunk_Encode(
+			buffer, chunk->chunkposition[0], chunk->chunkposition[1],
+			keptrooms, keptroomcount, keptthings, keptthingcount, keptinstances, keptinstancecount
+		);
+		if ((Uint32)size != chunk->size || BAS_CRC32C(buffer, size) != chunk->crc)
+		{
+			continue;
+		}
+		for (j = roomstart[i]; j < roomstart[i+1]; j++)
+		{
+			removed[removed_count][0] = plan->rooms[roomlist[j]].cellposition[0];
+			removed[removed_count][1] = plan->rooms[roomlist[j]].cellposition[1];
+			removed_count++;
+		}
+		for (j = thingstart[i]; j < thingstart[i+1]; j++)
+		{
+			removedthings[thinglist[j]] = 1;
+		}
+		for (j = instancestart[i]; j < instancestart[i+1]; j++)
+		{
+			removedinstances[instancelist[j]] = 1;
+		}
+		chunk->resident = 0;
+		resident       -= BAS_Paging_Bytes(roomcount, thingcount);
+		evicted++;
+	}
+	/* Rooms go by position, since every deletion moves another room. */
+	for (i = 0; i < removed_count; i++)
+	{
+		BAS_Room_Delete(removed[i][0], removed[i][1]);
+	}
+	thingsremoved = BAS_Thing_Remove(removedthings);
+	for (i = j = 0; i < plan->instance_count; i++)
+	{
+		if (!removedinstances[i])
+		{
+			plan->instances[j++] = plan->instances[i];
+		}
+	}
+	plan->instance_count = j;
+	if (evicted)
+	{
+		BAS_InvalidateLines();
+		plan->paging_stuck = -1;
+	}
+	if (resident > plan->paging_cap)
+	{
+		/* Everything left is in view or edited, do not try again until the plan changes. */
+		plan->paging_stuck = (long)plan->room_count+plan->thing_count;
+		WRITE_W("The plan is over the memory cap, save it to let edited chunks go.");
+	}
+	snprintf(message, sizeof(message), "Paged out %d chunks, %d left resident.", evicted, candidate_count-evicted);
+	WRITE_I(message);
+done:
+	free(buffer);
+	free(candidates);
+	free(rank);
+	free(roomstart);
+	free(thingstart);
+	free(instancestart);
+	free(roomlist);
+	free(thinglist);
+	free(instancelist);
+	free(keptrooms);
+	free(keptthings);
+	free(keptinstances);
+	free(itemrank);
+	free(removed);
+	free(removedthings);
+	free(removedinstances);
+	return thingsremoved > 0;
+}
+
+/*
+ * Once per frame: page in the chunks around the view, and page out chunks if
+ * the plan is over the cap. Returns 1 if things were paged out.
+ */
+static int
+BAS_Paging_Update(void)
+{
+	int x0, y0, x1, y1;
+	if (!plan->paging_map)
+	{
+		return 0;
+	}
+	plan->paging_frame++;
+	BAS_View_ToPlan(0, 0, &x0, &y0);
+	BAS_View_ToPlan(WINDOW_WIDTH, WINDOW_HEIGHT, &x1, &y1);
+	BAS_Paging_Require(
+		BAS_FloorDiv(x0, CELL_SCALE)-PAGING_MARGIN*PLANCHUNK_SIZE, BAS_FloorDiv(y0, CELL_SCALE)-PAGING_MARGIN*PLANCHUNK_SIZE,
+		BAS_FloorDiv(x1, CELL_SCALE)+PAGING_MARGIN*PLANCHUNK_SIZE, BAS_FloorDiv(y1, CELL_SCALE)+PAGING_MARGIN*PLANCHUNK_SIZE
+	);
+	if (BAS_Paging_Bytes(plan->room_count, plan->thing_count) <= plan->paging_cap || plan->paging_stuck == (long)plan->room_count+plan->thing_count)
+	{
+		return 0;
+	}
+	return BAS_Paging_Evict();
+}
+
+/*
+ * Open the plan file at the given path paged, with the given memory cap in bytes.
+ * Only its index is read, chunks come in with BAS_Paging_Update.
+ * Returns 0 on success, 1 on error.
+ */
+static int
+BAS_Paging_Open(const char *path, size_t cap)
+{
+	Uint8 header[PLANFILE_HEADER_SIZE];
+	struct BAS_PlanChunkEntry *index, prefabs;
+	int chunkcount;
+	Uint64 end;
+	char message[128];
+	FILE *file;
+	const Uint64 start = SDL_GetPerformanceCounter();
+	if (!BAS_PlanFile_PathFits(path))
+	{
+		return 1;
+	}
+	if (!(file = fopen(path, "rb")))
+	{
+		WRITE_E("Failed to open file for reading!");
+		return 1;
+	}
+	index = BAS_PlanFile_ReadIndex(file, header, &chunkcount, &prefabs, &end);
+	fclose(file);
+	if (!index)
+	{
+		return 1;
+	}
+	BAS_Paging_Close();
+	BAS_Plan_Clear();
+	BAS_PlanFile_Adopt(path, header, index, chunkcount, &prefabs, end);
+	/* The prefabs are decoded right away, chunks refer to them. */
+	if (BAS_Paging_Map() || (prefabs.capacity && (
+		prefabs.offset+prefabs.size > plan->paging_mapsize
+	 || BAS_CRC32C(plan->paging_map+prefabs.offset, prefabs.size) != prefabs.crc
+	 || BAS_Prefab_DecodeTable(plan->paging_map+prefabs.offset, plan->paging_map+prefabs.offset+prefabs.size)
+	)))
+	{
+		if (plan->paging_map)
+		{
+			WRITE_E("Failed to read the prefabs!");
+			BAS_Paging_Close();
+		}
+		BAS_Free(plan->planfile_index);
+		plan->planfile_index          = NULL;
+		plan->planfile_chunkcount     = 0;
+		plan->planfile_prefabcapacity = 0;
+		return 1;
+	}
+	plan->paging_cap = cap;
+	snprintf(
+		message, sizeof(message), "Opened %d chunks paged (%lu MB cap) in %.1f ms.",
+		plan->planfile_chunkcount, (unsigned long)(cap >> 20), (SDL_GetPerformanceCounter()-start)*1000.0/SDL_GetPerformanceFrequency()
+	);
+	WRITE_I(message);
+	return 0;
+}
+
+/* An empty plan. */
+static void
+BAS_Plan_Init(struct BAS_Plan *p)
+{
+	memset(p, 0, sizeof(*p));
+	p->floor_outdated = 1;
+	p->paging_cap     = PAGING_DEFAULT_CAP;
+	p->paging_frame   = 1;
+	p->paging_stuck   = -1;
+}
+static void
+BAS_Plan_Free(struct BAS_Plan *p)
+{
+	struct BAS_Plan *const current = plan;
+	plan = p;
+	BAS_Paging_Close();
+	plan = current;
+	BAS_Free(p->planfile_index);
+	BAS_Free(p->instances);
+	BAS_Free(p->prefab_things);
+	BAS_Free(p->prefab_rooms);
+	BAS_Free(p->prefabs);
+	BAS_Free(p->roomneighbours);
+	BAS_Free(p->floorrects);
+	BAS_Free(p->things.flags);
+	BAS_Free(p->things.facing);
+	BAS_Free(p->things.type);
+	BAS_Free(p->things.thingposition[1]);
+	BAS_Free(p->things.thingposition[0]);
+	BAS_Free(p->roomindex);
+	BAS_Free(p->lines);
+	BAS_Free(p->rooms);
+	BAS_Plan_Init(p);
+}
+
+/*
+ * Save the plan to the given path. If it is the file last saved or loaded,
+ * only the chunks which changed since are appended to it, with a new index,
+ * unless more than half the file has become unused slots. Otherwise the whole
+ * plan is written to a temporary file which then replaces the one at path.
+ * Returns 0 on success, 1 on error (the file at path then still holds the
+ * previous save).
+ */
+static int
+BAS_Plan_Save(const char *path)
+{
+	register int i, r, t, n;
+	int *roomlist = NULL, *thinglist = NULL, *instancelist = NULL, instancecount = 0, chunkcount = 0, written = 0, size;
+	struct planchunk_lists *lists = NULL;
+	unsigned char *intact = NULL;
+	Uint8 *buffer = NULL;
+	struct BAS_PlanChunkEntry *previous = NULL, *index = NULL;
+	int previouscount = 0, incremental, maximum;
+	Uint64 livebytes = 0, byteswritten = 0;
+	FILE *file = NULL;
+	char message[128], temporary[104] = "";
+	const struct BAS_Plan saved = *plan;
+	const Uint64 start = SDL_GetPerformanceCounter();
+	if (!BAS_PlanFile_PathFits(path))
+	{
+		return 1;
+	}
+	/* A paged plan keeps the chunks which are not resident, they must not collide with resident ones. */
+	if (plan->paging_map && (strcmp(plan->planfile_path, path) || BAS_Paging_PageInEdited()))
+	{
+		WRITE_E("A paged plan can only be saved to its own file!");
+		return 1;
+	}
+	if (BAS_Instance_ExpandPending())
+	{
+		return 1;
+	}
+	/* Group the rooms, things and instances by chunk. */
+	roomlist     = malloc((plan->room_count+1)*sizeof(int));
+	thinglist    = malloc((plan->thing_count+1)*sizeof(int));
+	instancelist = malloc((plan->instance_count+1)*sizeof(int));
+	intact       = calloc(plan->instance_count+1, 1);
+	index        = BAS_Alloc(MEMORY_PLAN, (plan->room_count+plan->thing_count+plan->planfile_chunkcount+1)*sizeof(struct BAS_PlanChunkEntry));
+	lists        = malloc((plan->room_count+plan->thing_count+1)*sizeof(struct planchunk_lists));
+	if (!roomlist || !thinglist || !instancelist || !intact || !index || !lists)
+	{
+		goto outofmemory;
+	}
+	for (i = 0; i < plan->room_count; i++)
+	{
+		roomlist[i] = i;
+	}
+	for (i = 0; i < plan->thing_count; i++)
+	{
+		thinglist[i] = i;
+	}
+	qsort(roomlist, plan->room_count, sizeof(int), planroom_compare);
+	qsort(thinglist, plan->thing_count, sizeof(int), planthing_compare);
+	/* Instances which straddle chunks are saved as plain rooms and things. */
+	for (i = 0; i < plan->instance_count; i++)
+	{
+		if (BAS_PlanChunk_HoldsInstance(&plan->instances[i]))
+		{
+			instancelist[instancecount++] = i;
+		}
+	}
+	qsort(instancelist, instancecount, sizeof(int), planinstance_compare);
+	/* Walk the lists chunk by chunk. */
+	maximum = BAS_Prefab_TableSize();
+	for (r = t = n = 0; r < plan->room_count || t < plan->thing_count; chunkcount++)
+	{
+		int chunkx, chunky;
+		struct planchunk_lists *list = &lists[chunkcount];
+		if (t >= plan->thing_count || (r < plan->room_count && planroomthing_compare(roomlist[r], thinglist[t]) <= 0))
+		{
+			chunkx = BAS_PlanChunk_OfCell(plan->rooms[roomlist[r]].cellposition[0]);
+			chunky = BAS_PlanChunk_OfCell(plan->rooms[roomlist[r]].cellposition[1]);
+		}
+		else
+		{
+			chunkx = BAS_PlanChunk_OfThing(plan->things.thingposition[0][thinglist[t]]);
+			chunky = BAS_PlanChunk_OfThing(plan->things.thingposition[1][thinglist[t]]);
+		}
+		list->rooms  = r;
+		list->things = t;
+		while (r < plan->room_count
+		    && BAS_PlanChunk_OfCell(plan->rooms[roomlist[r]].cellposition[0]) == chunkx
+		    && BAS_PlanChunk_OfCell(plan->rooms[roomlist[r]].cellposition[1]) == chunky)
+		{
+			r++;
+		}
+		while (t < plan->thing_count
+		    && BAS_PlanChunk_OfThing(plan->things.thingposition[0][thinglist[t]]) == chunkx
+		    && BAS_PlanChunk_OfThing(plan->things.thingposition[1][thinglist[t]]) == chunky)
+		{
+			t++;
+		}
+		/* Instances in chunks without rooms or things are not intact. */
+		while (n < instancecount && planchunk_compare(
+			BAS_PlanChunk_OfInstance(&plan->instances[instancelist[n]], 0), BAS_PlanChunk_OfInstance(&plan->instances[instancelist[n]], 1), chunkx, chunky
+		) < 0)
+		{
+			n++;
+		}
+		list->instances = n;
+		while (n < instancecount
+		    && BAS_PlanChunk_OfInstance(&plan->instances[instancelist[n]], 0) == chunkx
+		    && BAS_PlanChunk_OfInstance(&plan->instances[instancelist[n]], 1) == chunky)
+		{
+			n++;
+		}
+		list->roomcount     = r-list->rooms;
+		list->thingcount    = t-list->things;
+		list->instancecount = n-list->instances;
+		if (BAS_PlanChunk_Omit(
+			roomlist+list->rooms, &list->roomcount, thinglist+list->things, &list->thingcount,
+			instancelist+list->instances, &list->instancecount
+		))
+		{
+			goto outofmemory;
+		}
+		for (i = 0; i < list->instancecount; i++)
+		{
+			intact[instancelist[list->instances+i]] = 1;
+		}
+		index[chunkcount].chunkposition[0] = chunkx;
+		index[chunkcount].chunkposition[1] = chunky;
+		size    = BAS_PlanChunk_MaximumSize(list->roomcount, list->thingcount, list->instancecount);
+		maximum = size > maximum ? size : maximum;
+	}
+	if (!(buffer = malloc(maximum ? maximum : 1)))
+	{
+		goto outofmemory;
+	}
+	/* Incremental save: the file must still be the one we have the index of. */
+	incremental = 0;
+	if (plan->planfile_index && !strcmp(plan->planfile_path, path) && (file = fopen(path, "r+b")))
+	{
+		Uint8 header[PLANFILE_HEADER_SIZE];
+		incremental = fread(header, PLANFILE_HEADER_SIZE, 1, file) == 1
+		           && !memcmp(header, "BASPLAN", 8)
+		           && BAS_GetU32(header+16) == (Uint32)(plan->planfile_chunkcount+(plan->planfile_prefabcapacity != 0))
+		           && BAS_GetU64(header+24) == plan->planfile_indexoffset;
+		livebytes = plan->planfile_prefabcapacity;
+		for (i = 0; incremental && i < plan->planfile_chunkcount; i++)
+		{
+			livebytes += plan->planfile_index[i].capacity;
+		}
+		/* Compact when more than half of the file is unused (a paged file is still needed as it is). */
+		if (incremental && !plan->paging_map && (plan->planfile_end-PLANFILE_HEADER_SIZE)/2 > livebytes)
+		{
+			incremental = 0;
+		}
+		if (!incremental)
+		{
+			fclose(file);
+			file = NULL;
+		}
+	}
+	if (incremental)
+	{
+		previous      = plan->planfile_index;
+		previouscount = plan->planfile_chunkcount;
+	}
+	else if (plan->paging_map)
+	{
+		WRITE_E("The paged plan file has changed on disk!");
+		goto failed;
+	}
+	else
+	{
+		snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+		if (!(file = fopen(temporary, "w+b")))
+		{
+			WRITE_E("Failed to open file for writing!");
+			goto failed;
+		}
+		plan->planfile_end            = PLANFILE_HEADER_SIZE;
+		plan->planfile_indexoffset    = 0;
+		plan->planfile_indexcapacity  = 0;
+		plan->planfile_prefabcapacity = 0;
+	}
+	/* Write the chunks which are new or have changed, after everything the header refers to. */
+	for (i = 0; i < chunkcount; i++)
+	{
+		struct BAS_PlanChunkEntry *chunk = &index[i];
+		const struct BAS_PlanChunkEntry *old;
+		size = BAS_PlanChunk_Encode(
+			buffer, chunk->chunkposition[0], chunk->chunkposition[1],
+			roomlist+lists[i].rooms, lists[i].roomcount, thinglist+lists[i].things, lists[i].thingcount,
+			instancelist+lists[i].instances, lists[i].instancecount
+		);
+		chunk->size     = size;
+		chunk->crc      = BAS_CRC32C(buffer, size);
+		chunk->resident = 1;
+		old = BAS_PlanFile_FindChunk(previous, previouscount, chunk->chunkposition[0], chunk->chunkposition[1]);
+		chunk->lastuse  = old ? old->lastuse : plan->paging_frame;
+		if (old && old->size == chunk->size && old->crc == chunk->crc)
+		{
+			chunk->offset   = old->offset;
+			chunk->capacity = old->capacity;
+			continue;
+		}
+		chunk->offset       = plan->planfile_end;
+		chunk->capacity     = size;
+		plan->planfile_end += size;
+		if (fseek(file, (long)chunk->offset, SEEK_SET) || fwrite(buffer, 1, size, file) != (size_t)size)
+		{
+			WRITE_E("Failed to write a chunk!");
+			goto failed;
+		}
+		byteswritten += size;
+		written++;
+	}
+	/* The prefab table goes the same way as a chunk. */
+	if (plan->prefab_count || plan->planfile_prefabcapacity)
+	{
+		const Uint32 crc = BAS_CRC32C(buffer, size = BAS_Prefab_EncodeTable(buffer));
+		if (!plan->planfile_prefabcapacity || (Uint32)size != plan->planfile_prefabsize || crc != plan->planfile_prefabcrc)
+		{
+			plan->planfile_prefaboffset   = plan->planfile_end;
+			plan->planfile_prefabcapacity = size;
+			plan->planfile_end           += size;
+			if (fseek(file, (long)plan->planfile_prefaboffset, SEEK_SET) || fwrite(buffer, 1, size, file) != (size_t)size)
+			{
+				WRITE_E("Failed to write the prefabs!");
+				goto failed;
+			}
+			byteswritten += size;
+		}
+		plan->planfile_prefabsize = size;
+		plan->planfile_prefabcrc  = crc;
+	}
+	/* Chunks which are paged out stay as they are. */
+	for (i = 0; i < previouscount; i++)
+	{
+		if (!previous[i].resident)
+		{
+			index[chunkcount++] = previous[i];
+		}
+	}
+	qsort(index, chunkcount, sizeof(struct BAS_PlanChunkEntry), planentry_compare);
+	/*
+	 * The new index goes after the chunks. Only once both are on the disk
+	 * does the header point to it, the header being the last write.
+	 */
+	plan->planfile_index         = index;
+	plan->planfile_chunkcount    = chunkcount;
+	plan->planfile_indexoffset   = plan->planfile_end;
+	plan->planfile_indexcapacity = chunkcount+(plan->planfile_prefabcapacity != 0);
+	plan->planfile_end          += (Uint64)plan->planfile_indexcapacity*PLANFILE_ENTRY_SIZE;
+	index                        = NULL;
+	if (BAS_PlanFile_WriteIndex(file) || BAS_PlanFile_Sync(file) || BAS_PlanFile_WriteHeader(file) || BAS_PlanFile_Sync(file))
+	{
+		WRITE_E("Failed to write the index!");
+		goto failed;
+	}
+	byteswritten += (Uint64)plan->planfile_indexcapacity*PLANFILE_ENTRY_SIZE+PLANFILE_HEADER_SIZE;
+	fclose(file);
+	file = NULL;
+	/* Where rename does not replace an existing file, the old one has to go first. */
+	if (!incremental && rename(temporary, path) && (remove(path) || rename(temporary, path)))
+	{
+		WRITE_E("Failed to replace the plan file!");
+		goto failed;
+	}
+	BAS_Free(saved.planfile_index);
+	plan->planfile_revision++;
+	strcpy(plan->planfile_path, path);
+	if (plan->paging_map && BAS_Paging_Map())
+	{
+		WRITE_E("Failed to map the plan file again!");
+	}
+	/* Instances which were not written are now plain rooms and things. */
+	for (i = n = 0; i < plan->instance_count; i++)
+	{
+		if (intact[i])
+		{
+			plan->instances[n++] = plan->instances[i];
+		}
+	}
+	if (n < plan->instance_count)
+	{
+		snprintf(message, sizeof(message), "%d edited or straddling prefab instances saved as plain rooms.", plan->instance_count-n);
+		WRITE_I(message);
+	}
+	plan->instance_count = n;
+	free(roomlist);
+	free(thinglist);
+	free(instancelist);
+	free(intact);
+	free(lists);
+	free(buffer);
+	snprintf(
+		message, sizeof(message), "Saved %d of %d chunks, %llu bytes written, in %.1f ms.",
+		written, chunkcount, (unsigned long long)byteswritten, (SDL_GetPerformanceCounter()-start)*1000.0/SDL_GetPerformanceFrequency()
+	);
+	WRITE_I(message);
+	return 0;
+outofmemory:
+	WRITE_E("Out of memory!");
+failed:
+	/* Nothing the header refers to was overwritten, the previous save and its index still hold. */
+	if (file)
+	{
+		fclose(file);
+	}
+	if (temporary[0])
+	{
+		remove(temporary);
+	}
+	if (plan->planfile_index != saved.planfile_index)
+	{
+		BAS_Free(plan->planfile_index);
+	}
+	plan->planfile_index          = saved.planfile_index;
+	plan->planfile_chunkcount     = saved.planfile_chunkcount;
+	plan->planfile_indexoffset    = saved.planfile_indexoffset;
+	plan->planfile_indexcapacity  = saved.planfile_indexcapacity;
+	plan->planfile_prefaboffset   = saved.planfile_prefaboffset;
+	plan->planfile_prefabsize     = saved.planfile_prefabsize;
+	plan->planfile_prefabcapacity = saved.planfile_prefabcapacity;
+	plan->planfile_prefabcrc      = saved.planfile_prefabcrc;
+	plan->planfile_end            = saved.planfile_end;
+	free(roomlist);
+	free(thinglist);
+	free(instancelist);
+	free(intact);
+	free(lists);
+	free(buffer);
+	BAS_Free(index);
+	return 1;
+}
+
+/*
+ * Replace the plan with the one saved at the given path.
+ * Returns 0 on success, 1 on error (the plan is then left empty).
+ */
+static int
+BAS_Plan_Load(const char *path)
+{
+	register int i;
+	Uint8 header[PLANFILE_HEADER_SIZE], *buffer = NULL;
+	Uint32 buffercapacity = 0;
+	struct BAS_PlanChunkEntry *index, prefabs;
+	int chunkcount;
+	Uint64 end;
+	char message[128];
+	FILE *file;
+	const Uint64 start = SDL_GetPerformanceCounter();
+	if (!BAS_PlanFile_PathFits(path))
+	{
+		return 1;
+	}
+	if (!(file = fopen(path, "rb")))
+	{
+		WRITE_E("Failed to open file for reading!");
+		return 1;
+	}
+	if (!(index = BAS_PlanFile_ReadIndex(file, header, &chunkcount, &prefabs, &end)))
+	{
+		fclose(file);
+		return 1;
+	}
+	BAS_Paging_Close();
+	BAS_Plan_Clear();
+	/* The prefabs come first, chunks refer to them. */
+	for (i = prefabs.capacity ? -1 : 0; i < chunkcount; i++)
+	{
+		struct BAS_PlanChunkEntry *chunk = i < 0 ? &prefabs : &index[i];
+		if (BAS_PlanFile_ReadSlot(file, chunk, &buffer, &buffercapacity))
+		{
+			goto failed;
+		}
+		if (i < 0 ? BAS_Prefab_DecodeTable(buffer, buffer+chunk->size) : BAS_PlanChunk_Decode(buffer, buffer+chunk->size, chunk->chunkposition[0], chunk->chunkposition[1]))
+		{
+			WRITE_E("Malformed chunk!");
+			goto failed;
+		}
+		chunk->resident = 1;
+	}
+	fclose(file);
+	free(buffer);
+	BAS_PlanFile_Adopt(path, header, index, chunkcount, &prefabs, end);
+	snprintf(
+		message, sizeof(message), "Loaded %d rooms and %d things from %d chunks in %.1f ms.",
+		plan->room_count, plan->thing_count, chunkcount, (SDL_GetPerformanceCounter()-start)*1000.0/SDL_GetPerformanceFrequency()
+	);
+	WRITE_I(message);
+	return 0;
+failed:
+	fclose(file);
+	free(buffer);
+	BAS_Free(index);
+	BAS_Plan_Clear();
+	return 1;
+}
+
+/*
+ * ----------------
+ * Live link.
+ * The editor's plan can be published to a POSIX shared memory region, so a
+ * running game (or the stand-in consumer, src/livelink.c) picks up every edit
+ * within a frame without going through a file. The layout and the seqlock
+ * guarding it are described in livelink.h. A publish writes the walls and
+ * things of the chunks changed since the previous one after what the region
+ * holds, with a new chunk table, and happens at most once per frame, after the
+ * walls are recalculated. Once most of the region is no longer referred to,
+ * the whole plan is written again from the start.
+ * A paged plan lets go of chunks which are still in the file, it has no live
+ * link.
+ * ----------------
+ */
+#ifdef BAS_HAVE_SHM
+#define LIVELINK_INITIAL_SIZE ((size_t)1 << 20)
+/* A chunk of the region's chunk table. */
+struct livelink_chunk
+{
+	int chunkposition[2];
+	Uint32 offset;      /* Of its walls and then its things, in values after the header. */
+	Uint32 line_count;
+	Uint32 thing_count;
+};
+static struct BAS_LiveLinkHeader *livelink_header = NULL;
+static size_t livelink_mapsize = 0;
+static int livelink_descriptor = -1;
+static struct livelink_chunk *livelink_chunks = NULL; /* As in the region, sorted like livelinkchunk_compare. */
+static int livelink_chunk_count = 0;
+static size_t livelink_used = 0; /* Values written after the header. */
+static size_t livelink_live = 0; /* Of those, the ones of the chunks in the table. */
+/* Walls and things of the chunks being published. */
+static int32_t *livelink_walls  = NULL;
+static int32_t *livelink_things = NULL;
+static int livelink_walls_capacity  = 0;
+static int livelink_things_capacity = 0;
+
+/* Size the region to at least `size` bytes and map it. Returns 0 on success, 1 on error. */
+static int
+BAS_LiveLink_Map(size_t size)
+{
+	void *map;
+	struct stat status;
+	if (fstat(livelink_descriptor, &status))
+	{
+		return 1;
+	}
+	if ((size_t)status.st_size > size)
+	{
+		size = status.st_size;
+	}
+	if (((size_t)status.st_size < size && ftruncate(livelink_descriptor, size)) || size > UINT32_MAX)
+	{
+		return 1;
+	}
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, livelink_descriptor, 0);
+	if (map == MAP_FAILED)
+	{
+		return 1;
+	}
+	if (livelink_header)
+	{
+		munmap(livelink_header, livelink_mapsize);
+	}
+	livelink_header  = map;
+	livelink_mapsize = size;
+	return 0;
+}
+
+static void
+BAS_LiveLink_Close(void)
+{
+	if (!livelink_header)
+	{
+		return;
+	}
+	LIVELINK_SEQUENCE_WRITE(livelink_header, livelink_header->sequence+1);
+	LIVELINK_FENCE_RELEASE();
+	livelink_header->flags |= LIVELINK_FLAG_CLOSED;
+	LIVELINK_SEQUENCE_WRITE(livelink_header, livelink_header->sequence+1);
+	munmap(livelink_header, livelink_mapsize);
+	close(livelink_descriptor);
+	livelink_header      = NULL;
+	livelink_mapsize     = 0;
+	livelink_descriptor  = -1;
+	livelink_active      = 0;
+	livelink_dirty_count = 0;
+	BAS_Free(livelink_chunks);
+	BAS_Free(livelink_walls);
+	BAS_Free(livelink_things);
+	livelink_chunks          = NULL;
+	livelink_walls           = NULL;
+	livelink_things          = NULL;
+	livelink_chunk_count     = 0;
+	livelink_walls_capacity  = 0;
+	livelink_things_capacity = 0;
+	livelink_used            = 0;
+	livelink_live            = 0;
+}
+
+/*
+ * Open (or create) the region of the given name and publish the whole plan
+ * on the next frame. A region left by an earlier session is taken over, its
+ * consumers carry on. Returns 0 on success, 1 on error.
+ */
+static int
+BAS_LiveLink_Open(const char *name)
+{
+	struct BAS_LiveLinkHeader *header;
+	BAS_LiveLink_Close();
+	if (plan_editor.paging_map)
+	{
+		WRITE_E("The live link cannot follow a paged plan!");
+		return 1;
+	}
+	if ((livelink_descriptor = shm_open(name, O_RDWR | O_CREAT, 0600)) < 0)
+	{
+		WRITE_E("Failed to open the live link!");
+		return 1;
+	}
+	if (BAS_LiveLink_Map(LIVELINK_INITIAL_SIZE))
+	{
+		WRITE_E("Failed to map the live link!");
+		close(livelink_descriptor);
+		livelink_descriptor = -1;
+		return 1;
+	}
+	header = livelink_header;
+	if (memcmp(header->magic, LIVELINK_MAGIC, 8) || header->version != LIVELINK_VERSION)
+	{
+		memset(header, 0, sizeof(struct BAS_LiveLinkHeader));
+		memcpy(header->magic, LIVELINK_MAGIC, 8);
+		header->version = LIVELINK_VERSION;
+	}
+	LIVELINK_SEQUENCE_WRITE(header, (header->sequence+1) | 1);
+	LIVELINK_FENCE_RELEASE();
+	header->size        = (uint32_t)livelink_mapsize;
+	header->flags       = LIVELINK_FLAG_FULL;
+	header->cell_scale  = CELL_SCALE;
+	header->thing_scale = THING_SCALE;
+	header->chunk_size  = LIVELINK_CHUNK_SIZE;
+	header->line_count  = header->thing_count = header->dirty_count = header->chunk_count = header->used = 0;
+	LIVELINK_SEQUENCE_WRITE(header, header->sequence+1);
+	livelink_active = 1;
+	livelink_full   = 1;
+	return 0;
+}
+
+static int
+livelinkchunk_compare(const void *a, const void *b)
+{
+	const int *ca = a, *cb = b;
+	if (ca[1] != cb[1]) { return ca[1] < cb[1] ? -1 : 1; }
+	if (ca[0] != cb[0]) { return ca[0] < cb[0] ? -1 : 1; }
+	return 0;
+}
+/* Index of the given chunk in the sorted dirty list, or -1. */
+static inline int
+BAS_LiveLink_FindDirty(int chunkx, int chunky)
+{
+	const int key[2] = {chunkx, chunky};
+	const int (*found)[2] = bsearch(key, livelink_dirty, livelink_dirty_count, sizeof(int[2]), livelinkchunk_compare);
+	return found ? (int)(found-livelink_dirty) : -1;
+}
+/* Append a wall to the walls of the chunks being published. Returns 0 on success, 1 on error. */
+static inline int
+BAS_LiveLink_AddWall(int count, int cx, int cy, int side)
+{
+	int32_t *wall;
+	if (BAS_Reserve(MEMORY_WORK, (void **)&livelink_walls, &livelink_walls_capacity, (count+1)*LIVELINK_LINE_FIELDS, sizeof(int32_t)))
+	{
+		return 1;
+	}
+	wall    = livelink_walls+(size_t)count*LIVELINK_LINE_FIELDS;
+	wall[0] = cx+SIDE_WALL[side][0];
+	wall[1] = cy+SIDE_WALL[side][1];
+	wall[2] = cx+SIDE_WALL[side][2];
+	wall[3] = cy+SIDE_WALL[side][3];
+	return 0;
+}
+
+/*
+ * Gather the walls and things of the dirty chunks, by chunk: dirty[i] gets
+ * the walls from dirty[i][0] on, dirty[i][1] of them, and likewise the things
+ * in dirty[i][2] and dirty[i][3]. A few chunks look their rooms up cell by
+ * cell, more go through every wall. Returns 0 on success, 1 on error.
+ */
+static int
+BAS_LiveLink_Gather(int (*dirty)[4])
+{
+	register int i, x, y;
+	int side, count = 0;
+	const int chunkcells = LIVELINK_CHUNK_SIZE*LIVELINK_CHUNK_SIZE;
+	if (!livelink_full && (size_t)livelink_dirty_count*chunkcells < (size_t)plan->line_count)
+	{
+		for (i = 0; i < livelink_dirty_count; i++)
+		{
+			const int left = livelink_dirty[i][0]*LIVELINK_CHUNK_SIZE;
+			const int top  = livelink_dirty[i][1]*LIVELINK_CHUNK_SIZE;
+			dirty[i][0] = count;
+			for (y = top; y < top+LIVELINK_CHUNK_SIZE; y++)
+			{
+				for (x = left; x < left+LIVELINK_CHUNK_SIZE; x++)
+				{
+					if (BAS_RoomIndex_FindSlot(x, y) < 0)
+					{
+						continue;
+					}
+					for (side = 0; side < 4; side++)
+					{
+						if (BAS_RoomIndex_FindSlot(x+SIDE_NEIGHBOUR[side][0], y+SIDE_NEIGHBOUR[side][1]) < 0 && BAS_LiveLink_AddWall(count++, x, y, side))
+						{
+							return 1;
+						}
+					}
+				}
+			}
+			dirty[i][1] = count-dirty[i][0];
+		}
+	}
+	else
+	{
+		int *chunks = BAS_Alloc(MEMORY_WORK, (plan->line_count+1)*sizeof(int));
+		if (!chunks || BAS_Reserve(MEMORY_WORK, (void **)&livelink_walls, &livelink_walls_capacity, plan->line_count*LIVELINK_LINE_FIELDS, sizeof(int32_t)))
+		{
+			BAS_Free(chunks);
+			return 1;
+		}
+		for (i = 0; i < plan->line_count; i++)
+		{
+			int nodes[4];
+			side = BAS_Line_Side(&plan->lines[i]);
+			BAS_Line_Nodes(&plan->lines[i], nodes);
+			chunks[i] = BAS_LiveLink_FindDirty(
+				BAS_FloorDiv(nodes[0]-SIDE_WALL[side][0], LIVELINK_CHUNK_SIZE), BAS_FloorDiv(nodes[1]-SIDE_WALL[side][1], LIVELINK_CHUNK_SIZE)
+			);
+			if (chunks[i] >= 0)
+			{
+				dirty[chunks[i]][1]++;
+			}
+		}
+		for (i = 0; i < livelink_dirty_count; i++)
+		{
+			dirty[i][0] = count;
+			count      += dirty[i][1];
+			dirty[i][1] = 0;
+		}
+		for (i = 0; i < plan->line_count; i++)
+		{
+			if (chunks[i] >= 0)
+			{
+				BAS_Line_Nodes(&plan->lines[i], livelink_walls+(size_t)(dirty[chunks[i]][0]+dirty[chunks[i]][1]++)*LIVELINK_LINE_FIELDS);
+			}
+		}
+		BAS_Free(chunks);
+	}
+	/* Things, counted and then placed. */
+	count = 0;
+	for (i = 0; i < plan->thing_count; i++)
+	{
+		const int chunk = BAS_LiveLink_FindDirty(
+			BAS_FloorDiv(plan->things.thingposition[0][i], CELL_SCALE*LIVELINK_CHUNK_SIZE),
+			BAS_FloorDiv(plan->things.thingposition[1][i], CELL_SCALE*LIVELINK_CHUNK_SIZE)
+		);
+		if (chunk >= 0)
+		{
+			dirty[chunk][3]++;
+			count++;
+		}
+	}
+	if (BAS_Reserve(MEMORY_WORK, (void **)&livelink_things, &livelink_things_capacity, count*LIVELINK_THING_FIELDS, sizeof(int32_t)))
+	{
+		return 1;
+	}
+	for (i = count = 0; i < livelink_dirty_count; i++)
+	{
+		dirty[i][2] = count;
+		count      += dirty[i][3];
+		dirty[i][3] = 0;
+	}
+	for (i = 0; count && i < plan->thing_count; i++)
+	{
+		int32_t *values;
+		const int chunk = BAS_LiveLink_FindDirty(
+			BAS_FloorDiv(plan->things.thingposition[0][i], CELL_SCALE*LIVELINK_CHUNK_SIZE),
+			BAS_FloorDiv(plan->things.thingposition[1][i], CELL_SCALE*LIVELINK_CHUNK_SIZE)
+		);
+		if (chunk < 0)
+		{
+			continue;
+		}
+		values    = livelink_things+(size_t)(dirty[chunk][2]+dirty[chunk][3]++)*LIVELINK_THING_FIELDS;
+		values[0] = plan->things.thingposition[0][i];
+		values[1] = plan->things.thingposition[1][i];
+		values[2] = plan->things.type[i];
+		values[3] = plan->things.facing[i];
+		values[4] = (int32_t)(Uint32)plan->things.flags[i];
+		values[5] = (int32_t)(Uint32)(plan->things.flags[i] >> 32);
+	}
+	return 0;
+}
+
+/*
+ * Publish the editor's plan if it changed since the last time and its walls
+ * are up to date. Only the dirty chunks are gathered and written, after what
+ * is in the region already, along with a new chunk table.
+ */
+static void
+BAS_LiveLink_Publish(void)
+{
+	register int i, j;
+	int (*dirty)[4], table_count = 0;
+	size_t needed, blocks = 0, offset;
+	Uint32 line_count = 0, thing_count = 0;
+	int32_t *values;
+	struct livelink_chunk *table;
+	struct BAS_LiveLinkHeader *header;
+	if (!livelink_header || plan != &plan_editor || plan->lines_outdated || (!livelink_full && !livelink_dirty_count))
+	{
+		return;
+	}
+	/* Start over once most of the region is left over from earlier publishes. */
+	if (livelink_used > 2*livelink_live+LIVELINK_INITIAL_SIZE/sizeof(int32_t))
+	{
+		livelink_full = 1;
+	}
+	if (livelink_full)
+	{
+		/* Every chunk with a room or a thing is dirty. */
+		if (BAS_Reserve(MEMORY_WORK, (void **)&livelink_dirty, &livelink_dirty_capacity, plan->room_count+plan->thing_count, sizeof(int[2])))
+		{
+			WRITE_E("Out of memory, closing the live link.");
+			BAS_LiveLink_Close();
+			return;
+		}
+		for (i = 0; i < plan->room_count; i++)
+		{
+			livelink_dirty[i][0] = BAS_FloorDiv(plan->rooms[i].cellposition[0], LIVELINK_CHUNK_SIZE);
+			livelink_dirty[i][1] = BAS_FloorDiv(plan->rooms[i].cellposition[1], LIVELINK_CHUNK_SIZE);
+		}
+		for (j = 0; j < plan->thing_count; j++, i++)
+		{
+			livelink_dirty[i][0] = BAS_FloorDiv(plan->things.thingposition[0][j], CELL_SCALE*LIVELINK_CHUNK_SIZE);
+			livelink_dirty[i][1] = BAS_FloorDiv(plan->things.thingposition[1][j], CELL_SCALE*LIVELINK_CHUNK_SIZE);
+		}
+		livelink_dirty_count = i;
+		livelink_chunk_count = 0;
+		livelink_used        = 0;
+		livelink_live        = 0;
+	}
+	qsort(livelink_dirty, livelink_dirty_count, sizeof(int[2]), livelinkchunk_compare);
+	for (i = j = 0; i < livelink_dirty_count; i++)
+	{
+		if (!j || livelinkchunk_compare(livelink_dirty[i], livelink_dirty[j-1]))
+		{
+			livelink_dirty[j][0] = livelink_dirty[i][0];
+			livelink_dirty[j][1] = livelink_dirty[i][1];
+			j++;
+		}
+	}
+	livelink_dirty_count = j;
+	dirty = BAS_Calloc(MEMORY_WORK, livelink_dirty_count+1, sizeof(int[4]));
+	table = BAS_Alloc(MEMORY_WORK, (livelink_chunk_count+livelink_dirty_count+1)*sizeof(struct livelink_chunk));
+	if (!dirty || !table || BAS_LiveLink_Gather(dirty))
+	{
+		WRITE_E("Out of memory, closing the live link.");
+		BAS_Free(dirty);
+		BAS_Free(table);
+		BAS_LiveLink_Close();
+		return;
+	}
+	/* The chunk table: the chunks which are not dirty keep their place, the dirty ones go after what is there. */
+	for (i = j = 0; i < livelink_chunk_count || j < livelink_dirty_count; )
+	{
+		const int order = i >= livelink_chunk_count ? 1 : j >= livelink_dirty_count ? -1 : livelinkchunk_compare(livelink_chunks[i].chunkposition, livelink_dirty[j]);
+		if (order < 0)
+		{
+			table[table_count++] = livelink_chunks[i++];
+			continue;
+		}
+		if (order == 0)
+		{
+			livelink_live -= (size_t)livelink_chunks[i].line_count*LIVELINK_LINE_FIELDS+(size_t)livelink_chunks[i].thing_count*LIVELINK_THING_FIELDS;
+			i++;
+		}
+		if (dirty[j][1] || dirty[j][3])
+		{
+			struct livelink_chunk *chunk = &table[table_count++];
+			chunk->chunkposition[0] = livelink_dirty[j][0];
+			chunk->chunkposition[1] = livelink_dirty[j][1];
+			chunk->offset           = (Uint32)(livelink_used+blocks);
+			chunk->line_count       = dirty[j][1];
+			chunk->thing_count      = dirty[j][3];
+			blocks += (size_t)dirty[j][1]*LIVELINK_LINE_FIELDS+(size_t)dirty[j][3]*LIVELINK_THING_FIELDS;
+		}
+		j++;
+	}
+	needed = sizeof(struct BAS_LiveLinkHeader)+sizeof(int32_t)*(
+		livelink_used+blocks+(size_t)table_count*LIVELINK_CHUNK_FIELDS+(livelink_full ? 0 : (size_t)livelink_dirty_count*2)
+	);
+	if (needed > livelink_mapsize)
+	{
+		size_t size = livelink_mapsize;
+		while (size < needed)
+		{
+			size *= 2;
+		}
+		if (BAS_LiveLink_Map(size))
+		{
+			WRITE_E("Failed to grow the live link, closing it.");
+			BAS_Free(dirty);
+			BAS_Free(table);
+			BAS_LiveLink_Close();
+			return;
+		}
+	}
+	header = livelink_header;
+	values = (int32_t *)(header+1);
+	LIVELINK_SEQUENCE_WRITE(header, header->sequence+1);
+	LIVELINK_FENCE_RELEASE();
+	offset = livelink_used;
+	for (j = 0; j < livelink_dirty_count; j++)
+	{
+		if (dirty[j][1])
+		{
+			memcpy(values+offset, livelink_walls+(size_t)dirty[j][0]*LIVELINK_LINE_FIELDS, (size_t)dirty[j][1]*LIVELINK_LINE_FIELDS*sizeof(int32_t));
+			offset += (size_t)dirty[j][1]*LIVELINK_LINE_FIELDS;
+		}
+		if (dirty[j][3])
+		{
+			memcpy(values+offset, livelink_things+(size_t)dirty[j][2]*LIVELINK_THING_FIELDS, (size_t)dirty[j][3]*LIVELINK_THING_FIELDS*sizeof(int32_t));
+			offset += (size_t)dirty[j][3]*LIVELINK_THING_FIELDS;
+		}
+	}
+	header->chunk_offset = (uint32_t)offset;
+	for (i = 0; i < table_count; i++)
+	{
+		values[offset++] = table[i].chunkposition[0];
+		values[offset++] = table[i].chunkposition[1];
+		values[offset++] = (int32_t)table[i].offset;
+		values[offset++] = (int32_t)table[i].line_count;
+		values[offset++] = (int32_t)table[i].thing_count;
+		line_count      += table[i].line_count;
+		thing_count     += table[i].thing_count;
+	}
+	header->dirty_offset = (uint32_t)offset;
+	header->dirty_count  = livelink_full ? 0 : livelink_dirty_count;
+	if (!livelink_full)
+	{
+		memcpy(values+offset, livelink_dirty, livelink_dirty_count*sizeof(int[2]));
+		offset += (size_t)livelink_dirty_count*2;
+	}
+	header->size        = (uint32_t)livelink_mapsize;
+	header->flags       = livelink_full ? LIVELINK_FLAG_FULL : 0;
+	header->line_count  = line_count;
+	header->thing_count = thing_count;
+	header->chunk_count = table_count;
+	header->used        = (uint32_t)offset;
+	header->generation++;
+	LIVELINK_SEQUENCE_WRITE(header, header->sequence+1);
+	BAS_Free(livelink_chunks);
+	BAS_Free(dirty);
+	livelink_chunks      = table;
+	livelink_chunk_count = table_count;
+	livelink_used        = offset;
+	livelink_live       += blocks;
+	livelink_dirty_count = 0;
+	livelink_full        = 0;
+}
+#else
+static int
+BAS_LiveLink_Open(const char *name)
+{
+	(void)name;
+	WRITE_E("The live link needs shared memory, which this platform build lacks.");
+	return 1;
+}
+static void
+BAS_LiveLink_Close(void)
+{
+}
+static void
+BAS_LiveLink_Publish(void)
+{
+}
+#endif
+
+/*
+ * ----------------
+ * Hot reload.
+ * The directory of the editor's plan file is watched (inotify), so a plan
+ * written by a script while the editor is open is taken in without F7. A
+ * worker thread reads the new index and decodes the chunks whose size or CRC
+ * differ from the index the editor has into a plan of its own; the main
+ * thread then only adds and removes the rooms, things and instances of those
+ * chunks, which updates the minimap, the level of detail and the live link
+ * for those chunks alone. Changed chunks take what is in the file, unsaved
+ * edits in them are lost. When the prefabs changed every chunk is taken
+ * again. A paged plan lets go of its changed chunks instead, they are paged
+ * in again from the new file.
+ * ----------------
+ */
+struct BAS_HotReloadJob
+{
+	SDL_Thread *thread;
+	SDL_atomic_t done;
+	/* The plan file as the editor knows it. */
+	char path[96];
+	struct BAS_PlanChunkEntry *known;
+	int known_count;
+	Uint32 known_prefabsize;
+	Uint32 known_prefabcrc;
+	int paged;
+	Uint32 revision;
+	/* The plan file as it is now, and what changed. */
+	int failed;
+	int full;                           /* The prefabs changed, so did every chunk. */
+	Uint8 header[PLANFILE_HEADER_SIZE];
+	struct BAS_PlanChunkEntry *index;
+	struct BAS_PlanChunkEntry prefabs;
+	int chunkcount;
+	Uint64 end;
+	struct BAS_PlanChunkEntry *changed; /* Positions only, in index order. */
+	int changed_count;
+	struct BAS_Plan scratch;            /* The prefabs and the changed chunks, unless paged. */
+	double milliseconds;
+};
+static struct BAS_HotReloadJob hotreload;
+static int hotreload_pending = 0;
+#ifdef BAS_HAVE_INOTIFY
+static int hotreload_descriptor = -1;
+static int hotreload_watch      = -1;
+static char hotreload_watched[96]; /* Path the watch is for, set once it is in place. */
+static char hotreload_warned[96];  /* Path a failure to watch was reported for, it is tried again quietly. */
+#endif
+
+static int
+hotreload_worker(void *data)
+{
+	register int i;
+	struct BAS_HotReloadJob *job = data;
+	Uint8 *buffer = NULL;
+	Uint32 buffercapacity = 0;
+	FILE *file;
+	const Uint64 start = SDL_GetPerformanceCounter();
+	plan = &job->scratch;
+	job->failed = 1;
+	BAS_Span_Thread("BAS_HotReload");
+	BAS_Span_Begin("hotreload_worker");
+	if (!(file = fopen(job->path, "rb")))
+	{
+		goto done;
+	}
+	if (!(job->index = BAS_PlanFile_ReadIndex(file, job->header, &job->chunkcount, &job->prefabs, &job->end))
+	 || !(job->changed = malloc((job->chunkcount+job->known_count+1)*sizeof(struct BAS_PlanChunkEntry))))
+	{
+		goto failed;
+	}
+	job->full = job->prefabs.size != job->known_prefabsize || job->prefabs.crc != job->known_prefabcrc;
+	for (i = 0; i < job->chunkcount; i++)
+	{
+		const struct BAS_PlanChunkEntry *chunk = &job->index[i];
+		const struct BAS_PlanChunkEntry *old   = BAS_PlanFile_FindChunk(job->known, job->known_count, chunk->chunkposition[0], chunk->chunkposition[1]);
+		if (job->full || !old || old->size != chunk->size || old->crc != chunk->crc)
+		{
+			job->changed[job->changed_count++] = *chunk;
+		}
+	}
+	/* Chunks which are gone from the file changed as well. */
+	for (i = 0; i < job->known_count; i++)
+	{
+		const struct BAS_PlanChunkEntry *old = &job->known[i];
+		if (job->full || !BAS_PlanFile_FindChunk(job->index, job->chunkcount, old->chunkposition[0], old->chunkposition[1]))
+		{
+			job->changed[job->changed_count++] = *old;
+		}
+	}
+	qsort(job->changed, job->changed_count, sizeof(struct BAS_PlanChunkEntry), planentry_compare);
+	/* The prefabs come first, chunks refer to them. */
+	if (job->prefabs.capacity && (
+		BAS_PlanFile_ReadSlot(file, &job->prefabs, &buffer, &buffercapacity)
+	 || BAS_Prefab_DecodeTable(buffer, buffer+job->prefabs.size)
+	))
+	{
+		goto failed;
+	}
+	for (i = 0; i < job->chunkcount && !job->paged; i++)
+	{
+		const struct BAS_PlanChunkEntry *chunk = &job->index[i];
+		if (!BAS_PlanFile_FindChunk(job->changed, job->changed_count, chunk->chunkposition[0], chunk->chunkposition[1]))
+		{
+			continue;
+		}
+		if (BAS_PlanFile_ReadSlot(file, chunk, &buffer, &buffercapacity)
+		 || BAS_PlanChunk_Decode(buffer, buffer+chunk->size, chunk->chunkposition[0], chunk->chunkposition[1]))
+		{
+			goto failed;
+		}
+	}
+	job->failed = BAS_Instance_ExpandPending();
+failed:
+	fclose(file);
+done:
+	free(buffer);
+	job->milliseconds = (SDL_GetPerformanceCounter()-start)*1000.0/SDL_GetPerformanceFrequency();
+	BAS_Span_End("hotreload_worker");
+	BAS_Span_ThreadEnd();
+	SDL_AtomicSet(&job->done, 1);
+	return 0;
+}
+
+/* Let go of everything the job holds. The thread must have finished. */
+static void
+BAS_HotReload_Reset(struct BAS_HotReloadJob *job)
+{
+	free(job->known);
+	BAS_Free(job->index);
+	free(job->changed);
+	BAS_Plan_Free(&job->scratch);
+	memset(job, 0, sizeof(*job));
+}
+
+/* Start reading the editor's plan file again, on a worker thread. Returns 0 on success, 1 on error. */
+static int
+BAS_HotReload_Start(void)
+{
+	struct BAS_HotReloadJob *job = &hotreload;
+	memset(job, 0, sizeof(*job));
+	if (!(job->known = malloc((plan->planfile_chunkcount+1)*sizeof(struct BAS_PlanChunkEntry))))
+	{
+		WRITE_E("Out of memory!");
+		return 1;
+	}
+	memcpy(job->known, plan->planfile_index, plan->planfile_chunkcount*sizeof(struct BAS_PlanChunkEntry));
+	strcpy(job->path, plan->planfile_path);
+	job->known_count      = plan->planfile_chunkcount;
+	job->known_prefabsize = plan->planfile_prefabcapacity ? plan->planfile_prefabsize : 0;
+	job->known_prefabcrc  = plan->planfile_prefabcapacity ? plan->planfile_prefabcrc  : 0;
+	job->paged            = plan->paging_map != NULL;
+	job->revision         = plan->planfile_revision;
+	BAS_Plan_Init(&job->scratch);
+	SDL_AtomicSet(&job->done, 0);
+	if (!(job->thread = SDL_CreateThread(hotreload_worker, "BAS_HotReload", job)))
+	{
+		WRITE_E("Failed to start the hot reload thread!");
+		BAS_HotReload_Reset(job);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Take the changed chunks of a finished job into the editor's plan and adopt
+ * the new index. Returns 1 if any thing was removed (thing indices have
+ * changed), 0 otherwise.
+ */
+static int
+BAS_HotReload_Apply(struct BAS_HotReloadJob *job)
+{
+	register int i, j;
+	int thingsremoved = 0, instance_count;
+	unsigned char *apply, *have, *want, *removedthings;
+	const int paged = plan->paging_map != NULL;
+	const int chunkbytes = PLANCHUNK_SIZE*PLANCHUNK_SIZE/8;
+	/* A bit per cell of every changed chunk: whether it has a room now and whether it should. */
+	apply         = malloc(job->changed_count);
+	have          = calloc(job->changed_count, chunkbytes);
+	want          = calloc(job->changed_count, chunkbytes);
+	removedthings = calloc(plan->thing_count+1, 1);
+	if (!apply || !have || !want || !removedthings
+	 || BAS_Instance_ExpandPending()
+	 || BAS_Room_Reserve(job->scratch.room_count) || BAS_Thing_Reserve(job->scratch.thing_count))
+	{
+		WRITE_E("Out of memory!");
+		goto done;
+	}
+	/* A paged plan only holds its resident chunks, the others are read from the new file when they are needed. */
+	for (i = 0; i < job->changed_count; i++)
+	{
+		const struct BAS_PlanChunkEntry *old = BAS_PlanFile_FindChunk(
+			plan->planfile_index, plan->planfile_chunkcount, job->changed[i].chunkposition[0], job->changed[i].chunkposition[1]
+		);
+		apply[i] = !paged || (old && old->resident);
+	}
+	for (i = 0; i < plan->room_count + job->scratch.room_count; i++)
+	{
+		const struct BAS_Room *room = i < plan->room_count ? &plan->rooms[i] : &job->scratch.rooms[i-plan->room_count];
+		const int chunkx = BAS_PlanChunk_OfCell(room->cellposition[0]);
+		const int chunky = BAS_PlanChunk_OfCell(room->cellposition[1]);
+		const struct BAS_PlanChunkEntry *chunk = BAS_PlanFile_FindChunk(job->changed, job->changed_count, chunkx, chunky);
+		if (chunk && apply[chunk-job->changed])
+		{
+			const int cell = (room->cellposition[1]-chunky*PLANCHUNK_SIZE)*PLANCHUNK_SIZE+room->cellposition[0]-chunkx*PLANCHUNK_SIZE;
+			(i < plan->room_count ? have : want)[(chunk-job->changed)*chunkbytes+cell/8] |= 1 << (cell & 7);
+		}
+	}
+	/* Rooms: only the cells which differ. */
+	for (i = 0; i < job->changed_count*chunkbytes; i++)
+	{
+		const int chunk = i/chunkbytes, origin[2] = {
+			job->changed[chunk].chunkposition[0]*PLANCHUNK_SIZE, job->changed[chunk].chunkposition[1]*PLANCHUNK_SIZE
+		};
+		if (have[i] == want[i])
+		{
+			continue;
+		}
+		for (j = 0; j < 8; j++)
+		{
+			const int cell = i%chunkbytes*8+j;
+			const int cx = origin[0]+cell%PLANCHUNK_SIZE, cy = origin[1]+cell/PLANCHUNK_SIZE;
+			if ((have[i] & ~want[i]) >> j & 1)
+			{
+				BAS_Room_Delete(cx, cy);
+			}
+			else if ((want[i] & ~have[i]) >> j & 1)
+			{
+				BAS_Room_Append(cx, cy);
+			}
+		}
+	}
+	/* Things and instances: those of the changed chunks make way for the file's. */
+	for (i = 0; i < plan->thing_count; i++)
+	{
+		const struct BAS_PlanChunkEntry *chunk = BAS_PlanFile_FindChunk(
+			job->changed, job->changed_count,
+			BAS_PlanChunk_OfThing(plan->things.thingposition[0][i]), BAS_PlanChunk_OfThing(plan->things.thingposition[1][i])
+		);
+		removedthings[i] = chunk && apply[chunk-job->changed];
+	}
+	thingsremoved = BAS_Thing_Remove(removedthings);
+	for (i = 0; i < job->scratch.thing_count; i++)
+	{
+		const int thing = BAS_Thing_Create(job->scratch.things.thingposition[0][i], job->scratch.things.thingposition[1][i], job->scratch.things.facing[i]);
+		plan->things.type[thing]  = job->scratch.things.type[i];
+		plan->things.flags[thing] = job->scratch.things.flags[i];
+	}
+	if (job->full)
+	{
+		/* The instances left refer to the old prefabs, their rooms and things stay as they are. */
+		struct BAS_Plan swap = *plan;
+		plan->prefabs               = job->scratch.prefabs;
+		plan->prefab_count          = job->scratch.prefab_count;
+		plan->prefab_capacity       = job->scratch.prefab_capacity;
+		plan->prefab_rooms          = job->scratch.prefab_rooms;
+		plan->prefab_room_count     = job->scratch.prefab_room_count;
+		plan->prefab_room_capacity  = job->scratch.prefab_room_capacity;
+		plan->prefab_things         = job->scratch.prefab_things;
+		plan->prefab_thing_count    = job->scratch.prefab_thing_count;
+		plan->prefab_thing_capacity = job->scratch.prefab_thing_capacity;
+		job->scratch.prefabs               = swap.prefabs;
+		job->scratch.prefab_capacity       = swap.prefab_capacity;
+		job->scratch.prefab_rooms          = swap.prefab_rooms;
+		job->scratch.prefab_room_capacity  = swap.prefab_room_capacity;
+		job->scratch.prefab_things         = swap.prefab_things;
+		job->scratch.prefab_thing_capacity = swap.prefab_thing_capacity;
+		plan->instance_count = 0;
+	}
+	for (i = instance_count = 0; i < plan->instance_count; i++)
+	{
+		const struct BAS_Instance *instance = &plan->instances[i];
+		const struct BAS_PlanChunkEntry *chunk = !BAS_PlanChunk_HoldsInstance(instance) ? NULL : BAS_PlanFile_FindChunk(
+			job->changed, job->changed_count, BAS_PlanChunk_OfInstance(instance, 0), BAS_PlanChunk_OfInstance(instance, 1)
+		);
+		if (!chunk || !apply[chunk-job->changed])
+		{
+			plan->instances[instance_count++] = *instance;
+		}
+	}
+	plan->instance_count = instance_count;
+	for (i = 0; i < job->scratch.instance_count; i++)
+	{
+		const struct BAS_Instance *instance = &job->scratch.instances[i];
+		if (BAS_Instance_Add(instance->prefab, instance->cellposition[0], instance->cellposition[1], instance->rotation, 1))
+		{
+			break;
+		}
+	}
+	/* Chunks which did not change keep their state, changed chunks of a paged plan are paged in again. */
+	for (i = 0; i < job->chunkcount; i++)
+	{
+		struct BAS_PlanChunkEntry *chunk = &job->index[i];
+		const struct BAS_PlanChunkEntry *old = BAS_PlanFile_FindChunk(plan->planfile_index, plan->planfile_chunkcount, chunk->chunkposition[0], chunk->chunkposition[1]);
+		const int changed = BAS_PlanFile_FindChunk(job->changed, job->changed_count, chunk->chunkposition[0], chunk->chunkposition[1]) != NULL;
+		chunk->resident = !paged || (old && old->resident && !changed);
+		chunk->lastuse  = old ? old->lastuse : plan->paging_frame;
+	}
+	BAS_PlanFile_Adopt(job->path, job->header, job->index, job->chunkcount, &job->prefabs, job->end);
+	job->index = NULL;
+	if (paged)
+	{
+		plan->paging_stuck = -1;
+		if (BAS_Paging_Map())
+		{
+			BAS_Paging_Close();
+		}
+	}
+	BAS_InvalidateLines();
+done:
+	free(apply);
+	free(have);
+	free(want);
+	free(removedthings);
+	return thingsremoved > 0;
+}
+
+/* Follow the editor's plan file, and read its events. */
+static void
+BAS_HotReload_Watch(void)
+{
+#ifdef BAS_HAVE_INOTIFY
+	union
+	{
+		struct inotify_event event;
+		char bytes[4096];
+	} events;
+	const char *name;
+	ssize_t length;
+	if (strcmp(hotreload_watched, plan->planfile_path))
+	{
+		char directory[96];
+		const char *slash = strrchr(plan->planfile_path, '/');
+		const int warn    = strcmp(hotreload_warned, plan->planfile_path);
+		if (hotreload_descriptor < 0 && (hotreload_descriptor = inotify_init1(IN_NONBLOCK)) < 0)
+		{
+			if (warn)
+			{
+				WRITE_W("Failed to start watching files, plans are not reloaded when changed.");
+				strcpy(hotreload_warned, plan->planfile_path);
+			}
+			return;
+		}
+		if (hotreload_watch >= 0)
+		{
+			inotify_rm_watch(hotreload_descriptor, hotreload_watch);
+			hotreload_watch = -1;
+		}
+		strcpy(directory, slash == plan->planfile_path ? "/" : ".");
+		if (slash && slash != plan->planfile_path)
+		{
+			memcpy(directory, plan->planfile_path, slash-plan->planfile_path);
+			directory[slash-plan->planfile_path] = '\0';
+		}
+		/* Scripts may write the file in place or move a new one over it. */
+		if (plan->planfile_path[0] && (hotreload_watch = inotify_add_watch(hotreload_descriptor, directory, IN_CLOSE_WRITE | IN_MOVED_TO)) < 0)
+		{
+			if (warn)
+			{
+				WRITE_W("Failed to watch the plan file, it is not reloaded when changed.");
+				strcpy(hotreload_warned, plan->planfile_path);
+			}
+		}
+		else
+		{
+			strcpy(hotreload_watched, plan->planfile_path);
+		}
+	}
+	if (hotreload_descriptor < 0)
+	{
+		return;
+	}
+	name = strrchr(hotreload_watched, '/');
+	name = name ? name+1 : hotreload_watched;
+	while ((length = read(hotreload_descriptor, events.bytes, sizeof(events.bytes))) > 0)
+	{
+		const char *p;
+		for (p = events.bytes; p < events.bytes+length; p += sizeof(struct inotify_event)+((const struct inotify_event *)p)->len)
+		{
+			const struct inotify_event *event = (const struct inotify_event *)p;
+			if ((event->mask & IN_Q_OVERFLOW) || (event->wd == hotreload_watch && event->len && !strcmp(event->name, name)))
+			{
+				hotreload_pending = 1;
+			}
+		}
+	}
+#endif
+}
+
+/*
+ * Once per frame: look for changes to the editor's plan file, start reading it
+ * again and take in what a finished read found. Returns 1 if things were
+ * removed.
+ */
+static int
+BAS_HotReload_Update(void)
+{
+	int thingsremoved = 0;
+	char message[128];
+	BAS_HotReload_Watch();
+	if (hotreload.thread && SDL_AtomicGet(&hotreload.done))
+	{
+		struct BAS_HotReloadJob *job = &hotreload;
+		SDL_WaitThread(job->thread, NULL);
+		job->thread = NULL;
+		/* The plan was saved, loaded or cleared meanwhile, compare against that instead. */
+		if (job->revision != plan->planfile_revision || strcmp(job->path, plan->planfile_path))
+		{
+			hotreload_pending = 1;
+		}
+		else if (job->failed)
+		{
+			BAS_PushStatusAndWriteWarning("The plan file changed, but it could not be read.");
+		}
+		else if (job->changed_count)
+		{
+			const Uint64 start = SDL_GetPerformanceCounter();
+			BAS_Span_Begin("BAS_HotReload_Apply");
+			thingsremoved = BAS_HotReload_Apply(job);
+			BAS_Span_End("BAS_HotReload_Apply");
+			snprintf(
+				message, sizeof(message), "Reloaded %d changed chunks in %.1f ms, applied in %.1f ms.",
+				job->changed_count, job->milliseconds, (SDL_GetPerformanceCounter()-start)*1000.0/SDL_GetPerformanceFrequency()
+			);
+			BAS_PushStatusAndWriteInfo(message);
+		}
+		BAS_HotReload_Reset(job);
+	}
+	if (hotreload_pending && !hotreload.thread && plan->planfile_index)
+	{
+		hotreload_pending = 0;
+		BAS_HotReload_Start();
+	}
+	return thingsremoved;
+}
+
+static void
+BAS_HotReload_Stop(void)
+{
+	if (hotreload.thread)
+	{
+		SDL_WaitThread(hotreload.thread, NULL);
+		BAS_HotReload_Reset(&hotreload);
+	}
+#ifdef BAS_HAVE_INOTIFY
+	if (hotreload_descriptor >= 0)
+	{
+		close(hotreload_descriptor);
+		hotreload_descriptor = -1;
+		hotreload_watch      = -1;
+		hotreload_watched[0] = '\0';
+		hotreload_warned[0]  = '\0';
+	}
+#endif
+}
+
+/*
+ * ----------------
+ * Generator.
+ * Seeded plan generators, for stress content and benchmarks. Every generator
+ * fills a width x height occupancy grid from its seed alone, which is then
+ * added to the plan with its top left corner at the given cell; rooms which
+ * exist already are kept. The same seed always gives the same plan.
+ * ----------------
+ */
+#define GENERATOR_MAZE    0 /* Recursive backtracker maze with one cell wide corridors. */
+#define GENERATOR_CAVERN  1 /* Random walkers, until 45% of the area is open. */
+#define GENERATOR_DUNGEON 2 /* Rectangular rooms joined by L shaped corridors. */
+#define GENERATOR_NOISE   3 /* Thresholded value noise. */
+#define GENERATOR_COUNT   4
+#define GENERATOR_MAXIMUM_SIZE 16384 /* Largest width and height, the grid is a byte per cell. */
+static const char *const GENERATOR_NAMES[GENERATOR_COUNT] = {"maze", "cavern", "dungeon", "noise"};
+
+/* splitmix64, small and good enough for level content. */
+static inline Uint64
+BAS_Random_Next(Uint64 *state)
+{
+	Uint64 z = (*state += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30))*0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27))*0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+/* Uniform in [0, n). */
+static inline int
+BAS_Random_Below(Uint64 *state, int n)
+{
+	return (int)((BAS_Random_Next(state) >> 32)*(Uint64)n >> 32);
+}
+
+static void
+generator_maze(unsigned char *grid, int width, int height, Uint64 *random)
+{
+	/* Maze nodes sit on odd cells, the cells between two nodes are the passages. */
+	const int nodes[2] = {(width-1)/2, (height-1)/2};
+	const int step[4][2] = {{0, -1}, {0, 1}, {-1, 0}, {1, 0}};
+	int *stack, top = 0;
+	if (nodes[0] <= 0 || nodes[1] <= 0 || !(stack = malloc((size_t)nodes[0]*nodes[1]*sizeof(int))))
+	{
+		return;
+	}
+	stack[top++] = 0;
+	grid[width+1] = 1;
+	while (top)
+	{
+		register int i;
+		int options[4], option_count = 0;
+		const int node = stack[top-1];
+		const int nx = node%nodes[0];
+		const int ny = node/nodes[0];
+		for (i = 0; i < 4; i++)
+		{
+			const int x = nx+step[i][0];
+			const int y = ny+step[i][1];
+			if (x >= 0 && y >= 0 && x < nodes[0] && y < nodes[1] && !grid[(size_t)(2*y+1)*width+2*x+1])
+			{
+				options[option_count++] = i;
+			}
+		}
+		if (!option_count)
+		{
+			top--;
+			continue;
+		}
+		i = options[BAS_Random_Below(random, option_count)];
+		grid[(size_t)(2*ny+1+step[i][1])*width+2*nx+1+step[i][0]] = 1;
+		grid[(size_t)(2*(ny+step[i][1])+1)*width+2*(nx+step[i][0])+1] = 1;
+		stack[top++] = (ny+step[i][1])*nodes[0]+nx+step[i][0];
+	}
+	free(stack);
+}
+
+static void
+generator_cavern(unsigned char *grid, int width, int height, Uint64 *random)
+{
+	const size_t target = (size_t)width*height*45/100;
+	size_t open = 0;
+	Sint64 budget = (Sint64)target*20;
+	while (open < target && budget > 0)
+	{
+		/* Every walker starts at an open cell (the first in the middle) and keeps the cave connected. */
+		int x = width/2, y = height/2, steps;
+		if (open)
+		{
+			do
+			{
+				x = BAS_Random_Below(random, width);
+				y = BAS_Random_Below(random, height);
+			} while (!grid[(size_t)y*width+x]);
+		}
+		for (steps = 4096; steps > 0 && open < target; steps--, budget--)
+		{
+			if (!grid[(size_t)y*width+x])
+			{
+				grid[(size_t)y*width+x] = 1;
+				open++;
+			}
+			switch (BAS_Random_Below(random, 4))
+			{
+				case 0: y = y > 1        ? y-1 : y; break;
+				case 1: y = y < height-2 ? y+1 : y; break;
+				case 2: x = x > 1        ? x-1 : x; break;
+				case 3: x = x < width-2  ? x+1 : x; break;
+			}
+		}
+	}
+}
+
+static void
+generator_dungeon(unsigned char *grid, int width, int height, Uint64 *random)
+{
+	register int x, y;
+	int tries = (width/8)*(height/8), previous[2] = {-1, -1};
+	while (tries-- > 0)
+	{
+		const int w  = 4+BAS_Random_Below(random, 9);
+		const int h  = 4+BAS_Random_Below(random, 9);
+		int left, top, free_area = 1, centre[2];
+		if (w+2 >= width || h+2 >= height)
+		{
+			return;
+		}
+		left = 1+BAS_Random_Below(random, width-w-1);
+		top  = 1+BAS_Random_Below(random, height-h-1);
+		/* Keep a wall of at least one cell between rooms. */
+		for (y = top-1; y <= top+h && free_area; y++)
+		{
+			for (x = left-1; x <= left+w && free_area; x++)
+			{
+				free_area = !grid[(size_t)y*width+x];
+			}
+		}
+		if (!free_area)
+		{
+			continue;
+		}
+		for (y = top; y < top+h; y++)
+		{
+			memset(grid+(size_t)y*width+left, 1, w);
+		}
+		centre[0] = left+w/2;
+		centre[1] = top+h/2;
+		if (previous[0] >= 0)
+		{
+			const int dx = centre[0] < previous[0] ? -1 : 1;
+			const int dy = centre[1] < previous[1] ? -1 : 1;
+			for (x = previous[0]; x != centre[0]; x += dx)
+			{
+				grid[(size_t)previous[1]*width+x] = 1;
+			}
+			for (y = previous[1]; y != centre[1]; y += dy)
+			{
+				grid[(size_t)y*width+centre[0]] = 1;
+			}
+		}
+		previous[0] = centre[0];
+		previous[1] = centre[1];
+	}
+}
+
+/* Value noise: random values on a lattice every `period` cells, interpolated smoothly. */
+static inline float
+generator_lattice(Uint64 seed, int x, int y)
+{
+	Uint64 state = seed ^ ((Uint64)(Uint32)x << 32 | (Uint32)y);
+	return (BAS_Random_Next(&state) >> 40)/(float)(1 << 24);
+}
+static void
+generator_noise(unsigned char *grid, int width, int height, Uint64 *random)
+{
+	register int x, y;
+	const int period = 8;
+	const Uint64 seed = BAS_Random_Next(random);
+	for (y = 0; y < height; y++)
+	{
+		const float fy = (float)(y%period)/period;
+		const float sy = fy*fy*(3.0f-2.0f*fy);
+		for (x = 0; x < width; x++)
+		{
+			const float fx = (float)(x%period)/period;
+			const float sx = fx*fx*(3.0f-2.0f*fx);
+			const int lx = x/period, ly = y/period;
+			const float top    = generator_lattice(seed, lx, ly)  +(generator_lattice(seed, lx+1, ly)  -generator_lattice(seed, lx, ly))*sx;
+			const float bottom = generator_lattice(seed, lx, ly+1)+(generator_lattice(seed, lx+1, ly+1)-generator_lattice(seed, lx, ly+1))*sx;
+			grid[(size_t)y*width+x] = top+(bottom-top)*sy > 0.5f;
+		}
+	}
+}
+
+#define GENERATOR_DEFAULT_SIZE 256 /* Width and height generated with F4. */
+static int generator_kind    = GENERATOR_MAZE;
+static Uint64 generator_seed = 1;
+
+/*
+ * Generate a plan of the given kind into the width x height cells starting at
+ * cell (cx, cy), at most GENERATOR_MAXIMUM_SIZE cells each way.
+ * Returns the number of rooms created, or -1 on error.
+ */
+static int
+BAS_Generate(int kind, Uint64 seed, int width, int height, int cx, int cy)
+{
+	register int x, y;
+	int created = 0;
+	size_t count = 0, cell;
+	unsigned char *grid;
+	Uint64 random = seed;
+	char message[128];
+	const Uint64 start = SDL_GetPerformanceCounter();
+	if (kind < 0 || kind >= GENERATOR_COUNT || width <= 0 || height <= 0)
+	{
+		WRITE_E("Unknown generator or empty area!");
+		return -1;
+	}
+	if (width > GENERATOR_MAXIMUM_SIZE || height > GENERATOR_MAXIMUM_SIZE)
+	{
+		WRITE_E("Generated area is too large!");
+		return -1;
+	}
+	if (!BAS_Room_Inside(cx, cy) || !BAS_Room_Inside((Sint64)cx+width-1, (Sint64)cy+height-1))
+	{
+		WRITE_E("Generated area is out of range!");
+		return -1;
+	}
+	if (!(grid = calloc((size_t)width*height, 1)))
+	{
+		WRITE_E("Out of memory!");
+		return -1;
+	}
+	switch (kind)
+	{
+		case GENERATOR_MAZE:    generator_maze(grid, width, height, &random);    break;
+		case GENERATOR_CAVERN:  generator_cavern(grid, width, height, &random);  break;
+		case GENERATOR_DUNGEON: generator_dungeon(grid, width, height, &random); break;
+		case GENERATOR_NOISE:   generator_noise(grid, width, height, &random);   break;
+	}
+	for (cell = 0; cell < (size_t)width*height; cell++)
+	{
+		count += grid[cell];
+	}
+	if (count > (size_t)(INT_MAX/2-plan->room_count) || BAS_Room_Reserve((int)count))
+	{
+		free(grid);
+		return -1;
+	}
+	for (y = 0; y < height; y++)
+	{
+		for (x = 0; x < width; x++)
+		{
+			if (grid[(size_t)y*width+x] && BAS_RoomIndex_FindSlot(cx+x, cy+y) < 0)
+			{
+				BAS_Room_Append(cx+x, cy+y);
+				created++;
+			}
+		}
+	}
+	free(grid);
+	BAS_InvalidateLines();
+	snprintf(
+		message, sizeof(message), "Generated %s %dx%d (seed %llu): %d rooms in %.1f ms.",
+		GENERATOR_NAMES[kind], width, height, (unsigned long long)seed, created,
+		(SDL_GetPerformanceCounter()-start)*1000.0/SDL_GetPerformanceFrequency()
+	);
+	WRITE_I(message);
+	return created;
+}
+
+/*
+ * ----------------
+ * Help tool.
+ * ----------------
+ */
+static SDL_Texture* helpme_textureauthor = NULL;
+static SDL_Texture* helpme_textblock[8]  = {NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL};
+static inline void
+helpme_resetstate(void)
+{
+	SDL_SetCursor(BAS_Cursor(CURSOR_ARROW));
+}
+static void
+helpme_createtextures(void)
+{
+	/*
+	 * If helpme_textureauthor is not a valid texture, we can safely assume other
+	 * textures are also invalid.
+	 */
+	if (!basilisk_texture)
+	{
+		SDL_Surface *surface = IMG_Load(HELP_IMAGE);
+		basilisk_texture = SDL_CreateTextureFromSurface(renderer, surface);
+		SDL_FreeSurface(surface);
+	}
+	if (!helpme_textureauthor)
+	{
+		helpme_textureauthor = BAS_CreateTextTexture(BAS_Font(FONT_DEFAULT), "author ★ Aleksandar Urošević, 2019.");
+		helpme_textblock[0] = BAS_CreateTextTextureBlended(BAS_Font(FONT_TEXTINPUT), "Basilisk 0");
+		helpme_textblock[1] = BAS_CreateTextTextureBlended(BAS_Font(FONT_TEXTINPUT), "----------------");
+		helpme_textblock[2] = BAS_CreateTextTextureBlended(BAS_Font(FONT_TEXTINPUT), "F1 - help screen; F9 - memory; F11 - record spans;");
+		helpme_textblock[3] = BAS_CreateTextTextureBlended(BAS_Font(FONT_TEXTINPUT), "F2 - room placing tool; ALT+drag - prefab, V - stamp it;");
+		helpme_textblock[4] = BAS_CreateTextTextureBlended(BAS_Font(FONT_TEXTINPUT), "F3 - thing editing tool; F4 - generate;");
+		helpme_textblock[5] = BAS_CreateTextTextureBlended(BAS_Font(FONT_TEXTINPUT), "F5 - export world plan; F6/F7 - save/load plan;");
+		helpme_textblock[6] = BAS_CreateTextTextureBlended(BAS_Font(FONT_TEXTINPUT), "Wheel - zoom; middle drag - pan; F8 - minimap; F10 - live link.");
+		helpme_textblock[7] = BAS_CreateTextTextureBlended(BAS_Font(FONT_TEXTINPUT), "Have a nice day.");
+	}
+}
+static void
+helpme_destroytextures(void)
+{
+	BAS_DestroyTextTexture(helpme_textblock[0]);
+	BAS_DestroyTextTexture(helpme_textblock[1]);
+	BAS_DestroyTextTexture(helpme_textblock[2]);
+	BAS_DestroyTextTexture(helpme_textblock[3]);
+	BAS_DestroyTextTexture(helpme_textblock[4]);
+	BAS_DestroyTextTexture(helpme_textblock[5]);
+	BAS_DestroyTextTexture(helpme_textblock[6]);
+	BAS_DestroyTextTexture(helpme_textblock[7]);
+	BAS_DestroyTextTexture(helpme_textureauthor);
+	helpme_textureauthor = NULL;
+}
+static void
+BAS_Tool_HelpMe(SDL_Event e, int mx, int my, int special)
+{
+	switch(special)
+	{
+	case TOOL_SPECIAL_RESETSTATE:
+		helpme_resetstate();
+		return;
+	case TOOL_SPECIAL_BEGIN:
+		helpme_createtextures();
+		return;
+	case TOOL_SPECIAL_STOP:
+		helpme_destroytextures();
+		return;
+	}
+}
+static void
+BAS_Tool_HelpMe_Draw(int mx, int my)
+{
+	int i;
+	const int screen_w = 800;
+	const int screen_h = 500;
+	SDL_Rect rectangle;
+	rectangle.w = screen_w;
+	rectangle.h = screen_h;
+	rectangle.x = WINDOW_WIDTH/2-screen_w/2;
+	rectangle.y = WINDOW_HEIGHT/2-screen_h/2;
+	/* Title image */
+	SDL_RenderCopy(renderer, basilisk_texture, NULL, &rectangle);
+	/* Outline */
+	BAS_UseColour(255, 255, 255);
+	SDL_RenderDrawRect(renderer, &rectangle);
+	/* Text on the title image */
+	rectangle.x += 1;
+	rectangle.y += 1;
+	for (i = 0; i < 8; i++)
+	{
+		SDL_QueryTexture(helpme_textblock[i], NULL, NULL, &rectangle.w, &rectangle.h);
+		SDL_RenderCopy(renderer, helpme_textblock[i], NULL, &rectangle);
+		rectangle.y += 24;
+	}
+	/* Black strip */
+	rectangle.x = 1+WINDOW_WIDTH/2-screen_w/2;
+	rectangle.y = WINDOW_HEIGHT/2+(screen_h*3.0)/7.0;
+	rectangle.h = 12;
+	rectangle.w = screen_w-2;
+	BAS_UseColour(0, 0, 0);
+	SDL_RenderFillRect(renderer, &rectangle);
+	/* Author text */
+	rectangle.x += rectangle.w;
+	SDL_QueryTexture(helpme_textureauthor, NULL, NULL, &rectangle.w, &rectangle.h);
+	rectangle.x -= rectangle.w+12;
+	SDL_RenderCopy(renderer, helpme_textureauthor, NULL, &rectangle);
+}
+
+/*
+ * ----------------
+ * Tool for placing rooms.
+ * Left click (or SPACE) places a room and right click (or DELETE) removes it,
+ * keeping the button held while moving the mouse paints (or erases) a stroke.
+ * Dragging with SHIFT held fills (left) or erases (right) a whole rectangle,
+ * CTRL+left click (or F) fills the enclosed empty area under the cursor.
+ * Dragging with ALT held makes a prefab of the rectangle and starts stamping
+ * it: every left click places an instance with its top left corner under the
+ * cursor, R turns it and ESCAPE stops. V stamps the last prefab again.
+ * ----------------
+ */
+#define DRAWROOM_RECTANGLE_NONE   0
+#define DRAWROOM_RECTANGLE_FILL   1
+#define DRAWROOM_RECTANGLE_ERASE  2
+#define DRAWROOM_RECTANGLE_PREFAB 3
+#define DRAWROOM_PAINT_NONE      0
+#define DRAWROOM_PAINT_PLACE     1
+#define DRAWROOM_PAINT_ERASE     2
+#define DRAWROOM_PREVIEW_ROOMS   4096 /* Bigger prefabs are previewed by their outline only. */
+static int drawroom_rectangle = DRAWROOM_RECTANGLE_NONE;
+static int drawroom_anchor[2];
+static int drawroom_paint = DRAWROOM_PAINT_NONE;
+static int drawroom_paintlast[2]; /* Last painted cell, strokes continue from it. */
+static int drawroom_prefab   = -1; /* Prefab last captured. */
+static int drawroom_stamping = 0;
+static int drawroom_rotation = 0;
+static inline void
+drawroom_resetstate(void)
+{
+	SDL_SetCursor(BAS_Cursor(CURSOR_ARROW));
+	drawroom_rectangle = DRAWROOM_RECTANGLE_NONE;
+	drawroom_paint     = DRAWROOM_PAINT_NONE;
+	drawroom_stamping  = 0;
+}
+/* The instance a click would stamp, with its top left corner at the cell under (mx, my). */
+static inline struct BAS_Instance
+drawroom_stampinstance(int mx, int my)
+{
+	struct BAS_Instance instance;
+	BAS_ClosestCellPosition(mx, my, &instance.cellposition[0], &instance.cellposition[1]);
+	instance.prefab   = drawroom_prefab;
+	instance.rotation = drawroom_rotation;
+	instance.expanded = 0;
+	return instance;
+}
+/*
+ * Outdate the walls once for the whole batch, BAS_Lines_Update recalculates
+ * them (in the background if the plan is large), and report how long the
+ * batch itself took.
+ */
+static void
+drawroom_finishbatch(const char *what, int count, Uint64 start)
+{
+	char message[BAS_STATUSMESSAGE_LENGTH];
+	if (count < 0)
+	{
+		snprintf(message, sizeof(message), "%s failed, the area is too big, out of range or not enclosed.", what);
+		BAS_PushStatusAndWriteWarning(message);
+		return;
+	}
+	if (count > 0)
+	{
+		BAS_InvalidateLines();
+	}
+	snprintf(
+		message, sizeof(message), "%s: %d cells in %.2f ms.",
+		what, count, (SDL_GetPerformanceCounter()-start)*1000.0/SDL_GetPerformanceFrequency()
+	);
+	BAS_PushStatusAndWriteInfo(message);
+}
+static void
+BAS_Tool_DrawRoom(SDL_Event e, int mx, int my, int special)
+{
+	switch(special)
+	{
+	case TOOL_SPECIAL_RESETSTATE:
+		drawroom_resetstate();
+		return;
+	case TOOL_SPECIAL_STOP:
+		drawroom_rectangle = DRAWROOM_RECTANGLE_NONE;
+		drawroom_paint     = DRAWROOM_PAINT_NONE;
+		return;
+	}
+	/* Loading or clearing the plan drops its prefabs. */
+	if (drawroom_prefab >= plan->prefab_count)
+	{
+		drawroom_prefab   = -1;
+		drawroom_stamping = 0;
+	}
+	if (e.type == SDL_MOUSEBUTTONDOWN && e.button.button == SDL_BUTTON_LEFT && (BAS_GetModState() & KMOD_ALT))
+	{
+		BAS_ClosestCellPosition(mx, my, &drawroom_anchor[0], &drawroom_anchor[1]);
+		drawroom_rectangle = DRAWROOM_RECTANGLE_PREFAB;
+	}
+	else if (e.type == SDL_MOUSEBUTTONUP && drawroom_rectangle == DRAWROOM_RECTANGLE_PREFAB)
+	{
+		int cx, cy, prefab;
+		char message[BAS_STATUSMESSAGE_LENGTH];
+		BAS_ClosestCellPosition(mx, my, &cx, &cy);
+		BAS_Paging_Require(drawroom_anchor[0], drawroom_anchor[1], cx, cy);
+		drawroom_rectangle = DRAWROOM_RECTANGLE_NONE;
+		if ((prefab = BAS_Prefab_Capture(drawroom_anchor[0], drawroom_anchor[1], cx, cy)) < 0)
+		{
+			BAS_PushStatusAndWriteWarning("Nothing to make a prefab of, or the area is too big.");
+			return;
+		}
+		drawroom_prefab   = prefab;
+		drawroom_stamping = 1;
+		drawroom_rotation = 0;
+		snprintf(
+			message, sizeof(message), "Prefab %d: %dx%d cells, %d rooms and %d things. Click to stamp it, R turns it.",
+			prefab, plan->prefabs[prefab].size[0], plan->prefabs[prefab].size[1], plan->prefabs[prefab].room_count, plan->prefabs[prefab].thing_count
+		);
+		BAS_PushStatusAndWriteInfo(message);
+	}
+	else if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_v && drawroom_prefab >= 0)
+	{
+		drawroom_stamping = 1;
+	}
+	else if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_r && drawroom_stamping)
+	{
+		drawroom_rotation = (drawroom_rotation+1) & 3;
+	}
+	else if (e.type == SDL_MOUSEBUTTONDOWN && e.button.button == SDL_BUTTON_LEFT && drawroom_stamping)
+	{
+		int width, height;
+		const struct BAS_Instance instance = drawroom_stampinstance(mx, my);
+		BAS_Instance_Size(&instance, &width, &height);
+		BAS_Paging_Require(instance.cellposition[0], instance.cellposition[1], instance.cellposition[0]+width-1, instance.cellposition[1]+height-1);
+		if (BAS_Instance_Stamp(instance.prefab, instance.cellposition[0], instance.cellposition[1], instance.rotation))
+		{
+			BAS_PushStatusAndWriteError("Could not stamp the prefab.");
+		}
+	}
+	else if (e.type == SDL_MOUSEBUTTONDOWN && (BAS_GetModState() & KMOD_SHIFT)
+	 && (e.button.button == SDL_BUTTON_LEFT || e.button.button == SDL_BUTTON_RIGHT))
+	{
+		BAS_ClosestCellPosition(mx, my, &drawroom_anchor[0], &drawroom_anchor[1]);
+		drawroom_rectangle = e.button.button == SDL_BUTTON_LEFT ? DRAWROOM_RECTANGLE_FILL : DRAWROOM_RECTANGLE_ERASE;
+	}
+	else if (e.type == SDL_MOUSEBUTTONUP && drawroom_rectangle != DRAWROOM_RECTANGLE_NONE)
+	{
+		int cx, cy;
+		const Uint64 start = SDL_GetPerformanceCounter();
+		BAS_ClosestCellPosition(mx, my, &cx, &cy);
+		/* The anchor may have been panned out of view. */
+		BAS_Paging_Require(drawroom_anchor[0], drawroom_anchor[1], cx, cy);
+		if (drawroom_rectangle == DRAWROOM_RECTANGLE_FILL)
+		{
+			drawroom_finishbatch("Rectangle fill", BAS_Room_FillRectangle(drawroom_anchor[0], drawroom_anchor[1], cx, cy), start);
+		}
+		else
+		{
+			drawroom_finishbatch("Rectangle erase", BAS_Room_EraseRectangle(drawroom_anchor[0], drawroom_anchor[1], cx, cy), start);
+		}
+		drawroom_rectangle = DRAWROOM_RECTANGLE_NONE;
+	}
+	else if ((e.type == SDL_KEYDOWN         && e.key.keysym.sym == SDLK_f)
+	 || (e.type == SDL_MOUSEBUTTONDOWN && e.button.button  == SDL_BUTTON_LEFT && (BAS_GetModState() & KMOD_CTRL)))
+	{
+		int cx, cy;
+		const Uint64 start = SDL_GetPerformanceCounter();
+		BAS_ClosestCellPosition(mx, my, &cx, &cy);
+		drawroom_finishbatch("Flood fill", BAS_Room_FloodFill(cx, cy), start);
+	}
+	else if (e.type == SDL_MOUSEMOTION && drawroom_paint != DRAWROOM_PAINT_NONE)
+	{
+		/*
+		 * Use the position of this motion sample rather than the current mouse
+		 * state and join it to the previous one, so fast strokes have no holes.
+		 */
+		int px, py, cx, cy;
+		BAS_View_ToPlan(e.motion.x, e.motion.y, &px, &py);
+		BAS_ClosestCellPosition(px, py, &cx, &cy);
+		if (cx != drawroom_paintlast[0] || cy != drawroom_paintlast[1])
+		{
+			if (BAS_Room_PaintLine(drawroom_paintlast[0], drawroom_paintlast[1], cx, cy, drawroom_paint == DRAWROOM_PAINT_ERASE) > 0)
+			{
+				BAS_InvalidateLines();
+			}
+			drawroom_paintlast[0] = cx;
+			drawroom_paintlast[1] = cy;
+		}
+	}
+	else if (e.type == SDL_MOUSEBUTTONUP && drawroom_paint != DRAWROOM_PAINT_NONE)
+	{
+		drawroom_paint = DRAWROOM_PAINT_NONE;
+	}
+	else if ((e.type == SDL_KEYDOWN         && e.key.keysym.sym == SDLK_SPACE)
+	 || (e.type == SDL_MOUSEBUTTONDOWN && e.button.button  == SDL_BUTTON_LEFT))
+	{
+		int cx, cy;
+		BAS_ClosestCellPosition(mx, my, &cx, &cy);
+		if (e.type == SDL_MOUSEBUTTONDOWN)
+		{
+			drawroom_paint        = DRAWROOM_PAINT_PLACE;
+			drawroom_paintlast[0] = cx;
+			drawroom_paintlast[1] = cy;
+		}
+		switch (BAS_Room_Create(cx, cy))
+		{
+		case 0:
+			BAS_InvalidateLines();
+			break;
+		case 1:
+			BAS_PushStatusAndWriteWarning("Selected room already exists.");
+			break;
+		default:
+			BAS_PushStatusAndWriteError("Could not create the room.");
+		}
+	}
+	else if ((e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_DELETE)
+	 || (e.type == SDL_MOUSEBUTTONDOWN && e.button.button == SDL_BUTTON_RIGHT))
+	{
+		int cx, cy;
+		BAS_ClosestCellPosition(mx, my, &cx, &cy);
+		if (e.type == SDL_MOUSEBUTTONDOWN)
+		{
+			drawroom_paint        = DRAWROOM_PAINT_ERASE;
+			drawroom_paintlast[0] = cx;
+			drawroom_paintlast[1] = cy;
+		}
+		if (!BAS_Room_Delete(cx, cy))
+		{
+			BAS_InvalidateLines();
+		}
+		else
+		{
+			BAS_PushStatusAndWriteWarning("No room under the cursor to delete!");
+		}
+	}
+}
+/*
+ * While the room tool is used, draw the room in the cell that's under the mouse.
+ * During a rectangle drag, the whole rectangle is drawn instead, and while
+ * stamping the footprint and rooms of the turned prefab.
+ */
+static void
+BAS_Tool_DrawRoom_Draw(int mx, int my)
+{
+	SDL_Rect rectangle;
+	const int activeroomalpha = 255*fabsf(sinf(SDL_GetTicks()/300.0f));
+	BAS_DrawCrosshair();
+	if (drawroom_stamping && drawroom_prefab < plan->prefab_count && drawroom_rectangle == DRAWROOM_RECTANGLE_NONE)
+	{
+		register int i;
+		int width, height, x1, y1;
+		const struct BAS_Instance instance = drawroom_stampinstance(mx, my);
+		const struct BAS_Prefab *prefab = &plan->prefabs[instance.prefab];
+		BAS_Instance_Size(&instance, &width, &height);
+		BAS_UseColourAlpha(0, 160, 255, 80);
+		for (i = 0; i < prefab->room_count && prefab->room_count <= DRAWROOM_PREVIEW_ROOMS; i++)
+		{
+			int cx, cy;
+			BAS_Instance_Cell(&instance, plan->prefab_rooms[prefab->rooms+i][0], plan->prefab_rooms[prefab->rooms+i][1], &cx, &cy);
+			BAS_View_ToScreen(cx*CELL_SCALE, cy*CELL_SCALE, &rectangle.x, &rectangle.y);
+			rectangle.w = rectangle.h = BAS_View_Scale(CELL_SCALE);
+			SDL_RenderFillRect(renderer, &rectangle);
+		}
+		BAS_View_ToScreen(instance.cellposition[0]*CELL_SCALE, instance.cellposition[1]*CELL_SCALE, &rectangle.x, &rectangle.y);
+		BAS_View_ToScreen((instance.cellposition[0]+width)*CELL_SCALE, (instance.cellposition[1]+height)*CELL_SCALE, &x1, &y1);
+		rectangle.w = x1-rectangle.x;
+		rectangle.h = y1-rectangle.y;
+		BAS_UseColourAlpha(255, 255, 255, activeroomalpha);
+		SDL_RenderDrawRect(renderer, &rectangle);
+		return;
+	}
+	if (drawroom_rectangle != DRAWROOM_RECTANGLE_NONE)
+	{
+		int cx, cy, x1, y1;
+		BAS_ClosestCellPosition(mx, my, &cx, &cy);
+		BAS_View_ToScreen(
+			(cx < drawroom_anchor[0] ? cx : drawroom_anchor[0])*CELL_SCALE,
+			(cy < drawroom_anchor[1] ? cy : drawroom_anchor[1])*CELL_SCALE,
+			&rectangle.x, &rectangle.y
+		);
+		BAS_View_ToScreen(
+			((cx > drawroom_anchor[0] ? cx : drawroom_anchor[0])+1)*CELL_SCALE,
+			((cy > drawroom_anchor[1] ? cy : drawroom_anchor[1])+1)*CELL_SCALE,
+			&x1, &y1
+		);
+		rectangle.w = x1-rectangle.x;
+		rectangle.h = y1-rectangle.y;
+		if (drawroom_rectangle == DRAWROOM_RECTANGLE_FILL)        { BAS_UseColourAlpha(0, 255, 0, 80); }
+		else if (drawroom_rectangle == DRAWROOM_RECTANGLE_PREFAB) { BAS_UseColourAlpha(0, 160, 255, 80); }
+		else                                                      { BAS_UseColourAlpha(255, 0, 0, 80); }
+		SDL_RenderFillRect(renderer, &rectangle);
+		BAS_UseColourAlpha(255, 255, 255, activeroomalpha);
+		SDL_RenderDrawRect(renderer, &rectangle);
+		return;
+	}
+	BAS_SnapToClosestCell(&mx, &my);
+	BAS_View_ToScreen(mx, my, &rectangle.x, &rectangle.y);
+	rectangle.w = BAS_View_Scale(CELL_SCALE);
+	rectangle.h = BAS_View_Scale(CELL_SCALE);
+	BAS_UseColourAlpha(255, 0, 0, activeroomalpha);
+	SDL_RenderFillRect(renderer, &rectangle);
+}
+
+/*
+ * ----------------
+ * Navigation graph.
+ * Rooms are the nodes and neighbouring rooms are joined by edges, the graph is
+ * kept in CSR form: the neighbours of room i are edges[offsets[i]] up to
+ * edges[offsets[i+1]-1].
+ * On top of that, rooms are grouped into regions: the rooms of one
+ * NAVGRAPH_REGION_SIZE x NAVGRAPH_REGION_SIZE tile which are connected inside
+ * that tile. Regions get their own CSR graph and a component number, so path
+ * queries can reject unreachable goals at once and search the small region
+ * graph before the room graph.
+ * ----------------
+ */
+#define NAVGRAPH_REGION_SIZE 16
+struct BAS_NavGraph
+{
+	int *offsets; /* room_count+1 elements. */
+	int *edges;
+	int edge_count;
+	int *region;  /* Region of every room. */
+	int region_count;
+	int *region_offsets; /* region_count+1 elements. */
+	int *region_edges;
+	int region_edge_count;
+	int (*region_bounds)[4]; /* Cell-space bounding box [x0, y0, x1, y1). */
+	int *region_component;
+};
+static void
+BAS_NavGraph_Free(struct BAS_NavGraph *graph)
+{
+	free(graph->offsets);
+	free(graph->edges);
+	free(graph->region);
+	free(graph->region_offsets);
+	free(graph->region_edges);
+	BAS_Free(graph->region_bounds);
+	free(graph->region_component);
+	memset(graph, 0, sizeof(struct BAS_NavGraph));
+}
+static int
+navgraph_comparepairs(const void *a, const void *b)
+{
+	const long long x = *(const long long *)a;
+	const long long y = *(const long long *)b;
+	return (x > y)-(x < y);
+}
+/* Flood the region of the given room, staying inside the room's tile. */
+static void
+navgraph_floodregion(struct BAS_NavGraph *graph, int room, int *queue)
+{
+	register int i;
+	int head = 0, tail = 0;
+	const int r  = graph->region_count-1;
+	const int tx = BAS_FloorDiv(plan->rooms[room].cellposition[0], NAVGRAPH_REGION_SIZE);
+	const int ty = BAS_FloorDiv(plan->rooms[room].cellposition[1], NAVGRAPH_REGION_SIZE);
+	int *bounds  = graph->region_bounds[r];
+	bounds[0] = bounds[2] = plan->rooms[room].cellposition[0];
+	bounds[1] = bounds[3] = plan->rooms[room].cellposition[1];
+	graph->region[room] = r;
+	queue[tail++] = room;
+	while (head < tail)
+	{
+		const int current = queue[head++];
+		const int cx = plan->rooms[current].cellposition[0];
+		const int cy = plan->rooms[current].cellposition[1];
+		if (cx < bounds[0]) { bounds[0] = cx; }
+		if (cy < bounds[1]) { bounds[1] = cy; }
+		if (cx > bounds[2]) { bounds[2] = cx; }
+		if (cy > bounds[3]) { bounds[3] = cy; }
+		for (i = graph->offsets[current]; i < graph->offsets[current+1]; i++)
+		{
+			const int next = graph->edges[i];
+			if (graph->region[next] < 0
+			 && BAS_FloorDiv(plan->rooms[next].cellposition[0], NAVGRAPH_REGION_SIZE) == tx
+			 && BAS_FloorDiv(plan->rooms[next].cellposition[1], NAVGRAPH_REGION_SIZE) == ty)
+			{
+				graph->region[next] = r;
+				queue[tail++] = next;
+			}
+		}
+	}
+	bounds[2]++;
+	bounds[3]++;
+}
+/*
+ * Build the navigation graph of the current plan. Returns 0 on success, 1 on
+ * error. The graph must be freed with BAS_NavGraph_Free.
+ */
+static int
+BAS_NavGraph_Build(struct BAS_NavGraph *graph)
+{
+	register int i, side;
+	int *queue;
+	long long *pairs;
+	int pair_count = 0, bounds_capacity = 0;
+	memset(graph, 0, sizeof(struct BAS_NavGraph));
+	if (plan->lines_outdated)
+	{
+		BAS_RecalculateLines();
+	}
+	graph->offsets = malloc((plan->room_count+1)*sizeof(int));
+	graph->edges   = malloc((plan->room_count*4+1)*sizeof(int));
+	graph->region  = malloc((plan->room_count+1)*sizeof(int));
+	queue          = malloc((plan->room_count+1)*sizeof(int));
+	pairs          = malloc((plan->room_count*4+1)*sizeof(long long));
+	if (!graph->offsets || !graph->edges || !graph->region || !queue || !pairs)
+	{
+		goto outofmemory;
+	}
+	/* Room graph, straight from the neighbours found while placing the walls. */
+	for (i = 0; i < plan->room_count; i++)
+	{
+		graph->offsets[i] = graph->edge_count;
+		graph->region[i]  = -1;
+		for (side = 0; side < 4; side++)
+		{
+			if (plan->roomneighbours[i][side] != BAS_NO_SUCH_ROOM)
+			{
+				graph->edges[graph->edge_count++] = plan->roomneighbours[i][side];
+			}
+		}
+	}
+	graph->offsets[plan->room_count] = graph->edge_count;
+	/* Regions. */
+	for (i = 0; i < plan->room_count; i++)
+	{
+		if (graph->region[i] < 0)
+		{
+			if (BAS_Reserve(MEMORY_WORK, (void **)&graph->region_bounds, &bounds_capacity, graph->region_count+1, sizeof(int[4])))
+			{
+				goto outofmemory;
+			}
+			graph->region_count++;
+			navgraph_floodregion(graph, i, queue);
+		}
+	}
+	/* Region graph, from the room edges which cross between regions. */
+	for (i = 0; i < plan->room_count; i++)
+	{
+		for (side = graph->offsets[i]; side < graph->offsets[i+1]; side++)
+		{
+			const int a = graph->region[i];
+			const int b = graph->region[graph->edges[side]];
+			if (a != b)
+			{
+				pairs[pair_count++] = (long long)a*graph->region_count+b;
+			}
+		}
+	}
+	qsort(pairs, pair_count, sizeof(long long), navgraph_comparepairs);
+	graph->region_offsets   = malloc((graph->region_count+1)*sizeof(int));
+	graph->region_edges     = malloc((pair_count+1)*sizeof(int));
+	graph->region_component = malloc((graph->region_count+1)*sizeof(int));
+	if (!graph->region_offsets || !graph->region_edges || !graph->region_component)
+	{
+		goto outofmemory;
+	}
+	for (i = 0, side = 0; i < graph->region_count; i++)
+	{
+		graph->region_offsets[i] = graph->region_edge_count;
+		for (; side < pair_count && pairs[side]/graph->region_count == i; side++)
+		{
+			if (side == 0 || pairs[side] != pairs[side-1])
+			{
+				graph->region_edges[graph->region_edge_count++] = pairs[side]%graph->region_count;
+			}
+		}
+		graph->region_component[i] = -1;
+	}
+	graph->region_offsets[graph->region_count] = graph->region_edge_count;
+	/* Connected components of the region graph. */
+	for (i = 0, pair_count = 0; i < graph->region_count; i++)
+	{
+		int head = 0, tail = 0;
+		if (graph->region_component[i] >= 0)
+		{
+			continue;
+		}
+		graph->region_component[i] = pair_count;
+		queue[tail++] = i;
+		while (head < tail)
+		{
+			const int current = queue[head++];
+			for (side = graph->region_offsets[current]; side < graph->region_offsets[current+1]; side++)
+			{
+				const int next = graph->region_edges[side];
+				if (graph->region_component[next] < 0)
+				{
+					graph->region_component[next] = pair_count;
+					queue[tail++] = next;
+				}
+			}
+		}
+		pair_count++;
+	}
+	free(queue);
+	free(pairs);
+	return 0;
+outofmemory:
+	WRITE_E("Out of memory!");
+	free(queue);
+	free(pairs);
+	BAS_NavGraph_Free(graph);
+	return 1;
+}
+
+/*
+ * ----------------
+ * Wall merging.
+ * A wall span is a run of walls along one grid line, all facing the same side:
+ * it covers the nodes [start, end] along x (north/south walls) or y (west/east
+ * walls) at `fixed` on the other axis.
+ * ----------------
+ */
+struct BAS_WallSpan
+{
+	int side;
+	int fixed;
+	int start, end;
+};
+static void
+BAS_WallSpan_FromLine(const struct BAS_Line *line, struct BAS_WallSpan *span)
+{
+	int nodes[4];
+	BAS_Line_Nodes(line, nodes);
+	span->side = BAS_Line_Side(line);
+	if (span->side == BAS_SIDE_NORTH || span->side == BAS_SIDE_SOUTH)
+	{
+		span->fixed = nodes[1];
+		span->start = nodes[0] < nodes[2] ? nodes[0] : nodes[2];
+	}
+	else
+	{
+		span->fixed = nodes[0];
+		span->start = nodes[1] < nodes[3] ? nodes[1] : nodes[3];
+	}
+	span->end = span->start+1;
+}
+/* The start and end node of the span (node-space), with the same winding as BAS_RecalculateLines uses. */
+static void
+BAS_WallSpan_Nodes(const struct BAS_WallSpan *span, int nodes[4])
+{
+	switch (span->side)
+	{
+	case BAS_SIDE_NORTH:
+		nodes[0] = span->end;   nodes[1] = span->fixed;
+		nodes[2] = span->start; nodes[3] = span->fixed;
+		break;
+	case BAS_SIDE_SOUTH:
+		nodes[0] = span->start; nodes[1] = span->fixed;
+		nodes[2] = span->end;   nodes[3] = span->fixed;
+		break;
+	case BAS_SIDE_WEST:
+		nodes[0] = span->fixed; nodes[1] = span->start;
+		nodes[2] = span->fixed; nodes[3] = span->end;
+		break;
+	default:
+		nodes[0] = span->fixed; nodes[1] = span->end;
+		nodes[2] = span->fixed; nodes[3] = span->start;
+	}
+}
+static int
+wallspan_compare(const void *a, const void *b)
+{
+	const struct BAS_WallSpan *x = a;
+	const struct BAS_WallSpan *y = b;
+	if (x->side  != y->side)  { return x->side  < y->side  ? -1 : 1; }
+	if (x->fixed != y->fixed) { return x->fixed < y->fixed ? -1 : 1; }
+	return (x->start > y->start)-(x->start < y->start);
+}
+/*
+ * Merge the walls which continue each other into spans. `spans` must have room
+ * for line_count elements. Returns the number of spans.
+ */
+static int
+BAS_MergeLines(struct BAS_WallSpan *spans)
+{
+	register int i;
+	int count = 0;
+	for (i = 0; i < plan->line_count; i++)
+	{
+		BAS_WallSpan_FromLine(&plan->lines[i], &spans[i]);
+	}
+	qsort(spans, plan->line_count, sizeof(struct BAS_WallSpan), wallspan_compare);
+	for (i = 0; i < plan->line_count; i++)
+	{
+		if (count > 0
+		 && spans[count-1].side  == spans[i].side
+		 && spans[count-1].fixed == spans[i].fixed
+		 && spans[count-1].end   == spans[i].start)
+		{
+			spans[count-1].end = spans[i].end;
+		}
+		else
+		{
+			spans[count++] = spans[i];
+		}
+	}
+	return count;
+}
+
+/*
+ * ----------------
+ * Collision grid.
+ * A uniform grid over the walls, meant as a ready made broad phase for the
+ * game. Grid cell (x, y) covers the nodes from x*COLLISIONGRID_SIZE up to
+ * (x+1)*COLLISIONGRID_SIZE along x, and so on along y. Walls are cut at the
+ * grid lines so that every piece lies in a single grid cell, pieces lying on a
+ * grid line are put in the cells on both sides of it. Only the grid cells
+ * which hold pieces are kept, sorted by row and then column, so that a lookup
+ * is a binary search and the grid grows with the walls and not with the area
+ * around them. Grid cell i owns the pieces segments[offsets[i]] up to
+ * segments[offsets[i+1]-1].
+ * ----------------
+ */
+#define COLLISIONGRID_SIZE 8 /* Size of a grid cell, in cells. */
+struct BAS_CollisionGrid
+{
+	int cell_count;  /* Grid cells which hold pieces. */
+	int (*cells)[2]; /* cell_count grid cell positions, sorted by row and then column. */
+	int *offsets;    /* cell_count+1 elements. */
+	struct BAS_WallSpan *segments;
+	int segment_count;
+};
+struct collisiongrid_piece
+{
+	int cell[2];
+	struct BAS_WallSpan span;
+};
+static int
+collisiongrid_comparepieces(const void *a, const void *b)
+{
+	const struct collisiongrid_piece *x = a;
+	const struct collisiongrid_piece *y = b;
+	if (x->cell[1] != y->cell[1])
+	{
+		return x->cell[1] < y->cell[1] ? -1 : 1;
+	}
+	if (x->cell[0] != y->cell[0])
+	{
+		return x->cell[0] < y->cell[0] ? -1 : 1;
+	}
+	return wallspan_compare(&x->span, &y->span);
+}
+static void
+BAS_CollisionGrid_Free(struct BAS_CollisionGrid *grid)
+{
+	free(grid->cells);
+	free(grid->offsets);
+	free(grid->segments);
+	memset(grid, 0, sizeof(struct BAS_CollisionGrid));
+}
+/*
+ * Build the collision grid over the walls, merged into spans first if `merge`
+ * is set. Returns 0 on success, 1 on error.
+ */
+static int
+BAS_CollisionGrid_Build(struct BAS_CollisionGrid *grid, int merge)
+{
+	register int i;
+	int span_count, piece_count = 0, piece_capacity = 0;
+	struct BAS_WallSpan *spans;
+	struct collisiongrid_piece *pieces = NULL;
+	memset(grid, 0, sizeof(struct BAS_CollisionGrid));
+	if (plan->lines_outdated)
+	{
+		BAS_RecalculateLines();
+	}
+	spans = malloc((plan->line_count+1)*sizeof(struct BAS_WallSpan));
+	if (!spans)
+	{
+		WRITE_E("Out of memory!");
+		return 1;
+	}
+	if (merge)
+	{
+		span_count = BAS_MergeLines(spans);
+	}
+	else
+	{
+		for (i = 0; i < plan->line_count; i++)
+		{
+			BAS_WallSpan_FromLine(&plan->lines[i], &spans[i]);
+		}
+		span_count = plan->line_count;
+	}
+	/* Cut the spans at the grid lines. */
+	for (i = 0; i < span_count; i++)
+	{
+		const int horizontal = spans[i].side == BAS_SIDE_NORTH || spans[i].side == BAS_SIDE_SOUTH;
+		const int fixed      = BAS_FloorDiv(spans[i].fixed, COLLISIONGRID_SIZE);
+		const int onborder   = spans[i].fixed%COLLISIONGRID_SIZE == 0;
+		int start = spans[i].start;
+		while (start < spans[i].end)
+		{
+			const int step   = BAS_FloorDiv(start, COLLISIONGRID_SIZE);
+			const int border = (step+1)*COLLISIONGRID_SIZE;
+			const int end    = border < spans[i].end ? border : spans[i].end;
+			int copy;
+			if (BAS_Reserve(MEMORY_WORK, (void **)&pieces, &piece_capacity, piece_count+2, sizeof(struct collisiongrid_piece)))
+			{
+				free(spans);
+				BAS_Free(pieces);
+				return 1;
+			}
+			for (copy = 0; copy <= onborder; copy++)
+			{
+				pieces[piece_count].cell[0]    = horizontal ? step : fixed-copy;
+				pieces[piece_count].cell[1]    = horizontal ? fixed-copy : step;
+				pieces[piece_count].span       = spans[i];
+				pieces[piece_count].span.start = start;
+				pieces[piece_count].span.end   = end;
+				piece_count++;
+			}
+			start = end;
+		}
+	}
+	free(spans);
+	if (piece_count)
+	{
+		qsort(pieces, piece_count, sizeof(struct collisiongrid_piece), collisiongrid_comparepieces);
+	}
+	for (i = 0; i < piece_count; i++)
+	{
+		grid->cell_count += !i || memcmp(pieces[i].cell, pieces[i-1].cell, sizeof(pieces[i].cell));
+	}
+	grid->cells    = malloc((grid->cell_count+1)*sizeof(*grid->cells));
+	grid->offsets  = malloc((grid->cell_count+1)*sizeof(int));
+	grid->segments = malloc((piece_count+1)*sizeof(struct BAS_WallSpan));
+	if (!grid->cells || !grid->offsets || !grid->segments)
+	{
+		WRITE_E("Out of memory!");
+		BAS_Free(pieces);
+		BAS_CollisionGrid_Free(grid);
+		return 1;
+	}
+	grid->segment_count = piece_count;
+	grid->cell_count    = 0;
+	for (i = 0; i < piece_count; i++)
+	{
+		if (!i || memcmp(pieces[i].cell, pieces[i-1].cell, sizeof(pieces[i].cell)))
+		{
+			grid->cells[grid->cell_count][0] = pieces[i].cell[0];
+			grid->cells[grid->cell_count][1] = pieces[i].cell[1];
+			grid->offsets[grid->cell_count]  = i;
+			grid->cell_count++;
+		}
+		grid->segments[i] = pieces[i].span;
+	}
+	grid->offsets[grid->cell_count] = piece_count;
+	BAS_Free(pieces);
+	return 0;
+}
+/* The index of grid cell (gx, gy), or -1 if it holds no pieces. */
+static int
+BAS_CollisionGrid_Find(const struct BAS_CollisionGrid *grid, int gx, int gy)
+{
+	int low = 0, high = grid->cell_count;
+	while (low < high)
+	{
+		const int middle = low+(high-low)/2;
+		if (grid->cells[middle][1] < gy || (grid->cells[middle][1] == gy && grid->cells[middle][0] < gx))
+		{
+			low = middle+1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+	return low < grid->cell_count && grid->cells[low][0] == gx && grid->cells[low][1] == gy ? low : -1;
+}
+
+/*
+ * ----------------
+ * Stress test.
+ * Random edits are applied to a small plan and after every one of them the
+ * fast paths are checked against brute force: the walls and neighbours of
+ * BAS_RecalculateLines, the floor rectangles, the collision grid, BAS_FindRoom
+ * and BAS_FindThing against scans of the plain arrays, and plan files against
+ * the plan they were saved from. Most edits land around the origin, the others
+ * far away from it or across the edge of the range rooms are kept in, so the
+ * plan is also sparse and edits past ROOM_LIMIT have to be refused.
+ * A failing sequence is shrunk by dropping steps for as long as it still fails
+ * and printed as a reproducer.
+ * ----------------
+ */
+#define STRESS_AREA     16 /* Edits land in the cells [-STRESS_AREA/2, STRESS_AREA/2) around an origin, a chunk corner. */
+#define STRESS_FILE     "./plans/stress.bas"
+#define STRESS_CREATE   0
+#define STRESS_DELETE   1
+#define STRESS_FILL     2
+#define STRESS_ERASE    3
+#define STRESS_PAINT    4
+#define STRESS_UNPAINT  5
+#define STRESS_FLOOD    6
+#define STRESS_THING    7
+#define STRESS_GENERATE 8
+#define STRESS_RELOAD   9
+#define STRESS_KINDS    10
+static const char *const STRESS_NAMES[STRESS_KINDS] = {
+	"create", "delete", "fill", "erase", "paint", "unpaint", "flood", "thing", "generate", "reload"
+};
+/* How often each kind of step is picked, out of 100. */
+static const int STRESS_WEIGHTS[STRESS_KINDS] = {20, 14, 10, 10, 10, 8, 8, 12, 2, 6};
+/* Where edits land: mostly the first, one in STRESS_FARAWAY one of the others. */
+#define STRESS_ORIGINS  4
+#define STRESS_FARAWAY  8
+static const int STRESS_ORIGIN[STRESS_ORIGINS][2] = {
+	{0, 0},
+	{1 << 20, -(3 << 18)},                                       /* Far from the others. */
+	{ROOM_LIMIT-STRESS_AREA/4, -ROOM_LIMIT+STRESS_AREA/4},       /* Across the edges of the range. */
+	{-ROOM_LIMIT+STRESS_AREA/4, ROOM_LIMIT-STRESS_AREA/4}
+};
+struct BAS_StressStep
+{
+	int kind;
+	int a[4];
+};
+struct stress_thing
+{
+	int x, y, type, facing;
+	uint64_t flags;
+};
+
+static int
+stress_compare4(const void *a, const void *b)
+{
+	register int i;
+	for (i = 0; i < 4; i++)
+	{
+		if (((const int *)a)[i] != ((const int *)b)[i])
+		{
+			return ((const int *)a)[i] < ((const int *)b)[i] ? -1 : 1;
+		}
+	}
+	return 0;
+}
+static int
+stress_thingcompare(const void *a, const void *b)
+{
+	const struct stress_thing *ta = a, *tb = b;
+	const int c = stress_compare4(&ta->x, &tb->x);
+	return c ? c : (ta->flags > tb->flags)-(ta->flags < tb->flags);
+}
+
+/* The room at the given cell, by walking the whole room array. */
+static int
+stress_scanroom(int cx, int cy)
+{
+	register int i;
+	for (i = 0; i < plan->room_count; i++)
+	{
+		if (plan->rooms[i].cellposition[0] == cx && plan->rooms[i].cellposition[1] == cy)
+		{
+			return i;
+		}
+	}
+	return BAS_NO_SUCH_ROOM;
+}
+
+/* Rooms as sorted (x, y, 0, 0) and things as sorted records, for comparing plans. */
+static int
+stress_snapshot(int **roomcells, struct stress_thing **thinglist)
+{
+	register int i;
+	*roomcells = malloc((plan->room_count+1)*sizeof(int[4]));
+	*thinglist = malloc((plan->thing_count+1)*sizeof(struct stress_thing));
+	if (!*roomcells || !*thinglist)
+	{
+		WRITE_E("Out of memory!");
+		free(*roomcells);
+		free(*thinglist);
+		return 1;
+	}
+	for (i = 0; i < plan->room_count; i++)
+	{
+		(*roomcells)[i*4+0] = plan->rooms[i].cellposition[0];
+		(*roomcells)[i*4+1] = plan->rooms[i].cellposition[1];
+		(*roomcells)[i*4+2] = (*roomcells)[i*4+3] = 0;
+	}
+	for (i = 0; i < plan->thing_count; i++)
+	{
+		const struct BAS_Thing t = BAS_Thing_Get(i);
+		(*thinglist)[i].x      = t.thingposition[0];
+		(*thinglist)[i].y      = t.thingposition[1];
+		(*thinglist)[i].type   = t.type;
+		(*thinglist)[i].facing = t.facing;
+		(*thinglist)[i].flags  = t.flags;
+	}
+	qsort(*roomcells, plan->room_count, sizeof(int[4]), stress_compare4);
+	qsort(*thinglist, plan->thing_count, sizeof(struct stress_thing), stress_thingcompare);
+	return 0;
+}
+
+/*
+ * Compare the fast paths against brute force on the current plan.
+ * Returns 0 if they agree, 1 with the first difference written into `why`.
+ */
+static int
+stress_check(char *why, size_t whysize)
+{
+	register int i, j, side;
+	int x, y, covered = 0, failed = 0;
+	int (*expected)[4], (*actual)[4], wall_count = 0;
+	struct BAS_CollisionGrid collision;
+	BAS_RecalculateLines();
+	expected = malloc((plan->room_count*4+1)*sizeof(int[4]));
+	actual   = malloc((plan->line_count+1)*sizeof(int[4]));
+	if (!expected || !actual)
+	{
+		free(expected);
+		free(actual);
+		snprintf(why, whysize, "out of memory");
+		return 1;
+	}
+	/* Walls and neighbours. */
+	for (i = 0; i < plan->room_count && !failed; i++)
+	{
+		const int cx = plan->rooms[i].cellposition[0];
+		const int cy = plan->rooms[i].cellposition[1];
+		if (!BAS_Room_Inside(cx, cy))
+		{
+			snprintf(why, whysize, "room (%d, %d) is out of range", cx, cy);
+			failed = 1;
+			break;
+		}
+		for (side = 0; side < 4; side++)
+		{
+			const int neighbour = stress_scanroom(cx+SIDE_NEIGHBOUR[side][0], cy+SIDE_NEIGHBOUR[side][1]);
+			if (plan->roomneighbours[i][side] != neighbour)
+			{
+				snprintf(why, whysize, "room (%d, %d) has neighbour %d on side %d, expected %d", cx, cy, plan->roomneighbours[i][side], side, neighbour);
+				failed = 1;
+				break;
+			}
+			if (neighbour == BAS_NO_SUCH_ROOM)
+			{
+				expected[wall_count][0] = cx+SIDE_WALL[side][0];
+				expected[wall_count][1] = cy+SIDE_WALL[side][1];
+				expected[wall_count][2] = cx+SIDE_WALL[side][2];
+				expected[wall_count][3] = cy+SIDE_WALL[side][3];
+				wall_count++;
+			}
+		}
+	}
+	for (i = 0; i < plan->line_count; i++)
+	{
+		BAS_Line_Nodes(&plan->lines[i], actual[i]);
+	}
+	qsort(expected, wall_count, sizeof(int[4]), stress_compare4);
+	qsort(actual, plan->line_count, sizeof(int[4]), stress_compare4);
+	if (!failed && (wall_count != plan->line_count || memcmp(expected, actual, wall_count*sizeof(int[4]))))
+	{
+		snprintf(why, whysize, "%d walls, expected %d", plan->line_count, wall_count);
+		failed = 1;
+	}
+	free(expected);
+	/* Collision grid: every wall is found in the grid cells next to it, and every piece lies in its grid cell. */
+	if (!failed && BAS_CollisionGrid_Build(&collision, 0))
+	{
+		snprintf(why, whysize, "the collision grid could not be built");
+		failed = 1;
+	}
+	else if (!failed)
+	{
+		for (i = 0; i < collision.cell_count && !failed; i++)
+		{
+			for (j = collision.offsets[i]; j < collision.offsets[i+1]; j++)
+			{
+				int nodes[4];
+				BAS_WallSpan_Nodes(&collision.segments[j], nodes);
+				if ((nodes[0] < nodes[2] ? nodes[0] : nodes[2]) < collision.cells[i][0]*COLLISIONGRID_SIZE
+				 || (nodes[1] < nodes[3] ? nodes[1] : nodes[3]) < collision.cells[i][1]*COLLISIONGRID_SIZE
+				 || (nodes[0] > nodes[2] ? nodes[0] : nodes[2]) > (collision.cells[i][0]+1)*COLLISIONGRID_SIZE
+				 || (nodes[1] > nodes[3] ? nodes[1] : nodes[3]) > (collision.cells[i][1]+1)*COLLISIONGRID_SIZE
+				 || (i > 0 && collision.cells[i-1][1] == collision.cells[i][1] && collision.cells[i-1][0] >= collision.cells[i][0])
+				 || (i > 0 && collision.cells[i-1][1] > collision.cells[i][1]))
+				{
+					snprintf(why, whysize, "collision grid cell (%d, %d) is out of order or holds a piece outside it", collision.cells[i][0], collision.cells[i][1]);
+					failed = 1;
+					break;
+				}
+			}
+		}
+		for (i = 0; i < plan->line_count*2 && !failed; i++)
+		{
+			/* Both grid cells next to the wall, the same one unless the wall lies on a grid line. */
+			const int *wall      = actual[i/2];
+			const int horizontal = wall[1] == wall[3];
+			const int cell = BAS_CollisionGrid_Find(
+				&collision,
+				BAS_FloorDiv((wall[0] < wall[2] ? wall[0] : wall[2])-(i & 1 && !horizontal), COLLISIONGRID_SIZE),
+				BAS_FloorDiv((wall[1] < wall[3] ? wall[1] : wall[3])-(i & 1 && horizontal), COLLISIONGRID_SIZE)
+			);
+			for (j = cell < 0 ? 0 : collision.offsets[cell]; cell >= 0 && j < collision.offsets[cell+1]; j++)
+			{
+				int nodes[4];
+				BAS_WallSpan_Nodes(&collision.segments[j], nodes);
+				if (!memcmp(nodes, wall, sizeof(nodes)))
+				{
+					break;
+				}
+			}
+			if (cell < 0 || j == collision.offsets[cell+1])
+			{
+				snprintf(why, whysize, "wall (%d, %d)-(%d, %d) is not in the collision grid", wall[0], wall[1], wall[2], wall[3]);
+				failed = 1;
+			}
+		}
+		BAS_CollisionGrid_Free(&collision);
+	}
+	free(actual);
+	/* Room lookups, over the edited areas and a border around them. */
+	for (i = 0; i < plan->room_count && !failed; i++)
+	{
+		if (BAS_FindRoom(plan->rooms[i].cellposition[0], plan->rooms[i].cellposition[1]) != i)
+		{
+			snprintf(why, whysize, "room %d at (%d, %d) is found as %d", i, plan->rooms[i].cellposition[0], plan->rooms[i].cellposition[1], BAS_FindRoom(plan->rooms[i].cellposition[0], plan->rooms[i].cellposition[1]));
+			failed = 1;
+		}
+	}
+	for (j = 0; j < STRESS_ORIGINS && !failed; j++)
+	{
+		for (y = STRESS_ORIGIN[j][1]-STRESS_AREA/2-2; y < STRESS_ORIGIN[j][1]+STRESS_AREA/2+2 && !failed; y++)
+		{
+			for (x = STRESS_ORIGIN[j][0]-STRESS_AREA/2-2; x < STRESS_ORIGIN[j][0]+STRESS_AREA/2+2; x++)
+			{
+				if (BAS_FindRoom(x, y) != stress_scanroom(x, y))
+				{
+					snprintf(why, whysize, "cell (%d, %d) is found as room %d, expected %d", x, y, BAS_FindRoom(x, y), stress_scanroom(x, y));
+					failed = 1;
+					break;
+				}
+			}
+		}
+	}
+	/* Thing lookups: the first thing at a position. */
+	for (i = 0; i < plan->thing_count && !failed; i++)
+	{
+		register int first;
+		const int tx = plan->things.thingposition[0][i];
+		const int ty = plan->things.thingposition[1][i];
+		for (first = 0; plan->things.thingposition[0][first] != tx || plan->things.thingposition[1][first] != ty; first++);
+		if (BAS_FindThing(tx, ty) != first)
+		{
+			snprintf(why, whysize, "thing at (%d, %d) is found as %d, expected %d", tx, ty, BAS_FindThing(tx, ty), first);
+			failed = 1;
+		}
+	}
+	if (!failed && BAS_FindThing(INT_MIN, INT_MIN) != BAS_NO_SUCH_THING)
+	{
+		snprintf(why, whysize, "a thing is found where there is none");
+		failed = 1;
+	}
+	/* Floor rectangles must cover every room exactly once, and nothing else. */
+	if (!failed)
+	{
+		int (*cells)[4];
+		BAS_RecalculateFloor();
+		for (i = 0; i < plan->floorrect_count; i++)
+		{
+			covered += plan->floorrects[i].size[0]*plan->floorrects[i].size[1];
+		}
+		if (covered != plan->room_count)
+		{
+			snprintf(why, whysize, "floor rectangles cover %d cells, expected %d", covered, plan->room_count);
+			return 1;
+		}
+		if (!(cells = malloc((covered+1)*sizeof(int[4]))))
+		{
+			snprintf(why, whysize, "out of memory");
+			return 1;
+		}
+		for (i = 0, covered = 0; i < plan->floorrect_count; i++)
+		{
+			const struct BAS_FloorRect *rect = &plan->floorrects[i];
+			for (y = rect->cellposition[1]; y < rect->cellposition[1]+rect->size[1]; y++)
+			{
+				for (x = rect->cellposition[0]; x < rect->cellposition[0]+rect->size[0]; x++)
+				{
+					cells[covered][0] = x;
+					cells[covered][1] = y;
+					cells[covered][2] = cells[covered][3] = 0;
+					covered++;
+				}
+			}
+		}
+		qsort(cells, covered, sizeof(int[4]), stress_compare4);
+		for (i = 0; i < covered && !failed; i++)
+		{
+			if ((i > 0 && !memcmp(cells[i-1], cells[i], sizeof(int[4]))) || stress_scanroom(cells[i][0], cells[i][1]) == BAS_NO_SUCH_ROOM)
+			{
+				snprintf(why, whysize, "a floor rectangle covers cell (%d, %d) wrongly", cells[i][0], cells[i][1]);
+				failed = 1;
+			}
+		}
+		free(cells);
+	}
+	return failed;
+}
+
+/* Save the plan to the stress file, load it back and compare. */
+static int
+stress_reload(char *why, size_t whysize)
+{
+	int *beforerooms, *afterrooms;
+	struct stress_thing *beforethings, *afterthings;
+	const int roomsbefore = plan->room_count, thingsbefore = plan->thing_count;
+	int failed;
+	if (stress_snapshot(&beforerooms, &beforethings))
+	{
+		snprintf(why, whysize, "out of memory");
+		return 1;
+	}
+	if (BAS_Plan_Save(STRESS_FILE) || BAS_Plan_Load(STRESS_FILE))
+	{
+		free(beforerooms);
+		free(beforethings);
+		snprintf(why, whysize, "the plan file could not be saved or loaded");
+		return 1;
+	}
+	if (stress_snapshot(&afterrooms, &afterthings))
+	{
+		free(beforerooms);
+		free(beforethings);
+		snprintf(why, whysize, "out of memory");
+		return 1;
+	}
+	failed = plan->room_count != roomsbefore || plan->thing_count != thingsbefore
+	      || memcmp(beforerooms, afterrooms, plan->room_count*sizeof(int[4]))
+	      || memcmp(beforethings, afterthings, plan->thing_count*sizeof(struct stress_thing));
+	if (failed)
+	{
+		snprintf(why, whysize, "reloaded %d rooms and %d things, saved %d and %d (or they differ)", plan->room_count, plan->thing_count, roomsbefore, thingsbefore);
+	}
+	free(beforerooms);
+	free(beforethings);
+	free(afterrooms);
+	free(afterthings);
+	return failed;
+}
+
+/* Start from an empty plan and no plan file, so every run is the same. */
+static void
+stress_reset(void)
+{
+	BAS_Paging_Close();
+	BAS_Plan_Clear();
+	BAS_Free(plan->planfile_index);
+	plan->planfile_index      = NULL;
+	plan->planfile_chunkcount     = 0;
+	plan->planfile_prefabcapacity = 0;
+	plan->planfile_path[0]        = '\0';
+	remove(STRESS_FILE);
+}
+
+/*
+ * Run the steps which are not `dropped`, checking after each one.
+ * Returns the number of the failing step (counting from 1), 0 if all passed.
+ */
+static int
+stress_run(const struct BAS_StressStep *steps, const unsigned char *dropped, int count, char *why, size_t whysize)
+{
+	register int i;
+	stress_reset();
+	for (i = 0; i < count; i++)
+	{
+		const struct BAS_StressStep *step = &steps[i];
+		int thing, failed = 0;
+		if (dropped && dropped[i])
+		{
+			continue;
+		}
+		switch (step->kind)
+		{
+			case STRESS_CREATE:  BAS_Room_Create(step->a[0], step->a[1]);                                  break;
+			case STRESS_DELETE:  BAS_Room_Delete(step->a[0], step->a[1]);                                  break;
+			case STRESS_FILL:    BAS_Room_FillRectangle(step->a[0], step->a[1], step->a[2], step->a[3]);   break;
+			case STRESS_ERASE:   BAS_Room_EraseRectangle(step->a[0], step->a[1], step->a[2], step->a[3]);  break;
+			case STRESS_PAINT:   BAS_Room_PaintLine(step->a[0], step->a[1], step->a[2], step->a[3], 0);    break;
+			case STRESS_UNPAINT: BAS_Room_PaintLine(step->a[0], step->a[1], step->a[2], step->a[3], 1);    break;
+			case STRESS_FLOOD:   BAS_Room_FloodFill(step->a[0], step->a[1]);                               break;
+			case STRESS_THING:
+				if ((thing = BAS_Thing_Create(step->a[0], step->a[1], step->a[2] & 3)) != BAS_NO_SUCH_THING)
+				{
+					plan->things.type[thing]  = step->a[2] >> 2;
+					plan->things.flags[thing] = (uint64_t)(unsigned int)step->a[3]*0x9E3779B97F4A7C15ull;
+				}
+				break;
+			case STRESS_GENERATE:
+				BAS_Generate(step->a[0], (Uint64)step->a[1], STRESS_AREA, STRESS_AREA, step->a[2], step->a[3]);
+				break;
+			case STRESS_RELOAD:
+				failed = stress_reload(why, whysize);
+				break;
+		}
+		BAS_InvalidateLines();
+		if (failed || stress_check(why, whysize))
+		{
+			return i+1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Run `count` random steps from the given seed. On failure the steps are shrunk
+ * and printed. Replaces the plan. Returns 0 when everything agreed, 1 otherwise.
+ */
+static int
+BAS_Stress(Uint64 seed, int count)
+{
+	register int i, j;
+	struct BAS_StressStep *steps;
+	unsigned char *dropped, *saved;
+	Uint64 random = seed;
+	char why[160], message[96+sizeof(why)]; /* Room for the prefix and the whole of why. */
+	int failing, chunk, remaining;
+	const int quiet = print_quiet;
+	const Uint64 start = SDL_GetPerformanceCounter();
+	if (count <= 0)
+	{
+		WRITE_E("No stress steps to run!");
+		return 1;
+	}
+	steps   = malloc((size_t)count*sizeof(struct BAS_StressStep));
+	dropped = calloc(count, 2);
+	if (!steps || !dropped)
+	{
+		WRITE_E("Out of memory!");
+		free(steps);
+		free(dropped);
+		return 1;
+	}
+	saved = dropped+count;
+	for (i = 0; i < count; i++)
+	{
+		int pick = BAS_Random_Below(&random, 100);
+		const int *origin = STRESS_ORIGIN[BAS_Random_Below(&random, STRESS_FARAWAY) ? 0 : 1+BAS_Random_Below(&random, STRESS_ORIGINS-1)];
+		for (j = 0; pick >= STRESS_WEIGHTS[j]; pick -= STRESS_WEIGHTS[j], j++);
+		steps[i].kind = j;
+		for (j = 0; j < 4; j++)
+		{
+			steps[i].a[j] = origin[j & 1]+BAS_Random_Below(&random, STRESS_AREA)-STRESS_AREA/2;
+		}
+		if (steps[i].kind == STRESS_THING)
+		{
+			/* On a coarse grid, so things pile up on the same positions. */
+			steps[i].a[0] = steps[i].a[0]*CELL_SCALE+BAS_Random_Below(&random, 2)*THING_SCALE;
+			steps[i].a[1] = steps[i].a[1]*CELL_SCALE+BAS_Random_Below(&random, 2)*THING_SCALE;
+			steps[i].a[2] = BAS_Random_Below(&random, 64);
+			steps[i].a[3] = (int)(BAS_Random_Next(&random) >> 33);
+		}
+		else if (steps[i].kind == STRESS_GENERATE)
+		{
+			/* Not across the edges, where the whole area would be refused. */
+			steps[i].a[0] = BAS_Random_Below(&random, GENERATOR_COUNT);
+			steps[i].a[1] = (int)(BAS_Random_Next(&random) >> 33);
+			steps[i].a[2] = (origin == STRESS_ORIGIN[1] ? origin[0] : 0)-STRESS_AREA/2;
+			steps[i].a[3] = (origin == STRESS_ORIGIN[1] ? origin[1] : 0)-STRESS_AREA/2;
+		}
+	}
+	print_quiet = 1;
+	failing = stress_run(steps, NULL, count, why, sizeof(why));
+	if (failing)
+	{
+		/* Everything after the failing step is not needed, then drop ever smaller runs of steps. */
+		snprintf(message, sizeof(message), "Stress test failed at step %d of %d (seed %llu): %s.", failing, count, (unsigned long long)seed, why);
+		WRITE_E(message);
+		for (i = failing; i < count; i++)
+		{
+			dropped[i] = 1;
+		}
+		for (chunk = failing/2 > 0 ? failing/2 : 1; chunk > 0; chunk /= 2)
+		{
+			for (i = 0; i < failing; i += chunk)
+			{
+				const int end = i+chunk < failing ? i+chunk : failing;
+				memcpy(saved+i, dropped+i, end-i);
+				memset(dropped+i, 1, end-i);
+				/* Keep the run dropped only if the steps left still fail. */
+				if (memcmp(saved+i, dropped+i, end-i) && !stress_run(steps, dropped, count, why, sizeof(why)))
+				{
+					memcpy(dropped+i, saved+i, end-i);
+				}
+			}
+		}
+		stress_run(steps, dropped, count, why, sizeof(why));
+		BAS_Log_Flush();
+		for (remaining = i = 0; i < count; i++)
+		{
+			remaining += !dropped[i];
+		}
+		printf("Reproducer, %d steps from an empty plan, failing with: %s.\n", remaining, why);
+		for (i = 0; i < count; i++)
+		{
+			if (!dropped[i])
+			{
+				printf("\t%-8s %d %d %d %d\n", STRESS_NAMES[steps[i].kind], steps[i].a[0], steps[i].a[1], steps[i].a[2], steps[i].a[3]);
+			}
+		}
+	}
+	stress_reset();
+	print_quiet = quiet;
+	if (!failing)
+	{
+		snprintf(
+			message, sizeof(message), "Stress test passed: %d steps (seed %llu) in %.1f ms.",
+			count, (unsigned long long)seed, (SDL_GetPerformanceCounter()-start)*1000.0/SDL_GetPerformanceFrequency()
+		);
+		WRITE_I(message);
+	}
+	free(steps);
+	free(dropped);
+	return failing != 0;
+}
+
+/*
+ * ----------------
+ * Potentially visible sets.
+ * For every region of the navigation graph, the regions which can be seen
+ * from it. Regions only meet on the tile lines, at portals: runs of tile line
+ * with a room of one region on one side and a room of another on the other.
+ * A line of sight crosses a portal at every tile line it passes, so a region
+ * is visible from another if some line through the other's bounding box
+ * stabs a chain of portals leading to it.
+ * Lines are searched one octant of directions at a time, the octant turned so
+ * that 0 <= dy <= dx. There a line is y = a+b*x, and passing through a box or
+ * a portal is a pair of linear constraints on (a, b). Every region reached
+ * keeps the convex hull of the (a, b) of the lines reaching it, which holds
+ * all of them and maybe more, so the sets are conservative: nothing visible
+ * is left out, though a line slipping between two walls through their shared
+ * corner counts as blocked. Every portal crossed leads one tile right or up,
+ * so regions are reached in layers, one tile line at a time, up to
+ * PVS_MAXDISTANCE cells away along the rows and columns.
+ * A region always sees itself and its neighbours, and visibility is made
+ * symmetric at the end. Regions are handed out to one worker thread per CPU.
+ * Row r of `bits` has bit c set if region c is visible from region r.
+ * ----------------
+ */
+#define PVS_MAXDISTANCE 1024 /* In cells. */
+#define PVS_MAXVERTICES 16   /* Bigger hulls are replaced by their bounding box. */
+#define PVS_EPSILON     1e-7
+struct BAS_PVS
+{
+	int region_count;
+	int words; /* 32-bit words per row. */
+	Uint32 *bits;
+};
+/* A run of tile line between a room of region[0] on the lower side and a room of region[1] on the higher side. */
+struct pvs_portal
+{
+	int region[2];
+	int vertical; /* On the line x = at, else on y = at. */
+	int at;
+	int from, to; /* Along the line. */
+};
+/* A convex polygon of (a, b), empty without vertices. */
+struct pvs_polygon
+{
+	int count;
+	double vertex[PVS_MAXVERTICES+1][2];
+};
+struct pvs_reach
+{
+	int region;
+	struct pvs_polygon lines;
+};
+struct pvs_job
+{
+	const struct BAS_NavGraph *graph;
+	const struct pvs_portal *portals;
+	const int *regionportals; /* Portals of every region, on either side. */
+	const int *regionfirst;   /* region_count+1 offsets into regionportals. */
+	struct BAS_PVS *pvs;
+	SDL_atomic_t next;
+	SDL_atomic_t failed;
+};
+/* Turn a point into the octant: bit 0 flips x, bit 1 flips y and bit 2 swaps them. */
+static inline void
+pvs_turn(int octant, int x, int y, int turned[2])
+{
+	if (octant & 1) { x = -x; }
+	if (octant & 2) { y = -y; }
+	turned[0] = octant & 4 ? y : x;
+	turned[1] = octant & 4 ? x : y;
+}
+/* Keep the part of the polygon where ka*a+kb*b <= k, give or take PVS_EPSILON. */
+static void
+pvs_clip(struct pvs_polygon *polygon, double ka, double kb, double k)
+{
+	register int i;
+	struct pvs_polygon clipped;
+	clipped.count = 0;
+	k += PVS_EPSILON;
+	for (i = 0; i < polygon->count; i++)
+	{
+		const double *p = polygon->vertex[i ? i-1 : polygon->count-1];
+		const double *q = polygon->vertex[i];
+		const double dp = ka*p[0]+kb*p[1]-k;
+		const double dq = ka*q[0]+kb*q[1]-k;
+		if ((dp <= 0.0) != (dq <= 0.0))
+		{
+			const double t = dp/(dp-dq);
+			clipped.vertex[clipped.count][0] = p[0]+t*(q[0]-p[0]);
+			clipped.vertex[clipped.count][1] = p[1]+t*(q[1]-p[1]);
+			clipped.count++;
+		}
+		if (dq <= 0.0)
+		{
+			clipped.vertex[clipped.count][0] = q[0];
+			clipped.vertex[clipped.count][1] = q[1];
+			clipped.count++;
+		}
+	}
+	*polygon = clipped;
+}
+/* Replace the polygon with the bounding box of the given points, which holds it. */
+static void
+pvs_bound(struct pvs_polygon *polygon, const double (*points)[2], int count)
+{
+	register int i;
+	double low[2], high[2];
+	low[0] = high[0] = points[0][0];
+	low[1] = high[1] = points[0][1];
+	for (i = 1; i < count; i++)
+	{
+		if (points[i][0] < low[0])  { low[0]  = points[i][0]; }
+		if (points[i][1] < low[1])  { low[1]  = points[i][1]; }
+		if (points[i][0] > high[0]) { high[0] = points[i][0]; }
+		if (points[i][1] > high[1]) { high[1] = points[i][1]; }
+	}
+	polygon->count = 4;
+	polygon->vertex[0][0] = low[0];  polygon->vertex[0][1] = low[1];
+	polygon->vertex[1][0] = high[0]; polygon->vertex[1][1] = low[1];
+	polygon->vertex[2][0] = high[0]; polygon->vertex[2][1] = high[1];
+	polygon->vertex[3][0] = low[0];  polygon->vertex[3][1] = high[1];
+}
+static int
+pvs_comparepoints(const void *a, const void *b)
+{
+	const double *p = a;
+	const double *q = b;
+	if (p[0] != q[0])
+	{
+		return p[0] < q[0] ? -1 : 1;
+	}
+	return (p[1] > q[1])-(p[1] < q[1]);
+}
+static inline double
+pvs_cross(const double *o, const double *p, const double *q)
+{
+	return (p[0]-o[0])*(q[1]-o[1])-(p[1]-o[1])*(q[0]-o[0]);
+}
+/* The convex hull of the points (monotone chain), `hull` has room for 2*count points. */
+static void
+pvs_hull(struct pvs_polygon *polygon, double (*points)[2], int count, double (*hull)[2])
+{
+	register int i;
+	int k = 0, lower;
+	qsort(points, count, sizeof(double[2]), pvs_comparepoints);
+	for (i = 0; i < count; i++)
+	{
+		while (k >= 2 && pvs_cross(hull[k-2], hull[k-1], points[i]) <= 0.0)
+		{
+			k--;
+		}
+		hull[k][0] = points[i][0];
+		hull[k][1] = points[i][1];
+		k++;
+	}
+	for (i = count-2, lower = k+1; i >= 0; i--)
+	{
+		while (k >= lower && pvs_cross(hull[k-2], hull[k-1], points[i]) <= 0.0)
+		{
+			k--;
+		}
+		hull[k][0] = points[i][0];
+		hull[k][1] = points[i][1];
+		k++;
+	}
+	/* The first point closes the chain. All points the same leave just that. */
+	k = k > 1 ? k-1 : k;
+	if (k > PVS_MAXVERTICES)
+	{
+		pvs_bound(polygon, (const double (*)[2])points, count);
+		return;
+	}
+	polygon->count = k;
+	memcpy(polygon->vertex, hull, k*sizeof(double[2]));
+}
+/*
+ * Narrow the lines down to those which go through the portal, crossing it
+ * from the given region in the direction of the octant. Returns the region on
+ * the other side, or -1 if the portal leads the other way or no line is left.
+ */
+static int
+pvs_crossportal(const struct pvs_portal *portal, int region, int octant, const int origin[2], struct pvs_polygon *lines)
+{
+	int ends[2][2];
+	const int flip = portal->vertical ? octant & 1 : octant & 2;
+	if (portal->region[flip ? 1 : 0] != region)
+	{
+		return -1;
+	}
+	if (portal->vertical)
+	{
+		pvs_turn(octant, portal->at-origin[0], portal->from-origin[1], ends[0]);
+		pvs_turn(octant, portal->at-origin[0], portal->to-origin[1], ends[1]);
+	}
+	else
+	{
+		pvs_turn(octant, portal->from-origin[0], portal->at-origin[1], ends[0]);
+		pvs_turn(octant, portal->to-origin[0], portal->at-origin[1], ends[1]);
+	}
+	if (ends[0][0] == ends[1][0])
+	{
+		/* On x = c: lo <= a+b*c <= hi. */
+		const double c  = ends[0][0];
+		const double lo = ends[0][1] < ends[1][1] ? ends[0][1] : ends[1][1];
+		const double hi = ends[0][1] < ends[1][1] ? ends[1][1] : ends[0][1];
+		pvs_clip(lines, 1.0, c, hi);
+		pvs_clip(lines, -1.0, -c, -lo);
+	}
+	else
+	{
+		/* On y = c, and the lines do not go down: a+b*lo <= c <= a+b*hi. */
+		const double c  = ends[0][1];
+		const double lo = ends[0][0] < ends[1][0] ? ends[0][0] : ends[1][0];
+		const double hi = ends[0][0] < ends[1][0] ? ends[1][0] : ends[0][0];
+		pvs_clip(lines, 1.0, lo, c);
+		pvs_clip(lines, -1.0, -hi, -c);
+	}
+	if (!lines->count)
+	{
+		return -1;
+	}
+	if (lines->count > PVS_MAXVERTICES)
+	{
+		pvs_bound(lines, (const double (*)[2])lines->vertex, lines->count);
+	}
+	return portal->region[flip ? 0 : 1];
+}
+static int
+pvs_comparereaches(const void *a, const void *b)
+{
+	return ((const struct pvs_reach *)a)->region-((const struct pvs_reach *)b)->region;
+}
+/* The lines of the octant which pass through the region's bounding box. */
+static void
+pvs_sourcelines(const int bounds[4], int octant, struct pvs_polygon *lines)
+{
+	int corners[2][2];
+	const double extent = 4*NAVGRAPH_REGION_SIZE; /* More than any a = y-b*x in the box. */
+	pvs_turn(octant, 0, 0, corners[0]);
+	pvs_turn(octant, bounds[2]-bounds[0], bounds[3]-bounds[1], corners[1]);
+	lines->count = 4;
+	lines->vertex[0][0] = -extent; lines->vertex[0][1] = 0.0;
+	lines->vertex[1][0] =  extent; lines->vertex[1][1] = 0.0;
+	lines->vertex[2][0] =  extent; lines->vertex[2][1] = 1.0;
+	lines->vertex[3][0] = -extent; lines->vertex[3][1] = 1.0;
+	/* a+b*x0 <= y1 and a+b*x1 >= y0. */
+	pvs_clip(
+		lines, 1.0, corners[0][0] < corners[1][0] ? corners[0][0] : corners[1][0],
+		corners[0][1] < corners[1][1] ? corners[1][1] : corners[0][1]
+	);
+	pvs_clip(
+		lines, -1.0, -(corners[0][0] < corners[1][0] ? corners[1][0] : corners[0][0]),
+		-(corners[0][1] < corners[1][1] ? corners[0][1] : corners[1][1])
+	);
+}
+static int
+pvs_worker(void *data)
+{
+	struct pvs_job *job = data;
+	const struct BAS_NavGraph *graph = job->graph;
+	struct pvs_reach *layer = NULL, *next = NULL;
+	double (*points)[2] = NULL, (*hull)[2] = NULL;
+	int layer_capacity = 0, next_capacity = 0, points_capacity = 0, hull_capacity = 0;
+	int region;
+	BAS_Span_Begin("pvs_worker");
+	while ((region = SDL_AtomicAdd(&job->next, 1)) < graph->region_count && !SDL_AtomicGet(&job->failed))
+	{
+		register int i, j;
+		int octant, depth, layer_count, next_count;
+		Uint32 *row = job->pvs->bits+(size_t)region*job->pvs->words;
+		const int *origin = graph->region_bounds[region];
+		row[region >> 5] |= 1u << (region & 31);
+		for (i = graph->region_offsets[region]; i < graph->region_offsets[region+1]; i++)
+		{
+			row[graph->region_edges[i] >> 5] |= 1u << (graph->region_edges[i] & 31);
+		}
+		for (octant = 0; octant < 8; octant++)
+		{
+			if (BAS_Reserve(MEMORY_WORK, (void **)&layer, &layer_capacity, 1, sizeof(struct pvs_reach)))
+			{
+				goto failed;
+			}
+			layer[0].region = region;
+			pvs_sourcelines(graph->region_bounds[region], octant, &layer[0].lines);
+			layer_count = layer[0].lines.count > 0;
+			for (depth = 0; depth < PVS_MAXDISTANCE/NAVGRAPH_REGION_SIZE && layer_count; depth++)
+			{
+				/* Through every portal of the layer, */
+				for (i = 0, next_count = 0; i < layer_count; i++)
+				{
+					const struct pvs_reach *reach = &layer[i];
+					for (j = job->regionfirst[reach->region]; j < job->regionfirst[reach->region+1]; j++)
+					{
+						if (BAS_Reserve(MEMORY_WORK, (void **)&next, &next_capacity, next_count+1, sizeof(struct pvs_reach)))
+						{
+							goto failed;
+						}
+						next[next_count].lines = reach->lines;
+						if ((next[next_count].region = pvs_crossportal(
+							&job->portals[job->regionportals[j]], reach->region, octant, origin, &next[next_count].lines
+						)) >= 0)
+						{
+							next_count++;
+						}
+					}
+				}
+				/* and the lines reaching each region of the next layer merged into one hull. */
+				qsort(next, next_count, sizeof(struct pvs_reach), pvs_comparereaches);
+				if (BAS_Reserve(MEMORY_WORK, (void **)&layer, &layer_capacity, next_count, sizeof(struct pvs_reach)))
+				{
+					goto failed;
+				}
+				for (i = 0, layer_count = 0; i < next_count; i = j)
+				{
+					int count = 0;
+					for (j = i; j < next_count && next[j].region == next[i].region; j++)
+					{
+						count += next[j].lines.count;
+					}
+					if (BAS_Reserve(MEMORY_WORK, (void **)&points, &points_capacity, count, sizeof(double[2]))
+					 || BAS_Reserve(MEMORY_WORK, (void **)&hull, &hull_capacity, count*2, sizeof(double[2])))
+					{
+						goto failed;
+					}
+					for (j = i, count = 0; j < next_count && next[j].region == next[i].region; j++)
+					{
+						memcpy(points+count, next[j].lines.vertex, next[j].lines.count*sizeof(double[2]));
+						count += next[j].lines.count;
+					}
+					layer[layer_count].region = next[i].region;
+					pvs_hull(&layer[layer_count].lines, points, count, hull);
+					row[next[i].region >> 5] |= 1u << (next[i].region & 31);
+					layer_count++;
+				}
+			}
+		}
+	}
+	goto done;
+failed:
+	SDL_AtomicSet(&job->failed, 1);
+done:
+	BAS_Free(layer);
+	BAS_Free(next);
+	BAS_Free(points);
+	BAS_Free(hull);
+	BAS_Span_End("pvs_worker");
+	return 0;
+}
+/* The threads besides the calling one, each with a lane of its own. */
+static int
+pvs_thread(void *data)
+{
+	BAS_Span_Thread("BAS_PVS");
+	pvs_worker(data);
+	BAS_Span_ThreadEnd();
+	return 0;
+}
+static void
+BAS_PVS_Free(struct BAS_PVS *pvs)
+{
+	free(pvs->bits);
+	memset(pvs, 0, sizeof(struct BAS_PVS));
+}
+static int
+pvs_compareportals(const void *a, const void *b)
+{
+	const struct pvs_portal *p = a;
+	const struct pvs_portal *q = b;
+	if (p->vertical  != q->vertical)  { return p->vertical-q->vertical; }
+	if (p->at        != q->at)        { return p->at < q->at ? -1 : 1; }
+	if (p->region[0] != q->region[0]) { return p->region[0]-q->region[0]; }
+	if (p->region[1] != q->region[1]) { return p->region[1]-q->region[1]; }
+	return (p->from > q->from)-(p->from < q->from);
+}
+/* Compute the PVS of the regions of the given graph. Returns 0 on success, 1 on error. */
+static int
+BAS_PVS_Build(struct BAS_PVS *pvs, const struct BAS_NavGraph *graph)
+{
+	register int i, j, side;
+	struct pvs_portal *portals;
+	int *regionportals, *regionfirst;
+	int portal_count = 0, thread_count, started = 1;
+	SDL_Thread *threads[64];
+	struct pvs_job job;
+	char message[128];
+	const Uint64 start = SDL_GetPerformanceCounter();
+	memset(pvs, 0, sizeof(struct BAS_PVS));
+	memset(&job, 0, sizeof(struct pvs_job));
+	if (graph->region_count <= 0)
+	{
+		return 0;
+	}
+	pvs->region_count = graph->region_count;
+	pvs->words        = (graph->region_count+31)/32;
+	pvs->bits         = calloc((size_t)pvs->region_count*pvs->words, sizeof(Uint32));
+	portals           = malloc(((size_t)plan->room_count*2+1)*sizeof(struct pvs_portal));
+	regionportals     = malloc(((size_t)plan->room_count*4+1)*sizeof(int));
+	regionfirst       = calloc(graph->region_count+1, sizeof(int));
+	if (!pvs->bits || !portals || !regionportals || !regionfirst)
+	{
+		WRITE_E("Out of memory!");
+		goto failed;
+	}
+	/* A portal edge under every room edge to the right or above which has a room of another region behind it, */
+	for (i = 0; i < plan->room_count; i++)
+	{
+		for (side = 0; side < 4; side++)
+		{
+			const int neighbour = plan->roomneighbours[i][side];
+			if (SIDE_NEIGHBOUR[side][0]+SIDE_NEIGHBOUR[side][1] > 0 && neighbour != BAS_NO_SUCH_ROOM && graph->region[neighbour] != graph->region[i])
+			{
+				struct pvs_portal *portal = &portals[portal_count++];
+				portal->region[0] = graph->region[i];
+				portal->region[1] = graph->region[neighbour];
+				portal->vertical  = SIDE_NEIGHBOUR[side][0];
+				portal->at        = plan->rooms[i].cellposition[portal->vertical ? 0 : 1]+1;
+				portal->from      = plan->rooms[i].cellposition[portal->vertical ? 1 : 0];
+				portal->to        = portal->from+1;
+			}
+		}
+	}
+	/* joined into runs. */
+	qsort(portals, portal_count, sizeof(struct pvs_portal), pvs_compareportals);
+	for (i = 0, j = 0; i < portal_count; i++)
+	{
+		struct pvs_portal *last = &portals[j-1];
+		if (j > 0 && last->vertical == portals[i].vertical && last->at == portals[i].at
+		 && last->region[0] == portals[i].region[0] && last->region[1] == portals[i].region[1] && last->to == portals[i].from)
+		{
+			last->to = portals[i].to;
+		}
+		else
+		{
+			portals[j++] = portals[i];
+		}
+	}
+	portal_count = j;
+	/* The portals of every region. */
+	for (i = 0; i < portal_count; i++)
+	{
+		regionfirst[portals[i].region[0]+1]++;
+		regionfirst[portals[i].region[1]+1]++;
+	}
+	for (i = 0; i < graph->region_count; i++)
+	{
+		regionfirst[i+1] += regionfirst[i];
+	}
+	for (i = 0; i < portal_count; i++)
+	{
+		regionportals[regionfirst[portals[i].region[0]]++] = i;
+		regionportals[regionfirst[portals[i].region[1]]++] = i;
+	}
+	for (i = graph->region_count; i > 0; i--)
+	{
+		regionfirst[i] = regionfirst[i-1];
+	}
+	regionfirst[0] = 0;
+	/* Search. The calling thread works as well, so threads which fail to start only slow it down. */
+	job.graph         = graph;
+	job.portals       = portals;
+	job.regionportals = regionportals;
+	job.regionfirst   = regionfirst;
+	job.pvs           = pvs;
+	SDL_AtomicSet(&job.next, 0);
+	SDL_AtomicSet(&job.failed, 0);
+	thread_count = SDL_GetCPUCount();
+	thread_count = thread_count < 1 ? 1 : thread_count > 64 ? 64 : thread_count;
+	for (i = 1; i < thread_count; i++)
+	{
+		threads[i] = SDL_CreateThread(pvs_thread, "BAS_PVS", &job);
+	}
+	pvs_worker(&job);
+	for (i = 1; i < thread_count; i++)
+	{
+		if (threads[i])
+		{
+			SDL_WaitThread(threads[i], NULL);
+			started++;
+		}
+	}
+	if (SDL_AtomicGet(&job.failed))
+	{
+		goto failed;
+	}
+	/* What one region sees, sees it back. */
+	for (i = 0; i < pvs->region_count; i++)
+	{
+		for (j = i+1; j < pvs->region_count; j++)
+		{
+			Uint32 *ij = &pvs->bits[(size_t)i*pvs->words+(j >> 5)];
+			Uint32 *ji = &pvs->bits[(size_t)j*pvs->words+(i >> 5)];
+			if ((*ij >> (j & 31)) & 1) { *ji |= 1u << (i & 31); }
+			if ((*ji >> (i & 31)) & 1) { *ij |= 1u << (j & 31); }
+		}
+	}
+	free(portals);
+	free(regionportals);
+	free(regionfirst);
+	snprintf(
+		message, sizeof(message), "PVS of %d regions (%d portals) on %d threads in %.1f ms.",
+		pvs->region_count, portal_count, started, (SDL_GetPerformanceCounter()-start)*1000.0/SDL_GetPerformanceFrequency()
+	);
+	WRITE_I(message);
+	return 0;
+failed:
+	free(portals);
+	free(regionportals);
+	free(regionfirst);
+	BAS_PVS_Free(pvs);
+	return 1;
+}
+
+/*
+ * ----------------
+ * Plan writer.
+ * Every section of a plan is a header followed by fixed size records and
+ * lists of integers. In text, the header is its tag and values on one line,
+ * a record is a line and a list is a single line.
+ * Compressed plans start with "Basilisk $version"z and a new line, the rest is
+ * binary: a section is its tag byte followed by the value count and the
+ * values, records are 'R', the field and record counts and then every field as
+ * the difference to the same field of the previous record, and lists are 'L',
+ * the element count and every element as the difference to the previous one.
+ * Walls are 'W' and their count, then every wall as its start node (see
+ * BAS_Line) relative to the previous wall's, in one varint: the zigzag x
+ * difference shifted left by three, a bit set if the y difference follows
+ * (as a zigzag varint) and the wall's side in the low two bits. The end of
+ * the wall follows from its side. Walls sorted by row mostly take one byte.
+ * All counts are varints (7 bits per byte, low bits first), all values and
+ * differences are zigzag varints, so that small differences of either sign
+ * take a single byte. Every record, list and wall section starts from zero.
+ * The stream is self describing, BAS_DecodePlan turns it back into text.
+ * ----------------
+ */
+#define PLANWRITER_MAXFIELDS 8
+#define PLANWRITER_WALLBITS  3 /* Side and whether the row changes, below the x difference. */
+#define PLANWRITER_NEWROW    4
+struct BAS_PlanWriter
+{
+	FILE *output;
+	int compressed;
+	int fields;
+	Uint32 previous[PLANWRITER_MAXFIELDS];
+};
+static inline Uint32
+BAS_Zigzag(Uint32 value)
+{
+	return (value << 1) ^ (0u-(value >> 31));
+}
+static inline void
+BAS_WriteVarint(FILE *output, Uint64 value)
+{
+	while (value >= 0x80)
+	{
+		putc((int)(value & 0x7F) | 0x80, output);
+		value >>= 7;
+	}
+	putc((int)value, output);
+}
+static inline void
+BAS_WriteZigzag(FILE *output, Uint32 value)
+{
+	BAS_WriteVarint(output, BAS_Zigzag(value));
+}
+static void
+BAS_PlanWriter_Section(struct BAS_PlanWriter *writer, char tag, const int *header, int count)
+{
+	register int i;
+	if (writer->compressed)
+	{
+		putc(tag, writer->output);
+		BAS_WriteVarint(writer->output, count);
+		for (i = 0; i < count; i++)
+		{
+			BAS_WriteZigzag(writer->output, (Uint32)header[i]);
+		}
+		return;
+	}
+	putc(tag, writer->output);
+	for (i = 0; i < count; i++)
+	{
+		fprintf(writer->output, " %d", header[i]);
+	}
+	putc('\n', writer->output);
+}
+/* Start `count` records of `fields` values each, written with BAS_PlanWriter_Record. */
+static void
+BAS_PlanWriter_BeginRecords(struct BAS_PlanWriter *writer, int fields, int count)
+{
+	writer->fields = fields;
+	memset(writer->previous, 0, sizeof(writer->previous));
+	if (writer->compressed)
+	{
+		putc('R', writer->output);
+		BAS_WriteVarint(writer->output, fields);
+		BAS_WriteVarint(writer->output, count);
+	}
+}
+static void
+BAS_PlanWriter_Record(struct BAS_PlanWriter *writer, const int *record)
+{
+	register int i;
+	if (writer->compressed)
+	{
+		for (i = 0; i < writer->fields; i++)
+		{
+			BAS_WriteZigzag(writer->output, (Uint32)record[i]-writer->previous[i]);
+			writer->previous[i] = (Uint32)record[i];
+		}
+		return;
+	}
+	for (i = 0; i < writer->fields; i++)
+	{
+		fprintf(writer->output, i ? " %d" : "%d", record[i]);
+	}
+	putc('\n', writer->output);
+}
+/* Start `count` walls, written with BAS_PlanWriter_Wall. In text they are records of their start and end node. */
+static void
+BAS_PlanWriter_BeginWalls(struct BAS_PlanWriter *writer, int count)
+{
+	writer->fields = 4;
+	memset(writer->previous, 0, sizeof(writer->previous));
+	if (writer->compressed)
+	{
+		putc('W', writer->output);
+		BAS_WriteVarint(writer->output, count);
+	}
+}
+static void
+BAS_PlanWriter_Wall(struct BAS_PlanWriter *writer, const int nodes[4])
+{
+	register int side;
+	if (!writer->compressed)
+	{
+		BAS_PlanWriter_Record(writer, nodes);
+		return;
+	}
+	for (side = 0; side < 3; side++)
+	{
+		if (nodes[2]-nodes[0] == SIDE_WALL[side][2]-SIDE_WALL[side][0] && nodes[3]-nodes[1] == SIDE_WALL[side][3]-SIDE_WALL[side][1])
+		{
+			break;
+		}
+	}
+	BAS_WriteVarint(
+		writer->output,
+		(Uint64)BAS_Zigzag((Uint32)nodes[0]-writer->previous[0]) << PLANWRITER_WALLBITS | ((Uint32)nodes[1] != writer->previous[1] ? PLANWRITER_NEWROW : 0) | side
+	);
+	if ((Uint32)nodes[1] != writer->previous[1])
+	{
+		BAS_WriteZigzag(writer->output, (Uint32)nodes[1]-writer->previous[1]);
+	}
+	writer->previous[0] = (Uint32)nodes[0];
+	writer->previous[1] = (Uint32)nodes[1];
+}
+static void
+BAS_PlanWriter_List(struct BAS_PlanWriter *writer, const int *list, int count)
+{
+	register int i;
+	if (writer->compressed)
+	{
+		Uint32 previous = 0;
+		putc('L', writer->output);
+		BAS_WriteVarint(writer->output, count);
+		for (i = 0; i < count; i++)
+		{
+			BAS_WriteZigzag(writer->output, (Uint32)list[i]-previous);
+			previous = (Uint32)list[i];
+		}
+		return;
+	}
+	for (i = 0; i < count; i++)
+	{
+		fprintf(writer->output, i ? " %d" : "%d", list[i]);
+	}
+	putc('\n', writer->output);
+}
+/* Records are sorted by row and then column, so that neighbours follow each other. */
+static int
+planrecord_compare4(const void *a, const void *b)
+{
+	const int *ra = a, *rb = b;
+	if (ra[1] != rb[1]) { return ra[1] < rb[1] ? -1 : 1; }
+	if (ra[0] != rb[0]) { return ra[0] < rb[0] ? -1 : 1; }
+	if (ra[3] != rb[3]) { return ra[3] < rb[3] ? -1 : 1; }
+	if (ra[2] != rb[2]) { return ra[2] < rb[2] ? -1 : 1; }
+	return 0;
+}
+static int
+planrecord_compare2(const void *a, const void *b)
+{
+	const int *ra = a, *rb = b;
+	if (ra[1] != rb[1]) { return ra[1] < rb[1] ? -1 : 1; }
+	if (ra[0] != rb[0]) { return ra[0] < rb[0] ? -1 : 1; }
+	return 0;
+}
+
+/*
+ * Reading side of the compressed format. Returns 0 on success, 1 at the end
+ * of the input or on a malformed varint.
+ */
+static int
+BAS_ReadVarint64(FILE *input, Uint64 *value)
+{
+	int c, shift;
+	*value = 0;
+	for (shift = 0; shift < 70; shift += 7)
+	{
+		if ((c = getc(input)) == EOF)
+		{
+			return 1;
+		}
+		*value |= (Uint64)(c & 0x7F) << shift;
+		if (!(c & 0x80))
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+static int
+BAS_ReadVarint(FILE *input, Uint32 *value)
+{
+	Uint64 wide;
+	if (BAS_ReadVarint64(input, &wide) || wide > 0xFFFFFFFFu)
+	{
+		return 1;
+	}
+	*value = (Uint32)wide;
+	return 0;
+}
+static inline int
+BAS_ReadZigzag(FILE *input, Uint32 *value)
+{
+	if (BAS_ReadVarint(input, value))
+	{
+		return 1;
+	}
+	*value = (*value >> 1) ^ (0u-(*value & 1));
+	return 0;
+}
+/*
+ * Decode a compressed plan into the text format, in a single pass and without
+ * holding more than one record in memory.
+ * Returns 0 on success, 1 on error.
+ */
+static int
+BAS_DecodePlan(const char *inputpath, const char *outputpath)
+{
+	int c, version;
+	Uint32 fields, count, value, i, j;
+	Uint32 previous[PLANWRITER_MAXFIELDS];
+	FILE *input, *output;
+	input = fopen(inputpath, "rb");
+	if (!input)
+	{
+		WRITE_E("Failed to open file for reading!");
+		return 1;
+	}
+	if (fscanf(input, "Basilisk %dz", &version) != 1 || getc(input) != '\n')
+	{
+		WRITE_E("Not a compressed plan!");
+		fclose(input);
+		return 1;
+	}
+	output = fopen(outputpath, "w");
+	if (!output)
+	{
+		WRITE_E("Failed to open file for writing!");
+		fclose(input);
+		return 1;
+	}
+	fprintf(output, "Basilisk %d\n", version);
+	while ((c = getc(input)) != EOF)
+	{
+		if (c == 'R')
+		{
+			if (BAS_ReadVarint(input, &fields) || BAS_ReadVarint(input, &count) || fields > PLANWRITER_MAXFIELDS)
+			{
+				goto malformed;
+			}
+			memset(previous, 0, sizeof(previous));
+			for (i = 0; i < count; i++)
+			{
+				for (j = 0; j < fields; j++)
+				{
+					if (BAS_ReadZigzag(input, &value))
+					{
+						goto malformed;
+					}
+					previous[j] += value;
+					fprintf(output, j ? " %d" : "%d", (int)previous[j]);
+				}
+				putc('\n', output);
+			}
+		}
+		else if (c == 'W')
+		{
+			if (BAS_ReadVarint(input, &count))
+			{
+				goto malformed;
+			}
+			previous[0] = previous[1] = 0;
+			for (i = 0; i < count; i++)
+			{
+				Uint64 packed;
+				Uint32 dx;
+				int side;
+				value = 0;
+				if (BAS_ReadVarint64(input, &packed) || (packed >> PLANWRITER_WALLBITS) > 0xFFFFFFFFu
+				 || ((packed & PLANWRITER_NEWROW) && BAS_ReadZigzag(input, &value)))
+				{
+					goto malformed;
+				}
+				side = (int)(packed & 3);
+				dx   = (Uint32)(packed >> PLANWRITER_WALLBITS);
+				previous[0] += (dx >> 1) ^ (0u-(dx & 1));
+				previous[1] += value;
+				fprintf(
+					output, "%d %d %d %d\n", (int)previous[0], (int)previous[1],
+					(int)(previous[0]+SIDE_WALL[side][2]-SIDE_WALL[side][0]), (int)(previous[1]+SIDE_WALL[side][3]-SIDE_WALL[side][1])
+				);
+			}
+		}
+		else if (c == 'L')
+		{
+			if (BAS_ReadVarint(input, &count))
+			{
+				goto malformed;
+			}
+			previous[0] = 0;
+			for (i = 0; i < count; i++)
+			{
+				if (BAS_ReadZigzag(input, &value))
+				{
+					goto malformed;
+				}
+				previous[0] += value;
+				fprintf(output, i ? " %d" : "%d", (int)previous[0]);
+			}
+			putc('\n', output);
+		}
+		else if (c >= 'a' && c <= 'z')
+		{
+			if (BAS_ReadVarint(input, &count))
+			{
+				goto malformed;
+			}
+			putc(c, output);
+			for (i = 0; i < count; i++)
+			{
+				if (BAS_ReadZigzag(input, &value))
+				{
+					goto malformed;
+				}
+				fprintf(output, " %d", (int)value);
+			}
+			putc('\n', output);
+		}
+		else
+		{
+			goto malformed;
+		}
+	}
+	fclose(input);
+	fclose(output);
+	return 0;
+malformed:
+	WRITE_E("Malformed compressed plan!");
+	fclose(input);
+	fclose(output);
+	return 1;
+}
+
+/*
+ * Export the current plan state to a file.
+ * Returns 0 on success, 1 on error.
+ * The file format is very simple, here is how it looks (words with $ are variables):
+ *
+ * Basilisk $version
+ * $CELL_SCALE $THING_SCALE
+ * l $line_count
+ * l.x0 l.y0 l.x1 l.y1
+ * (...) repeated $line_count times
+ * t $thing_count
+ * t[0].x t[0].y t[0].*
+ * (...) repeated $thing_count times
+ *
+ * Optional sections follow, depending on the export options.
+ * EXPORT_OPTION_NAVGRAPH writes the navigation graph (see BAS_NavGraph):
+ *
+ * g $room_count $edge_count $region_count $regionedge_count
+ * g.x g.y g.offset g.region
+ * (...) repeated $room_count times, g.offset indexes the room edges
+ * $edge_count room indices on a single line
+ * r.x0 r.y0 r.x1 r.y1 r.offset r.component
+ * (...) repeated $region_count times, r.offset indexes the region edges
+ * $regionedge_count region indices on a single line
+ *
+ * EXPORT_OPTION_COLLISIONGRID writes the collision grid (see BAS_CollisionGrid),
+ * built over merged walls if EXPORT_OPTION_MERGELINES is also set:
+ *
+ * c $COLLISIONGRID_SIZE $cell_count $segment_count
+ * g.x g.y g.offset
+ * (...) repeated $cell_count times, the grid cells which hold segments, sorted
+ * by row and then column. Grid cell (g.x, g.y) covers the nodes from
+ * g.x*$COLLISIONGRID_SIZE to (g.x+1)*$COLLISIONGRID_SIZE along x, and so on
+ * along y, and owns the segments from g.offset up to the next grid cell's
+ * offset (or $segment_count).
+ * c.x0 c.y0 c.x1 c.y1
+ * (...) repeated $segment_count times
+ *
+ * EXPORT_OPTION_FLOOR writes the rooms merged into rectangles (see BAS_FloorRect),
+ * in cells:
+ *
+ * f $rectangle_count
+ * f.x f.y f.width f.height
+ * (...) repeated $rectangle_count times.
+ *
+ * EXPORT_OPTION_PVS writes the regions visible from every region (see BAS_PVS),
+ * it implies EXPORT_OPTION_NAVGRAPH since that is where the regions are defined:
+ *
+ * v $region_count $PVS_MAXDISTANCE
+ * $run_count $run_0 $run_1 (...)
+ * (...) repeated $region_count times. The runs alternate between regions which
+ * are not visible and regions which are, starting with the ones that are not.
+ *
+ * EXPORT_OPTION_INSTANCES writes the prefabs and the instances of them whose
+ * rooms and things are all still there (see BAS_Instance), in cells and
+ * thing-space relative to the prefab. The things of those instances are then
+ * left out of the things above, the walls are always written in full:
+ *
+ * p $prefab_count $room_count $thing_count
+ * p.width p.height p.rooms p.things
+ * (...) repeated $prefab_count times, p.rooms and p.things index the lists below
+ * r.x r.y
+ * (...) repeated $room_count times
+ * t.x t.y
+ * (...) repeated $thing_count times
+ * i $instance_count
+ * i.prefab i.x i.y i.rotation
+ * (...) repeated $instance_count times. The prefab is turned i.rotation
+ * quarter turns clockwise, its cell (x, y) lands on (i.x, i.y) plus (x, y),
+ * (p.height-1-y, x), (p.width-1-x, p.height-1-y) or (y, p.width-1-x). Things
+ * turn the same way within p.width*$CELL_SCALE-$THING_SCALE by
+ * p.height*$CELL_SCALE-$THING_SCALE.
+ *
+ * Lines and things are sorted by row and then column.
+ * With EXPORT_OPTION_COMPRESS the same sections are written in the compressed
+ * encoding described with BAS_PlanWriter.
+ *
+ * If `thingfilter` is not NULL, only the things matching it are written.
+ */
+#define EXPORT_OPTION_FILTERTHINGS  (1 << 0)
+#define EXPORT_OPTION_NAVGRAPH      (1 << 1)
+#define EXPORT_OPTION_COLLISIONGRID (1 << 2)
+#define EXPORT_OPTION_MERGELINES    (1 << 3)
+#define EXPORT_OPTION_PVS           (1 << 4)
+#define EXPORT_OPTION_FLOOR         (1 << 5)
+#define EXPORT_OPTION_COMPRESS      (1 << 6)
+#define EXPORT_OPTION_INSTANCES     (1 << 7)
+/*
+ * Find the intact instances and leave the things they account for out of the
+ * exported ones. Returns the instances in `instancelist`, NULL on error.
+ */
+static int *
+BAS_ExportCoverInstances(int *exported, int *exported_count, int *instancecount)
+{
+	register int i;
+	int roomcount = plan->room_count;
+	int *roomlist     = malloc((plan->room_count+1)*sizeof(int));
+	int *instancelist = malloc((plan->instance_count+1)*sizeof(int));
+	if (!roomlist || !instancelist)
+	{
+		free(roomlist);
+		free(instancelist);
+		return NULL;
+	}
+	for (i = 0; i < plan->room_count; i++)
+	{
+		roomlist[i] = i;
+	}
+	for (i = 0; i < plan->instance_count; i++)
+	{
+		instancelist[i] = i;
+	}
+	*instancecount = plan->instance_count;
+	qsort(roomlist, plan->room_count, sizeof(int), planroom_compare);
+	qsort(exported, *exported_count, sizeof(int), planthing_compare);
+	qsort(instancelist, plan->instance_count, sizeof(int), planinstance_compare);
+	if (BAS_PlanChunk_Omit(roomlist, &roomcount, exported, exported_count, instancelist, instancecount))
+	{
+		free(instancelist);
+		instancelist = NULL;
+	}
+	free(roomlist);
+	return instancelist;
+}
+static void
+BAS_ExportInstances(struct BAS_PlanWriter *writer, const int *instancelist, int instancecount)
+{
+	register int i;
+	const int header[3] = {plan->prefab_count, plan->prefab_room_count, plan->prefab_thing_count};
+	BAS_PlanWriter_Section(writer, 'p', header, 3);
+	BAS_PlanWriter_BeginRecords(writer, 4, plan->prefab_count);
+	for (i = 0; i < plan->prefab_count; i++)
+	{
+		const int record[4] = {plan->prefabs[i].size[0], plan->prefabs[i].size[1], plan->prefabs[i].rooms, plan->prefabs[i].things};
+		BAS_PlanWriter_Record(writer, record);
+	}
+	BAS_PlanWriter_BeginRecords(writer, 2, plan->prefab_room_count);
+	for (i = 0; i < plan->prefab_room_count; i++)
+	{
+		BAS_PlanWriter_Record(writer, plan->prefab_rooms[i]);
+	}
+	BAS_PlanWriter_BeginRecords(writer, 2, plan->prefab_thing_count);
+	for (i = 0; i < plan->prefab_thing_count; i++)
+	{
+		BAS_PlanWriter_Record(writer, plan->prefab_things[i].thingposition);
+	}
+	BAS_PlanWriter_Section(writer, 'i', &instancecount, 1);
+	BAS_PlanWriter_BeginRecords(writer, 4, instancecount);
+	for (i = 0; i < instancecount; i++)
+	{
+		const struct BAS_Instance *instance = &plan->instances[instancelist[i]];
+		const int record[4] = {instance->prefab, instance->cellposition[0], instance->cellposition[1], instance->rotation};
+		BAS_PlanWriter_Record(writer, record);
+	}
+}
+static int
+BAS_ExportCollisionGrid(struct BAS_PlanWriter *writer, int merge)
+{
+	register int i;
+	struct BAS_CollisionGrid grid;
+	int failed;
+	BAS_Span_Begin("BAS_CollisionGrid_Build");
+	failed = BAS_CollisionGrid_Build(&grid, merge);
+	BAS_Span_End("BAS_CollisionGrid_Build");
+	if (failed)
+	{
+		return 1;
+	}
+	BAS_Span_Begin("BAS_ExportCollisionGrid");
+	{
+		const int header[3] = {COLLISIONGRID_SIZE, grid.cell_count, grid.segment_count};
+		BAS_PlanWriter_Section(writer, 'c', header, 3);
+	}
+	BAS_PlanWriter_BeginRecords(writer, 3, grid.cell_count);
+	for (i = 0; i < grid.cell_count; i++)
+	{
+		const int record[3] = {grid.cells[i][0], grid.cells[i][1], grid.offsets[i]};
+		BAS_PlanWriter_Record(writer, record);
+	}
+	BAS_PlanWriter_BeginRecords(writer, 4, grid.segment_count);
+	for (i = 0; i < grid.segment_count; i++)
+	{
+		int nodes[4];
+		BAS_WallSpan_Nodes(&grid.segments[i], nodes);
+		BAS_PlanWriter_Record(writer, nodes);
+	}
+	BAS_Span_End("BAS_ExportCollisionGrid");
+	BAS_CollisionGrid_Free(&grid);
+	return 0;
+}
+static void
+BAS_ExportNavGraph(struct BAS_PlanWriter *writer, const struct BAS_NavGraph *navgraph)
+{
+	register int i;
+	const struct BAS_NavGraph graph = *navgraph;
+	const int header[4] = {plan->room_count, graph.edge_count, graph.region_count, graph.region_edge_count};
+	BAS_Span_Begin("BAS_ExportNavGraph");
+	BAS_PlanWriter_Section(writer, 'g', header, 4);
+	BAS_PlanWriter_BeginRecords(writer, 4, plan->room_count);
+	for (i = 0; i < plan->room_count; i++)
+	{
+		const int record[4] = {plan->rooms[i].cellposition[0], plan->rooms[i].cellposition[1], graph.offsets[i], graph.region[i]};
+		BAS_PlanWriter_Record(writer, record);
+	}
+	BAS_PlanWriter_List(writer, graph.edges, graph.edge_count);
+	BAS_PlanWriter_BeginRecords(writer, 6, graph.region_count);
+	for (i = 0; i < graph.region_count; i++)
+	{
+		const int record[6] = {
+			graph.region_bounds[i][0], graph.region_bounds[i][1], graph.region_bounds[i][2], graph.region_bounds[i][3],
+			graph.region_offsets[i], graph.region_component[i]
+		};
+		BAS_PlanWriter_Record(writer, record);
+	}
+	BAS_PlanWriter_List(writer, graph.region_edges, graph.region_edge_count);
+	BAS_Span_End("BAS_ExportNavGraph");
+}
+/* Rows are written run length encoded, preceded by their run count. */
+static int
+BAS_ExportPVS(struct BAS_PlanWriter *writer, const struct BAS_NavGraph *graph)
+{
+	register int i, j;
+	struct BAS_PVS pvs;
+	int *runs;
+	if (BAS_PVS_Build(&pvs, graph))
+	{
+		return 1;
+	}
+	runs = malloc((pvs.region_count+2)*sizeof(int));
+	if (!runs)
+	{
+		BAS_PVS_Free(&pvs);
+		return 1;
+	}
+	BAS_Span_Begin("BAS_ExportPVS");
+	{
+		const int header[2] = {pvs.region_count, PVS_MAXDISTANCE};
+		BAS_PlanWriter_Section(writer, 'v', header, 2);
+	}
+	for (i = 0; i < pvs.region_count; i++)
+	{
+		const Uint32 *row = pvs.bits+(size_t)i*pvs.words;
+		int run_count = 1, visible = 0;
+		runs[1] = 0;
+		for (j = 0; j < pvs.region_count; j++)
+		{
+			if ((int)((row[j >> 5] >> (j & 31)) & 1) != visible)
+			{
+				visible = !visible;
+				runs[++run_count] = 0;
+			}
+			runs[run_count]++;
+		}
+		runs[0] = run_count;
+		BAS_PlanWriter_List(writer, runs, run_count+1);
+	}
+	BAS_Span_End("BAS_ExportPVS");
+	free(runs);
+	BAS_PVS_Free(&pvs);
+	return 0;
+}
+static int
+exportplan_write(const char *path, int options, const struct BAS_ThingFilter *thingfilter)
+{
+	int i;
+	int *exported, exported_count, *records, *instancelist = NULL, instancecount = 0;
+	struct BAS_PlanWriter writer;
+	char message[128];
+	WRITE_I("Writing to file...");
+	if (BAS_Instance_ExpandPending())
+	{
+		return 1;
+	}
+	memset(&writer, 0, sizeof(struct BAS_PlanWriter));
+	writer.compressed = (options & EXPORT_OPTION_COMPRESS) != 0;
+	writer.output     = fopen(path, writer.compressed ? "wb" : "w");
+	if (!writer.output)
+	{
+		WRITE_E("Failed to open file for writing!");
+		return 1;
+	}
+	exported = malloc((plan->thing_count ? plan->thing_count : 1)*sizeof(int));
+	records  = malloc((plan->line_count*4 > plan->thing_count*2 ? plan->line_count*4 : plan->thing_count*2+1)*sizeof(int));
+	if (!exported || !records)
+	{
+		WRITE_E("Out of memory!");
+		free(exported);
+		free(records);
+		fclose(writer.output);
+		return 1;
+	}
+	fprintf(writer.output, writer.compressed ? "Basilisk 0z\n" : "Basilisk 0\n");
+	{
+		const int scales[2] = {CELL_SCALE, THING_SCALE};
+		BAS_PlanWriter_BeginRecords(&writer, 2, 1);
+		BAS_PlanWriter_Record(&writer, scales);
+	}
+	BAS_Span_Begin("walls");
+	for (i = 0; i < plan->line_count; i++)
+	{
+		BAS_Line_Nodes(&plan->lines[i], &records[i*4]);
+	}
+	qsort(records, plan->line_count, 4*sizeof(int), planrecord_compare4);
+	BAS_PlanWriter_Section(&writer, 'l', &plan->line_count, 1);
+	BAS_PlanWriter_BeginWalls(&writer, plan->line_count);
+	for (i = 0; i < plan->line_count; i++)
+	{
+		BAS_PlanWriter_Wall(&writer, &records[i*4]);
+	}
+	BAS_Span_End("walls");
+	BAS_Span_Begin("things");
+	if (thingfilter)
+	{
+		exported_count = BAS_ThingFilter_Run(thingfilter, exported);
+	}
+	else
+	{
+		for (i = 0; i < plan->thing_count; i++)
+		{
+			exported[i] = i;
+		}
+		exported_count = plan->thing_count;
+	}
+	if ((options & EXPORT_OPTION_INSTANCES) && !(instancelist = BAS_ExportCoverInstances(exported, &exported_count, &instancecount)))
+	{
+		BAS_Span_End("things");
+		WRITE_E("Out of memory!");
+		free(exported);
+		free(records);
+		fclose(writer.output);
+		return 1;
+	}
+	for (i = 0; i < exported_count; i++)
+	{
+		records[i*2]   = plan->things.thingposition[0][exported[i]];
+		records[i*2+1] = plan->things.thingposition[1][exported[i]];
+	}
+	qsort(records, exported_count, 2*sizeof(int), planrecord_compare2);
+	BAS_PlanWriter_Section(&writer, 't', &exported_count, 1);
+	BAS_PlanWriter_BeginRecords(&writer, 2, exported_count);
+	for (i = 0; i < exported_count; i++)
+	{
+		BAS_PlanWriter_Record(&writer, &records[i*2]);
+	}
+	free(exported);
+	free(records);
+	if (instancelist)
+	{
+		BAS_ExportInstances(&writer, instancelist, instancecount);
+		free(instancelist);
+	}
+	BAS_Span_End("things");
+	if (options & EXPORT_OPTION_FLOOR)
+	{
+		BAS_Span_Begin("floor");
+		if (plan->floor_outdated)
+		{
+			BAS_RecalculateFloor();
+		}
+		BAS_PlanWriter_Section(&writer, 'f', &plan->floorrect_count, 1);
+		BAS_PlanWriter_BeginRecords(&writer, 4, plan->floorrect_count);
+		for (i = 0; i < plan->floorrect_count; i++)
+		{
+			const int record[4] = {plan->floorrects[i].cellposition[0], plan->floorrects[i].cellposition[1], plan->floorrects[i].size[0], plan->floorrects[i].size[1]};
+			BAS_PlanWriter_Record(&writer, record);
+		}
+		BAS_Span_End("floor");
+	}
+	if (options & (EXPORT_OPTION_NAVGRAPH | EXPORT_OPTION_PVS))
+	{
+		struct BAS_NavGraph graph;
+		int failed;
+		BAS_Span_Begin("BAS_NavGraph_Build");
+		failed = BAS_NavGraph_Build(&graph);
+		BAS_Span_End("BAS_NavGraph_Build");
+		if (failed)
+		{
+			WRITE_E("Failed to build the navigation graph!");
+			fclose(writer.output);
+			return 1;
+		}
+		BAS_ExportNavGraph(&writer, &graph);
+		if ((options & EXPORT_OPTION_PVS) && BAS_ExportPVS(&writer, &graph))
+		{
+			WRITE_E("Failed to write the potentially visible sets!");
+			BAS_NavGraph_Free(&graph);
+			fclose(writer.output);
+			return 1;
+		}
+		BAS_NavGraph_Free(&graph);
+	}
+	if ((options & EXPORT_OPTION_COLLISIONGRID) && BAS_ExportCollisionGrid(&writer, options & EXPORT_OPTION_MERGELINES))
+	{
+		WRITE_E("Failed to write the collision grid!");
+		fclose(writer.output);
+		return 1;
+	}
+	snprintf(message, sizeof(message), "Wrote %ld bytes.", ftell(writer.output));
+	WRITE_I(message);
+	BAS_Span_Begin("fclose");
+	fclose(writer.output);
+	BAS_Span_End("fclose");
+	return 0;
+}
+static int
+BAS_ExportPlan(const char *path, int options, const struct BAS_ThingFilter *thingfilter)
+{
+	int failed;
+	if (!BAS_PlanFile_PathFits(path))
+	{
+		return 1;
+	}
+	BAS_Span_Begin("BAS_ExportPlan");
+	failed = exportplan_write(path, options, thingfilter);
+	BAS_Span_End("BAS_ExportPlan");
+	return failed;
+}
+
+/*
+ * ----------------
+ * Thing placing tool
+ * Left click places or selects a thing, the arrow keys set its facing, the
+ * digits set its type and SHIFT+digit toggles one of its flags.
+ * Q filters things by the selected thing's type and flags, matching things are
+ * highlighted. Dragging with SHIFT held selects every matching thing inside the
+ * rectangle, edits then apply to the whole selection.
+ * ----------------
+ */
+#define THINGTOOL_EDIT_FACING 0
+#define THINGTOOL_EDIT_TYPE   1
+#define THINGTOOL_EDIT_FLAG   2
+static int panel_width = 225;
+static int thing_seeinfo = 0;
+static int thing_selected = BAS_NO_SUCH_THING;
+static int thingtool_updatecursor = 1;
+static SDL_Texture* thing_infos[32] = {NULL};
+static struct BAS_ThingFilter thing_filter;
+static int thing_filteractive = 0;
+static int *thing_selection = NULL;
+static int thing_selectioncount    = 0;
+static int thing_selectioncapacity = 0;
+static int thingtool_dragging = 0;
+static int thingtool_anchor[2];
+static inline void
+thingtool_resetstate(void)
+{
+	thing_seeinfo        = 0;
+	thing_selected       = BAS_NO_SUCH_THING;
+	thing_selectioncount = 0;
+	thingtool_dragging   = 0;
+}
+static void
+thingtool_destroyinfopanel(void)
+{
+	register int i;
+	for (i = 0; i < 32; i++)
+	{
+		BAS_DestroyTextTexture(thing_infos[i]);
+		thing_infos[i] = NULL;
+	}
+}
+static void
+thingtool_updateinfopanel(const int thingindex)
+{
+	char buffer[32];
+	const struct BAS_Thing thing = BAS_Thing_Get(thingindex);
+	thingtool_destroyinfopanel();
+	snprintf(buffer, 32, "Thing index %d.", thingindex);
+	thing_infos[0] = BAS_CreateTextTexture(BAS_Font(FONT_DEFAULT), buffer);
+	snprintf(buffer, 32, "----------------");
+	thing_infos[1] = BAS_CreateTextTexture(BAS_Font(FONT_DEFAULT), buffer);
+	snprintf(buffer, 32, "Structure data:");
+	thing_infos[2] = BAS_CreateTextTexture(BAS_Font(FONT_DEFAULT), buffer);
+	snprintf(buffer, 32, "struct BAS_Thing");
+	thing_infos[3] = BAS_CreateTextTexture(BAS_Font(FONT_DEFAULT), buffer);
+	snprintf(buffer, 32, "{");
+	thing_infos[4] = BAS_CreateTextTexture(BAS_Font(FONT_DEFAULT), buffer);
+	snprintf(buffer, 32, "  uint64_t flags = %ld;", thing.flags);
+	thing_infos[5] = BAS_CreateTextTexture(BAS_Font(FONT_DEFAULT), buffer);
+	snprintf(buffer, 32, "  int thingposition[0] = %d;", thing.thingposition[0]);
+	thing_infos[6] = BAS_CreateTextTexture(BAS_Font(FONT_DEFAULT), buffer);
+	snprintf(buffer, 32, "  int thingposition[1] = %d;", thing.thingposition[1]);
+	thing_infos[7] = BAS_CreateTextTexture(BAS_Font(FONT_DEFAULT), buffer);
+	snprintf(buffer, 32, "  int type = %d;", thing.type);
+	thing_infos[8] = BAS_CreateTextTexture(BAS_Font(FONT_DEFAULT), buffer);
+	snprintf(buffer, 32, "  int facing = %d;", thing.facing);
+	thing_infos[9] = BAS_CreateTextTexture(BAS_Font(FONT_DEFAULT), buffer);
+	snprintf(buffer, 32, "}");
+	thing_infos[10] = BAS_CreateTextTexture(BAS_Font(FONT_DEFAULT), buffer);
+}
+/* Apply an edit to the selected thing and to every other thing of the selection. */
+static void
+thingtool_edit(int what, int value)
+{
+	register int i;
+	for (i = -1; i < thing_selectioncount; i++)
+	{
+		const int thing = i < 0 ? thing_selected : thing_selection[i];
+		if (thing == BAS_NO_SUCH_THING || (i >= 0 && thing == thing_selected))
+		{
+			continue;
+		}
+		switch (what)
+		{
+			case THINGTOOL_EDIT_FACING: plan->things.facing[thing] = value; break;
+			case THINGTOOL_EDIT_TYPE:   plan->things.type[thing]   = value; break;
+			case THINGTOOL_EDIT_FLAG:   plan->things.flags[thing] ^= (uint64_t)1 << value; break;
+		}
+		BAS_LiveLink_MarkThing(thing);
+	}
+	if (thing_selected != BAS_NO_SUCH_THING)
+	{
+		thingtool_updateinfopanel(thing_selected);
+	}
+}
+/* Filter by the selected thing's type and flags, or turn the filter off. */
+static void
+thingtool_togglefilter(void)
+{
+	char message[BAS_STATUSMESSAGE_LENGTH];
+	Uint64 start;
+	int count;
+	if (thing_filteractive || thing_selected == BAS_NO_SUCH_THING)
+	{
+		thing_filteractive = 0;
+		BAS_PushStatusAndWriteInfo("Thing filter is off.");
+		return;
+	}
+	if (BAS_Reserve(MEMORY_RENDER, (void **)&thing_visible, &thing_visiblecapacity, plan->thing_count, sizeof(int)))
+	{
+		return;
+	}
+	BAS_ThingFilter_Reset(&thing_filter);
+	thing_filter.type     = plan->things.type[thing_selected];
+	thing_filter.flagmask = plan->things.flags[thing_selected];
+	thing_filteractive    = 1;
+	start = SDL_GetPerformanceCounter();
+	count = BAS_ThingFilter_Run(&thing_filter, thing_visible);
+	snprintf(
+		message, sizeof(message), "Thing filter: type %d, flags %#lx; %d of %d things match (%.3f ms).",
+		thing_filter.type, (unsigned long)thing_filter.flagmask, count, plan->thing_count,
+		(SDL_GetPerformanceCounter()-start)*1000.0/SDL_GetPerformanceFrequency()
+	);
+	BAS_PushStatusAndWriteInfo(message);
+}
+/* Select every thing inside the rectangle which passes the filter (if there is one). */
+static void
+thingtool_selectrectangle(int x0, int y0, int x1, int y1)
+{
+	char message[BAS_STATUSMESSAGE_LENGTH];
+	struct BAS_ThingFilter filter;
+	if (BAS_Reserve(MEMORY_WORK, (void **)&thing_selection, &thing_selectioncapacity, plan->thing_count, sizeof(int)))
+	{
+		return;
+	}
+	if (thing_filteractive)
+	{
+		filter = thing_filter;
+	}
+	else
+	{
+		BAS_ThingFilter_Reset(&filter);
+	}
+	filter.rectangle[0][0] = x0 < x1 ? x0 : x1;
+	filter.rectangle[0][1] = y0 < y1 ? y0 : y1;
+	filter.rectangle[1][0] = x0 < x1 ? x1 : x0;
+	filter.rectangle[1][1] = y0 < y1 ? y1 : y0;
+	thing_selectioncount = BAS_ThingFilter_Run(&filter, thing_selection);
+	snprintf(message, sizeof(message), "Selected %d things.", thing_selectioncount);
+	BAS_PushStatusAndWriteInfo(message);
+}
+static void
+BAS_Tool_ThingPlace(SDL_Event e, int mx, int my, int special)
+{
+	switch(special)
+	{
+	case TOOL_SPECIAL_RESETSTATE:
+		thingtool_resetstate();
+		return;
+	case TOOL_SPECIAL_BEGIN:
+		SDL_ShowCursor(SDL_DISABLE);
+		return;
+	case TOOL_SPECIAL_STOP:
+		SDL_ShowCursor(SDL_ENABLE);
+		thing_seeinfo = 0;
+		thingtool_destroyinfopanel();
+		return;
+	}
+	if (e.type == SDL_KEYDOWN)
+	{
+		const SDL_Keycode sym = e.key.keysym.sym;
+		switch(sym)
+		{
+			case SDLK_e:
+				thing_seeinfo = !thing_seeinfo;
+				break;
+			case SDLK_q:
+				thingtool_togglefilter();
+				break;
+			/* Control selected thing's facing direction. */
+			case SDLK_UP:    thingtool_edit(THINGTOOL_EDIT_FACING, 1); break;
+			case SDLK_LEFT:  thingtool_edit(THINGTOOL_EDIT_FACING, 2); break;
+			case SDLK_DOWN:  thingtool_edit(THINGTOOL_EDIT_FACING, 3); break;
+			case SDLK_RIGHT: thingtool_edit(THINGTOOL_EDIT_FACING, 0); break;
+			default:
+				if (sym >= SDLK_0 && sym <= SDLK_9)
+				{
+					thingtool_edit((e.key.keysym.mod & KMOD_SHIFT) ? THINGTOOL_EDIT_FLAG : THINGTOOL_EDIT_TYPE, sym-SDLK_0);
+				}
+		}
+	}
+	else if (e.type == SDL_MOUSEBUTTONDOWN)
+	{
+		if (e.button.button == SDL_BUTTON_LEFT && (BAS_GetModState() & KMOD_SHIFT))
+		{
+			thingtool_dragging  = 1;
+			thingtool_anchor[0] = mx;
+			thingtool_anchor[1] = my;
+		}
+		else if (e.button.button == SDL_BUTTON_LEFT)
+		{
+			int selected;
+			int x, y;
+			x = mx;
+			y = my;
+			BAS_SnapToClosestCell_Custom(&x, &y, THING_SCALE);
+			selected = BAS_FindThing(x, y);
+			thing_selectioncount = 0;
+			if (selected != BAS_NO_SUCH_THING)
+			{
+				thing_selected = selected;
+				thing_seeinfo  = 1;
+				thingtool_updateinfopanel(selected);
+			}
+			else if ((selected = BAS_Thing_Create(x, y, plan->thing_count%4)) != BAS_NO_SUCH_THING)
+			{
+				thing_seeinfo  = 1;
+				thing_selected = selected;
+				thingtool_updateinfopanel(thing_selected);
+			}
+		}
+	}
+	else if (e.type == SDL_MOUSEBUTTONUP && thingtool_dragging)
+	{
+		thingtool_dragging = 0;
+		thingtool_selectrectangle(thingtool_anchor[0], thingtool_anchor[1], mx, my);
+	}
+	else if (e.type == SDL_MOUSEMOTION)
+	{
+		if (e.motion.x < panel_width && thing_seeinfo)
+		{
+			SDL_ShowCursor(SDL_ENABLE);
+			thingtool_updatecursor = 0;
+		}
+		else
+		{
+			SDL_ShowCursor(SDL_DISABLE);
+			thingtool_updatecursor = 1;
+		}
+	}
+}
+/* Outline the given things, only the ones inside the window are passed in. */
+static void
+thingtool_outline(const int *list, int count, int grow)
+{
+	register int i;
+	SDL_Rect rectangle;
+	for (i = 0; i < count; i++)
+	{
+		BAS_View_ToScreen(plan->things.thingposition[0][list[i]], plan->things.thingposition[1][list[i]], &rectangle.x, &rectangle.y);
+		rectangle.x -= grow;
+		rectangle.y -= grow;
+		rectangle.w = rectangle.h = BAS_View_Scale(THING_SCALE)+2*grow;
+		SDL_RenderDrawRect(renderer, &rectangle);
+	}
+}
+static int thingtool_cursorposition[2];
+static void
+BAS_Tool_ThingPlace_Draw(int mx, int my)
+{
+	SDL_Rect rectangle;
+	int i;
+	int oldmx, oldmy;
+	const int activethingalpha = 255*fabsf(sinf(SDL_GetTicks()/100.0f));
+	oldmx = mx;
+	oldmy = my;
+	BAS_SnapToClosestCell_Custom(&mx, &my, THING_SCALE);
+	BAS_View_ToScreen(mx, my, &rectangle.x, &rectangle.y);
+	rectangle.w = BAS_View_Scale(THING_SCALE);
+	rectangle.h = BAS_View_Scale(THING_SCALE);
+	BAS_UseColourAlpha(255, 255, 0, activethingalpha);
+	SDL_RenderFillRect(renderer, &rectangle);
+	/* Highlight the things which pass the filter. */
+	if (thing_filteractive && !BAS_Reserve(MEMORY_RENDER, (void **)&thing_visible, &thing_visiblecapacity, plan->thing_count, sizeof(int)))
+	{
+		struct BAS_ThingFilter visible = thing_filter;
+		BAS_View_ToPlan(0, 0, &visible.rectangle[0][0], &visible.rectangle[0][1]);
+		BAS_View_ToPlan(WINDOW_WIDTH, WINDOW_HEIGHT, &visible.rectangle[1][0], &visible.rectangle[1][1]);
+		visible.rectangle[0][0] -= THING_SCALE;
+		visible.rectangle[0][1] -= THING_SCALE;
+		BAS_UseColour(255, 128, 0);
+		thingtool_outline(thing_visible, BAS_ThingFilter_Run(&visible, thing_visible), 1);
+	}
+	/* Selection and the rectangle being dragged. */
+	BAS_UseColour(0, 200, 255);
+	thingtool_outline(thing_selection, thing_selectioncount, 2);
+	if (thingtool_dragging)
+	{
+		int x1, y1;
+		BAS_View_ToScreen(thingtool_anchor[0], thingtool_anchor[1], &rectangle.x, &rectangle.y);
+		BAS_View_ToScreen(oldmx, oldmy, &x1, &y1);
+		rectangle.w = x1-rectangle.x;
+		rectangle.h = y1-rectangle.y;
+		SDL_RenderDrawRect(renderer, &rectangle);
+	}
+	/* Render the "big" outline for the selected thing. */
+	if (thing_selected != BAS_NO_SUCH_THING)
+	{
+		const int activethingalpha = 255*(fabsf(sinf(SDL_GetTicks()/100.0f))/2.0f+0.5f);
+		BAS_View_ToScreen(plan->things.thingposition[0][thing_selected], plan->things.thingposition[1][thing_selected], &rectangle.x, &rectangle.y);
+		rectangle.x -= 4;
+		rectangle.y -= 4;
+		rectangle.w = BAS_View_Scale(THING_SCALE)+8;
+		rectangle.h = BAS_View_Scale(THING_SCALE)+8;
+		BAS_UseColourAlpha(0, 255, 0, activethingalpha);
+		SDL_RenderDrawRect(renderer, &rectangle);
+	}
+	/* Render cursor. */
+	if (thingtool_updatecursor)
+	{
+		thingtool_cursorposition[0] = oldmx;
+		thingtool_cursorposition[1] = oldmy;
+		BAS_GetMouseState(&thingtool_cursorposition[0], &thingtool_cursorposition[1]);
+	}
+	BAS_DrawCrosshair_Small(thingtool_cursorposition[0], thingtool_cursorposition[1]);
+	/* Thing info editor. */
+	if (thing_seeinfo && thing_selected != BAS_NO_SUCH_THING)
+	{
+		const int facingpanel_scale = panel_width/2;
+		int facingpanel_line[2][2];
+		/* Panel */
+		rectangle.x = 0;
+		rectangle.y = 0;
+		rectangle.w = panel_width;
+		rectangle.h = WINDOW_HEIGHT;
+		BAS_UseColour(0, 0, 0);
+		SDL_RenderFillRect(renderer, &rectangle);
+		/* Panel gradient */
+		BAS_UseColourAlpha(255, 255, 255, 60);
+		for (i = 1; i < 50; i++)
+		{
+			float y = WINDOW_HEIGHT-tan(i/50.0)*50;
+			SDL_RenderDrawLine(renderer, 0, y, rectangle.w, y);
+		}
+		/* Thing info text */
+		rectangle.x = 0;
+		rectangle.y = 0;
+		for (i = 0; i < 11; i++)
+		{
+			SDL_QueryTexture(thing_infos[i], NULL, NULL, &rectangle.w, &rectangle.h);
+			SDL_RenderCopy(renderer, thing_infos[i], NULL, &rectangle);
+			rectangle.y += rectangle.h;
+		}
+		rectangle.y += rectangle.h;
+		/* Thing facing direction */
+		rectangle.w = rectangle.h = facingpanel_scale;
+		BAS_UseColour(20, 60, 20);
+		rectangle.w += 4;
+		rectangle.h += 4;
+		SDL_RenderFillRect(renderer, &rectangle);
+		rectangle.w -= 4;
+		rectangle.h -= 4;
+		BAS_UseColour(30, 200, 30);
+		SDL_RenderFillRect(renderer, &rectangle);
+		facingpanel_line[0][0] = facingpanel_scale/2;
+		facingpanel_line[0][1] = rectangle.y+facingpanel_scale/2;
+		switch (plan->things.facing[thing_selected])
+		{
+			case 0:
+				facingpanel_line[1][0] = facingpanel_scale;
+				facingpanel_line[1][1] = facingpanel_line[0][1];
+				break;
+			case 1:
+				facingpanel_line[1][0] = facingpanel_line[0][0];
+				facingpanel_line[1][1] = facingpanel_line[0][1]-facingpanel_scale/2;
+				break;
+			case 2:
+				facingpanel_line[1][0] = -facingpanel_scale/2;
+				facingpanel_line[1][1] = facingpanel_line[0][1];
+				break;
+			case 3:
+				facingpanel_line[1][0] = facingpanel_line[0][0];
+				facingpanel_line[1][1] = facingpanel_line[0][1]+facingpanel_scale/2;
+				break;
+		}
+		BAS_UseColour(255, 255, 255);
+		SDL_RenderDrawLine(renderer, facingpanel_line[0][0], facingpanel_line[0][1], facingpanel_line[1][0], facingpanel_line[1][1]);
+	}
+}
+
+/*
+ * ----------------
+ * Export plan tool
+ * ----------------
+ */
+/* Define the indices for the texture array. */
+#define INPUT 0
+#define LABEL 1
+#define ADDITIONAL 2
+#define EXPORTED 3
+#define OPTIONS 4
+#define DEFAULT_EXPORT_FILE "./plans/t"
+/* Export options, each is toggled with CTRL and its key. */
+static const struct
+{
+	int option;
+	SDL_Keycode key;
+	const char *name;
+} EXPORT_OPTIONS[] =
+{
+	{EXPORT_OPTION_FILTERTHINGS,  SDLK_f, "^F filtered things"},
+	{EXPORT_OPTION_NAVGRAPH,      SDLK_g, "^G navigation graph"},
+	{EXPORT_OPTION_COLLISIONGRID, SDLK_c, "^C collision grid"},
+	{EXPORT_OPTION_MERGELINES,    SDLK_m, "^M merged walls"},
+	{EXPORT_OPTION_PVS,           SDLK_v, "^V visible sets"},
+	{EXPORT_OPTION_FLOOR,         SDLK_r, "^R floor rectangles"},
+	{EXPORT_OPTION_COMPRESS,      SDLK_z, "^Z compressed"},
+	{EXPORT_OPTION_INSTANCES,     SDLK_i, "^I prefab instances"},
+};
+#define EXPORT_OPTION_COUNT ((int)(sizeof(EXPORT_OPTIONS)/sizeof(EXPORT_OPTIONS[0])))
+static int exportplan_options = 0;
+static char exportplan_filepath[96]  = DEFAULT_EXPORT_FILE;
+static int exportplan_filepathlength = strlen(DEFAULT_EXPORT_FILE);
+static int exportplan_cursor         = 8;
+static int exportplan_planexported   = 0;
+static SDL_Texture* exportplan_textures[5] = {NULL, NULL, NULL, NULL, NULL};
+static const int CURSOR_BLINK_INTERVAL = 512;
+static void
+exportplan_updateinputtexture(void)
+{
+	char inputtext[96];
+	strcpy(inputtext, exportplan_filepath);
+	if ((SDL_GetTicks() % CURSOR_BLINK_INTERVAL) > CURSOR_BLINK_INTERVAL/2)
+	{
+		char buf[96] = "\0";
+		/* Don't copy garbage if the cursor is at the end of the input string... */
+		if (exportplan_cursor != exportplan_filepathlength)
+		{
+			strcpy(buf, inputtext+exportplan_cursor+1);
+		}
+		strcpy(inputtext+exportplan_cursor, "_");
+		strcat(inputtext, buf);
+	}
+	BAS_DestroyTextTexture(exportplan_textures[INPUT]);
+	exportplan_textures[INPUT] = BAS_CreateTextTexture(BAS_Font(FONT_TEXTINPUT), inputtext);
+}
+static void
+exportplan_updateoptionstexture(void)
+{
+	register int i;
+	char text[256] = "Options:";
+	for (i = 0; i < EXPORT_OPTION_COUNT; i++)
+	{
+		strcat(text, (exportplan_options & EXPORT_OPTIONS[i].option) ? " [x] " : " [ ] ");
+		strcat(text, EXPORT_OPTIONS[i].name);
+	}
+	BAS_DestroyTextTexture(exportplan_textures[OPTIONS]);
+	exportplan_textures[OPTIONS] = BAS_CreateTextTextureWrapped(BAS_Font(FONT_DEFAULT), text, WINDOW_WIDTH/2);
+}
+static void
+exportplan_begin(void)
+{
+	exportplan_textures[LABEL]      = BAS_CreateTextTexture(BAS_Font(FONT_TEXTINPUT), "Output file path: ");
+	exportplan_textures[ADDITIONAL] = BAS_CreateTextTexture(BAS_Font(FONT_TEXTINPUT), "Insert the file's name and press RETURN to write...");
+	exportplan_textures[EXPORTED]   = BAS_CreateTextTexture(BAS_Font(FONT_TEXTINPUT), "The file has been written.");
+	exportplan_updateinputtexture();
+	exportplan_updateoptionstexture();
+}
+static void
+exportplan_stop(void)
+{
+	BAS_DestroyTextTexture(exportplan_textures[4]);
+	exportplan_textures[4] = NULL;
+	BAS_DestroyTextTexture(exportplan_textures[3]);
+	exportplan_textures[3] = NULL;
+	BAS_DestroyTextTexture(exportplan_textures[2]);
+	exportplan_textures[2] = NULL;
+	BAS_DestroyTextTexture(exportplan_textures[1]);
+	exportplan_textures[1] = NULL;
+	BAS_DestroyTextTexture(exportplan_textures[0]);
+	exportplan_textures[0] = NULL;
+}
+static inline void
+exportplan_resetstate(void)
+{
+	SDL_SetCursor(BAS_Cursor(CURSOR_ARROW));
+	exportplan_planexported = 0;
+}
+static void
+BAS_Tool_ExportPlan(SDL_Event e, int mx, int my, int special)
+{
+	register int i;
+	switch(special)
+	{
+	case TOOL_SPECIAL_RESETSTATE:
+		exportplan_resetstate();
+		return;
+	case TOOL_SPECIAL_BEGIN:
+		exportplan_begin();
+		return;
+	case TOOL_SPECIAL_STOP:
+		exportplan_stop();
+		return;
+	}
+	/*
+	 * Text editor.
+	 * Left/right arrow move the cursor.
+	 * Backspace deletes the previous character.
+	 * Delete deletes the current character.
+	 * Valid characters are [a-z],./
+	 */
+	if (e.type == SDL_KEYDOWN && (e.key.keysym.mod & KMOD_CTRL))
+	{
+		for (i = 0; i < EXPORT_OPTION_COUNT; i++)
+		{
+			if (e.key.keysym.sym == EXPORT_OPTIONS[i].key)
+			{
+				exportplan_options ^= EXPORT_OPTIONS[i].option;
+				exportplan_updateoptionstexture();
+			}
+		}
+	}
+	else if (e.type == SDL_KEYDOWN)
+	{
+		switch (e.key.keysym.sym)
+		{
+			case SDLK_RETURN:
+				if ((exportplan_options & EXPORT_OPTION_FILTERTHINGS) && !thing_filteractive)
+				{
+					BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_WARNING, "File export", "No thing filter is set, filter with Q in the thing tool.");
+					break;
+				}
+				if (BAS_ExportPlan(exportplan_filepath, exportplan_options, (exportplan_options & EXPORT_OPTION_FILTERTHINGS) ? &thing_filter : NULL))
+				{
+					BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_ERROR, "File export error", "The file was not written.");
+					exportplan_planexported = 0;
+				}
+				else
+				{
+					BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_INFO, "File export", "The file was successfully written.");
+					exportplan_planexported = 1;
+				}
+				break;
+			case SDLK_LEFT:
+				if (exportplan_cursor > 0)
+				{
+					exportplan_cursor--;
+					exportplan_updateinputtexture();
+				}
+				break;
+			case SDLK_RIGHT:
+				if (exportplan_cursor < exportplan_filepathlength)
+				{
+					exportplan_cursor++;
+					exportplan_updateinputtexture();
+				}
+				break;
+			case SDLK_HOME:
+				if (exportplan_cursor != 0)
+				{
+					exportplan_cursor = 0;
+					exportplan_updateinputtexture();
+				}
+				break;
+			case SDLK_END:
+				if (exportplan_cursor != exportplan_filepathlength)
+				{
+					exportplan_cursor = exportplan_filepathlength;
+					exportplan_updateinputtexture();
+				}
+				break;
+			case SDLK_BACKSPACE:
+				if (exportplan_cursor > 0)
+				{
+					for (i = exportplan_cursor-1; i < exportplan_filepathlength+1; i++)
+					{
+						exportplan_filepath[i] = exportplan_filepath[i+1];
+					}
+					exportplan_cursor--;
+					exportplan_filepathlength--;
+					exportplan_updateinputtexture();
+				}
+				break;
+			case SDLK_DELETE:
+				if (exportplan_cursor >= 0 && exportplan_filepath[exportplan_cursor] != '\0')
+				{
+					for (i = exportplan_cursor; i < exportplan_filepathlength+1; i++)
+					{
+						exportplan_filepath[i] = exportplan_filepath[i+1];
+					}
+					exportplan_filepathlength--;
+					exportplan_updateinputtexture();
+				}
+				break;
+			case SDLK_a: case SDLK_b: case SDLK_c: case SDLK_d: case SDLK_e:
+			case SDLK_f: case SDLK_g: case SDLK_h: case SDLK_i: case SDLK_j:
+			case SDLK_k: case SDLK_l: case SDLK_m: case SDLK_n: case SDLK_o:
+			case SDLK_p: case SDLK_q: case SDLK_r: case SDLK_s: case SDLK_t:
+			case SDLK_u: case SDLK_v: case SDLK_w: case SDLK_x: case SDLK_y:
+			case SDLK_z:
+			case SDLK_0: case SDLK_1: case SDLK_2: case SDLK_3: case SDLK_4:
+			case SDLK_5: case SDLK_6: case SDLK_7: case SDLK_8: case SDLK_9:
+			case SDLK_PERIOD: case SDLK_COMMA: case SDLK_SLASH:
+				exportplan_filepath[exportplan_cursor] = e.key.keysym.sym;
+				exportplan_cursor++;
+				exportplan_filepathlength = strlen(exportplan_filepath);
+				exportplan_updateinputtexture();
+		}
+	}
+}
+static void
+BAS_Tool_ExportPlan_Draw(int mx, int my)
 {
-	char buffer[32];
-	SDL_DestroyTexture(thing_infos[0]);
-	snprintf(buffer, 32, "Thing index %d.", thingindex);
-	thing_infos[0] = BAS_CreateTextTexture(font_default, buffer);
-	snprintf(buffer, 32, "----------------");
-	thing_infos[1] = BAS_CreateTextTexture(font_default, buffer);
-	snprintf(buffer, 32, "Structure data:");
-	thing_infos[2] = BAS_CreateTextTexture(font_default, buffer);
-	snprintf(buffer, 32, "struct BAS_Thing");
-	thing_infos[3] = BAS_CreateTextTexture(font_default, buffer);
-	snprintf(buffer, 32, "{");
-	thing_infos[4] = BAS_CreateTextTexture(font_default, buffer);
-	snprintf(buffer, 32, "  uint64_t flags = %ld;", things[thingindex].flags);
-	thing_infos[5] = BAS_CreateTextTexture(font_default, buffer);
-	snprintf(buffer, 32, "  int thingposition[0] = %d;", things[thingindex].thingposition[0]);
-	thing_infos[6] = BAS_CreateTextTexture(font_default, buffer);
-	snprintf(buffer, 32, "  int thingposition[1] = %d;", things[thingindex].thingposition[1]);
-	thing_infos[7] = BAS_CreateTextTexture(font_default, buffer);
-	snprintf(buffer, 32, "  int type = %d;", things[thingindex].type);
-	thing_infos[8] = BAS_CreateTextTexture(font_default, buffer);
-	snprintf(buffer, 32, "  int facing = %d;", things[thingindex].facing);
-	thing_infos[9] = BAS_CreateTextTexture(font_default, buffer);
-	snprintf(buffer, 32, "}");
-	thing_infos[10] = BAS_CreateTextTexture(font_default, buffer);
+	SDL_Rect rectangle;
+	int screen_left, screen_top, temp;
+	exportplan_updateinputtexture();
+	/* Screen */
+	rectangle.w = 800;
+	rectangle.h = 128;
+	screen_left = WINDOW_WIDTH/2-rectangle.w/2;
+	rectangle.x = screen_left;
+	screen_top  = WINDOW_HEIGHT/2-rectangle.h/2;
+	rectangle.y = screen_top;
+	BAS_UseColourAlpha(0, 0, 0, 196);
+	SDL_RenderFillRect(renderer, &rectangle);
+	BAS_UseColour(255, 255, 255);
+	SDL_RenderDrawRect(renderer, &rectangle);
+	/* Input text label */
+	rectangle.x = screen_left;
+	SDL_QueryTexture(exportplan_textures[LABEL], NULL, NULL, &rectangle.w, &rectangle.h);
+	SDL_RenderCopy(renderer, exportplan_textures[LABEL], NULL, &rectangle);
+	/* Input text */
+	rectangle.x = temp = rectangle.x+rectangle.w;
+	SDL_QueryTexture(exportplan_textures[INPUT], NULL, NULL, &rectangle.w, &rectangle.h);
+	SDL_RenderCopy(renderer, exportplan_textures[INPUT], NULL, &rectangle);
+	/* Additinal text */
+	rectangle.x = screen_left;
+	rectangle.y += rectangle.h;
+	SDL_QueryTexture(exportplan_textures[ADDITIONAL], NULL, NULL, &rectangle.w, &rectangle.h);
+	SDL_RenderCopy(renderer, exportplan_textures[ADDITIONAL], NULL, &rectangle);
+	/* Options */
+	rectangle.y += rectangle.h;
+	SDL_QueryTexture(exportplan_textures[OPTIONS], NULL, NULL, &rectangle.w, &rectangle.h);
+	SDL_RenderCopy(renderer, exportplan_textures[OPTIONS], NULL, &rectangle);
+	/* Additinal text */
+	if (exportplan_planexported)
+	{
+		rectangle.x = screen_left;
+		rectangle.y += rectangle.h;
+		SDL_QueryTexture(exportplan_textures[EXPORTED], NULL, NULL, &rectangle.w, &rectangle.h);
+		SDL_RenderCopy(renderer, exportplan_textures[EXPORTED], NULL, &rectangle);
+	}
+}
+
+/*
+ * ----------------
+ * Traces.
+ * A recorded session is the stream of input events, frame by frame, so it can
+ * be replayed without a display and timed.
+ *
+ * The file is "BASTRACE", a version byte, then per frame its events followed
+ * by a 0 byte. An event is its TRACE_EVENT code, the time since the previous
+ * event in milliseconds, the mouse position and modifiers as the tools saw
+ * them (as zigzag deltas from the previous event) and the fields of its type;
+ * all numbers are varints.
+ * ----------------
+ */
+#define TRACE_VERSION          1
+#define TRACE_EVENT_END        0 /* End of the frame. */
+#define TRACE_EVENT_QUIT       1
+#define TRACE_EVENT_WINDOW     2
+#define TRACE_EVENT_KEYDOWN    3
+#define TRACE_EVENT_KEYUP      4
+#define TRACE_EVENT_BUTTONDOWN 5
+#define TRACE_EVENT_BUTTONUP   6
+#define TRACE_EVENT_MOTION     7
+#define TRACE_EVENT_WHEEL      8
+static FILE *trace_file     = NULL;
+static int trace_finished   = 0;
+static Uint32 trace_time    = 0;
+static int trace_state[3]   = {0, 0, 0}; /* Mouse x, y and modifiers of the previous event. */
+static float *trace_frametimes   = NULL;
+static int trace_framecount      = 0;
+static int trace_framecapacity   = 0;
+
+/* Open a trace for recording, or for replaying. Returns 0 on success, 1 on error. */
+static int
+BAS_Trace_Open(const char *path, int replay)
+{
+	char header[9];
+	if (!(trace_file = fopen(path, replay ? "rb" : "wb")))
+	{
+		WRITE_E("Failed to open the trace!");
+		return 1;
+	}
+	trace_replaying = replay;
+	if (!replay)
+	{
+		fwrite("BASTRACE", 8, 1, trace_file);
+		putc(TRACE_VERSION, trace_file);
+		return 0;
+	}
+	if (fread(header, 9, 1, trace_file) != 1 || memcmp(header, "BASTRACE", 8) || header[8] != TRACE_VERSION)
+	{
+		WRITE_E("Not a trace, or of another version!");
+		fclose(trace_file);
+		trace_file      = NULL;
+		trace_replaying = 0;
+		return 1;
+	}
+	return 0;
 }
+
+/* Write an event polled while recording. Events which the editor does not handle are left out. */
 static void
-BAS_Tool_ThingPlace(SDL_Event e, int mx, int my, int special)
+BAS_Trace_Write(const SDL_Event *e)
+{
+	int code, mouse[2], mod;
+	switch (e->type)
+	{
+		case SDL_QUIT:            code = TRACE_EVENT_QUIT;       break;
+		case SDL_WINDOWEVENT:     code = TRACE_EVENT_WINDOW;     break;
+		case SDL_KEYDOWN:         code = TRACE_EVENT_KEYDOWN;    break;
+		case SDL_KEYUP:           code = TRACE_EVENT_KEYUP;      break;
+		case SDL_MOUSEBUTTONDOWN: code = TRACE_EVENT_BUTTONDOWN; break;
+		case SDL_MOUSEBUTTONUP:   code = TRACE_EVENT_BUTTONUP;   break;
+		case SDL_MOUSEMOTION:     code = TRACE_EVENT_MOTION;     break;
+		case SDL_MOUSEWHEEL:      code = TRACE_EVENT_WHEEL;      break;
+		default: return;
+	}
+	SDL_GetMouseState(&mouse[0], &mouse[1]);
+	mod = SDL_GetModState();
+	putc(code, trace_file);
+	BAS_WriteVarint(trace_file, e->common.timestamp-trace_time);
+	BAS_WriteZigzag(trace_file, mouse[0]-trace_state[0]);
+	BAS_WriteZigzag(trace_file, mouse[1]-trace_state[1]);
+	BAS_WriteVarint(trace_file, mod);
+	trace_time     = e->common.timestamp;
+	trace_state[0] = mouse[0];
+	trace_state[1] = mouse[1];
+	switch (code)
+	{
+		case TRACE_EVENT_WINDOW:
+			BAS_WriteVarint(trace_file, e->window.event);
+			break;
+		case TRACE_EVENT_KEYDOWN:
+		case TRACE_EVENT_KEYUP:
+			BAS_WriteVarint(trace_file, e->key.keysym.sym);
+			BAS_WriteVarint(trace_file, e->key.keysym.scancode);
+			BAS_WriteVarint(trace_file, e->key.keysym.mod);
+			BAS_WriteVarint(trace_file, e->key.repeat);
+			break;
+		case TRACE_EVENT_BUTTONDOWN:
+		case TRACE_EVENT_BUTTONUP:
+			BAS_WriteVarint(trace_file, e->button.button);
+			BAS_WriteVarint(trace_file, e->button.clicks);
+			BAS_WriteZigzag(trace_file, e->button.x-mouse[0]);
+			BAS_WriteZigzag(trace_file, e->button.y-mouse[1]);
+			break;
+		case TRACE_EVENT_MOTION:
+			BAS_WriteVarint(trace_file, e->motion.state);
+			BAS_WriteZigzag(trace_file, e->motion.x-mouse[0]);
+			BAS_WriteZigzag(trace_file, e->motion.y-mouse[1]);
+			BAS_WriteZigzag(trace_file, e->motion.xrel);
+			BAS_WriteZigzag(trace_file, e->motion.yrel);
+			break;
+		case TRACE_EVENT_WHEEL:
+			BAS_WriteZigzag(trace_file, e->wheel.x);
+			BAS_WriteZigzag(trace_file, e->wheel.y);
+			break;
+	}
+}
+
+/*
+ * Read the next event of the frame being replayed, like SDL_PollEvent.
+ * Returns 0 at the end of the frame; at the end of the trace, trace_finished is set.
+ */
+static int
+BAS_Trace_Poll(SDL_Event *e)
+{
+	Uint32 value[5];
+	int code, i, count;
+	if (trace_finished || (code = getc(trace_file)) == EOF)
+	{
+		trace_finished = 1;
+		return 0;
+	}
+	if (code == TRACE_EVENT_END)
+	{
+		return 0;
+	}
+	/* The fields of every type, after the common ones. */
+	switch (code)
+	{
+		case TRACE_EVENT_QUIT:       count = 0; break;
+		case TRACE_EVENT_WINDOW:     count = 1; break;
+		case TRACE_EVENT_KEYDOWN:
+		case TRACE_EVENT_KEYUP:      count = 4; break;
+		case TRACE_EVENT_BUTTONDOWN:
+		case TRACE_EVENT_BUTTONUP:   count = 4; break;
+		case TRACE_EVENT_MOTION:     count = 5; break;
+		case TRACE_EVENT_WHEEL:      count = 2; break;
+		default:                     count = -1;
+	}
+	if (count < 0
+	 || BAS_ReadVarint(trace_file, &value[0])
+	 || BAS_ReadZigzag(trace_file, &value[1])
+	 || BAS_ReadZigzag(trace_file, &value[2])
+	 || BAS_ReadVarint(trace_file, &value[3]))
+	{
+		WRITE_E("The trace is damaged, stopping here.");
+		trace_finished = 1;
+		return 0;
+	}
+	memset(e, 0, sizeof(*e));
+	e->common.timestamp = trace_time += value[0];
+	trace_mouse[0] = trace_state[0] += (int)value[1];
+	trace_mouse[1] = trace_state[1] += (int)value[2];
+	trace_mod      = (Uint16)value[3];
+	for (i = 0; i < count; i++)
+	{
+		/* Positions and motion are zigzag coded, the other fields are plain varints. */
+		const int zigzag = (code == TRACE_EVENT_BUTTONDOWN || code == TRACE_EVENT_BUTTONUP) ? i >= 2
+		                 : code == TRACE_EVENT_MOTION ? i >= 1 : code == TRACE_EVENT_WHEEL;
+		if (zigzag ? BAS_ReadZigzag(trace_file, &value[i]) : BAS_ReadVarint(trace_file, &value[i]))
+		{
+			WRITE_E("The trace is damaged, stopping here.");
+			trace_finished = 1;
+			return 0;
+		}
+	}
+	switch (code)
+	{
+		case TRACE_EVENT_QUIT:
+			e->type = SDL_QUIT;
+			break;
+		case TRACE_EVENT_WINDOW:
+			e->type         = SDL_WINDOWEVENT;
+			e->window.event = value[0];
+			break;
+		case TRACE_EVENT_KEYDOWN:
+		case TRACE_EVENT_KEYUP:
+			e->type              = code == TRACE_EVENT_KEYDOWN ? SDL_KEYDOWN : SDL_KEYUP;
+			e->key.state         = code == TRACE_EVENT_KEYDOWN ? SDL_PRESSED : SDL_RELEASED;
+			e->key.keysym.sym      = (SDL_Keycode)value[0];
+			e->key.keysym.scancode = (SDL_Scancode)value[1];
+			e->key.keysym.mod      = (Uint16)value[2];
+			e->key.repeat          = value[3];
+			break;
+		case TRACE_EVENT_BUTTONDOWN:
+		case TRACE_EVENT_BUTTONUP:
+			e->type          = code == TRACE_EVENT_BUTTONDOWN ? SDL_MOUSEBUTTONDOWN : SDL_MOUSEBUTTONUP;
+			e->button.state  = code == TRACE_EVENT_BUTTONDOWN ? SDL_PRESSED : SDL_RELEASED;
+			e->button.button = value[0];
+			e->button.clicks = value[1];
+			e->button.x      = trace_mouse[0]+(int)value[2];
+			e->button.y      = trace_mouse[1]+(int)value[3];
+			break;
+		case TRACE_EVENT_MOTION:
+			e->type         = SDL_MOUSEMOTION;
+			e->motion.state = value[0];
+			e->motion.x     = trace_mouse[0]+(int)value[1];
+			e->motion.y     = trace_mouse[1]+(int)value[2];
+			e->motion.xrel  = (int)value[3];
+			e->motion.yrel  = (int)value[4];
+			break;
+		case TRACE_EVENT_WHEEL:
+			e->type    = SDL_MOUSEWHEEL;
+			e->wheel.x = (int)value[0];
+			e->wheel.y = (int)value[1];
+			break;
+	}
+	return 1;
+}
+
+/* Close the frame while recording, or note how long it took while replaying. */
+static void
+BAS_Trace_EndFrame(Uint64 framestart)
+{
+	if (!trace_replaying)
+	{
+		putc(TRACE_EVENT_END, trace_file);
+		return;
+	}
+	if (!BAS_Reserve(MEMORY_WORK, (void **)&trace_frametimes, &trace_framecapacity, trace_framecount+1, sizeof(float)))
+	{
+		trace_frametimes[trace_framecount++] = (SDL_GetPerformanceCounter()-framestart)*1000.0/SDL_GetPerformanceFrequency();
+	}
+}
+
+/*
+ * Hash of the plan's rooms and things, which does not depend on their order.
+ * Two runs of the same trace must end with the same hash.
+ */
+static Uint64
+BAS_Plan_Hash(void)
+{
+	register int i;
+	Uint64 hash = (Uint64)plan->room_count << 32 | (Uint32)plan->thing_count;
+	for (i = 0; i < plan->room_count; i++)
+	{
+		Uint64 state = (Uint64)(Uint32)plan->rooms[i].cellposition[0] << 32 | (Uint32)plan->rooms[i].cellposition[1];
+		hash += BAS_Random_Next(&state);
+	}
+	for (i = 0; i < plan->thing_count; i++)
+	{
+		Uint64 state = (Uint64)(Uint32)plan->things.thingposition[0][i] << 32 | (Uint32)plan->things.thingposition[1][i];
+		state ^= BAS_Random_Next(&state)+plan->things.flags[i];
+		state ^= (Uint64)(Uint32)plan->things.type[i] << 32 | (Uint32)plan->things.facing[i];
+		hash  += BAS_Random_Next(&state);
+	}
+	return hash;
+}
+
+static int
+tracetime_compare(const void *a, const void *b)
+{
+	const float fa = *(const float *)a, fb = *(const float *)b;
+	return (fa > fb)-(fa < fb);
+}
+
+/* Close the trace and report the plan it ended with, after a replay also the frame times. */
+static void
+BAS_Trace_Close(void)
+{
+	char message[192];
+	if (!trace_file)
+	{
+		return;
+	}
+	fclose(trace_file);
+	trace_file = NULL;
+	if (trace_replaying && trace_framecount > 0)
+	{
+		register int i;
+		double total = 0.0;
+		for (i = 0; i < trace_framecount; i++)
+		{
+			total += trace_frametimes[i];
+		}
+		qsort(trace_frametimes, trace_framecount, sizeof(float), tracetime_compare);
+		snprintf(
+			message, sizeof(message), "Replayed %d frames in %.1f ms: mean %.3f, median %.3f, 95%% %.3f, 99%% %.3f, max %.3f ms per frame.",
+			trace_framecount, total, total/trace_framecount,
+			trace_frametimes[trace_framecount/2],
+			trace_frametimes[(int)(trace_framecount*0.95)],
+			trace_frametimes[(int)(trace_framecount*0.99)],
+			trace_frametimes[trace_framecount-1]
+		);
+		WRITE_I(message);
+	}
+	/* A replay must end with the plan the recording ended with. */
+	if (plan->lines_outdated)
+	{
+		BAS_RecalculateLines();
+	}
+	snprintf(
+		message, sizeof(message), "Plan hash %016llx: %d rooms, %d things, %d walls.",
+		(unsigned long long)BAS_Plan_Hash(), plan->room_count, plan->thing_count, plan->line_count
+	);
+	WRITE_I(message);
+	BAS_Free(trace_frametimes);
+	trace_frametimes = NULL;
+	trace_replaying  = 0;
+}
+
+/*
+ * ----------------
+ * Batch conversion.
+ * Every plan file in a directory is loaded into a plan of its own and
+ * exported, on a thread per core. The plans are dealt round robin to the
+ * threads' queues, biggest first; a thread takes plans from the back of its
+ * own queue and, once that is empty, steals from the front of the others.
+ * ----------------
+ */
+#define BATCH_DONE         0
+#define BATCH_FAILED_LOAD  1
+#define BATCH_FAILED_WRITE 2
+#define BATCH_SKIPPED      3 /* The path is too long for a plan file path. */
+struct BAS_BatchJob
+{
+	char input[96];
+	char output[96];
+	long size;
+	int status;
+	int rooms, things, walls;
+	int thread;
+	double milliseconds;
+};
+struct batch_queue
+{
+	SDL_SpinLock lock;
+	int *jobs;
+	int first, last; /* jobs[first, last) are left. */
+};
+struct batch_pool
+{
+	struct BAS_BatchJob *jobs;
+	struct batch_queue *queues;
+	int queue_count;
+	int options;
+};
+struct batch_worker
+{
+	struct batch_pool *pool;
+	int index;
+};
+
+static int
+batchjob_namecompare(const void *a, const void *b)
+{
+	return strcmp(((const struct BAS_BatchJob *)a)->input, ((const struct BAS_BatchJob *)b)->input);
+}
+static const struct BAS_BatchJob *batchjob_sizeorder;
+static int
+batchjob_sizecompare(const void *a, const void *b)
+{
+	const long sa = batchjob_sizeorder[*(const int *)a].size;
+	const long sb = batchjob_sizeorder[*(const int *)b].size;
+	return (sa < sb)-(sa > sb);
+}
+
+/* The next job for the given worker, or -1 when every queue is empty. */
+static int
+batch_take(struct batch_pool *pool, int self)
 {
-	switch(special)
-	{
-	case TOOL_SPECIAL_RESETSTATE:
-		thingtool_resetstate();
-		return;
-	case TOOL_SPECIAL_BEGIN:
-		SDL_ShowCursor(SDL_DISABLE);
-		return;
-	case TOOL_SPECIAL_STOP:
-		SDL_ShowCursor(SDL_ENABLE);
-		return;
-	}
-	if (e.type == SDL_KEYDOWN)
+	register int i;
+	int job = -1;
+	struct batch_queue *queue = &pool->queues[self];
+	SDL_AtomicLock(&queue->lock);
+	if (queue->first < queue->last)
 	{
-		switch(e.key.keysym.sym)
-		{
-			case SDLK_e:
-				thing_seeinfo = !thing_seeinfo;
-				break;
-			/* Control selected thing's facing direction. */
-			case SDLK_UP:    if (thing_selected != BAS_NO_SUCH_THING) { things[thing_selected].facing = 1; thingtool_updateinfopanel(thing_selected); } break;
-			case SDLK_LEFT:  if (thing_selected != BAS_NO_SUCH_THING) { things[thing_selected].facing = 2; thingtool_updateinfopanel(thing_selected); } break;
-			case SDLK_DOWN:  if (thing_selected != BAS_NO_SUCH_THING) { things[thing_selected].facing = 3; thingtool_updateinfopanel(thing_selected); } break;
-			case SDLK_RIGHT: if (thing_selected != BAS_NO_SUCH_THING) { things[thing_selected].facing = 0; thingtool_updateinfopanel(thing_selected); } break;
-		}
+		job = queue->jobs[--queue->last];
 	}
-	else if (e.type == SDL_MOUSEBUTTONDOWN)
+	SDL_AtomicUnlock(&queue->lock);
+	for (i = 1; job < 0 && i < pool->queue_count; i++)
 	{
-		if (e.button.button == SDL_BUTTON_LEFT)
+		queue = &pool->queues[(self+i)%pool->queue_count];
+		SDL_AtomicLock(&queue->lock);
+		if (queue->first < queue->last)
 		{
-			int selected;
-			int x, y;
-			x = mx;
-			y = my;
-			BAS_SnapToClosestCell_Custom(&x, &y, THING_SCALE);
-			selected = BAS_FindThing(x, y);
-			if (selected != BAS_NO_SUCH_THING)
-			{
-				thing_selected = selected;
-				thing_seeinfo  = 1;
-				thingtool_updateinfopanel(selected);
-			}
-			else
-			{
-				things[thing_count].thingposition[0] = x;
-				things[thing_count].thingposition[1] = y;
-				things[thing_count].facing = thing_count%4;
-				thing_seeinfo  = 1;
-				thing_selected = thing_count;
-				thingtool_updateinfopanel(thing_selected);
-				thing_count++;
-			}
+			job = queue->jobs[queue->first++];
 		}
+		SDL_AtomicUnlock(&queue->lock);
 	}
-	else if (e.type == SDL_MOUSEMOTION)
+	return job;
+}
+
+static int
+batch_worker(void *data)
+{
+	const struct batch_worker *worker = data;
+	struct batch_pool *pool = worker->pool;
+	struct BAS_Plan context;
+	int index;
+	/* Also run on the calling thread, when its thread could not be started: its plan and lane are put back. */
+	struct BAS_Plan *const current     = plan;
+	struct BAS_SpanBuffer *const lane  = span_buffer;
+	const char *const thread           = span_thread;
+	BAS_Plan_Init(&context);
+	plan = &context;
+	BAS_Span_Thread("BAS_Batch");
+	while ((index = batch_take(pool, worker->index)) >= 0)
 	{
-		if (e.motion.x < panel_width && thing_seeinfo)
+		struct BAS_BatchJob *job = &pool->jobs[index];
+		const Uint64 start = SDL_GetPerformanceCounter();
+		int failed;
+		job->thread = worker->index;
+		BAS_Span_Begin("batch job");
+		BAS_Span_Begin("BAS_Plan_Load");
+		failed = BAS_Plan_Load(job->input);
+		BAS_Span_End("BAS_Plan_Load");
+		if (failed)
 		{
-			SDL_ShowCursor(SDL_ENABLE);
-			thingtool_updatecursor = 0;
+			job->status = BATCH_FAILED_LOAD;
 		}
 		else
 		{
-			SDL_ShowCursor(SDL_DISABLE);
-			thingtool_updatecursor = 1;
+			BAS_RecalculateLines();
+			job->status = BAS_ExportPlan(job->output, pool->options, NULL) ? BATCH_FAILED_WRITE : BATCH_DONE;
+			job->rooms  = plan->room_count;
+			job->things = plan->thing_count;
+			job->walls  = plan->line_count;
 		}
+		job->milliseconds = (SDL_GetPerformanceCounter()-start)*1000.0/SDL_GetPerformanceFrequency();
+		BAS_Plan_Free(&context);
+		BAS_Span_End("batch job");
 	}
-}
-static int thingtool_cursorposition[2];
-static void
-BAS_Tool_ThingPlace_Draw(int mx, int my)
-{
-	SDL_Rect rectangle;
-	int i;
-	int oldmx, oldmy;
-	const int activethingalpha = 255*fabsf(sinf(SDL_GetTicks()/100.0f));
-	oldmx = mx;
-	oldmy = my;
-	BAS_SnapToClosestCell_Custom(&mx, &my, THING_SCALE);
-	rectangle.x = mx;
-	rectangle.y = my;
-	rectangle.w = THING_SCALE;
-	rectangle.h = THING_SCALE;
-	BAS_UseColourAlpha(255, 255, 0, activethingalpha);
-	SDL_RenderFillRect(renderer, &rectangle);
-	/* Render the "big" outline for the selected thing. */
-	if (thing_selected != BAS_NO_SUCH_THING)
+	if (!lane)
 	{
-		const int activethingalpha = 255*(fabsf(sinf(SDL_GetTicks()/100.0f))/2.0f+0.5f);
-		rectangle.x = things[thing_selected].thingposition[0]-4;
-		rectangle.y = things[thing_selected].thingposition[1]-4;
-		rectangle.w = THING_SCALE+8;
-		rectangle.h = THING_SCALE+8;
-		BAS_UseColourAlpha(0, 255, 0, activethingalpha);
-		SDL_RenderDrawRect(renderer, &rectangle);
+		BAS_Span_ThreadEnd();
 	}
-	/* Render cursor. */
-	if (thingtool_updatecursor)
+	span_thread = thread;
+	plan        = current;
+	return 0;
+}
+
+/*
+ * Export every "*.bas" plan file of the input directory into the output
+ * directory, under the same name without the extension.
+ * Returns 0 when all of them were converted, 1 otherwise.
+ */
+static int
+BAS_Batch(const char *inputdirectory, const char *outputdirectory, int options)
+{
+#ifdef BAS_HAVE_DIRENT
+	register int i;
+	struct BAS_BatchJob *jobs = NULL;
+	struct batch_queue *queues = NULL;
+	struct batch_worker *workers = NULL;
+	SDL_Thread **threads = NULL;
+	struct batch_pool pool;
+	int *order = NULL, job_count = 0, job_capacity = 0, thread_count, failed = 0;
+	double work = 0.0;
+	char message[256]; /* Room for an input and an output path. */
+	struct dirent *entry;
+	const int quiet = print_quiet;
+	const Uint64 start = SDL_GetPerformanceCounter();
+	DIR *directory = opendir(inputdirectory);
+	if (!directory)
 	{
-		thingtool_cursorposition[0] = oldmx;
-		thingtool_cursorposition[1] = oldmy;
-		SDL_GetMouseState(&thingtool_cursorposition[0], &thingtool_cursorposition[1]);
+		WRITE_E("Failed to open the input directory!");
+		return 1;
 	}
-	BAS_DrawCrosshair_Small(thingtool_cursorposition[0], thingtool_cursorposition[1]);
-	/* Thing info editor. */
-	if (thing_seeinfo)
+	while ((entry = readdir(directory)))
 	{
-		const int facingpanel_scale = panel_width/2;
-		int facingpanel_line[2][2];
-		/* Panel */
-		rectangle.x = 0;
-		rectangle.y = 0;
-		rectangle.w = panel_width;
-		rectangle.h = WINDOW_HEIGHT;
-		BAS_UseColour(0, 0, 0);
-		SDL_RenderFillRect(renderer, &rectangle);
-		/* Panel gradient */
-		BAS_UseColourAlpha(255, 255, 255, 60);
-		for (i = 1; i < 50; i++)
+		struct BAS_BatchJob *job;
+		struct stat status;
+		const size_t length = strlen(entry->d_name);
+		if (length <= 4 || strcmp(entry->d_name+length-4, ".bas"))
 		{
-			float y = WINDOW_HEIGHT-tan(i/50.0)*50;
-			SDL_RenderDrawLine(renderer, 0, y, rectangle.w, y);
+			continue;
 		}
-		/* Thing info text */
-		rectangle.x = 0;
-		rectangle.y = 0;
-		for (i = 0; i < 11; i++)
+		if (BAS_Reserve(MEMORY_WORK, (void **)&jobs, &job_capacity, job_count+1, sizeof(struct BAS_BatchJob)))
 		{
-			SDL_QueryTexture(thing_infos[i], NULL, NULL, &rectangle.w, &rectangle.h);
-			SDL_RenderCopy(renderer, thing_infos[i], NULL, &rectangle);
-			rectangle.y += rectangle.h;
+			closedir(directory);
+			BAS_Free(jobs);
+			return 1;
 		}
-		rectangle.y += rectangle.h;
-		/* Thing facing direction */
-		rectangle.w = rectangle.h = facingpanel_scale;
-		BAS_UseColour(20, 60, 20);
-		rectangle.w += 4;
-		rectangle.h += 4;
-		SDL_RenderFillRect(renderer, &rectangle);
-		rectangle.w -= 4;
-		rectangle.h -= 4;
-		BAS_UseColour(30, 200, 30);
-		SDL_RenderFillRect(renderer, &rectangle);
-		facingpanel_line[0][0] = facingpanel_scale/2;
-		facingpanel_line[0][1] = rectangle.y+facingpanel_scale/2;
-		switch (things[thing_selected].facing)
+		job = &jobs[job_count];
+		memset(job, 0, sizeof(struct BAS_BatchJob));
+		job->status = BATCH_SKIPPED;
+		if (snprintf(job->input, sizeof(job->input), "%s/%s", inputdirectory, entry->d_name) >= (int)sizeof(job->input)
+		 || snprintf(job->output, sizeof(job->output), "%s/%.*s", outputdirectory, (int)length-4, entry->d_name) >= (int)sizeof(job->output))
 		{
-			case 0:
-				facingpanel_line[1][0] = facingpanel_scale;
-				facingpanel_line[1][1] = facingpanel_line[0][1];
-				break;
-			case 1:
-				facingpanel_line[1][0] = facingpanel_line[0][0];
-				facingpanel_line[1][1] = facingpanel_line[0][1]-facingpanel_scale/2;
-				break;
-			case 2:
-				facingpanel_line[1][0] = -facingpanel_scale/2;
-				facingpanel_line[1][1] = facingpanel_line[0][1];
-				break;
-			case 3:
-				facingpanel_line[1][0] = facingpanel_line[0][0];
-				facingpanel_line[1][1] = facingpanel_line[0][1]+facingpanel_scale/2;
-				break;
+			/* Left in the report, but not queued. */
+			job->size = -1;
 		}
-		BAS_UseColour(255, 255, 255);
-		SDL_RenderDrawLine(renderer, facingpanel_line[0][0], facingpanel_line[0][1], facingpanel_line[1][0], facingpanel_line[1][1]);
+		else if (stat(job->input, &status) || !S_ISREG(status.st_mode))
+		{
+			continue;
+		}
+		else
+		{
+			job->size = (long)status.st_size;
+		}
+		job_count++;
 	}
-}
-
-/*
- * ----------------
- * Export plan tool
- * ----------------
- */
-/* Define the indices for the texture array. */
-#define INPUT 0
-#define LABEL 1
-#define ADDITIONAL 2
-#define EXPORTED 3
-#define DEFAULT_EXPORT_FILE "./plans/t"
-static char exportplan_filepath[96]  = DEFAULT_EXPORT_FILE;
-static int exportplan_filepathlength = strlen(DEFAULT_EXPORT_FILE);
-static int exportplan_cursor         = 8;
-static int exportplan_planexported   = 0;
-static SDL_Texture* exportplan_textures[4] = {NULL, NULL, NULL, NULL};
-static const int CURSOR_BLINK_INTERVAL = 512;
-static void
-exportplan_updateinputtexture(void)
-{
-	char inputtext[96];
-	strcpy(inputtext, exportplan_filepath);
-	if ((SDL_GetTicks() % CURSOR_BLINK_INTERVAL) > CURSOR_BLINK_INTERVAL/2)
+	closedir(directory);
+	if (!job_count)
 	{
-		char buf[96] = "\0";
-		/* Don't copy garbage if the cursor is at the end of the input string... */
-		if (exportplan_cursor != exportplan_filepathlength)
+		WRITE_W("No plan files to convert.");
+		BAS_Free(jobs);
+		return 0;
+	}
+	qsort(jobs, job_count, sizeof(struct BAS_BatchJob), batchjob_namecompare);
+	/* Deal the plans out biggest first, so the threads start on even work. */
+	thread_count = SDL_GetCPUCount() < job_count ? SDL_GetCPUCount() : job_count;
+	thread_count = thread_count > 0 ? thread_count : 1;
+	order   = malloc(job_count*sizeof(int));
+	queues  = calloc(thread_count, sizeof(struct batch_queue));
+	workers = malloc(thread_count*sizeof(struct batch_worker));
+	threads = malloc(thread_count*sizeof(SDL_Thread *));
+	for (i = 0; queues && i < thread_count; i++)
+	{
+		if (!(queues[i].jobs = malloc((job_count/thread_count+1)*sizeof(int))))
 		{
-			strcpy(buf, inputtext+exportplan_cursor+1);
+			break;
 		}
-		strcpy(inputtext+exportplan_cursor, "_");
-		strcat(inputtext, buf);
 	}
-	if (exportplan_textures[INPUT])
+	if (!order || !queues || !workers || !threads || i < thread_count)
 	{
-		SDL_DestroyTexture(exportplan_textures[INPUT]);
+		WRITE_E("Out of memory!");
+		for (i = 0; queues && i < thread_count; i++)
+		{
+			free(queues[i].jobs);
+		}
+		free(queues);
+		free(order);
+		free(workers);
+		free(threads);
+		BAS_Free(jobs);
+		return 1;
 	}
-	exportplan_textures[INPUT] = BAS_CreateTextTexture(font_textinput, inputtext);
-}
-static void
-exportplan_begin(void)
-{
-	exportplan_textures[LABEL]      = BAS_CreateTextTexture(font_textinput, "Output file path: ");
-	exportplan_textures[ADDITIONAL] = BAS_CreateTextTexture(font_textinput, "Insert the file's name and press RETURN to write...");
-	exportplan_textures[EXPORTED]   = BAS_CreateTextTexture(font_textinput, "The file has been written.");
-	exportplan_updateinputtexture();
-}
-static void
-exportplan_stop(void)
-{
-	SDL_DestroyTexture(exportplan_textures[3]);
-	exportplan_textures[3] = NULL;
-	SDL_DestroyTexture(exportplan_textures[2]);
-	exportplan_textures[2] = NULL;
-	SDL_DestroyTexture(exportplan_textures[1]);
-	exportplan_textures[1] = NULL;
-	SDL_DestroyTexture(exportplan_textures[0]);
-	exportplan_textures[0] = NULL;
-}
-static inline void
-exportplan_resetstate(void)
-{
-	SDL_SetCursor(cursorheap[CURSOR_ARROW]);
-	exportplan_planexported = 0;
-}
-static void
-BAS_Tool_ExportPlan(SDL_Event e, int mx, int my, int special)
-{
-	register int i;
-	switch(special)
+	for (i = 0; i < job_count; i++)
 	{
-	case TOOL_SPECIAL_RESETSTATE:
-		exportplan_resetstate();
-		return;
-	case TOOL_SPECIAL_BEGIN:
-		exportplan_begin();
-		return;
-	case TOOL_SPECIAL_STOP:
-		exportplan_stop();
-		return;
+		order[i] = i;
 	}
-	/*
-	 * Text editor.
-	 * Left/right arrow move the cursor.
-	 * Backspace deletes the previous character.
-	 * Delete deletes the current character.
-	 * Valid characters are [a-z],./
-	 */
-	if (e.type == SDL_KEYDOWN)
+	batchjob_sizeorder = jobs;
+	qsort(order, job_count, sizeof(int), batchjob_sizecompare);
+	for (i = job_count-1; i >= 0; i--)
 	{
-		switch (e.key.keysym.sym)
+		/* Smallest first in, as the owner takes from the back. */
+		struct batch_queue *queue = &queues[i%thread_count];
+		if (jobs[order[i]].size >= 0)
 		{
-			case SDLK_RETURN:
-				if (BAS_ExportPlan(exportplan_filepath))
-				{
-					BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_ERROR, "File export error", "The file was not written.");
-					exportplan_planexported = 0;
-				}
-				else
-				{
-					BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_INFO, "File export", "The file was successfully written.");
-					exportplan_planexported = 1;
-				}
-				break;
-			case SDLK_LEFT:
-				if (exportplan_cursor > 0)
-				{
-					exportplan_cursor--;
-					exportplan_updateinputtexture();
-				}
-				break;
-			case SDLK_RIGHT:
-				if (exportplan_cursor < exportplan_filepathlength)
-				{
-					exportplan_cursor++;
-					exportplan_updateinputtexture();
-				}
-				break;
-			case SDLK_HOME:
-				if (exportplan_cursor != 0)
-				{
-					exportplan_cursor = 0;
-					exportplan_updateinputtexture();
-				}
+			queue->jobs[queue->last++] = order[i];
+		}
+	}
+	pool.jobs        = jobs;
+	pool.queues      = queues;
+	pool.queue_count = thread_count;
+	pool.options     = options;
+	/* The checksum table is made on first use, not while the workers race for it. */
+	BAS_CRC32C(NULL, 0);
+	print_quiet = 1;
+	for (i = 0; i < thread_count; i++)
+	{
+		workers[i].pool  = &pool;
+		workers[i].index = i;
+		threads[i] = SDL_CreateThread(batch_worker, "BAS_Batch", &workers[i]);
+	}
+	for (i = 0; i < thread_count; i++)
+	{
+		if (threads[i])
+		{
+			SDL_WaitThread(threads[i], NULL);
+		}
+		else
+		{
+			/* The thread could not be started, its queue is run here. */
+			batch_worker(&workers[i]);
+		}
+	}
+	print_quiet = quiet;
+	/* Report, by name. */
+	for (i = 0; i < job_count; i++)
+	{
+		const struct BAS_BatchJob *job = &jobs[i];
+		switch (job->status)
+		{
+			case BATCH_DONE:
+				snprintf(
+					message, sizeof(message), "%s: %d rooms, %d things, %d walls in %.1f ms (thread %d).",
+					job->input, job->rooms, job->things, job->walls, job->milliseconds, job->thread
+				);
+				WRITE_I(message);
 				break;
-			case SDLK_END:
-				if (exportplan_cursor != exportplan_filepathlength)
-				{
-					exportplan_cursor = exportplan_filepathlength;
-					exportplan_updateinputtexture();
-				}
+			case BATCH_FAILED_LOAD:
+				snprintf(message, sizeof(message), "%s: failed to load.", job->input);
+				WRITE_E(message);
 				break;
-			case SDLK_BACKSPACE:
-				if (exportplan_cursor > 0)
-				{
-					for (i = exportplan_cursor-1; i < exportplan_filepathlength+1; i++)
-					{
-						exportplan_filepath[i] = exportplan_filepath[i+1];
-					}
-					exportplan_cursor--;
-					exportplan_filepathlength--;
-					exportplan_updateinputtexture();
-				}
+			case BATCH_FAILED_WRITE:
+				snprintf(message, sizeof(message), "%s: failed to write %s.", job->input, job->output);
+				WRITE_E(message);
 				break;
-			case SDLK_DELETE:
-				if (exportplan_cursor >= 0 && exportplan_filepath[exportplan_cursor] != '\0')
-				{
-					for (i = exportplan_cursor; i < exportplan_filepathlength+1; i++)
-					{
-						exportplan_filepath[i] = exportplan_filepath[i+1];
-					}
-					exportplan_filepathlength--;
-					exportplan_updateinputtexture();
-				}
+			case BATCH_SKIPPED:
+				snprintf(message, sizeof(message), "%s...: the path is too long, skipped.", job->input);
+				WRITE_E(message);
 				break;
-			case SDLK_a: case SDLK_b: case SDLK_c: case SDLK_d: case SDLK_e:
-			case SDLK_f: case SDLK_g: case SDLK_h: case SDLK_i: case SDLK_j:
-			case SDLK_k: case SDLK_l: case SDLK_m: case SDLK_n: case SDLK_o:
-			case SDLK_p: case SDLK_q: case SDLK_r: case SDLK_s: case SDLK_t:
-			case SDLK_u: case SDLK_v: case SDLK_w: case SDLK_x: case SDLK_y:
-			case SDLK_z:
-			case SDLK_0: case SDLK_1: case SDLK_2: case SDLK_3: case SDLK_4:
-			case SDLK_5: case SDLK_6: case SDLK_7: case SDLK_8: case SDLK_9:
-			case SDLK_PERIOD: case SDLK_COMMA: case SDLK_SLASH:
-				exportplan_filepath[exportplan_cursor] = e.key.keysym.sym;
-				exportplan_cursor++;
-				exportplan_filepathlength = strlen(exportplan_filepath);
-				exportplan_updateinputtexture();
 		}
+		failed += job->status != BATCH_DONE;
+		work   += job->milliseconds;
+	}
+	snprintf(
+		message, sizeof(message), "Converted %d of %d plans in %.1f ms on %d threads (%.1f ms of work).",
+		job_count-failed, job_count, (SDL_GetPerformanceCounter()-start)*1000.0/SDL_GetPerformanceFrequency(), thread_count, work
+	);
+	WRITE_I(message);
+	for (i = 0; i < thread_count; i++)
+	{
+		free(queues[i].jobs);
 	}
+	free(queues);
+	free(order);
+	free(workers);
+	free(threads);
+	BAS_Free(jobs);
+	return failed != 0;
+#else
+	(void)inputdirectory;
+	(void)outputdirectory;
+	(void)options;
+	WRITE_E("Batch conversion needs directory listing, which this platform build lacks.");
+	return 1;
+#endif
 }
-static void
-BAS_Tool_ExportPlan_Draw(int mx, int my)
+
+/*
+ * ----------------
+ * Command line.
+ * Without arguments Basilisk opens its window. Otherwise every argument is an
+ * action, run in order without a window:
+ *
+ * --generate $kind $seed $width $height  add a generated plan (maze, cavern, dungeon or noise)
+ * --load $path                           load a plan file
+ * --save $path                           save the plan file
+ * --export $path [$options]              export the plan, $options are the export screen keys ("gvz")
+ * --decode $input $output                turn a compressed export into text
+ * --stress $seed $steps                  check random edits against brute force, replaces the plan
+ * --batch $input $output [$options]      export every plan file of a directory, see BAS_Batch
+ * --spans $path                          record spans of the actions which follow, see Spans
+ * --budgets $list                        set memory budgets, see BAS_Memory_Budgets
+ * --memory                               report what every memory category holds
+ *
+ * --record $path and --replay $path (alone, or followed by --spans $path)
+ * open the window, see Traces.
+ *
+ * Budgets can also be set through the BASILISK_BUDGETS environment variable,
+ * for the window too. Whatever is still held at exit is reported as leaked.
+ *
+ * Returns the exit status.
+ * ----------------
+ */
+/*
+ * Take the export options from the argument after argv[*i], if there is one
+ * which is not an action. Returns 0 on success, 1 on an unknown option or
+ * one which only the editor can apply.
+ */
+static int
+commandline_exportoptions(int argc, char *argv[], int *i, int *options)
 {
-	SDL_Rect rectangle;
-	int screen_left, screen_top, temp;
-	exportplan_updateinputtexture();
-	/* Screen */
-	rectangle.w = 800;
-	rectangle.h = 128;
-	screen_left = WINDOW_WIDTH/2-rectangle.w/2;
-	rectangle.x = screen_left;
-	screen_top  = WINDOW_HEIGHT/2-rectangle.h/2;
-	rectangle.y = screen_top;
-	BAS_UseColourAlpha(0, 0, 0, 196);
-	SDL_RenderFillRect(renderer, &rectangle);
-	BAS_UseColour(255, 255, 255);
-	SDL_RenderDrawRect(renderer, &rectangle);
-	/* Input text label */
-	rectangle.x = screen_left;
-	SDL_QueryTexture(exportplan_textures[LABEL], NULL, NULL, &rectangle.w, &rectangle.h);
-	SDL_RenderCopy(renderer, exportplan_textures[LABEL], NULL, &rectangle);
-	/* Input text */
-	rectangle.x = temp = rectangle.x+rectangle.w;
-	SDL_QueryTexture(exportplan_textures[INPUT], NULL, NULL, &rectangle.w, &rectangle.h);
-	SDL_RenderCopy(renderer, exportplan_textures[INPUT], NULL, &rectangle);
-	/* Additinal text */
-	rectangle.x = screen_left;
-	rectangle.y += rectangle.h;
-	SDL_QueryTexture(exportplan_textures[ADDITIONAL], NULL, NULL, &rectangle.w, &rectangle.h);
-	SDL_RenderCopy(renderer, exportplan_textures[ADDITIONAL], NULL, &rectangle);
-	/* Additinal text */
-	if (exportplan_planexported)
+	register int j;
+	const char *key;
+	*options = 0;
+	if (*i+1 >= argc || !strncmp(argv[*i+1], "--", 2))
 	{
-		rectangle.x = screen_left;
-		rectangle.y += rectangle.h;
-		SDL_QueryTexture(exportplan_textures[EXPORTED], NULL, NULL, &rectangle.w, &rectangle.h);
-		SDL_RenderCopy(renderer, exportplan_textures[EXPORTED], NULL, &rectangle);
+		return 0;
+	}
+	for (key = argv[++*i]; *key; key++)
+	{
+		for (j = 0; j < EXPORT_OPTION_COUNT && EXPORT_OPTIONS[j].key != *key; j++);
+		if (j == EXPORT_OPTION_COUNT)
+		{
+			fprintf(stderr, "Unknown export option '%c'.\n", *key);
+			return 1;
+		}
+		*options |= EXPORT_OPTIONS[j].option;
+	}
+	if (*options & EXPORT_OPTION_FILTERTHINGS)
+	{
+		fprintf(stderr, "There is no thing filter on the command line, option 'f' is for the editor.\n");
+		return 1;
+	}
+	return 0;
+}
+static int
+BAS_CommandLine(int argc, char *argv[])
+{
+	int i;
+	for (i = 1; i < argc; i++)
+	{
+		const char *action = argv[i];
+		const int left     = argc-i-1;
+		if (!strcmp(action, "--generate") && left >= 4)
+		{
+			int kind;
+			const long width  = strtol(argv[i+3], NULL, 10);
+			const long height = strtol(argv[i+4], NULL, 10);
+			for (kind = 0; kind < GENERATOR_COUNT && strcmp(argv[i+1], GENERATOR_NAMES[kind]); kind++);
+			/* Out of range sizes must not wrap around on the way to int. */
+			if (width <= 0 || height <= 0 || width > GENERATOR_MAXIMUM_SIZE || height > GENERATOR_MAXIMUM_SIZE)
+			{
+				WRITE_E("The generated width and height must be between 1 and 16384!");
+				return 1;
+			}
+			if (BAS_Generate(kind, strtoull(argv[i+2], NULL, 10), (int)width, (int)height, 0, 0) < 0)
+			{
+				return 1;
+			}
+			i += 4;
+		}
+		else if (!strcmp(action, "--load") && left >= 1)
+		{
+			if (BAS_Plan_Load(argv[++i]))
+			{
+				return 1;
+			}
+		}
+		else if (!strcmp(action, "--save") && left >= 1)
+		{
+			if (BAS_Plan_Save(argv[++i]))
+			{
+				return 1;
+			}
+		}
+		else if (!strcmp(action, "--export") && left >= 1)
+		{
+			int options;
+			const char *path = argv[++i];
+			if (commandline_exportoptions(argc, argv, &i, &options))
+			{
+				return 1;
+			}
+			if (plan->lines_outdated)
+			{
+				BAS_RecalculateLines();
+			}
+			if (BAS_ExportPlan(path, options, NULL))
+			{
+				return 1;
+			}
+		}
+		else if (!strcmp(action, "--decode") && left >= 2)
+		{
+			if (BAS_DecodePlan(argv[i+1], argv[i+2]))
+			{
+				return 1;
+			}
+			i += 2;
+		}
+		else if (!strcmp(action, "--batch") && left >= 2)
+		{
+			int options;
+			const char *input  = argv[i+1];
+			const char *output = argv[i+2];
+			i += 2;
+			if (commandline_exportoptions(argc, argv, &i, &options) || BAS_Batch(input, output, options))
+			{
+				return 1;
+			}
+		}
+		else if (!strcmp(action, "--spans") && left >= 1)
+		{
+			span_file = argv[++i];
+			BAS_Span_Start();
+		}
+		else if (!strcmp(action, "--budgets") && left >= 1)
+		{
+			if (BAS_Memory_Budgets(argv[++i]))
+			{
+				return 1;
+			}
+		}
+		else if (!strcmp(action, "--memory"))
+		{
+			BAS_Memory_Report();
+		}
+		else if (!strcmp(action, "--stress") && left >= 2)
+		{
+			if (BAS_Stress(strtoull(argv[i+1], NULL, 10), atoi(argv[i+2])))
+			{
+				return 1;
+			}
+			i += 2;
+		}
+		else
+		{
+			fprintf(stderr, "Unknown or incomplete action '%s'.\n", action);
+			return 1;
+		}
 	}
+	return 0;
 }
 
 #define CHECKSDL(check) if (check) { WRITE_E(SDL_GetError()); return 1; }
 int
-main(void)
+main(int argc, char *argv[])
 {
 	int running, havefocus, mousemotion;
 	executionjump currentjump, previousjump;
 	drawexectionjump drawjump;
+	const char *toolname; /* Of the current tool, for its spans. */
 	SDL_Event e;
-	SDL_Surface *surface;
+	register int i;
+	Uint64 startup[4]; /* Start, video up, window and renderer made, first frame presented. */
 	/* Beginning */
+	BAS_Log_Start();
+	BAS_Plan_Init(&plan_editor);
+	BAS_Span_Thread("main");
+	startup[0] = SDL_GetPerformanceCounter();
 	WRITE_I("This is Basilisk ("BASILISK_VERSION").");
+	if (SDL_getenv(MEMORY_BUDGETS_ENV) && BAS_Memory_Budgets(SDL_getenv(MEMORY_BUDGETS_ENV)))
+	{
+		return 1;
+	}
+	/* A trace is recorded or replayed through the window, the other actions run without one. */
+	if ((argc == 3 || (argc == 5 && !strcmp(argv[3], "--spans"))) && (!strcmp(argv[1], "--record") || !strcmp(argv[1], "--replay")))
+	{
+		if (BAS_Trace_Open(argv[2], !strcmp(argv[1], "--replay")))
+		{
+			return 1;
+		}
+		if (trace_replaying)
+		{
+			SDL_setenv("SDL_VIDEODRIVER", "dummy", 0);
+		}
+		if (argc == 5)
+		{
+			span_file = argv[4];
+			BAS_Span_Start();
+		}
+	}
+	else if (argc > 1)
+	{
+		int status = BAS_CommandLine(argc, argv);
+		if (span_file && BAS_Span_Stop(span_file))
+		{
+			status = 1;
+		}
+		BAS_Span_Free();
+		BAS_Plan_Free(&plan_editor);
+		BAS_Memory_CheckLeaks();
+		return status;
+	}
+	/* Only what the first frame needs, fonts, cursors and images are loaded on first use. */
 	WRITE_I("Call SDL_Init.");
-	CHECKSDL(SDL_Init(SDL_INIT_EVERYTHING));
-	WRITE_I("Call TTF_Init.");
-	CHECKSDL(TTF_Init());
+	CHECKSDL(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS));
+	startup[1] = SDL_GetPerformanceCounter();
 	WRITE_I("Opening window.");
 	window = SDL_CreateWindow(
 		"_BASILISK_",
@@ -1191,23 +10668,15 @@ main(void)
 	renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE);
 	CHECKSDL(!renderer);
 	SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
-	/* Persistent data */
-	WRITE_I("Load persistent data into memory.");
-	font_default                  = TTF_OpenFont(FONT_PATH, 12);
-	font_textinput                = TTF_OpenFont(FONT_PATH, 24);
-	cursorheap[CURSOR_ARROW]      = SDL_CreateSystemCursor(SDL_SYSTEM_CURSOR_ARROW);
-	cursorheap[CURSOR_CROSSHAIR]  = SDL_CreateSystemCursor(SDL_SYSTEM_CURSOR_CROSSHAIR);
-	cursorheap[CURSOR_HAND]       = SDL_CreateSystemCursor(SDL_SYSTEM_CURSOR_HAND);
-	cursorheap[CURSOR_CROSSBONES] = SDL_CreateSystemCursor(SDL_SYSTEM_CURSOR_NO);
-	surface = IMG_Load("data/bas.tga");
-	basilisk_texture = SDL_CreateTextureFromSurface(renderer, surface);
-	SDL_FreeSurface(surface);
+	startup[2] = SDL_GetPerformanceCounter();
+	startup[3] = 0;
 	/* Loop */
 	running     = 1;
 	havefocus   = 1;
 	mousemotion = 0;
 	currentjump = previousjump = &BAS_Tool_HelpMe;
 	drawjump    = BAS_Tool_HelpMe_Draw;
+	toolname    = "BAS_Tool_HelpMe";
 	currentjump(e, -1, -1, TOOL_SPECIAL_BEGIN);
 	BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_INFO, "All okay.", "F1 - help; F2 - room tool; F5 - export world plan.");
 	WRITE_I("All okay.");
@@ -1215,9 +10684,23 @@ main(void)
 	{
 		int mx, my;
 		int special = TOOL_SPECIAL_VOID;
+		const Uint64 framestart = SDL_GetPerformanceCounter();
 		mousemotion = 0;
-		while (SDL_PollEvent(&e))
+		/* Spans start and stop between frames, so the frame spans all match. */
+		if (span_toggle && !SDL_AtomicGet(&span_recording))
+		{
+			span_toggle = 0;
+			BAS_Span_Start();
+			BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_INFO, "Recording spans.", "F11 again writes them.");
+		}
+		BAS_Span_Begin("frame");
+		BAS_Span_Begin("events");
+		while (trace_replaying ? BAS_Trace_Poll(&e) : SDL_PollEvent(&e))
 		{
+			if (trace_file && !trace_replaying)
+			{
+				BAS_Trace_Write(&e);
+			}
 			/* Quit. */
 			if (e.type == SDL_QUIT)
 			{
@@ -1243,6 +10726,20 @@ main(void)
 			else if (e.type == SDL_MOUSEMOTION)
 			{
 				mousemotion = 1;
+				if (e.motion.state & SDL_BUTTON_MMASK)
+				{
+					BAS_View_Pan(e.motion.xrel, e.motion.yrel);
+				}
+			}
+			else if (e.type == SDL_MOUSEWHEEL)
+			{
+				BAS_GetMouseState(&mx, &my);
+				BAS_View_Zoom(e.wheel.y, mx, my);
+			}
+			/* A click on the minimap only moves the view, the tool never sees it. */
+			else if (e.type == SDL_MOUSEBUTTONDOWN && e.button.button == SDL_BUTTON_LEFT && BAS_Minimap_Click(e.button.x, e.button.y))
+			{
+				continue;
 			}
 			/*
 			 * Change the active tool.
@@ -1259,26 +10756,123 @@ main(void)
 					currentjump(e, mx, my, TOOL_SPECIAL_RESETSTATE);
 					currentjump = &BAS_Tool_HelpMe;
 					drawjump = &BAS_Tool_HelpMe_Draw;
+					toolname = "BAS_Tool_HelpMe";
 					BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_INFO, "BAS_Tool_HelpMe", "...");
 					break;
 				case SDLK_F2:
 					currentjump(e, mx, my, TOOL_SPECIAL_RESETSTATE);
 					currentjump = &BAS_Tool_DrawRoom;
 					drawjump = BAS_Tool_DrawRoom_Draw;
-					BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_INFO, "Room tool is now being used.", "Use the mouse to place rooms on the grid.");
+					toolname = "BAS_Tool_DrawRoom";
+					BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_INFO, "Room tool is now being used.", "Click to place rooms; SHIFT+drag fills a rectangle, CTRL+click flood fills, ALT+drag makes a prefab.");
 					break;
 				case SDLK_F3:
 					currentjump(e, mx, my, TOOL_SPECIAL_RESETSTATE);
 					currentjump = &BAS_Tool_ThingPlace;
 					drawjump = BAS_Tool_ThingPlace_Draw;
+					toolname = "BAS_Tool_ThingPlace";
 					BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_INFO, "Thing placing tool is now being used.", "$instructions");
 					break;
 				case SDLK_F5:
 					currentjump(e, mx, my, TOOL_SPECIAL_RESETSTATE);
 					currentjump = &BAS_Tool_ExportPlan;
 					drawjump = &BAS_Tool_ExportPlan_Draw;
+					toolname = "BAS_Tool_ExportPlan";
 					BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_INFO, "Exporting world plan.", "Choose the options.");
 					break;
+				case SDLK_F4:
+					/* SHIFT picks the next generator, every press uses the next seed. */
+					if (e.key.keysym.mod & KMOD_SHIFT)
+					{
+						generator_kind = (generator_kind+1)%GENERATOR_COUNT;
+						BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_INFO, "Generator:", GENERATOR_NAMES[generator_kind]);
+					}
+					else
+					{
+						int cx, cy;
+						char status[BAS_STATUSMESSAGE_LENGTH];
+						BAS_View_ToPlan(0, 0, &cx, &cy);
+						BAS_ClosestCellPosition(cx, cy, &cx, &cy);
+						snprintf(status, sizeof(status), "Generated %s, seed %llu.", GENERATOR_NAMES[generator_kind], (unsigned long long)generator_seed);
+						BAS_Generate(generator_kind, generator_seed++, GENERATOR_DEFAULT_SIZE, GENERATOR_DEFAULT_SIZE, cx, cy);
+						BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_INFO, status, "SHIFT+F4 picks another generator.");
+					}
+					break;
+				case SDLK_F6:
+					if (plan->lines_outdated)
+					{
+						BAS_RecalculateLines();
+					}
+					if (BAS_Plan_Save(DEFAULT_PLAN_FILE))
+					{
+						BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_ERROR, "Failed to save the plan.", DEFAULT_PLAN_FILE);
+					}
+					else
+					{
+						BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_INFO, "Plan saved.", DEFAULT_PLAN_FILE);
+					}
+					break;
+				case SDLK_F8:
+					minimap_visible = !minimap_visible;
+					break;
+				case SDLK_F9:
+					if ((memory_visible = !memory_visible) == 0)
+					{
+						BAS_Memory_DestroyOverlay();
+					}
+					break;
+				case SDLK_F11:
+					span_toggle = 1;
+					break;
+				case SDLK_F10:
+					if (livelink_active)
+					{
+						BAS_LiveLink_Close();
+						BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_INFO, "Live link closed.", LIVELINK_DEFAULT_NAME);
+					}
+					else if (plan_editor.paging_map)
+					{
+						BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_WARNING, "A paged plan has no live link, load it with F7.", LIVELINK_DEFAULT_NAME);
+					}
+					else if (BAS_LiveLink_Open(LIVELINK_DEFAULT_NAME))
+					{
+						BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_ERROR, "Failed to open the live link.", LIVELINK_DEFAULT_NAME);
+					}
+					else
+					{
+						BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_INFO, "Live link open, every edit is published.", LIVELINK_DEFAULT_NAME);
+					}
+					break;
+				case SDLK_F7:
+					currentjump(e, mx, my, TOOL_SPECIAL_RESETSTATE);
+					thingtool_resetstate();
+					/* SHIFT opens the plan paged, it is then read as it comes into view. */
+					if (e.key.keysym.mod & KMOD_SHIFT)
+					{
+						if (BAS_Paging_Open(DEFAULT_PLAN_FILE, PAGING_DEFAULT_CAP))
+						{
+							BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_ERROR, "Failed to open the plan.", DEFAULT_PLAN_FILE);
+						}
+						else if (livelink_active)
+						{
+							/* Chunks let go of would vanish from the live link. */
+							BAS_LiveLink_Close();
+							BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_WARNING, "Plan opened paged, the live link is closed.", DEFAULT_PLAN_FILE);
+						}
+						else
+						{
+							BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_INFO, "Plan opened paged.", DEFAULT_PLAN_FILE);
+						}
+					}
+					else if (BAS_Plan_Load(DEFAULT_PLAN_FILE))
+					{
+						BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_ERROR, "Failed to load the plan.", DEFAULT_PLAN_FILE);
+					}
+					else
+					{
+						BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_INFO, "Plan loaded.", DEFAULT_PLAN_FILE);
+					}
+					break;
 				}
 			}
 			if (currentjump != previousjump)
@@ -1286,12 +10880,37 @@ main(void)
 				previousjump(e, mx, my, TOOL_SPECIAL_STOP);
 				currentjump (e, mx, my, TOOL_SPECIAL_BEGIN);
 				previousjump = currentjump;
-				SDL_SetCursor(cursorheap[CURSOR_ARROW]);
+				SDL_SetCursor(BAS_Cursor(CURSOR_ARROW));
 			}
-			/* Handle the tool. */
-			SDL_GetMouseState(&mx, &my);
+			/* Handle the tool, it works in plan-space. */
+			BAS_GetMouseState(&mx, &my);
+			BAS_View_ToPlan(mx, my, &mx, &my);
+			BAS_Span_Begin(toolname);
 			currentjump(e, mx, my, special);
+			BAS_Span_End(toolname);
+		}
+		BAS_Span_End("events");
+		/* Take in changes made to the plan file by others. */
+		BAS_Span_Begin("BAS_HotReload_Update");
+		if (BAS_HotReload_Update())
+		{
+			thingtool_resetstate();
+		}
+		BAS_Span_End("BAS_HotReload_Update");
+		/* Bring in (and let go of) the chunks of a paged plan. */
+		BAS_Span_Begin("BAS_Paging_Update");
+		if (BAS_Paging_Update())
+		{
+			thingtool_resetstate();
 		}
+		BAS_Span_End("BAS_Paging_Update");
+		/* Commit the edits of this event batch with a single wall update. */
+		BAS_Span_Begin("BAS_Lines_Update");
+		BAS_Lines_Update();
+		BAS_Span_End("BAS_Lines_Update");
+		BAS_Span_Begin("BAS_LiveLink_Publish");
+		BAS_LiveLink_Publish();
+		BAS_Span_End("BAS_LiveLink_Publish");
 		/* To make motion smooth, delay should be minimised when we're moving the mouse. */
 		if (havefocus)
 		{
@@ -1299,6 +10918,7 @@ main(void)
 			else             { delayperframe = DELAY_PER_FRAME_DEFAULT; }
 		}
 		/* Draw */
+		BAS_Span_Begin("draw");
 		BAS_UseColour(0, 0, 20);
 		BAS_Clear;
 		BAS_DrawGrid();
@@ -1307,26 +10927,106 @@ main(void)
 		BAS_DrawThings();
 		if (drawjump)
 		{
+			BAS_GetMouseState(&mx, &my);
+			BAS_View_ToPlan(mx, my, &mx, &my);
 			drawjump(mx, my);
 		}
+		BAS_DrawMinimap();
+		BAS_DrawMemory();
 		BAS_DrawStatusline();
+		BAS_Span_End("draw");
+		BAS_Span_Begin("present");
 		BAS_Present;
-		/* And wait some time... */
-		SDL_Delay(delayperframe);
+		BAS_Span_End("present");
+		if (!startup[3])
+		{
+			char message[160];
+			const double frequency = SDL_GetPerformanceFrequency()/1000.0;
+			startup[3] = SDL_GetPerformanceCounter();
+			snprintf(
+				message, sizeof(message), "First frame after %.1f ms (video %.1f ms, window and renderer %.1f ms, first frame %.1f ms).",
+				(startup[3]-startup[0])/frequency, (startup[1]-startup[0])/frequency,
+				(startup[2]-startup[1])/frequency, (startup[3]-startup[2])/frequency
+			);
+			WRITE_I(message);
+		}
+		BAS_Span_End("frame");
+		if (span_toggle && SDL_AtomicGet(&span_recording))
+		{
+			span_toggle = 0;
+			if (BAS_Span_Stop(span_file ? span_file : SPAN_DEFAULT_FILE))
+			{
+				BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_ERROR, "Failed to write the spans.", span_file ? span_file : SPAN_DEFAULT_FILE);
+			}
+			else
+			{
+				BAS_PushStatus(BAS_STATUSMESSAGE_TYPE_INFO, "Spans written.", span_file ? span_file : SPAN_DEFAULT_FILE);
+			}
+		}
+		if (trace_file)
+		{
+			BAS_Trace_EndFrame(framestart);
+			running &= !trace_finished;
+		}
+		/* And wait some time... (a replay runs as fast as it can) */
+		if (!trace_replaying)
+		{
+			SDL_Delay(delayperframe);
+		}
 	}
 	/* End */
+	if (SDL_AtomicGet(&span_recording))
+	{
+		BAS_Span_Stop(span_file ? span_file : SPAN_DEFAULT_FILE);
+	}
+	BAS_Trace_Close();
+	BAS_LiveLink_Close();
+	BAS_Free(livelink_dirty);
+	BAS_HotReload_Stop();
+	BAS_Lines_Stop();
+	BAS_Span_Free();
 	WRITE_I("Freeing memory now.");
 	currentjump(e, 0, 0, TOOL_SPECIAL_STOP);
 	SDL_DestroyTexture(basilisk_texture);
-	SDL_FreeCursor(cursorheap[CURSOR_CROSSBONES]);
-	SDL_FreeCursor(cursorheap[CURSOR_HAND]);
-	SDL_FreeCursor(cursorheap[CURSOR_CROSSHAIR]);
-	SDL_FreeCursor(cursorheap[CURSOR_ARROW]);
+	if (minimap_texture)
+	{
+		BAS_Memory_CountTexture(MEMORY_RENDER, minimap_texture, -1);
+		SDL_DestroyTexture(minimap_texture);
+	}
+	BAS_Free(minimap_pixels);
+	BAS_Free(minimap_counts);
+	BAS_Free(lod_blocks);
+	for (i = 0; i < LOD_SHADES; i++)
+	{
+		BAS_Free(lod_rects[i]);
+	}
+	BAS_Free(thing_selection);
+	BAS_Free(thing_visible);
+	BAS_Plan_Free(&plan_editor);
+	BAS_Memory_DestroyOverlay();
+	BAS_DestroyTextTexture(statuslinetexture[0]);
+	BAS_DestroyTextTexture(statuslinetexture[1]);
+	BAS_Memory_CheckLeaks();
+	for (i = 0; i < CURSOR_COUNT; i++)
+	{
+		if (cursorheap[i])
+		{
+			SDL_FreeCursor(cursorheap[i]);
+		}
+	}
 	SDL_DestroyWindow(window);
 	SDL_DestroyRenderer(renderer);
-	TTF_CloseFont(font_textinput);
-	TTF_CloseFont(font_default);
-	TTF_Quit();
+	for (i = 0; i < FONT_COUNT; i++)
+	{
+		if (fontheap[i])
+		{
+			TTF_CloseFont(fontheap[i]);
+		}
+	}
+	if (TTF_WasInit())
+	{
+		TTF_Quit();
+	}
 	SDL_Quit();
 	WRITE_I("Goodbye.");
 	return 0;